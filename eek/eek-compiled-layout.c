@@ -0,0 +1,897 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* Binary layout format.  A compiled layout is a snapshot of the
+   unscaled keyboard built from the XML files of a keyboard, laid out
+   so that it can be mapped into memory and turned into an
+   EekKeyboard without parsing: a fixed header followed by tables of
+   fixed size records, which refer to each other by index and to
+   strings by offset into a string pool.  Numbers are stored in host
+   byte order; a file written on a host with another byte order is
+   rejected, as is a file older than any of the XML files it was
+   compiled from. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "eek-compiled-layout.h"
+#include "eek-section.h"
+#include "eek-key.h"
+#include "eek-symbol-pool.h"
+
+#define COMPILED_MAGIC "EEKLAYT"
+#define COMPILED_BYTE_ORDER 0x01020304
+#define COMPILED_NONE G_MAXUINT32
+
+enum {
+    TABLE_STRINGS,
+    TABLE_SOURCES,
+    TABLE_OUTLINES,
+    TABLE_POINTS,
+    TABLE_SECTIONS,
+    TABLE_ROWS,
+    TABLE_KEYS,
+    TABLE_SYMBOLS,
+    TABLE_MATRICES,
+    TABLE_CELLS,
+    N_TABLES
+};
+
+struct _CompiledTable {
+    guint32 offset;             /* from the start of the file */
+    guint32 length;             /* in records */
+};
+typedef struct _CompiledTable CompiledTable;
+
+struct _CompiledBounds {
+    gdouble x, y, width, height;
+};
+typedef struct _CompiledBounds CompiledBounds;
+
+struct _CompiledHeader {
+    gchar magic[8];
+    guint32 version;
+    guint32 byte_order;
+    CompiledBounds bounds;
+    CompiledTable tables[N_TABLES];
+};
+typedef struct _CompiledHeader CompiledHeader;
+
+struct _CompiledOutline {
+    gdouble corner_radius;
+    guint32 first_point;
+    guint32 n_points;
+};
+typedef struct _CompiledOutline CompiledOutline;
+
+struct _CompiledPoint {
+    gdouble x, y;
+};
+typedef struct _CompiledPoint CompiledPoint;
+
+struct _CompiledSection {
+    CompiledBounds bounds;
+    guint32 name;
+    gint32 angle;
+    guint32 first_row;
+    guint32 n_rows;
+    guint32 first_key;
+    guint32 n_keys;
+};
+typedef struct _CompiledSection CompiledSection;
+
+struct _CompiledRow {
+    gint32 num_columns;
+    gint32 orientation;
+};
+typedef struct _CompiledRow CompiledRow;
+
+struct _CompiledKey {
+    CompiledBounds bounds;
+    guint32 name;
+    guint32 keycode;
+    gint32 column;
+    gint32 row;
+    guint32 oref;
+    guint32 matrix;
+};
+typedef struct _CompiledKey CompiledKey;
+
+/* Mirrors EekSymbolPoolKey, so that symbols are rebuilt through the
+   pool exactly as the XML loader builds them. */
+struct _CompiledSymbol {
+    guint32 kind;
+    guint32 xkeysym;
+    guint32 text;
+    guint32 label;
+    guint32 icon_name;
+    guint32 tooltip;
+    guint32 category;
+    guint32 modifier_mask;
+};
+typedef struct _CompiledSymbol CompiledSymbol;
+
+struct _CompiledMatrix {
+    gint32 num_groups;
+    gint32 num_levels;
+    guint32 first_cell;
+    guint32 padding;
+};
+typedef struct _CompiledMatrix CompiledMatrix;
+
+static const gsize table_record_size[N_TABLES] = {
+    1,                          /* TABLE_STRINGS */
+    sizeof (guint32),           /* TABLE_SOURCES */
+    sizeof (CompiledOutline),
+    sizeof (CompiledPoint),
+    sizeof (CompiledSection),
+    sizeof (CompiledRow),
+    sizeof (CompiledKey),
+    sizeof (CompiledSymbol),
+    sizeof (CompiledMatrix),
+    sizeof (guint32)            /* TABLE_CELLS */
+};
+
+/* Outline points are handed to eek_keyboard_add_outline() as is. */
+G_STATIC_ASSERT (sizeof (CompiledPoint) == sizeof (EekPoint));
+
+/**
+ * eek_compiled_layout_get_path:
+ * @keyboards_dir: directory which contains keyboards.xml
+ * @id: keyboard ID
+ *
+ * Get the file name of the compiled layout of the keyboard @id.
+ * Returns: a newly allocated string
+ */
+gchar *
+eek_compiled_layout_get_path (const gchar *keyboards_dir,
+                              const gchar *id)
+{
+    gchar *filename, *path;
+
+    filename = g_strdup_printf ("%s%s", id, EEK_COMPILED_LAYOUT_SUFFIX);
+    path = g_build_filename (keyboards_dir,
+                             EEK_COMPILED_LAYOUT_DIR,
+                             filename,
+                             NULL);
+    g_free (filename);
+    return path;
+}
+
+struct _CompiledWriter {
+    GByteArray *tables[N_TABLES];
+    GHashTable *strings;
+    GHashTable *symbols;
+    GHashTable *matrices;
+};
+typedef struct _CompiledWriter CompiledWriter;
+
+#define writer_append(writer, table, record)                            \
+    g_byte_array_append ((writer)->tables[table],                       \
+                         (const guint8 *)(record),                      \
+                         sizeof (*(record)))
+
+static guint32
+writer_get_length (CompiledWriter *writer, gint table)
+{
+    return writer->tables[table]->len / table_record_size[table];
+}
+
+static guint32
+writer_add_string (CompiledWriter *writer, const gchar *str)
+{
+    gpointer value;
+    guint32 offset;
+
+    if (str == NULL)
+        return COMPILED_NONE;
+
+    if (g_hash_table_lookup_extended (writer->strings, str, NULL, &value))
+        return GPOINTER_TO_UINT(value);
+
+    offset = writer->tables[TABLE_STRINGS]->len;
+    g_byte_array_append (writer->tables[TABLE_STRINGS],
+                         (const guint8 *)str,
+                         strlen (str) + 1);
+    g_hash_table_insert (writer->strings,
+                         g_strdup (str),
+                         GUINT_TO_POINTER(offset));
+    return offset;
+}
+
+static gboolean
+writer_add_symbol (CompiledWriter *writer,
+                   EekSymbol      *symbol,
+                   guint32        *index,
+                   GError        **error)
+{
+    const EekSymbolPoolKey *key;
+    CompiledSymbol record;
+    gpointer value;
+
+    if (symbol == NULL) {
+        *index = COMPILED_NONE;
+        return TRUE;
+    }
+
+    if (g_hash_table_lookup_extended (writer->symbols, symbol, NULL, &value)) {
+        *index = GPOINTER_TO_UINT(value);
+        return TRUE;
+    }
+
+    key = eek_symbol_pool_get_key (symbol);
+    if (key == NULL) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "symbol %s was not created from a layout",
+                     eek_symbol_get_name (symbol));
+        return FALSE;
+    }
+
+    record.kind = key->kind;
+    record.xkeysym = key->xkeysym;
+    record.text = writer_add_string (writer, key->text);
+    record.label = writer_add_string (writer, key->label);
+    record.icon_name = writer_add_string (writer, key->icon_name);
+    record.tooltip = writer_add_string (writer, key->tooltip);
+    record.category = key->category;
+    record.modifier_mask = key->modifier_mask;
+
+    *index = writer_get_length (writer, TABLE_SYMBOLS);
+    writer_append (writer, TABLE_SYMBOLS, &record);
+    g_hash_table_insert (writer->symbols, symbol, GUINT_TO_POINTER(*index));
+    return TRUE;
+}
+
+static gboolean
+writer_add_matrix (CompiledWriter  *writer,
+                   EekSymbolMatrix *matrix,
+                   guint32         *index,
+                   GError         **error)
+{
+    CompiledMatrix record;
+    gpointer value;
+    gint i, num_symbols;
+
+    if (matrix == NULL) {
+        *index = COMPILED_NONE;
+        return TRUE;
+    }
+
+    /* Keys share matrices, so most lookups hit here. */
+    if (g_hash_table_lookup_extended (writer->matrices, matrix, NULL, &value)) {
+        *index = GPOINTER_TO_UINT(value);
+        return TRUE;
+    }
+
+    memset (&record, 0, sizeof record);
+    record.num_groups = matrix->num_groups;
+    record.num_levels = matrix->num_levels;
+    record.first_cell = writer_get_length (writer, TABLE_CELLS);
+
+    num_symbols = matrix->num_groups * matrix->num_levels;
+    for (i = 0; i < num_symbols; i++) {
+        guint32 cell;
+
+        if (!writer_add_symbol (writer, matrix->data[i], &cell, error))
+            return FALSE;
+        writer_append (writer, TABLE_CELLS, &cell);
+    }
+
+    *index = writer_get_length (writer, TABLE_MATRICES);
+    writer_append (writer, TABLE_MATRICES, &record);
+    g_hash_table_insert (writer->matrices, matrix, GUINT_TO_POINTER(*index));
+    return TRUE;
+}
+
+static void
+bounds_to_compiled (const EekBounds *bounds, CompiledBounds *record)
+{
+    record->x = bounds->x;
+    record->y = bounds->y;
+    record->width = bounds->width;
+    record->height = bounds->height;
+}
+
+static void
+bounds_from_compiled (const CompiledBounds *record, EekBounds *bounds)
+{
+    bounds->x = record->x;
+    bounds->y = record->y;
+    bounds->width = record->width;
+    bounds->height = record->height;
+}
+
+static gboolean
+writer_add_key (CompiledWriter *writer,
+                EekKey         *key,
+                GError        **error)
+{
+    CompiledKey record;
+    EekBounds bounds;
+    gint column, row;
+
+    memset (&record, 0, sizeof record);
+    eek_element_get_bounds (EEK_ELEMENT(key), &bounds);
+    bounds_to_compiled (&bounds, &record.bounds);
+    record.name = writer_add_string (writer,
+                                     eek_element_get_name (EEK_ELEMENT(key)));
+    record.keycode = eek_key_get_keycode (key);
+    eek_key_get_index (key, &column, &row);
+    record.column = column;
+    record.row = row;
+    record.oref = eek_key_get_oref (key);
+    if (!writer_add_matrix (writer,
+                            eek_key_get_symbol_matrix (key),
+                            &record.matrix,
+                            error))
+        return FALSE;
+
+    writer_append (writer, TABLE_KEYS, &record);
+    return TRUE;
+}
+
+static gboolean
+writer_add_section (CompiledWriter *writer,
+                    EekSection     *section,
+                    GError        **error)
+{
+    CompiledSection record;
+    EekBounds bounds;
+    guint i;
+
+    memset (&record, 0, sizeof record);
+    eek_element_get_bounds (EEK_ELEMENT(section), &bounds);
+    bounds_to_compiled (&bounds, &record.bounds);
+    record.name =
+        writer_add_string (writer,
+                           eek_element_get_name (EEK_ELEMENT(section)));
+    record.angle = eek_section_get_angle (section);
+
+    record.first_row = writer_get_length (writer, TABLE_ROWS);
+    record.n_rows = eek_section_get_n_rows (section);
+    for (i = 0; i < record.n_rows; i++) {
+        CompiledRow row;
+        gint num_columns;
+        EekOrientation orientation;
+
+        eek_section_get_row (section, i, &num_columns, &orientation);
+        row.num_columns = num_columns;
+        row.orientation = orientation;
+        writer_append (writer, TABLE_ROWS, &row);
+    }
+
+    record.first_key = writer_get_length (writer, TABLE_KEYS);
+    record.n_keys = eek_container_get_n_children (EEK_CONTAINER(section));
+    for (i = 0; i < record.n_keys; i++) {
+        EekElement *key;
+
+        key = eek_container_get_child (EEK_CONTAINER(section), i);
+        if (!writer_add_key (writer, EEK_KEY(key), error))
+            return FALSE;
+    }
+
+    writer_append (writer, TABLE_SECTIONS, &record);
+    return TRUE;
+}
+
+/**
+ * eek_compiled_layout_write:
+ * @keyboard: an unscaled #EekKeyboard loaded from XML
+ * @sources: %NULL-terminated array of the XML files @keyboard was
+ * loaded from, relative to the keyboards directory
+ * @path: file name to write to
+ * @error: a #GError
+ *
+ * Write @keyboard to @path in the binary layout format.  All the
+ * symbols of @keyboard must come from the symbol pool.
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+eek_compiled_layout_write (EekKeyboard        *keyboard,
+                           const gchar * const *sources,
+                           const gchar        *path,
+                           GError            **error)
+{
+    static const guint8 padding[8] = { 0 };
+    CompiledWriter writer;
+    CompiledHeader header;
+    GByteArray *contents;
+    EekBounds bounds;
+    guint i, n_children;
+    gsize n_outlines;
+    gboolean retval = FALSE;
+
+    g_return_val_if_fail (EEK_IS_KEYBOARD(keyboard), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    for (i = 0; i < N_TABLES; i++)
+        writer.tables[i] = g_byte_array_new ();
+    writer.strings = g_hash_table_new_full (g_str_hash,
+                                            g_str_equal,
+                                            g_free,
+                                            NULL);
+    writer.symbols = g_hash_table_new (g_direct_hash, g_direct_equal);
+    writer.matrices = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    memset (&header, 0, sizeof header);
+    memcpy (header.magic, COMPILED_MAGIC, sizeof header.magic);
+    header.version = EEK_COMPILED_LAYOUT_VERSION;
+    header.byte_order = COMPILED_BYTE_ORDER;
+    eek_element_get_bounds (EEK_ELEMENT(keyboard), &bounds);
+    bounds_to_compiled (&bounds, &header.bounds);
+
+    for (; sources && *sources; sources++) {
+        guint32 source = writer_add_string (&writer, *sources);
+        writer_append (&writer, TABLE_SOURCES, &source);
+    }
+
+    n_outlines = eek_keyboard_get_n_outlines (keyboard);
+    for (i = 0; i < n_outlines; i++) {
+        EekOutline *outline = eek_keyboard_get_outline (keyboard, i);
+        CompiledOutline record;
+
+        memset (&record, 0, sizeof record);
+        record.corner_radius = outline->corner_radius;
+        record.first_point = writer_get_length (&writer, TABLE_POINTS);
+        record.n_points = outline->num_points;
+        g_byte_array_append (writer.tables[TABLE_POINTS],
+                             (const guint8 *)outline->points,
+                             outline->num_points * sizeof (EekPoint));
+        writer_append (&writer, TABLE_OUTLINES, &record);
+    }
+
+    n_children = eek_container_get_n_children (EEK_CONTAINER(keyboard));
+    for (i = 0; i < n_children; i++) {
+        EekElement *section;
+
+        section = eek_container_get_child (EEK_CONTAINER(keyboard), i);
+        if (!writer_add_section (&writer, EEK_SECTION(section), error))
+            goto out;
+    }
+
+    /* Lay out the tables after the header, keeping each of them
+       aligned for the doubles they contain. */
+    contents = g_byte_array_new ();
+    g_byte_array_append (contents, (const guint8 *)&header, sizeof header);
+    for (i = 0; i < N_TABLES; i++) {
+        if (contents->len % 8 != 0)
+            g_byte_array_append (contents, padding, 8 - contents->len % 8);
+        header.tables[i].offset = contents->len;
+        header.tables[i].length = writer_get_length (&writer, i);
+        g_byte_array_append (contents,
+                             writer.tables[i]->data,
+                             writer.tables[i]->len);
+    }
+    memcpy (contents->data, &header, sizeof header);
+
+    retval = g_file_set_contents (path,
+                                  (const gchar *)contents->data,
+                                  contents->len,
+                                  error);
+    g_byte_array_free (contents, TRUE);
+
+ out:
+    for (i = 0; i < N_TABLES; i++)
+        g_byte_array_free (writer.tables[i], TRUE);
+    g_hash_table_destroy (writer.strings);
+    g_hash_table_destroy (writer.symbols);
+    g_hash_table_destroy (writer.matrices);
+    return retval;
+}
+
+/* Read-only view of a mapped compiled layout. */
+struct _CompiledView {
+    const CompiledHeader *header;
+    const gchar *strings;
+    const guint32 *sources;
+    const CompiledOutline *outlines;
+    const CompiledPoint *points;
+    const CompiledSection *sections;
+    const CompiledRow *rows;
+    const CompiledKey *keys;
+    const CompiledSymbol *symbols;
+    const CompiledMatrix *matrices;
+    const guint32 *cells;
+};
+typedef struct _CompiledView CompiledView;
+
+#define view_get_length(view, table) ((view)->header->tables[table].length)
+
+static gboolean
+view_init (CompiledView *view,
+           const gchar  *contents,
+           gsize         length,
+           GError      **error)
+{
+    const CompiledHeader *header = (const CompiledHeader *)contents;
+    gint i;
+
+    if (contents == NULL || length < sizeof (CompiledHeader) ||
+        memcmp (header->magic, COMPILED_MAGIC, sizeof header->magic) != 0) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "not a compiled layout");
+        return FALSE;
+    }
+
+    if (header->version != EEK_COMPILED_LAYOUT_VERSION ||
+        header->byte_order != COMPILED_BYTE_ORDER) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "unsupported compiled layout version %u",
+                     header->version);
+        return FALSE;
+    }
+
+    for (i = 0; i < N_TABLES; i++) {
+        const CompiledTable *table = &header->tables[i];
+
+        if (table->offset % 8 != 0 ||
+            table->offset > length ||
+            table->length > (length - table->offset) / table_record_size[i]) {
+            g_set_error (error,
+                         EEK_ERROR,
+                         EEK_ERROR_LAYOUT_ERROR,
+                         "truncated compiled layout");
+            return FALSE;
+        }
+    }
+
+    view->header = header;
+    view->strings = contents + header->tables[TABLE_STRINGS].offset;
+    view->sources = (const guint32 *)
+        (contents + header->tables[TABLE_SOURCES].offset);
+    view->outlines = (const CompiledOutline *)
+        (contents + header->tables[TABLE_OUTLINES].offset);
+    view->points = (const CompiledPoint *)
+        (contents + header->tables[TABLE_POINTS].offset);
+    view->sections = (const CompiledSection *)
+        (contents + header->tables[TABLE_SECTIONS].offset);
+    view->rows = (const CompiledRow *)
+        (contents + header->tables[TABLE_ROWS].offset);
+    view->keys = (const CompiledKey *)
+        (contents + header->tables[TABLE_KEYS].offset);
+    view->symbols = (const CompiledSymbol *)
+        (contents + header->tables[TABLE_SYMBOLS].offset);
+    view->matrices = (const CompiledMatrix *)
+        (contents + header->tables[TABLE_MATRICES].offset);
+    view->cells = (const guint32 *)
+        (contents + header->tables[TABLE_CELLS].offset);
+    return TRUE;
+}
+
+static const gchar *
+view_get_string (const CompiledView *view, guint32 offset)
+{
+    return offset == COMPILED_NONE ? NULL : view->strings + offset;
+}
+
+static gboolean
+check_string (const CompiledView *view, guint32 offset)
+{
+    return offset == COMPILED_NONE ||
+        offset < view_get_length (view, TABLE_STRINGS);
+}
+
+static gboolean
+check_range (guint32 first, guint32 n, guint32 length)
+{
+    return first <= length && n <= length - first;
+}
+
+/* Check every reference in the tables once, so that building the
+   keyboard does not need to. */
+static gboolean
+view_check (const CompiledView *view, GError **error)
+{
+    guint32 n_strings = view_get_length (view, TABLE_STRINGS);
+    guint32 i;
+
+    if (n_strings > 0 && view->strings[n_strings - 1] != '\0')
+        goto corrupted;
+
+    for (i = 0; i < view_get_length (view, TABLE_SOURCES); i++)
+        if (view->sources[i] == COMPILED_NONE ||
+            !check_string (view, view->sources[i]))
+            goto corrupted;
+
+    for (i = 0; i < view_get_length (view, TABLE_OUTLINES); i++)
+        if (!check_range (view->outlines[i].first_point,
+                          view->outlines[i].n_points,
+                          view_get_length (view, TABLE_POINTS)))
+            goto corrupted;
+
+    for (i = 0; i < view_get_length (view, TABLE_ROWS); i++)
+        if (view->rows[i].num_columns < 0)
+            goto corrupted;
+
+    for (i = 0; i < view_get_length (view, TABLE_SECTIONS); i++) {
+        const CompiledSection *section = &view->sections[i];
+        guint32 j;
+
+        if (!check_string (view, section->name) ||
+            !check_range (section->first_row,
+                          section->n_rows,
+                          view_get_length (view, TABLE_ROWS)) ||
+            !check_range (section->first_key,
+                          section->n_keys,
+                          view_get_length (view, TABLE_KEYS)))
+            goto corrupted;
+
+        /* keys must fall in a row of their own section */
+        for (j = 0; j < section->n_keys; j++) {
+            const CompiledKey *key = &view->keys[section->first_key + j];
+
+            if (key->row < 0 || (guint32)key->row >= section->n_rows ||
+                key->column < 0 ||
+                key->column >=
+                view->rows[section->first_row + key->row].num_columns)
+                goto corrupted;
+        }
+    }
+
+    for (i = 0; i < view_get_length (view, TABLE_KEYS); i++) {
+        const CompiledKey *key = &view->keys[i];
+
+        if (!check_string (view, key->name) ||
+            key->oref >= MAX(view_get_length (view, TABLE_OUTLINES), 1) ||
+            (key->matrix != COMPILED_NONE &&
+             key->matrix >= view_get_length (view, TABLE_MATRICES)))
+            goto corrupted;
+    }
+
+    for (i = 0; i < view_get_length (view, TABLE_SYMBOLS); i++) {
+        const CompiledSymbol *symbol = &view->symbols[i];
+
+        if (symbol->kind > EEK_SYMBOL_POOL_SYMBOL ||
+            !check_string (view, symbol->text) ||
+            !check_string (view, symbol->label) ||
+            !check_string (view, symbol->icon_name) ||
+            !check_string (view, symbol->tooltip))
+            goto corrupted;
+    }
+
+    for (i = 0; i < view_get_length (view, TABLE_MATRICES); i++) {
+        const CompiledMatrix *matrix = &view->matrices[i];
+        guint64 num_symbols;
+
+        if (matrix->num_groups < 0 || matrix->num_levels < 0)
+            goto corrupted;
+        num_symbols = (guint64)matrix->num_groups * matrix->num_levels;
+        if (num_symbols > G_MAXUINT32 ||
+            !check_range (matrix->first_cell,
+                          num_symbols,
+                          view_get_length (view, TABLE_CELLS)))
+            goto corrupted;
+    }
+
+    for (i = 0; i < view_get_length (view, TABLE_CELLS); i++)
+        if (view->cells[i] != COMPILED_NONE &&
+            view->cells[i] >= view_get_length (view, TABLE_SYMBOLS))
+            goto corrupted;
+
+    return TRUE;
+
+ corrupted:
+    g_set_error (error,
+                 EEK_ERROR,
+                 EEK_ERROR_LAYOUT_ERROR,
+                 "corrupted compiled layout");
+    return FALSE;
+}
+
+/* A compiled layout is outdated if any of its XML sources has been
+   modified after it was written. */
+static gboolean
+view_check_sources (const CompiledView *view,
+                    const gchar        *path,
+                    const gchar        *keyboards_dir,
+                    GError            **error)
+{
+    GStatBuf buf;
+    time_t mtime;
+    guint32 i;
+
+    if (g_stat (path, &buf) < 0) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "can't stat %s", path);
+        return FALSE;
+    }
+    mtime = buf.st_mtime;
+
+    for (i = 0; i < view_get_length (view, TABLE_SOURCES); i++) {
+        const gchar *source = view_get_string (view, view->sources[i]);
+        gchar *source_path;
+        gboolean outdated;
+
+        source_path = g_build_filename (keyboards_dir, source, NULL);
+        outdated = g_stat (source_path, &buf) < 0 || buf.st_mtime > mtime;
+        g_free (source_path);
+        if (outdated) {
+            g_set_error (error,
+                         EEK_ERROR,
+                         EEK_ERROR_LAYOUT_ERROR,
+                         "%s is older than %s",
+                         path,
+                         source);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static EekKeyboard *
+view_create_keyboard (const CompiledView *view, EekLayout *layout)
+{
+    EekKeyboard *keyboard;
+    EekSymbol **symbols;
+    EekSymbolMatrix **matrices;
+    EekBounds bounds;
+    guint32 n_symbols, n_matrices, i, j;
+
+    keyboard = g_object_new (EEK_TYPE_KEYBOARD, "layout", layout, NULL);
+    bounds_from_compiled (&view->header->bounds, &bounds);
+    eek_element_set_bounds (EEK_ELEMENT(keyboard), &bounds);
+
+    for (i = 0; i < view_get_length (view, TABLE_OUTLINES); i++) {
+        const CompiledOutline *record = &view->outlines[i];
+        EekOutline outline;
+
+        outline.corner_radius = record->corner_radius;
+        outline.points = (EekPoint *)&view->points[record->first_point];
+        outline.num_points = record->n_points;
+        eek_keyboard_add_outline (keyboard, &outline);
+    }
+
+    n_symbols = view_get_length (view, TABLE_SYMBOLS);
+    symbols = g_new0 (EekSymbol *, n_symbols);
+    for (i = 0; i < n_symbols; i++) {
+        const CompiledSymbol *record = &view->symbols[i];
+        EekSymbolPoolKey key;
+
+        key.kind = record->kind;
+        key.xkeysym = record->xkeysym;
+        key.text = (gchar *)view_get_string (view, record->text);
+        key.label = (gchar *)view_get_string (view, record->label);
+        key.icon_name = (gchar *)view_get_string (view, record->icon_name);
+        key.tooltip = (gchar *)view_get_string (view, record->tooltip);
+        key.category = record->category;
+        key.modifier_mask = record->modifier_mask;
+        symbols[i] = eek_symbol_pool_lookup (&key);
+    }
+
+    n_matrices = view_get_length (view, TABLE_MATRICES);
+    matrices = g_new0 (EekSymbolMatrix *, n_matrices);
+    for (i = 0; i < n_matrices; i++) {
+        const CompiledMatrix *record = &view->matrices[i];
+        EekSymbolMatrix *matrix;
+        guint32 num_symbols;
+
+        matrix = eek_symbol_matrix_new (record->num_groups,
+                                        record->num_levels);
+        num_symbols = record->num_groups * record->num_levels;
+        for (j = 0; j < num_symbols; j++) {
+            guint32 cell = view->cells[record->first_cell + j];
+            if (cell != COMPILED_NONE && symbols[cell] != NULL)
+                matrix->data[j] = g_object_ref (symbols[cell]);
+            else
+                matrix->data[j] = NULL;
+        }
+        matrices[i] = eek_symbol_pool_get_matrix (matrix);
+    }
+
+    for (i = 0; i < view_get_length (view, TABLE_SECTIONS); i++) {
+        const CompiledSection *record = &view->sections[i];
+        EekSection *section;
+
+        section = eek_keyboard_create_section (keyboard);
+        if (record->name != COMPILED_NONE)
+            eek_element_set_name (EEK_ELEMENT(section),
+                                  view_get_string (view, record->name));
+        eek_section_set_angle (section, record->angle);
+        bounds_from_compiled (&record->bounds, &bounds);
+        eek_element_set_bounds (EEK_ELEMENT(section), &bounds);
+
+        for (j = 0; j < record->n_rows; j++) {
+            const CompiledRow *row = &view->rows[record->first_row + j];
+            eek_section_add_row (section, row->num_columns, row->orientation);
+        }
+
+        for (j = 0; j < record->n_keys; j++) {
+            const CompiledKey *key_record = &view->keys[record->first_key + j];
+            EekKey *key;
+
+            key = eek_section_create_key (section,
+                                          key_record->keycode,
+                                          key_record->column,
+                                          key_record->row);
+            if (key_record->name != COMPILED_NONE)
+                eek_element_set_name (EEK_ELEMENT(key),
+                                      view_get_string (view, key_record->name));
+            bounds_from_compiled (&key_record->bounds, &bounds);
+            eek_element_set_bounds (EEK_ELEMENT(key), &bounds);
+            eek_key_set_oref (key, key_record->oref);
+            if (key_record->matrix != COMPILED_NONE)
+                eek_key_take_symbol_matrix
+                    (key, eek_symbol_matrix_ref (matrices[key_record->matrix]));
+        }
+    }
+
+    for (i = 0; i < n_matrices; i++)
+        eek_symbol_matrix_free (matrices[i]);
+    g_free (matrices);
+    for (i = 0; i < n_symbols; i++)
+        if (symbols[i])
+            g_object_unref (symbols[i]);
+    g_free (symbols);
+
+    return keyboard;
+}
+
+/**
+ * eek_compiled_layout_load:
+ * @path: file name of a compiled layout
+ * @keyboards_dir: directory which contains the XML sources of @path
+ * @layout: an #EekLayout which the keyboard belongs to
+ * @error: a #GError
+ *
+ * Create an unscaled keyboard from the compiled layout @path.  Fails
+ * if @path is not a valid compiled layout or is older than one of
+ * the XML files it was compiled from.
+ * Returns: (transfer full): an #EekKeyboard or %NULL on error
+ */
+EekKeyboard *
+eek_compiled_layout_load (const gchar *path,
+                          const gchar *keyboards_dir,
+                          EekLayout   *layout,
+                          GError     **error)
+{
+    GMappedFile *mapped;
+    CompiledView view;
+    EekKeyboard *keyboard = NULL;
+
+    g_return_val_if_fail (path != NULL, NULL);
+    g_return_val_if_fail (keyboards_dir != NULL, NULL);
+
+    mapped = g_mapped_file_new (path, FALSE, error);
+    if (mapped == NULL)
+        return NULL;
+
+    if (view_init (&view,
+                   g_mapped_file_get_contents (mapped),
+                   g_mapped_file_get_length (mapped),
+                   error) &&
+        view_check (&view, error) &&
+        view_check_sources (&view, path, keyboards_dir, error))
+        keyboard = view_create_keyboard (&view, layout);
+
+    g_mapped_file_unref (mapped);
+    return keyboard;
+}
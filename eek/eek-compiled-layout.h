@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef EEK_COMPILED_LAYOUT_H
+#define EEK_COMPILED_LAYOUT_H 1
+
+#include "eek-keyboard.h"
+
+G_BEGIN_DECLS
+
+/* Version of the binary layout format; files written with another
+   version are rejected and the XML layout is used instead. */
+#define EEK_COMPILED_LAYOUT_VERSION 1
+
+/* Compiled layouts of a keyboards directory are stored as
+   KEYBOARDS_DIR/compiled/ID.layout */
+#define EEK_COMPILED_LAYOUT_DIR "compiled"
+#define EEK_COMPILED_LAYOUT_SUFFIX ".layout"
+
+gchar       *eek_compiled_layout_get_path (const gchar        *keyboards_dir,
+                                           const gchar        *id);
+
+gboolean     eek_compiled_layout_write    (EekKeyboard        *keyboard,
+                                           const gchar * const *sources,
+                                           const gchar        *path,
+                                           GError            **error);
+EekKeyboard *eek_compiled_layout_load     (const gchar        *path,
+                                           const gchar        *keyboards_dir,
+                                           EekLayout          *layout,
+                                           GError            **error);
+
+G_END_DECLS
+
+#endif  /* EEK_COMPILED_LAYOUT_H */
@@ -48,8 +48,7 @@ G_DEFINE_ABSTRACT_TYPE (EekContainer, eek_container, EEK_TYPE_ELEMENT);
 
 struct _EekContainerPrivate
 {
-    GList *head;
-    GList *last;
+    GPtrArray *children;
 };
 
 static void
@@ -61,12 +60,8 @@ eek_container_real_add_child (EekContainer *self,
     g_return_if_fail (EEK_IS_ELEMENT(child));
     g_object_ref (child);
 
-    if (!priv->head) {
-        priv->head = priv->last = g_list_prepend (priv->head, child);
-    } else {
-        priv->last->next = g_list_prepend (priv->last->next, child);
-        priv->last = priv->last->next;
-    }
+    g_ptr_array_add (priv->children, child);
+
     eek_element_set_parent (child, EEK_ELEMENT(self));
     g_signal_emit (self, signals[CHILD_ADDED], 0, child);
 }
@@ -76,15 +71,13 @@ eek_container_real_remove_child (EekContainer *self,
                                  EekElement   *child)
 {
     EekContainerPrivate *priv = EEK_CONTAINER_GET_PRIVATE(self);
-    GList *head;
 
     g_return_if_fail (EEK_IS_ELEMENT(child));
-    head = g_list_find (priv->head, child);
-    g_return_if_fail (head);
+    if (!g_ptr_array_remove (priv->children, child)) {
+        g_warning ("%p is not a child of %p", child, self);
+        return;
+    }
     g_object_unref (child);
-    if (head == priv->last)
-        priv->last = g_list_previous (priv->last);
-    priv->head = g_list_remove_link (priv->head, head);
     eek_element_set_parent (child, NULL);
     g_signal_emit (self, signals[CHILD_REMOVED], 0, child);
 }
@@ -95,10 +88,10 @@ eek_container_real_foreach_child (EekContainer *self,
                                   gpointer      user_data)
 {
     EekContainerPrivate *priv = EEK_CONTAINER_GET_PRIVATE(self);
-    GList *head;
+    gint i;
 
-    for (head = priv->head; head; head = g_list_next (head))
-        (*callback) (EEK_ELEMENT(head->data), user_data);
+    for (i = 0; i < priv->children->len; i++)
+        (*callback) (g_ptr_array_index (priv->children, i), user_data);
 }
 
 static EekElement *
@@ -107,11 +100,13 @@ eek_container_real_find (EekContainer *self,
                          gpointer user_data)
 {
     EekContainerPrivate *priv = EEK_CONTAINER_GET_PRIVATE(self);
-    GList *head;
+    gint i;
 
-    head = g_list_find_custom (priv->head, user_data, (GCompareFunc)func);
-    if (head)
-        return head->data;
+    for (i = 0; i < priv->children->len; i++) {
+        EekElement *element = g_ptr_array_index (priv->children, i);
+        if ((*func) (element, user_data) == 0)
+            return element;
+    }
     return NULL;
 }
 
@@ -119,16 +114,23 @@ static void
 eek_container_dispose (GObject *object)
 {
     EekContainerPrivate *priv = EEK_CONTAINER_GET_PRIVATE(object);
-    GList *head;
+    gint i;
 
-    for (head = priv->head; head; head = priv->head) {
-        g_object_unref (head->data);
-        priv->head = g_list_next (head);
-        g_list_free1 (head);
-    }
+    for (i = 0; i < priv->children->len; i++)
+        g_object_unref (g_ptr_array_index (priv->children, i));
+    g_ptr_array_set_size (priv->children, 0);
     G_OBJECT_CLASS(eek_container_parent_class)->dispose (object);
 }
 
+static void
+eek_container_finalize (GObject *object)
+{
+    EekContainerPrivate *priv = EEK_CONTAINER_GET_PRIVATE(object);
+
+    g_ptr_array_free (priv->children, TRUE);
+    G_OBJECT_CLASS(eek_container_parent_class)->finalize (object);
+}
+
 static void
 eek_container_class_init (EekContainerClass *klass)
 {
@@ -147,6 +149,7 @@ eek_container_class_init (EekContainerClass *klass)
     klass->child_removed = NULL;
 
     gobject_class->dispose = eek_container_dispose;
+    gobject_class->finalize = eek_container_finalize;
 
     /**
      * EekContainer::child-added:
@@ -190,6 +193,7 @@ static void
 eek_container_init (EekContainer *self)
 {
     self->priv = EEK_CONTAINER_GET_PRIVATE(self);
+    self->priv->children = g_ptr_array_new ();
 }
 
 /**
@@ -238,3 +242,36 @@ eek_container_add_child (EekContainer *container, EekElement *element)
     g_return_if_fail (EEK_IS_ELEMENT(element));
     return EEK_CONTAINER_GET_CLASS(container)->add_child (container, element);
 }
+
+/**
+ * eek_container_get_n_children:
+ * @container: an #EekContainer
+ *
+ * Get the number of children in @container.
+ */
+guint
+eek_container_get_n_children (EekContainer *container)
+{
+    g_return_val_if_fail (EEK_IS_CONTAINER(container), 0);
+    return container->priv->children->len;
+}
+
+/**
+ * eek_container_get_child:
+ * @container: an #EekContainer
+ * @index: index of the child, in the order added
+ *
+ * Get the child at @index in @container.  Together with
+ * eek_container_get_n_children(), this allows iterating over the
+ * children without a callback.
+ * Returns: (transfer none): an #EekElement or %NULL if @index is out
+ * of range
+ */
+EekElement *
+eek_container_get_child (EekContainer *container,
+                         guint         index)
+{
+    g_return_val_if_fail (EEK_IS_CONTAINER(container), NULL);
+    g_return_val_if_fail (index < container->priv->children->len, NULL);
+    return g_ptr_array_index (container->priv->children, index);
+}
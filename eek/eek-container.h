@@ -105,5 +105,10 @@ EekElement *eek_container_find          (EekContainer  *container,
 void        eek_container_add_child     (EekContainer  *container,
                                          EekElement    *element);
 
+guint       eek_container_get_n_children
+                                        (EekContainer  *container);
+EekElement *eek_container_get_child     (EekContainer  *container,
+                                         guint          index);
+
 G_END_DECLS
 #endif  /* EEK_CONTAINER_H */
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef EEK_ELEMENT_PRIVATE_H
+#define EEK_ELEMENT_PRIVATE_H 1
+
+#include "eek-element.h"
+
+G_BEGIN_DECLS
+
+/* Rotation (in degrees) of the coordinate space in which the
+   children of an element are placed.  Only sections are rotated. */
+void _eek_element_set_angle (EekElement *element,
+                             gint        angle);
+gint _eek_element_get_angle (EekElement *element);
+
+G_END_DECLS
+
+#endif  /* EEK_ELEMENT_PRIVATE_H */
@@ -30,9 +30,11 @@
 #include "config.h"
 #endif  /* HAVE_CONFIG_H */
 
+#include <math.h>
 #include <string.h>
 
 #include "eek-element.h"
+#include "eek-element-private.h"
 #include "eek-container.h"
 #include "eek-marshalers.h"
 
@@ -60,13 +62,189 @@ G_DEFINE_ABSTRACT_TYPE (EekElement, eek_element, G_TYPE_OBJECT);
 
 struct _EekElementPrivate
 {
-    gchar *name;
+    const gchar *name;
     EekBounds bounds;
     EekElement *parent;
     gint group;
     gint level;
+    gint angle;
+
+    /* Cached geometry in the coordinates of the root element.  The
+       cache is valid only if the parent's cache is valid too, so
+       invalidation can stop at elements which are already invalid. */
+    gboolean cache_valid;
+    /* sum of the offsets of the element and its ancestors */
+    gdouble absolute_x, absolute_y;
+    /* bounding box, taking the rotation of ancestors into account */
+    EekBounds absolute_bounds;
+    /* maps the local coordinates of children to root coordinates:
+       (x, y) -> (origin_x + cos_a * x - sin_a * y,
+                  origin_y + sin_a * x + cos_a * y) */
+    gdouble origin_x, origin_y, cos_a, sin_a;
 };
 
+/* Element names are shared between elements through a reference
+   counted table, since the same few key and section names recur in
+   every keyboard.  Names can come from clients, so unlike
+   g_intern_string() the table lets go of them once unused. */
+typedef struct _NameEntry NameEntry;
+struct _NameEntry {
+    gchar *name;
+    guint ref_count;
+};
+
+G_LOCK_DEFINE_STATIC (names);
+static GHashTable *names = NULL;
+
+static void
+name_entry_free (NameEntry *entry)
+{
+    g_free (entry->name);
+    g_slice_free (NameEntry, entry);
+}
+
+static const gchar *
+name_ref (const gchar *name)
+{
+    NameEntry *entry;
+
+    if (name == NULL)
+        return NULL;
+
+    G_LOCK (names);
+    if (names == NULL)
+        names = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       NULL,
+                                       (GDestroyNotify)name_entry_free);
+    entry = g_hash_table_lookup (names, name);
+    if (entry == NULL) {
+        entry = g_slice_new (NameEntry);
+        entry->name = g_strdup (name);
+        entry->ref_count = 0;
+        g_hash_table_insert (names, entry->name, entry);
+    }
+    entry->ref_count++;
+    name = entry->name;
+    G_UNLOCK (names);
+
+    return name;
+}
+
+static void
+name_unref (const gchar *name)
+{
+    NameEntry *entry;
+
+    if (name == NULL)
+        return;
+
+    G_LOCK (names);
+    entry = g_hash_table_lookup (names, name);
+    g_assert (entry != NULL && entry->name == name);
+    if (--entry->ref_count == 0)
+        g_hash_table_remove (names, name);
+    G_UNLOCK (names);
+}
+
+static void
+invalidate_cache (EekElement *element)
+{
+    EekElementPrivate *priv = element->priv;
+
+    if (!priv->cache_valid)
+        return;
+    priv->cache_valid = FALSE;
+
+    if (EEK_IS_CONTAINER(element)) {
+        guint i, n_children;
+
+        n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+        for (i = 0; i < n_children; i++)
+            invalidate_cache (eek_container_get_child (EEK_CONTAINER(element),
+                                                       i));
+    }
+}
+
+static void
+transform_point (EekElementPrivate *priv,
+                 gdouble            x,
+                 gdouble            y,
+                 EekPoint          *point)
+{
+    point->x = priv->origin_x + priv->cos_a * x - priv->sin_a * y;
+    point->y = priv->origin_y + priv->sin_a * x + priv->cos_a * y;
+}
+
+static void
+update_cache (EekElement *element)
+{
+    EekElementPrivate *priv = element->priv;
+    EekElementPrivate *ppriv;
+    EekBounds *bounds = &priv->bounds;
+    EekPoint points[4], min, max;
+    gdouble c, s;
+    gint i;
+
+    if (priv->cache_valid)
+        return;
+
+    if (priv->parent == NULL) {
+        priv->absolute_x = bounds->x;
+        priv->absolute_y = bounds->y;
+        priv->absolute_bounds = *bounds;
+        priv->origin_x = bounds->x;
+        priv->origin_y = bounds->y;
+        priv->cos_a = cos (priv->angle * G_PI / 180);
+        priv->sin_a = sin (priv->angle * G_PI / 180);
+        priv->cache_valid = TRUE;
+        return;
+    }
+
+    update_cache (priv->parent);
+    ppriv = priv->parent->priv;
+
+    priv->absolute_x = ppriv->absolute_x + bounds->x;
+    priv->absolute_y = ppriv->absolute_y + bounds->y;
+
+    transform_point (ppriv, bounds->x, bounds->y, &points[0]);
+    transform_point (ppriv, bounds->x + bounds->width, bounds->y,
+                     &points[1]);
+    transform_point (ppriv, bounds->x + bounds->width,
+                     bounds->y + bounds->height,
+                     &points[2]);
+    transform_point (ppriv, bounds->x, bounds->y + bounds->height,
+                     &points[3]);
+    min = max = points[0];
+    for (i = 1; i < G_N_ELEMENTS(points); i++) {
+        if (points[i].x < min.x)
+            min.x = points[i].x;
+        if (points[i].x > max.x)
+            max.x = points[i].x;
+        if (points[i].y < min.y)
+            min.y = points[i].y;
+        if (points[i].y > max.y)
+            max.y = points[i].y;
+    }
+    priv->absolute_bounds.x = min.x;
+    priv->absolute_bounds.y = min.y;
+    priv->absolute_bounds.width = max.x - min.x;
+    priv->absolute_bounds.height = max.y - min.y;
+
+    priv->origin_x = points[0].x;
+    priv->origin_y = points[0].y;
+    if (priv->angle == 0) {
+        priv->cos_a = ppriv->cos_a;
+        priv->sin_a = ppriv->sin_a;
+    } else {
+        c = cos (priv->angle * G_PI / 180);
+        s = sin (priv->angle * G_PI / 180);
+        priv->cos_a = ppriv->cos_a * c - ppriv->sin_a * s;
+        priv->sin_a = ppriv->sin_a * c + ppriv->cos_a * s;
+    }
+    priv->cache_valid = TRUE;
+}
+
 static void
 eek_element_real_symbol_index_changed (EekElement *self,
                                        gint        group,
@@ -80,7 +258,7 @@ eek_element_finalize (GObject *object)
 {
     EekElementPrivate *priv = EEK_ELEMENT_GET_PRIVATE(object);
 
-    g_free (priv->name);
+    name_unref (priv->name);
     G_OBJECT_CLASS (eek_element_parent_class)->finalize (object);
 }
 
@@ -271,6 +449,7 @@ eek_element_set_parent (EekElement *element,
         g_object_ref (element);
     }
 
+    invalidate_cache (element);
     element->priv->parent = parent;
 }
 
@@ -293,15 +472,23 @@ eek_element_get_parent (EekElement *element)
  * @element: an #EekElement
  * @name: name of @element
  *
- * Set the name of @element to @name.
+ * Set the name of @element to @name.  Elements with the same name
+ * share one copy of it.
  */
 void
 eek_element_set_name (EekElement  *element,
                       const gchar *name)
 {
+    const gchar *old_name;
+
     g_return_if_fail (EEK_IS_ELEMENT(element));
-    g_free (element->priv->name);
-    element->priv->name = g_strdup (name);
+
+    /* keep the old name alive until notify::name handlers have run */
+    old_name = element->priv->name;
+    element->priv->name = name_ref (name);
+    if (element->priv->name != old_name)
+        g_object_notify (G_OBJECT(element), "name");
+    name_unref (old_name);
 }
 
 /**
@@ -333,6 +520,7 @@ eek_element_set_bounds (EekElement  *element,
 {
     g_return_if_fail (EEK_IS_ELEMENT(element));
     memcpy (&element->priv->bounds, bounds, sizeof(EekBounds));
+    invalidate_cache (element);
 }
 
 /**
@@ -359,23 +547,57 @@ eek_element_get_bounds (EekElement  *element,
  * @x: pointer where the X coordinate of @element will be stored
  * @y: pointer where the Y coordinate of @element will be stored
  *
- * Compute the absolute position of @element.
+ * Compute the absolute position of @element, that is the sum of the
+ * positions of @element and its ancestors.  The result is cached
+ * until the bounds of @element or one of its ancestors change.
  */
 void
 eek_element_get_absolute_position (EekElement *element,
                                    gdouble    *x,
                                    gdouble    *y)
 {
-    EekBounds bounds;
-    gdouble ax = 0.0, ay = 0.0;
+    g_return_if_fail (EEK_IS_ELEMENT(element));
 
-    do {
-        eek_element_get_bounds (element, &bounds);
-        ax += bounds.x;
-        ay += bounds.y;
-    } while ((element = eek_element_get_parent (element)) != NULL);
-    *x = ax;
-    *y = ay;
+    update_cache (element);
+    *x = element->priv->absolute_x;
+    *y = element->priv->absolute_y;
+}
+
+/**
+ * eek_element_get_absolute_bounds:
+ * @element: an #EekElement
+ * @bounds: (out): pointer where the bounding box will be stored
+ *
+ * Get the bounding box of @element in the coordinates of the root
+ * element, with the rotation of ancestor sections applied.  The
+ * result is cached until the bounds of @element or one of its
+ * ancestors, or the angle of an ancestor, change.
+ */
+void
+eek_element_get_absolute_bounds (EekElement *element,
+                                 EekBounds  *bounds)
+{
+    g_return_if_fail (EEK_IS_ELEMENT(element));
+    g_return_if_fail (bounds != NULL);
+
+    update_cache (element);
+    *bounds = element->priv->absolute_bounds;
+}
+
+void
+_eek_element_set_angle (EekElement *element,
+                        gint        angle)
+{
+    if (element->priv->angle != angle) {
+        element->priv->angle = angle;
+        invalidate_cache (element);
+    }
+}
+
+gint
+_eek_element_get_angle (EekElement *element)
+{
+    return element->priv->angle;
 }
 
 /**
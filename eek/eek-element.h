@@ -84,6 +84,8 @@ void         eek_element_set_size              (EekElement  *element,
 void         eek_element_get_absolute_position (EekElement  *element,
                                                 gdouble     *x,
                                                 gdouble     *y);
+void         eek_element_get_absolute_bounds   (EekElement  *element,
+                                                EekBounds   *bounds);
 
 void         eek_element_set_symbol_index      (EekElement  *element,
                                                 gint         group,
@@ -425,16 +425,38 @@ eek_key_get_keycode (EekKey *key)
  * @key: an #EekKey
  * @matrix: an #EekSymbolMatrix
  *
- * Set the symbol matrix of @key to @matrix.
+ * Set the symbol matrix of @key to a copy of @matrix.  To share
+ * @matrix with @key instead, use eek_key_take_symbol_matrix().
  */
 void
 eek_key_set_symbol_matrix (EekKey          *key,
                            EekSymbolMatrix *matrix)
 {
     g_return_if_fail (EEK_IS_KEY(key));
+    g_return_if_fail (matrix != NULL);
+
+    eek_key_take_symbol_matrix (key, eek_symbol_matrix_copy (matrix));
+}
+
+/**
+ * eek_key_take_symbol_matrix:
+ * @key: an #EekKey
+ * @matrix: (transfer full): an #EekSymbolMatrix
+ *
+ * Set the symbol matrix of @key to @matrix, taking over the
+ * caller's reference to it.  The matrix may be shared with other
+ * keys, through eek_symbol_matrix_ref(), so it must not be modified
+ * afterwards.
+ */
+void
+eek_key_take_symbol_matrix (EekKey          *key,
+                            EekSymbolMatrix *matrix)
+{
+    g_return_if_fail (EEK_IS_KEY(key));
+    g_return_if_fail (matrix != NULL);
 
     eek_symbol_matrix_free (key->priv->symbol_matrix);
-    key->priv->symbol_matrix = eek_symbol_matrix_copy (matrix);
+    key->priv->symbol_matrix = matrix;
 }
 
 /**
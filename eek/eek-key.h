@@ -85,6 +85,8 @@ void             eek_key_set_keycode         (EekKey          *key,
 guint            eek_key_get_keycode         (EekKey          *key);
 void             eek_key_set_symbol_matrix   (EekKey          *key,
                                               EekSymbolMatrix *matrix);
+void             eek_key_take_symbol_matrix  (EekKey          *key,
+                                              EekSymbolMatrix *matrix);
 EekSymbolMatrix *eek_key_get_symbol_matrix   (EekKey          *key);
 EekSymbol       *eek_key_get_symbol          (EekKey          *key);
 EekSymbol       *eek_key_get_symbol_with_fallback
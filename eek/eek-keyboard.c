@@ -68,6 +68,7 @@ struct _EekKeyboardPrivate
     GList *pressed_keys;
     GList *locked_keys;
     GArray *outline_array;
+    GArray *point_array;
     GHashTable *keycodes;
 
     /* modifiers dynamically assigned at run time */
@@ -78,12 +79,40 @@ struct _EekKeyboardPrivate
 G_DEFINE_BOXED_TYPE(EekModifierKey, eek_modifier_key,
                     eek_modifier_key_copy, eek_modifier_key_free);
 
+struct _EekKeyboardState
+{
+    gint group;
+    EekModifierBehavior modifier_behavior;
+    EekModifierType modifiers;
+    /* EekModifierKey */
+    GList *locked_keys;
+    /* EekKey, pressed with eek_keyboard_state_press_key() */
+    GList *pressed_keys;
+};
+
+/**
+ * eek_modifier_key_copy:
+ * @modkey: an #EekModifierKey
+ *
+ * Copy @modkey.  The copy holds its own reference to the key, which
+ * eek_modifier_key_free() drops.
+ * Returns: a newly allocated #EekModifierKey
+ */
 EekModifierKey *
 eek_modifier_key_copy (EekModifierKey *modkey)
 {
-    return g_slice_dup (EekModifierKey, modkey);
+    EekModifierKey *copy = g_slice_dup (EekModifierKey, modkey);
+
+    g_object_ref (copy->key);
+    return copy;
 }
 
+/**
+ * eek_modifier_key_free:
+ * @modkey: an #EekModifierKey
+ *
+ * Free @modkey and drop its reference to the key.
+ */
 void
 eek_modifier_key_free (EekModifierKey *modkey)
 {
@@ -226,47 +255,63 @@ eek_keyboard_get_property (GObject    *object,
     }
 }
 
-static void
-set_level_from_modifiers (EekKeyboard *self)
+static gint
+get_level_from_modifiers (EekKeyboard *self, EekModifierType modifiers)
 {
     EekKeyboardPrivate *priv = EEK_KEYBOARD_GET_PRIVATE(self);
     gint level = 0;
 
-    if (priv->modifiers & priv->alt_gr_mask)
+    if (modifiers & priv->alt_gr_mask)
         level |= 2;
-    if (priv->modifiers & EEK_SHIFT_MASK)
+    if (modifiers & EEK_SHIFT_MASK)
         level |= 1;
-    eek_element_set_level (EEK_ELEMENT(self), level);
+    return level;
 }
 
 static void
-set_modifiers_with_key (EekKeyboard    *self,
-                        EekKey         *key,
-                        EekModifierType modifiers)
+set_level_from_modifiers (EekKeyboard *self)
 {
     EekKeyboardPrivate *priv = EEK_KEYBOARD_GET_PRIVATE(self);
-    EekModifierType enabled = (priv->modifiers ^ modifiers) & modifiers;
-    EekModifierType disabled = (priv->modifiers ^ modifiers) & priv->modifiers;
+
+    eek_element_set_level (EEK_ELEMENT(self),
+                           get_level_from_modifiers (self, priv->modifiers));
+}
+
+/* Set *MODIFIERS to NEW_MODIFIERS as KEY is pressed or released, and
+   lock or unlock KEY in *LOCKED_KEYS.  The keys are told with the
+   locked and unlocked signals only if NOTIFY is set, that is, if the
+   modifiers are those of the keyboard itself. */
+static void
+update_modifiers (EekModifierBehavior behavior,
+                  EekModifierType    *modifiers,
+                  GList             **locked_keys,
+                  EekKey             *key,
+                  EekModifierType     new_modifiers,
+                  gboolean            notify)
+{
+    EekModifierType enabled = (*modifiers ^ new_modifiers) & new_modifiers;
+    EekModifierType disabled = (*modifiers ^ new_modifiers) & *modifiers;
 
     if (enabled != 0) {
-        if (priv->modifier_behavior != EEK_MODIFIER_BEHAVIOR_NONE) {
+        if (behavior != EEK_MODIFIER_BEHAVIOR_NONE) {
             EekModifierKey *modifier_key = g_slice_new (EekModifierKey);
             modifier_key->modifiers = enabled;
             modifier_key->key = g_object_ref (key);
-            priv->locked_keys =
-                g_list_prepend (priv->locked_keys, modifier_key);
-            g_signal_emit_by_name (modifier_key->key, "locked");
+            *locked_keys = g_list_prepend (*locked_keys, modifier_key);
+            if (notify)
+                g_signal_emit_by_name (modifier_key->key, "locked");
         }
     } else {
-        if (priv->modifier_behavior != EEK_MODIFIER_BEHAVIOR_NONE) {
+        if (behavior != EEK_MODIFIER_BEHAVIOR_NONE) {
             GList *head;
-            for (head = priv->locked_keys; head; ) {
+            for (head = *locked_keys; head; ) {
                 EekModifierKey *modifier_key = head->data;
                 if (modifier_key->modifiers & disabled) {
                     GList *next = g_list_next (head);
-                    priv->locked_keys =
-                        g_list_remove_link (priv->locked_keys, head);
-                    g_signal_emit_by_name (modifier_key->key, "unlocked");
+                    *locked_keys = g_list_remove_link (*locked_keys, head);
+                    if (notify)
+                        g_signal_emit_by_name (modifier_key->key, "unlocked");
+                    eek_modifier_key_free (modifier_key);
                     g_list_free1 (head);
                     head = next;
                 } else
@@ -275,7 +320,51 @@ set_modifiers_with_key (EekKeyboard    *self,
         }
     }
 
-    priv->modifiers = modifiers;
+    *modifiers = new_modifiers;
+}
+
+/* Update the modifiers as KEY, whose symbol has MODIFIER, is
+   released. */
+static void
+release_modifier (EekModifierBehavior behavior,
+                  EekModifierType    *modifiers,
+                  GList             **locked_keys,
+                  EekKey             *key,
+                  EekModifierType     modifier,
+                  gboolean            notify)
+{
+    switch (behavior) {
+    case EEK_MODIFIER_BEHAVIOR_NONE:
+        update_modifiers (behavior, modifiers, locked_keys, key,
+                          *modifiers & ~modifier, notify);
+        break;
+    case EEK_MODIFIER_BEHAVIOR_LOCK:
+        *modifiers ^= modifier;
+        break;
+    case EEK_MODIFIER_BEHAVIOR_LATCH:
+        if (modifier)
+            update_modifiers (behavior, modifiers, locked_keys, key,
+                              *modifiers ^ modifier, notify);
+        else
+            update_modifiers (behavior, modifiers, locked_keys, key,
+                              (*modifiers ^ modifier) & modifier, notify);
+        break;
+    }
+}
+
+static void
+set_modifiers_with_key (EekKeyboard    *self,
+                        EekKey         *key,
+                        EekModifierType modifiers)
+{
+    EekKeyboardPrivate *priv = EEK_KEYBOARD_GET_PRIVATE(self);
+
+    update_modifiers (priv->modifier_behavior,
+                      &priv->modifiers,
+                      &priv->locked_keys,
+                      key,
+                      modifiers,
+                      TRUE);
 }
 
 static void
@@ -314,21 +403,12 @@ eek_keyboard_real_key_released (EekKeyboard *self,
         return;
 
     modifier = eek_symbol_get_modifier_mask (symbol);
-    switch (priv->modifier_behavior) {
-    case EEK_MODIFIER_BEHAVIOR_NONE:
-        set_modifiers_with_key (self, key, priv->modifiers & ~modifier);
-        break;
-    case EEK_MODIFIER_BEHAVIOR_LOCK:
-        priv->modifiers ^= modifier;
-        break;
-    case EEK_MODIFIER_BEHAVIOR_LATCH:
-        if (modifier)
-            set_modifiers_with_key (self, key, priv->modifiers ^ modifier);
-        else
-            set_modifiers_with_key (self, key,
-                                    (priv->modifiers ^ modifier) & modifier);
-        break;
-    }
+    release_modifier (priv->modifier_behavior,
+                      &priv->modifiers,
+                      &priv->locked_keys,
+                      key,
+                      modifier,
+                      TRUE);
     set_level_from_modifiers (self);
 }
 
@@ -365,7 +445,6 @@ static void
 eek_keyboard_finalize (GObject *object)
 {
     EekKeyboardPrivate *priv = EEK_KEYBOARD_GET_PRIVATE(object);
-    gint i;
 
     g_list_free (priv->pressed_keys);
     g_list_free_full (priv->locked_keys,
@@ -373,14 +452,8 @@ eek_keyboard_finalize (GObject *object)
 
     g_hash_table_destroy (priv->keycodes);
 
-    for (i = 0; i < priv->outline_array->len; i++) {
-        EekOutline *outline = &g_array_index (priv->outline_array,
-                                              EekOutline,
-                                              i);
-        g_slice_free1 (sizeof (EekPoint) * outline->num_points,
-                       outline->points);
-    }
     g_array_free (priv->outline_array, TRUE);
+    g_array_free (priv->point_array, TRUE);
         
     G_OBJECT_CLASS (eek_keyboard_parent_class)->finalize (object);
 }
@@ -575,6 +648,7 @@ eek_keyboard_init (EekKeyboard *self)
     self->priv = EEK_KEYBOARD_GET_PRIVATE(self);
     self->priv->modifier_behavior = EEK_MODIFIER_BEHAVIOR_NONE;
     self->priv->outline_array = g_array_new (FALSE, TRUE, sizeof (EekOutline));
+    self->priv->point_array = g_array_new (FALSE, FALSE, sizeof (EekPoint));
     self->priv->keycodes = g_hash_table_new (g_direct_hash, g_direct_equal);
     eek_element_set_symbol_index (EEK_ELEMENT(self), 0, 0);
 }
@@ -710,15 +784,47 @@ guint
 eek_keyboard_add_outline (EekKeyboard *keyboard,
                           EekOutline  *outline)
 {
-    EekOutline *_outline;
+    EekKeyboardPrivate *priv;
+    EekOutline _outline;
+    gpointer old_points;
 
     g_return_val_if_fail (EEK_IS_KEYBOARD(keyboard), 0);
 
-    _outline = eek_outline_copy (outline);
-    g_array_append_val (keyboard->priv->outline_array, *_outline);
-    /* don't use eek_outline_free here, so as to keep _outline->points */
-    g_slice_free (EekOutline, _outline);
-    return keyboard->priv->outline_array->len - 1;
+    priv = keyboard->priv;
+
+    /* The points of all outlines are stored in one array, so that
+       the outlines of a keyboard are released at once. */
+    old_points = priv->point_array->data;
+    _outline.corner_radius = outline->corner_radius;
+    _outline.num_points = outline->num_points;
+    _outline.points = NULL;
+    g_array_append_vals (priv->point_array,
+                         outline->points,
+                         outline->num_points);
+    g_array_append_val (priv->outline_array, _outline);
+
+    /* Outlines are stored in order, so the offset of their points
+       is the sum of the preceding num_points. */
+    if (priv->point_array->data != old_points) {
+        gint i, offset;
+
+        for (i = 0, offset = 0; i < priv->outline_array->len; i++) {
+            EekOutline *o = &g_array_index (priv->outline_array,
+                                            EekOutline,
+                                            i);
+            o->points = &g_array_index (priv->point_array, EekPoint, offset);
+            offset += o->num_points;
+        }
+    } else {
+        EekOutline *o = &g_array_index (priv->outline_array,
+                                        EekOutline,
+                                        priv->outline_array->len - 1);
+        o->points = &g_array_index (priv->point_array,
+                                    EekPoint,
+                                    priv->point_array->len - o->num_points);
+    }
+
+    return priv->outline_array->len - 1;
 }
 
 /**
@@ -842,3 +948,253 @@ eek_keyboard_get_locked_keys (EekKeyboard *keyboard)
     g_return_val_if_fail (EEK_IS_KEYBOARD(keyboard), NULL);
     return g_list_copy (keyboard->priv->locked_keys);
 }
+
+static GList *
+copy_locked_keys (GList *locked_keys)
+{
+    GList *copy = NULL, *head;
+
+    for (head = locked_keys; head; head = g_list_next (head))
+        copy = g_list_prepend (copy, eek_modifier_key_copy (head->data));
+    return g_list_reverse (copy);
+}
+
+/**
+ * eek_keyboard_get_state:
+ * @keyboard: an #EekKeyboard
+ *
+ * Save the group, the modifier behavior, the modifiers and the locked
+ * keys of @keyboard, so that they can be put back with
+ * eek_keyboard_set_state() after the keyboard has been used for
+ * something else.  Pressed keys are not saved.
+ * Returns: a newly allocated #EekKeyboardState
+ */
+EekKeyboardState *
+eek_keyboard_get_state (EekKeyboard *keyboard)
+{
+    EekKeyboardState *state;
+
+    g_return_val_if_fail (EEK_IS_KEYBOARD(keyboard), NULL);
+
+    state = g_slice_new (EekKeyboardState);
+    state->group = eek_element_get_group (EEK_ELEMENT(keyboard));
+    state->modifier_behavior = keyboard->priv->modifier_behavior;
+    state->modifiers = keyboard->priv->modifiers;
+    state->locked_keys = copy_locked_keys (keyboard->priv->locked_keys);
+    state->pressed_keys = NULL;
+    return state;
+}
+
+/**
+ * eek_keyboard_set_state:
+ * @keyboard: an #EekKeyboard
+ * @state: an #EekKeyboardState returned by eek_keyboard_get_state()
+ * on @keyboard
+ *
+ * Restore the state of @keyboard.  Keys which are pressed are
+ * cancelled, since a press cannot be carried over; this includes
+ * keys pressed in @state with eek_keyboard_state_press_key().
+ */
+void
+eek_keyboard_set_state (EekKeyboard            *keyboard,
+                        const EekKeyboardState *state)
+{
+    EekKeyboardPrivate *priv;
+    GList *head;
+
+    g_return_if_fail (EEK_IS_KEYBOARD(keyboard));
+    g_return_if_fail (state != NULL);
+
+    priv = keyboard->priv;
+
+    /* key_cancelled would edit the list while we walk it */
+    head = priv->pressed_keys;
+    priv->pressed_keys = NULL;
+    while (head) {
+        g_signal_emit_by_name (head->data, "cancelled");
+        head = g_list_delete_link (head, head);
+    }
+
+    for (head = priv->locked_keys; head; head = g_list_next (head)) {
+        EekModifierKey *modifier_key = head->data;
+        g_signal_emit_by_name (modifier_key->key, "unlocked");
+    }
+    g_list_free_full (priv->locked_keys,
+                      (GDestroyNotify) eek_modifier_key_free);
+
+    priv->locked_keys = copy_locked_keys (state->locked_keys);
+    for (head = priv->locked_keys; head; head = g_list_next (head)) {
+        EekModifierKey *modifier_key = head->data;
+        g_signal_emit_by_name (modifier_key->key, "locked");
+    }
+
+    priv->modifier_behavior = state->modifier_behavior;
+    priv->modifiers = state->modifiers;
+    set_level_from_modifiers (keyboard);
+    eek_element_set_group (EEK_ELEMENT(keyboard), state->group);
+}
+
+/**
+ * eek_keyboard_state_copy:
+ * @state: an #EekKeyboardState
+ *
+ * Copy @state.
+ * Returns: a newly allocated #EekKeyboardState
+ */
+EekKeyboardState *
+eek_keyboard_state_copy (const EekKeyboardState *state)
+{
+    EekKeyboardState *copy;
+
+    g_return_val_if_fail (state != NULL, NULL);
+
+    copy = g_slice_dup (EekKeyboardState, state);
+    copy->locked_keys = copy_locked_keys (state->locked_keys);
+    copy->pressed_keys = g_list_copy (state->pressed_keys);
+    return copy;
+}
+
+/**
+ * eek_keyboard_state_free:
+ * @state: an #EekKeyboardState
+ *
+ * Free @state.
+ */
+void
+eek_keyboard_state_free (EekKeyboardState *state)
+{
+    g_return_if_fail (state != NULL);
+
+    g_list_free_full (state->locked_keys,
+                      (GDestroyNotify) eek_modifier_key_free);
+    g_list_free (state->pressed_keys);
+    g_slice_free (EekKeyboardState, state);
+}
+
+/**
+ * eek_keyboard_state_set_modifier_behavior:
+ * @state: an #EekKeyboardState
+ * @modifier_behavior: modifier behavior
+ *
+ * Set the modifier handling mode kept in @state, which applies to
+ * keys pressed in @state and to the keyboard once @state is put back
+ * with eek_keyboard_set_state().
+ */
+void
+eek_keyboard_state_set_modifier_behavior (EekKeyboardState   *state,
+                                          EekModifierBehavior modifier_behavior)
+{
+    g_return_if_fail (state != NULL);
+    state->modifier_behavior = modifier_behavior;
+}
+
+/**
+ * eek_keyboard_state_set_group:
+ * @state: an #EekKeyboardState
+ * @group: group index
+ *
+ * Set the group kept in @state.
+ */
+void
+eek_keyboard_state_set_group (EekKeyboardState *state,
+                              gint              group)
+{
+    g_return_if_fail (state != NULL);
+    state->group = group;
+}
+
+/**
+ * eek_keyboard_state_get_group:
+ * @state: an #EekKeyboardState
+ *
+ * Get the group kept in @state.
+ * Returns: group index
+ */
+gint
+eek_keyboard_state_get_group (const EekKeyboardState *state)
+{
+    g_return_val_if_fail (state != NULL, -1);
+    return state->group;
+}
+
+/* The symbol of KEY in the group and level of STATE.  Levels which
+   sections set from num lock are not kept in states. */
+static EekSymbol *
+get_symbol_in_state (EekKeyboard            *keyboard,
+                     const EekKeyboardState *state,
+                     EekKey                 *key)
+{
+    gint group, level;
+
+    eek_element_get_symbol_index (EEK_ELEMENT(key), &group, &level);
+    if (group < 0)
+        group = state->group;
+    if (level < 0)
+        level = get_level_from_modifiers (keyboard, state->modifiers);
+    return eek_key_get_symbol_at_index (key, group, level, 0, 0);
+}
+
+/**
+ * eek_keyboard_state_press_key:
+ * @state: an #EekKeyboardState of @keyboard
+ * @keyboard: an #EekKeyboard
+ * @key: an #EekKey of @keyboard
+ *
+ * Press @key in @state, updating the modifiers of @state as pressing
+ * it on @keyboard would, but without touching @keyboard.  This lets
+ * several users share a keyboard, each with a state of their own.
+ */
+void
+eek_keyboard_state_press_key (EekKeyboardState *state,
+                              EekKeyboard      *keyboard,
+                              EekKey           *key)
+{
+    EekSymbol *symbol;
+
+    g_return_if_fail (state != NULL);
+    g_return_if_fail (EEK_IS_KEYBOARD(keyboard));
+    g_return_if_fail (EEK_IS_KEY(key));
+
+    state->pressed_keys = g_list_prepend (state->pressed_keys, key);
+
+    symbol = get_symbol_in_state (keyboard, state, key);
+    if (symbol && state->modifier_behavior == EEK_MODIFIER_BEHAVIOR_NONE)
+        update_modifiers (state->modifier_behavior,
+                          &state->modifiers,
+                          &state->locked_keys,
+                          key,
+                          state->modifiers |
+                          eek_symbol_get_modifier_mask (symbol),
+                          FALSE);
+}
+
+/**
+ * eek_keyboard_state_release_key:
+ * @state: an #EekKeyboardState of @keyboard
+ * @keyboard: an #EekKeyboard
+ * @key: an #EekKey of @keyboard
+ *
+ * Release @key in @state, like eek_keyboard_state_press_key().
+ */
+void
+eek_keyboard_state_release_key (EekKeyboardState *state,
+                                EekKeyboard      *keyboard,
+                                EekKey           *key)
+{
+    EekSymbol *symbol;
+
+    g_return_if_fail (state != NULL);
+    g_return_if_fail (EEK_IS_KEYBOARD(keyboard));
+    g_return_if_fail (EEK_IS_KEY(key));
+
+    state->pressed_keys = g_list_remove (state->pressed_keys, key);
+
+    symbol = get_symbol_in_state (keyboard, state, key);
+    if (symbol)
+        release_modifier (state->modifier_behavior,
+                          &state->modifiers,
+                          &state->locked_keys,
+                          key,
+                          eek_symbol_get_modifier_mask (symbol),
+                          FALSE);
+}
@@ -121,6 +121,14 @@ struct _EekModifierKey {
 };
 typedef struct _EekModifierKey EekModifierKey;
 
+/**
+ * EekKeyboardState:
+ *
+ * An opaque snapshot of the run time state of an #EekKeyboard,
+ * returned by eek_keyboard_get_state().
+ */
+typedef struct _EekKeyboardState EekKeyboardState;
+
 GType               eek_keyboard_get_type
                                      (void) G_GNUC_CONST;
 
@@ -183,6 +191,35 @@ GList              *eek_keyboard_get_pressed_keys
 GList              *eek_keyboard_get_locked_keys
                                      (EekKeyboard        *keyboard);
 
+EekKeyboardState   *eek_keyboard_get_state
+                                     (EekKeyboard        *keyboard);
+void                eek_keyboard_set_state
+                                     (EekKeyboard        *keyboard,
+                                      const EekKeyboardState
+                                                         *state);
+EekKeyboardState   *eek_keyboard_state_copy
+                                     (const EekKeyboardState
+                                                         *state);
+void                eek_keyboard_state_free
+                                     (EekKeyboardState   *state);
+void                eek_keyboard_state_set_modifier_behavior
+                                     (EekKeyboardState   *state,
+                                      EekModifierBehavior modifier_behavior);
+void                eek_keyboard_state_set_group
+                                     (EekKeyboardState   *state,
+                                      gint                group);
+gint                eek_keyboard_state_get_group
+                                     (const EekKeyboardState
+                                                         *state);
+void                eek_keyboard_state_press_key
+                                     (EekKeyboardState   *state,
+                                      EekKeyboard        *keyboard,
+                                      EekKey             *key);
+void                eek_keyboard_state_release_key
+                                     (EekKeyboardState   *state,
+                                      EekKeyboard        *keyboard,
+                                      EekKey             *key);
+
 EekModifierKey     *eek_modifier_key_copy
                                      (EekModifierKey     *modkey);
 void                eek_modifier_key_free
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef EEK_KEYSYM_PRIVATE_H
+#define EEK_KEYSYM_PRIVATE_H 1
+
+#include "eek-keysym.h"
+
+G_BEGIN_DECLS
+
+/* Create a new, unshared keysym with the same X keysym value and
+   modifier mask as KEYSYM, which the caller may modify. */
+EekKeysym *_eek_keysym_copy        (EekKeysym *keysym);
+/* Whether KEYSYM is the shared instance returned by eek_keysym_new()
+   and friends, in which case the keysym table holds a reference to
+   it. */
+gboolean   _eek_keysym_is_interned (EekKeysym *keysym);
+/* The modifier mask eek_keysym_new() gives to XKEYSYM. */
+EekModifierType
+           _eek_keysym_get_default_modifier_mask
+                                    (guint        xkeysym);
+/* Look up the X keysym value named NAME, as
+   eek_keysym_new_from_name() does. */
+gboolean   _eek_keysym_lookup_xkeysym
+                                    (const gchar *name,
+                                     guint       *xkeysym);
+
+G_END_DECLS
+
+#endif  /* EEK_KEYSYM_PRIVATE_H */
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 
 #include "eek-keysym.h"
+#include "eek-keysym-private.h"
 #include "eek-serializable.h"
 
 /* modifier keys */
@@ -52,6 +53,8 @@
 
 struct _EekKeysymPrivate {
     guint xkeysym;
+    /* whether this is the shared instance held by the keysyms table */
+    gboolean interned;
 };
 
 struct _EekKeysymEntry {
@@ -62,10 +65,34 @@ struct _EekKeysymEntry {
 
 typedef struct _EekKeysymEntry EekKeysymEntry;
 
+struct _EekUnicharEntry {
+    gunichar uc;
+    guint xkeysym;
+};
+
+typedef struct _EekUnicharEntry EekUnicharEntry;
+
 #include "eek-special-keysym-entries.h"
 #include "eek-unicode-keysym-entries.h"
 #include "eek-xkeysym-keysym-entries.h"
 
+/* Keysyms are never modified once built, so eek_keysym_new() and
+   friends hand out one shared instance per X keysym value and
+   modifier mask.  As in the symbol pool, the table holds a reference
+   to each keysym, and drops those nobody else refers to whenever it
+   has doubled in size. */
+struct _KeysymKey {
+    guint xkeysym;
+    EekModifierType modifier_mask;
+};
+typedef struct _KeysymKey KeysymKey;
+
+G_LOCK_DEFINE_STATIC (keysyms);
+static GHashTable *keysyms = NULL;
+
+#define MIN_SWEEP_SIZE 256
+static guint sweep_size = MIN_SWEEP_SIZE;
+
 static void eek_serializable_iface_init (EekSerializableIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (EekKeysym, eek_keysym, EEK_TYPE_SYMBOL,
@@ -114,21 +141,6 @@ eek_serializable_iface_init (EekSerializableIface *iface)
     iface->deserialize = eek_keysym_real_deserialize;
 }
 
-static gchar *
-unichar_to_utf8 (gunichar uc)
-{
-    if (g_unichar_isgraph (uc)) {
-        gchar *buf;
-        gint len;
-
-        len = g_unichar_to_utf8 (uc, NULL);
-        buf = g_malloc0 (len + 1);
-        g_unichar_to_utf8 (uc, buf);
-        return buf;
-    }
-    return g_strdup ("");
-}
-
 static int
 keysym_entry_compare_by_xkeysym (const void *key0, const void *key1)
 {
@@ -136,7 +148,7 @@ keysym_entry_compare_by_xkeysym (const void *key0, const void *key1)
     return (gint) (entry0->xkeysym - entry1->xkeysym);
 }
 
-static EekKeysymEntry *
+static const EekKeysymEntry *
 find_keysym_entry_by_xkeysym (guint xkeysym,
                               const EekKeysymEntry *entries,
                               gint num_entries)
@@ -148,6 +160,38 @@ find_keysym_entry_by_xkeysym (guint xkeysym,
                     keysym_entry_compare_by_xkeysym);
 }
 
+static int
+keysym_entry_compare_by_name (const void *key, const void *index)
+{
+    const EekKeysymEntry *entry =
+        &xkeysym_keysym_entries[*(const guint16 *)index];
+    return strcmp (key, entry->name);
+}
+
+static const EekKeysymEntry *
+find_xkeysym_entry_by_name (const gchar *name)
+{
+    const guint16 *index;
+
+    index = bsearch (name,
+                     xkeysym_keysym_entries_by_name,
+                     G_N_ELEMENTS(xkeysym_keysym_entries_by_name),
+                     sizeof (xkeysym_keysym_entries_by_name[0]),
+                     keysym_entry_compare_by_name);
+    return index ? &xkeysym_keysym_entries[*index] : NULL;
+}
+
+static int
+unichar_entry_compare (const void *key, const void *elem)
+{
+    gunichar uc = *(const gunichar *)key;
+    const EekUnicharEntry *entry = elem;
+
+    if (uc < entry->uc)
+        return -1;
+    return uc > entry->uc;
+}
+
 static gboolean
 get_unichar (guint xkeysym, gunichar *uc) {
     /* Check for Latin-1 characters (1:1 mapping) */
@@ -211,23 +255,15 @@ eek_keysym_init (EekKeysym *self)
     self->priv = EEK_KEYSYM_GET_PRIVATE(self);
 }
 
-/**
- * eek_keysym_new_with_modifier:
- * @xkeysym: an X keysym value
- * @modifier_mask: modifier assigned to @xkeysym
- *
- * Create an #EekKeysym with given X keysym value @xkeysym and
- * modifier @modifier_mask.
- */
-EekKeysym *
-eek_keysym_new_with_modifier (guint           xkeysym,
-                              EekModifierType modifier_mask)
+static EekKeysym *
+keysym_create (guint           xkeysym,
+               EekModifierType modifier_mask)
 {
     EekKeysym *keysym;
     EekKeysymPrivate *priv;
-    EekKeysymEntry *special_entry, *xkeysym_entry, *unicode_entry,
-        *unichar_entry;
-    gchar *name, *label;
+    const EekKeysymEntry *special_entry, *xkeysym_entry, *unicode_entry;
+    const gchar *name, *label, *unichar_name;
+    gchar unichar_buf[7];
     EekSymbolCategory category;
     gunichar uc;
 
@@ -243,39 +279,42 @@ eek_keysym_new_with_modifier (guint           xkeysym,
         find_keysym_entry_by_xkeysym (xkeysym,
                                       unicode_keysym_entries,
                                       G_N_ELEMENTS(unicode_keysym_entries));
-    unichar_entry = NULL;
+
+    /* Names and labels point to the static tables or to this stack
+       buffer; the symbol properties take their own copies. */
+    unichar_name = NULL;
     if (get_unichar (xkeysym, &uc)) {
-        unichar_entry = g_slice_new (EekKeysymEntry);
-        unichar_entry->xkeysym = xkeysym;
-        unichar_entry->name = unichar_to_utf8 (uc);
-        unichar_entry->category = EEK_SYMBOL_CATEGORY_LETTER;
+        unichar_name = "";
+        if (g_unichar_isgraph (uc)) {
+            unichar_buf[g_unichar_to_utf8 (uc, unichar_buf)] = '\0';
+            unichar_name = unichar_buf;
+        }
     }
 
     /* name and category */
-    name = NULL;
     if (xkeysym_entry) {
-        name = g_strdup (xkeysym_entry->name);
+        name = xkeysym_entry->name;
         category = xkeysym_entry->category;
-    } else if (unichar_entry) {
-        name = g_strdup (unichar_entry->name);
-        category = unichar_entry->category;
+    } else if (unichar_name) {
+        name = unichar_name;
+        category = EEK_SYMBOL_CATEGORY_LETTER;
     } else if (unicode_entry) {
-        name = g_strdup (unicode_entry->name);
+        name = unicode_entry->name;
         category = unicode_entry->category;
     } else {
-        name = g_strdup ("");
+        name = "";
         category = EEK_SYMBOL_CATEGORY_UNKNOWN;
     }
 
     /* label */
     if (special_entry)
-        label = g_strdup (special_entry->name);
-    else if (unichar_entry)
-        label = g_strdup (unichar_entry->name);
+        label = special_entry->name;
+    else if (unichar_name)
+        label = unichar_name;
     else if (unicode_entry)
-        label = g_strdup (unicode_entry->name);
+        label = unicode_entry->name;
     else
-        label = g_strdup (name);
+        label = name;
 
     keysym = g_object_new (EEK_TYPE_KEYSYM,
                            "name", name,
@@ -283,13 +322,6 @@ eek_keysym_new_with_modifier (guint           xkeysym,
                            "category", category,
                            "modifier-mask", modifier_mask,
                            NULL);
-    g_free (name);
-    g_free (label);
-
-    if (unichar_entry) {
-        g_free ((gpointer) unichar_entry->name);
-        g_slice_free (EekKeysymEntry, unichar_entry);
-    }
 
     priv = EEK_KEYSYM_GET_PRIVATE(keysym);
     priv->xkeysym = xkeysym;
@@ -297,11 +329,93 @@ eek_keysym_new_with_modifier (guint           xkeysym,
     return keysym;
 }
 
+static guint
+keysym_key_hash (gconstpointer v)
+{
+    const KeysymKey *key = v;
+
+    return key->xkeysym * 31 + key->modifier_mask;
+}
+
+static gboolean
+keysym_key_equal (gconstpointer v1, gconstpointer v2)
+{
+    const KeysymKey *key1 = v1, *key2 = v2;
+
+    return key1->xkeysym == key2->xkeysym &&
+        key1->modifier_mask == key2->modifier_mask;
+}
+
+static void
+keysym_key_free (KeysymKey *key)
+{
+    g_slice_free (KeysymKey, key);
+}
+
+/* Only the table hands out references to interned keysyms, so one
+   whose single reference is the table's can't be revived while the
+   lock is held. */
+static gboolean
+keysym_is_unused (gpointer key, gpointer value, gpointer user_data)
+{
+    GObject *object = value;
+
+    return g_atomic_int_get ((volatile gint *)&object->ref_count) == 1;
+}
+
+/**
+ * eek_keysym_new_with_modifier:
+ * @xkeysym: an X keysym value
+ * @modifier_mask: modifier assigned to @xkeysym
+ *
+ * Get an #EekKeysym with given X keysym value @xkeysym and modifier
+ * @modifier_mask.  Keysyms are shared between callers, so the
+ * returned one must not be modified.
+ * Returns: (transfer full): an #EekKeysym
+ */
+EekKeysym *
+eek_keysym_new_with_modifier (guint           xkeysym,
+                              EekModifierType modifier_mask)
+{
+    KeysymKey key, *copy;
+    EekKeysym *keysym;
+
+    key.xkeysym = xkeysym;
+    key.modifier_mask = modifier_mask;
+
+    G_LOCK (keysyms);
+    if (keysyms == NULL)
+        keysyms = g_hash_table_new_full (keysym_key_hash,
+                                         keysym_key_equal,
+                                         (GDestroyNotify)keysym_key_free,
+                                         (GDestroyNotify)g_object_unref);
+
+    keysym = g_hash_table_lookup (keysyms, &key);
+    if (keysym == NULL) {
+        if (g_hash_table_size (keysyms) >= sweep_size) {
+            g_hash_table_foreach_remove (keysyms, keysym_is_unused, NULL);
+            sweep_size = MAX(2 * g_hash_table_size (keysyms),
+                             MIN_SWEEP_SIZE);
+        }
+
+        keysym = keysym_create (xkeysym, modifier_mask);
+        keysym->priv->interned = TRUE;
+        copy = g_slice_dup (KeysymKey, &key);
+        g_hash_table_insert (keysyms, copy, keysym);
+    }
+    g_object_ref (keysym);
+    G_UNLOCK (keysyms);
+
+    return keysym;
+}
+
 /**
  * eek_keysym_new:
  * @xkeysym: an X keysym value
  *
- * Create an #EekKeysym with given X keysym value @xkeysym.
+ * Get an #EekKeysym with given X keysym value @xkeysym.  See
+ * eek_keysym_new_with_modifier().
+ * Returns: (transfer full): an #EekKeysym
  */
 EekKeysym *
 eek_keysym_new (guint xkeysym)
@@ -313,16 +427,21 @@ eek_keysym_new (guint xkeysym)
  * eek_keysym_new_from_name:
  * @name: an X keysym name
  *
- * Create an #EekKeysym with an X keysym value looked up by @name.
+ * Get an #EekKeysym with an X keysym value looked up by @name.  See
+ * eek_keysym_new_with_modifier().  If @name is not a known keysym
+ * name, a new #EekKeysym is created instead.
+ * Returns: (transfer full): an #EekKeysym
  */
 EekKeysym *
 eek_keysym_new_from_name (const gchar *name)
 {
-    gint i;
+    const EekKeysymEntry *entry;
+
+    g_return_val_if_fail (name != NULL, NULL);
 
-    for (i = 0; i < G_N_ELEMENTS(xkeysym_keysym_entries); i++)
-        if (g_strcmp0 (xkeysym_keysym_entries[i].name, name) == 0)
-            return eek_keysym_new (xkeysym_keysym_entries[i].xkeysym);
+    entry = find_xkeysym_entry_by_name (name);
+    if (entry)
+        return eek_keysym_new (entry->xkeysym);
 
     // g_warning ("can't find keysym entry for %s", name);
     return g_object_new (EEK_TYPE_KEYSYM,
@@ -333,6 +452,36 @@ eek_keysym_new_from_name (const gchar *name)
                          NULL);
 }
 
+EekKeysym *
+_eek_keysym_copy (EekKeysym *keysym)
+{
+    return keysym_create (keysym->priv->xkeysym,
+                          eek_symbol_get_modifier_mask (EEK_SYMBOL(keysym)));
+}
+
+gboolean
+_eek_keysym_is_interned (EekKeysym *keysym)
+{
+    return keysym->priv->interned;
+}
+
+EekModifierType
+_eek_keysym_get_default_modifier_mask (guint xkeysym)
+{
+    return get_modifier_mask (xkeysym);
+}
+
+gboolean
+_eek_keysym_lookup_xkeysym (const gchar *name, guint *xkeysym)
+{
+    const EekKeysymEntry *entry = find_xkeysym_entry_by_name (name);
+
+    if (entry == NULL)
+        return FALSE;
+    *xkeysym = entry->xkeysym;
+    return TRUE;
+}
+
 /**
  * eek_keysym_get_xkeysym:
  * @keysym: an #EekKeysym
@@ -348,3 +497,33 @@ eek_keysym_get_xkeysym (EekKeysym *keysym)
     priv = EEK_KEYSYM_GET_PRIVATE(keysym);
     return priv->xkeysym;
 }
+
+/**
+ * eek_keysym_unichar_to_xkeysym:
+ * @uc: a Unicode character
+ *
+ * Get the X keysym value which produces @uc.  Latin-1 characters map
+ * to the same value, characters with a legacy keysym map to that
+ * keysym, and the others to the directly encoded keysym
+ * 0x01000000 + @uc.
+ * Returns: an X keysym value
+ */
+guint
+eek_keysym_unichar_to_xkeysym (gunichar uc)
+{
+    const EekUnicharEntry *entry;
+
+    if ((uc >= 0x0020 && uc <= 0x007e) ||
+        (uc >= 0x00a0 && uc <= 0x00ff))
+        return uc;
+
+    entry = bsearch (&uc,
+                     unicode_keysym_entries_by_unichar,
+                     G_N_ELEMENTS(unicode_keysym_entries_by_unichar),
+                     sizeof (EekUnicharEntry),
+                     unichar_entry_compare);
+    if (entry)
+        return entry->xkeysym;
+
+    return uc | 0x01000000;
+}
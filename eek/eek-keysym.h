@@ -73,6 +73,9 @@ EekKeysym *eek_keysym_new_from_name     (const gchar    *name);
 EekKeysym *eek_keysym_new_with_modifier (guint           xkeysym,
                                          EekModifierType modifier_mask);
 
+guint      eek_keysym_unichar_to_xkeysym
+                                        (gunichar        uc);
+
 G_END_DECLS
 
 #endif  /* EEK_KEYSYM_H */
@@ -35,10 +35,114 @@
 
 G_DEFINE_ABSTRACT_TYPE (EekLayout, eek_layout, G_TYPE_OBJECT);
 
+struct _CreateKeyboardData {
+    gdouble initial_width;
+    gdouble initial_height;
+};
+typedef struct _CreateKeyboardData CreateKeyboardData;
+
+static void
+create_keyboard_data_free (CreateKeyboardData *data)
+{
+    g_slice_free (CreateKeyboardData, data);
+}
+
+static void
+create_keyboard_thread (GSimpleAsyncResult *result,
+                        GObject            *object,
+                        GCancellable       *cancellable)
+{
+    CreateKeyboardData *data =
+        g_simple_async_result_get_op_res_gpointer (result);
+    EekKeyboard *keyboard;
+    GError *error = NULL;
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, &error)) {
+        g_simple_async_result_set_from_error (result, error);
+        g_error_free (error);
+        return;
+    }
+
+    keyboard = EEK_LAYOUT_GET_CLASS(object)->create_keyboard
+        (EEK_LAYOUT(object), data->initial_width, data->initial_height);
+    if (keyboard == NULL) {
+        g_simple_async_result_set_error (result,
+                                         EEK_ERROR,
+                                         EEK_ERROR_LAYOUT_ERROR,
+                                         "can't create keyboard");
+        return;
+    }
+
+    /* Drop the keyboard if the caller gave up while it was built.
+       Otherwise it replaces the parameters as the result. */
+    if (g_cancellable_set_error_if_cancelled (cancellable, &error)) {
+        g_object_unref (keyboard);
+        g_simple_async_result_set_from_error (result, error);
+        g_error_free (error);
+        return;
+    }
+
+    g_simple_async_result_set_op_res_gpointer (result,
+                                               keyboard,
+                                               g_object_unref);
+}
+
+static void
+eek_layout_real_create_keyboard_async (EekLayout          *self,
+                                       gdouble             initial_width,
+                                       gdouble             initial_height,
+                                       GCancellable       *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer            user_data)
+{
+    GSimpleAsyncResult *result;
+    CreateKeyboardData *data;
+
+    result = g_simple_async_result_new (G_OBJECT(self),
+                                        callback,
+                                        user_data,
+                                        eek_layout_create_keyboard_async);
+
+    data = g_slice_new (CreateKeyboardData);
+    data->initial_width = initial_width;
+    data->initial_height = initial_height;
+    g_simple_async_result_set_op_res_gpointer
+        (result,
+         data,
+         (GDestroyNotify)create_keyboard_data_free);
+
+    g_simple_async_result_run_in_thread (result,
+                                         create_keyboard_thread,
+                                         G_PRIORITY_DEFAULT,
+                                         cancellable);
+    g_object_unref (result);
+}
+
+static EekKeyboard *
+eek_layout_real_create_keyboard_finish (EekLayout    *self,
+                                        GAsyncResult *result,
+                                        GError      **error)
+{
+    GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT(result);
+
+    g_return_val_if_fail (g_simple_async_result_is_valid
+                          (result,
+                           G_OBJECT(self),
+                           eek_layout_create_keyboard_async),
+                          NULL);
+
+    if (g_simple_async_result_propagate_error (simple, error))
+        return NULL;
+
+    return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
 static void
 eek_layout_class_init (EekLayoutClass *klass)
 {
     klass->create_keyboard = NULL;
+    klass->create_keyboard_async = eek_layout_real_create_keyboard_async;
+    klass->create_keyboard_finish = eek_layout_real_create_keyboard_finish;
 }
 
 void
@@ -66,3 +170,60 @@ eek_keyboard_new (EekLayout *layout,
                                                           initial_width,
                                                           initial_height);
 }
+
+/**
+ * eek_layout_create_keyboard_async:
+ * @layout: an #EekLayout
+ * @initial_width: initial width of the keyboard
+ * @initial_height: initial height of the keyboard
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the keyboard is ready
+ * @user_data: user data to pass to @callback
+ *
+ * Asynchronously create a new #EekKeyboard based on @layout.  By
+ * default the keyboard is built in a worker thread, so loading a
+ * layout does not block the main loop.  Call
+ * eek_layout_create_keyboard_finish() from @callback to get the
+ * keyboard.
+ */
+void
+eek_layout_create_keyboard_async (EekLayout          *layout,
+                                  gdouble             initial_width,
+                                  gdouble             initial_height,
+                                  GCancellable       *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer            user_data)
+{
+    g_return_if_fail (EEK_IS_LAYOUT(layout));
+    g_return_if_fail (EEK_LAYOUT_GET_CLASS(layout)->create_keyboard);
+
+    EEK_LAYOUT_GET_CLASS(layout)->create_keyboard_async (layout,
+                                                         initial_width,
+                                                         initial_height,
+                                                         cancellable,
+                                                         callback,
+                                                         user_data);
+}
+
+/**
+ * eek_layout_create_keyboard_finish:
+ * @layout: an #EekLayout
+ * @result: a #GAsyncResult
+ * @error: a #GError
+ *
+ * Finish an operation started with eek_layout_create_keyboard_async().
+ * Returns: (transfer full): a new #EekKeyboard, or %NULL if the
+ * keyboard could not be created or the operation was cancelled
+ */
+EekKeyboard *
+eek_layout_create_keyboard_finish (EekLayout    *layout,
+                                   GAsyncResult *result,
+                                   GError      **error)
+{
+    g_return_val_if_fail (EEK_IS_LAYOUT(layout), NULL);
+    g_return_val_if_fail (G_IS_ASYNC_RESULT(result), NULL);
+
+    return EEK_LAYOUT_GET_CLASS(layout)->create_keyboard_finish (layout,
+                                                                 result,
+                                                                 error);
+}
@@ -25,7 +25,7 @@
 #ifndef EEK_LAYOUT_H
 #define EEK_LAYOUT_H 1
 
-#include <glib-object.h>
+#include <gio/gio.h>
 #include "eek-types.h"
 
 G_BEGIN_DECLS
@@ -49,6 +49,10 @@ struct _EekLayout
 /**
  * EekLayoutClass:
  * @create_keyboard: virtual function for creating a keyboard
+ * @create_keyboard_async: virtual function for creating a keyboard
+ * asynchronously
+ * @create_keyboard_finish: virtual function for finishing
+ * @create_keyboard_async
  */
 struct _EekLayoutClass
 {
@@ -60,12 +64,36 @@ struct _EekLayoutClass
                                       gdouble    initial_width,
                                       gdouble    initial_height);
 
+    void         (* create_keyboard_async)
+                                     (EekLayout          *self,
+                                      gdouble             initial_width,
+                                      gdouble             initial_height,
+                                      GCancellable       *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer            user_data);
+    EekKeyboard* (* create_keyboard_finish)
+                                     (EekLayout          *self,
+                                      GAsyncResult       *result,
+                                      GError            **error);
+
     /*< private >*/
     /* padding */
-    gpointer pdummy[24];
+    gpointer pdummy[22];
 };
 
 GType        eek_layout_get_type  (void) G_GNUC_CONST;
 
+void         eek_layout_create_keyboard_async
+                                  (EekLayout          *layout,
+                                   gdouble             initial_width,
+                                   gdouble             initial_height,
+                                   GCancellable       *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer            user_data);
+EekKeyboard *eek_layout_create_keyboard_finish
+                                  (EekLayout          *layout,
+                                   GAsyncResult       *result,
+                                   GError            **error);
+
 G_END_DECLS
 #endif  /* EEK_LAYOUT_H */
@@ -132,6 +132,7 @@ create_keyboard_surface_section_callback (EekElement *element,
     EekRendererPrivate *priv = EEK_RENDERER_GET_PRIVATE(data->renderer);
     EekBounds bounds;
     gint angle;
+    guint i, n_children;
 
     cairo_save (data->cr);
 
@@ -140,10 +141,11 @@ create_keyboard_surface_section_callback (EekElement *element,
 
     angle = eek_section_get_angle (EEK_SECTION(element));
     cairo_rotate (data->cr, angle * G_PI / 180);
-    
-    eek_container_foreach_child (EEK_CONTAINER(element),
-                                 create_keyboard_surface_key_callback,
-                                 data);
+
+    n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+    for (i = 0; i < n_children; i++)
+        create_keyboard_surface_key_callback
+            (eek_container_get_child (EEK_CONTAINER(element), i), data);
 
     cairo_restore (data->cr);
 }
@@ -156,6 +158,7 @@ create_keyboard_surface (EekRenderer *renderer)
     cairo_surface_t *keyboard_surface;
     CreateKeyboardSurfaceCallbackData data;
     EekColor foreground, background;
+    guint i, n_children;
 
     eek_renderer_get_foreground_color (renderer,
                                        EEK_ELEMENT(priv->keyboard),
@@ -188,9 +191,11 @@ create_keyboard_surface (EekRenderer *renderer)
                            foreground.alpha);
 
     /* draw sections */
-    eek_container_foreach_child (EEK_CONTAINER(priv->keyboard),
-                                 create_keyboard_surface_section_callback,
-                                 &data);
+    n_children = eek_container_get_n_children (EEK_CONTAINER(priv->keyboard));
+    for (i = 0; i < n_children; i++)
+        create_keyboard_surface_section_callback
+            (eek_container_get_child (EEK_CONTAINER(priv->keyboard), i),
+             &data);
     cairo_destroy (data.cr);
 
     return keyboard_surface;
@@ -405,9 +410,12 @@ calculate_font_size_key_callback (EekElement *element, gpointer user_data)
 static void
 calculate_font_size_section_callback (EekElement *element, gpointer user_data)
 {
-    eek_container_foreach_child (EEK_CONTAINER(element),
-                                 calculate_font_size_key_callback,
-                                 user_data);
+    guint i, n_children;
+
+    n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+    for (i = 0; i < n_children; i++)
+        calculate_font_size_key_callback
+            (eek_container_get_child (EEK_CONTAINER(element), i), user_data);
 }
 
 static gdouble
@@ -417,14 +425,17 @@ calculate_font_size (EekRenderer                *renderer,
 {
     EekRendererPrivate *priv = EEK_RENDERER_GET_PRIVATE(renderer);
     CalculateFontSizeCallbackData data;
+    guint i, n_children;
 
     data.size = G_MAXDOUBLE;
     data.ascii = ascii;
     data.renderer = renderer;
     data.base_font = base_font;
-    eek_container_foreach_child (EEK_CONTAINER(priv->keyboard),
-                                 calculate_font_size_section_callback,
-                                 &data);
+    n_children = eek_container_get_n_children (EEK_CONTAINER(priv->keyboard));
+    for (i = 0; i < n_children; i++)
+        calculate_font_size_section_callback
+            (eek_container_get_child (EEK_CONTAINER(priv->keyboard), i),
+             &data);
     return data.size;
 }
 
@@ -953,61 +964,20 @@ eek_renderer_get_key_bounds (EekRenderer *renderer,
                              EekBounds   *bounds,
                              gboolean     rotate)
 {
-    EekElement *section;
-    EekBounds section_bounds, keyboard_bounds;
-    gint angle = 0;
-    EekPoint points[4], min, max;
-    gint i;
+    gdouble x, y;
 
     g_return_if_fail (EEK_IS_RENDERER(renderer));
     g_return_if_fail (EEK_IS_KEY(key));
     g_return_if_fail (bounds != NULL);
 
-    section = eek_element_get_parent (EEK_ELEMENT(key));
-
-    eek_element_get_bounds (EEK_ELEMENT(key), bounds);
-    eek_element_get_bounds (section, &section_bounds);
-    eek_element_get_bounds (EEK_ELEMENT(renderer->priv->keyboard),
-                            &keyboard_bounds);
-
-    if (!rotate) {
-        bounds->x += keyboard_bounds.x + section_bounds.x;
-        bounds->y += keyboard_bounds.y + section_bounds.y;
-        bounds->x *= renderer->priv->scale;
-        bounds->y *= renderer->priv->scale;
-        bounds->width *= renderer->priv->scale;
-        bounds->height *= renderer->priv->scale;
-        return;
-    }
-    points[0].x = bounds->x;
-    points[0].y = bounds->y;
-    points[1].x = points[0].x + bounds->width;
-    points[1].y = points[0].y;
-    points[2].x = points[1].x;
-    points[2].y = points[1].y + bounds->height;
-    points[3].x = points[0].x;
-    points[3].y = points[2].y;
-
     if (rotate)
-        angle = eek_section_get_angle (EEK_SECTION(section));
-
-    min = points[2];
-    max = points[0];
-    for (i = 0; i < G_N_ELEMENTS(points); i++) {
-        eek_point_rotate (&points[i], angle);
-        if (points[i].x < min.x)
-            min.x = points[i].x;
-        if (points[i].x > max.x)
-            max.x = points[i].x;
-        if (points[i].y < min.y)
-            min.y = points[i].y;
-        if (points[i].y > max.y)
-            max.y = points[i].y;
+        eek_element_get_absolute_bounds (EEK_ELEMENT(key), bounds);
+    else {
+        eek_element_get_bounds (EEK_ELEMENT(key), bounds);
+        eek_element_get_absolute_position (EEK_ELEMENT(key), &x, &y);
+        bounds->x = x;
+        bounds->y = y;
     }
-    bounds->x = keyboard_bounds.x + section_bounds.x + min.x;
-    bounds->y = keyboard_bounds.y + section_bounds.y + min.y;
-    bounds->width = (max.x - min.x);
-    bounds->height = (max.y - min.y);
     bounds->x *= renderer->priv->scale;
     bounds->y *= renderer->priv->scale;
     bounds->width *= renderer->priv->scale;
@@ -1247,6 +1217,7 @@ find_key_by_position_section_callback (EekElement *element,
     FindKeyByPositionCallbackData *data = user_data;
     EekBounds bounds;
     EekPoint origin;
+    guint i, n_children;
 
     origin = data->origin;
     eek_element_get_bounds (element, &bounds);
@@ -1254,9 +1225,11 @@ find_key_by_position_section_callback (EekElement *element,
     data->origin.y += bounds.y;
     data->angle = eek_section_get_angle (EEK_SECTION(element));
 
-    eek_container_find (EEK_CONTAINER(element),
-                        find_key_by_position_key_callback,
-                        data);
+    n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+    for (i = 0; i < n_children; i++)
+        if (find_key_by_position_key_callback
+            (eek_container_get_child (EEK_CONTAINER(element), i), data) == 0)
+            break;
     data->origin = origin;
     return data->key ? 0 : -1;
 }
@@ -1268,6 +1241,7 @@ eek_renderer_find_key_by_position (EekRenderer *renderer,
 {
     EekBounds bounds;
     FindKeyByPositionCallbackData data;
+    guint i, n_children;
 
     g_return_val_if_fail (EEK_IS_RENDERER(renderer), NULL);
 
@@ -1286,9 +1260,14 @@ eek_renderer_find_key_by_position (EekRenderer *renderer,
     data.key = NULL;
     data.renderer = renderer;
 
-    eek_container_find (EEK_CONTAINER(renderer->priv->keyboard),
-                        find_key_by_position_section_callback,
-                        &data);
+    n_children =
+        eek_container_get_n_children (EEK_CONTAINER(renderer->priv->keyboard));
+    for (i = 0; i < n_children; i++)
+        if (find_key_by_position_section_callback
+            (eek_container_get_child (EEK_CONTAINER(renderer->priv->keyboard),
+                                      i),
+             &data) == 0)
+            break;
     return data.key;
 }
 
@@ -1339,6 +1318,7 @@ create_theme_node_section_callback (EekElement *element,
 {
     CreateThemeNodeData *data = user_data;
     EekThemeNode *theme_node, *parent;
+    guint i, n_children;
 
     theme_node = eek_theme_node_new (data->context,
                                      data->parent,
@@ -1355,9 +1335,10 @@ create_theme_node_section_callback (EekElement *element,
 
     parent = data->parent;
     data->parent = theme_node;
-    eek_container_foreach_child (EEK_CONTAINER(element),
-                                 create_theme_node_key_callback,
-                                 data);
+    n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+    for (i = 0; i < n_children; i++)
+        create_theme_node_key_callback
+            (eek_container_get_child (EEK_CONTAINER(element), i), data);
     data->parent = parent;
 }
 
@@ -1368,6 +1349,7 @@ eek_renderer_set_theme (EekRenderer *renderer,
     EekThemeContext *theme_context;
     EekThemeNode *theme_node;
     CreateThemeNodeData data;
+    guint i, n_children;
 
     g_return_if_fail (EEK_IS_RENDERER(renderer));
     g_return_if_fail (EEK_IS_THEME(theme));
@@ -1394,7 +1376,11 @@ eek_renderer_set_theme (EekRenderer *renderer,
     data.context = theme_context;
     data.parent = theme_node;
     data.renderer = renderer;
-    eek_container_foreach_child (EEK_CONTAINER(renderer->priv->keyboard),
-                                 create_theme_node_section_callback,
-                                 &data);
+    n_children =
+        eek_container_get_n_children (EEK_CONTAINER(renderer->priv->keyboard));
+    for (i = 0; i < n_children; i++)
+        create_theme_node_section_callback
+            (eek_container_get_child (EEK_CONTAINER(renderer->priv->keyboard),
+                                      i),
+             &data);
 }
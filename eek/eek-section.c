@@ -35,6 +35,7 @@
 
 #include "eek-keyboard.h"
 #include "eek-section.h"
+#include "eek-element-private.h"
 #include "eek-key.h"
 #include "eek-symbol.h"
 
@@ -70,8 +71,7 @@ typedef struct _EekRow EekRow;
 
 struct _EekSectionPrivate
 {
-    gint angle;
-    GSList *rows;
+    GArray *rows;
     EekModifierType modifiers;
 };
 
@@ -80,7 +80,7 @@ eek_section_real_get_n_rows (EekSection *self)
 {
     EekSectionPrivate *priv = EEK_SECTION_GET_PRIVATE(self);
 
-    return g_slist_length (priv->rows);
+    return priv->rows->len;
 }
 
 static void
@@ -89,12 +89,11 @@ eek_section_real_add_row (EekSection    *self,
                           EekOrientation orientation)
 {
     EekSectionPrivate *priv = EEK_SECTION_GET_PRIVATE(self);
-    EekRow *row;
+    EekRow row;
 
-    row = g_slice_new (EekRow);
-    row->num_columns = num_columns;
-    row->orientation = orientation;
-    priv->rows = g_slist_append (priv->rows, row);
+    row.num_columns = num_columns;
+    row.orientation = orientation;
+    g_array_append_val (priv->rows, row);
 }
 
 static void
@@ -106,8 +105,8 @@ eek_section_real_get_row (EekSection     *self,
     EekSectionPrivate *priv = EEK_SECTION_GET_PRIVATE(self);
     EekRow *row;
 
-    row = g_slist_nth_data (priv->rows, index);
-    g_return_if_fail (row);
+    g_return_if_fail (0 <= index && index < priv->rows->len);
+    row = &g_array_index (priv->rows, EekRow, index);
     if (num_columns)
         *num_columns = row->num_columns;
     if (orientation)
@@ -162,7 +161,7 @@ eek_section_real_create_key (EekSection *self,
     num_rows = eek_section_get_n_rows (self);
     g_return_val_if_fail (0 <= row_index && row_index < num_rows, NULL);
 
-    row = g_slist_nth_data (self->priv->rows, row_index);
+    row = &g_array_index (self->priv->rows, EekRow, row_index);
     if (row->num_columns < column_index + 1)
         row->num_columns = column_index + 1;
 
@@ -250,11 +249,8 @@ static void
 eek_section_finalize (GObject *object)
 {
     EekSectionPrivate *priv = EEK_SECTION_GET_PRIVATE(object);
-    GSList *head;
 
-    for (head = priv->rows; head; head = g_slist_next (head))
-        g_slice_free (EekRow, head->data);
-    g_slist_free (priv->rows);
+    g_array_free (priv->rows, TRUE);
 
     G_OBJECT_CLASS (eek_section_parent_class)->finalize (object);
 }
@@ -458,6 +454,7 @@ static void
 eek_section_init (EekSection *self)
 {
     self->priv = EEK_SECTION_GET_PRIVATE (self);
+    self->priv->rows = g_array_new (FALSE, FALSE, sizeof (EekRow));
 }
 
 /**
@@ -472,8 +469,8 @@ eek_section_set_angle (EekSection  *section,
                        gint         angle)
 {
     g_return_if_fail (EEK_IS_SECTION(section));
-    if (section->priv->angle != angle) {
-        section->priv->angle = angle;
+    if (_eek_element_get_angle (EEK_ELEMENT(section)) != angle) {
+        _eek_element_set_angle (EEK_ELEMENT(section), angle);
         g_object_notify (G_OBJECT(section), "angle");
     }
 }
@@ -488,7 +485,7 @@ gint
 eek_section_get_angle (EekSection *section)
 {
     g_return_val_if_fail (EEK_IS_SECTION(section), -1);
-    return section->priv->angle;
+    return _eek_element_get_angle (EEK_ELEMENT(section));
 }
 
 /**
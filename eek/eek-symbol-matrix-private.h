@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef EEK_SYMBOL_MATRIX_PRIVATE_H
+#define EEK_SYMBOL_MATRIX_PRIVATE_H 1
+
+#include "eek-symbol-matrix.h"
+
+G_BEGIN_DECLS
+
+/* Whether the caller holds the only reference to MATRIX. */
+gboolean _eek_symbol_matrix_is_unique (const EekSymbolMatrix *matrix);
+
+G_END_DECLS
+
+#endif  /* EEK_SYMBOL_MATRIX_PRIVATE_H */
@@ -17,14 +17,30 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
  * 02110-1301 USA
  */
+#include <string.h>
+
 #include "eek-symbol-matrix.h"
+#include "eek-symbol-matrix-private.h"
+
+/* Matrices are reference counted so that keys can share one
+   immutable instance; the count is kept next to the public
+   structure. */
+struct _EekSymbolMatrixReal {
+    EekSymbolMatrix matrix;
+    volatile gint ref_count;
+};
+typedef struct _EekSymbolMatrixReal EekSymbolMatrixReal;
+
+#define EEK_SYMBOL_MATRIX_REAL(matrix) ((EekSymbolMatrixReal *)(matrix))
 
 EekSymbolMatrix *
 eek_symbol_matrix_new (gint num_groups,
                        gint num_levels)
 {
-    EekSymbolMatrix *matrix = g_slice_new (EekSymbolMatrix);
+    EekSymbolMatrixReal *real = g_slice_new (EekSymbolMatrixReal);
+    EekSymbolMatrix *matrix = &real->matrix;
 
+    real->ref_count = 1;
     matrix->num_groups = num_groups;
     matrix->num_levels = num_levels;
     matrix->data = g_slice_alloc0 (sizeof (EekSymbol *) *
@@ -38,24 +54,101 @@ eek_symbol_matrix_copy (const EekSymbolMatrix *matrix)
     EekSymbolMatrix *retval;
     gint i, num_symbols = matrix->num_groups * matrix->num_levels;
 
-    retval = g_slice_dup (EekSymbolMatrix, matrix);
-    retval->data = g_slice_copy (sizeof (EekSymbol *) * num_symbols,
-                                 matrix->data);
+    retval = eek_symbol_matrix_new (matrix->num_groups, matrix->num_levels);
+    memcpy (retval->data, matrix->data, sizeof (EekSymbol *) * num_symbols);
     for (i = 0; i < num_symbols; i++)
         if (retval->data[i])
             g_object_ref (retval->data[i]);
     return retval;
 }
 
+/**
+ * eek_symbol_matrix_ref:
+ * @matrix: an #EekSymbolMatrix
+ *
+ * Increase the reference count of @matrix.  A matrix which is
+ * shared this way must not be modified.
+ *
+ * Returns: (transfer full): @matrix
+ */
+EekSymbolMatrix *
+eek_symbol_matrix_ref (EekSymbolMatrix *matrix)
+{
+    g_return_val_if_fail (matrix != NULL, NULL);
+    g_atomic_int_inc (&EEK_SYMBOL_MATRIX_REAL(matrix)->ref_count);
+    return matrix;
+}
+
+/**
+ * eek_symbol_matrix_free:
+ * @matrix: an #EekSymbolMatrix
+ *
+ * Decrease the reference count of @matrix and free it, along with
+ * the references to its symbols, when the count drops to zero.
+ */
 void
 eek_symbol_matrix_free (EekSymbolMatrix *matrix)
 {
-    gint i, num_symbols = matrix->num_groups * matrix->num_levels;
+    gint i, num_symbols;
+
+    if (!g_atomic_int_dec_and_test (&EEK_SYMBOL_MATRIX_REAL(matrix)->ref_count))
+        return;
+
+    num_symbols = matrix->num_groups * matrix->num_levels;
     for (i = 0; i < num_symbols; i++)
         if (matrix->data[i])
             g_object_unref (matrix->data[i]);
     g_slice_free1 (sizeof (EekSymbol *) * num_symbols, matrix->data);
-    g_slice_free (EekSymbolMatrix, matrix);
+    g_slice_free (EekSymbolMatrixReal, EEK_SYMBOL_MATRIX_REAL(matrix));
+}
+
+gboolean
+_eek_symbol_matrix_is_unique (const EekSymbolMatrix *matrix)
+{
+    return g_atomic_int_get (&EEK_SYMBOL_MATRIX_REAL(matrix)->ref_count) == 1;
+}
+
+/**
+ * eek_symbol_matrix_equal:
+ * @matrix1: an #EekSymbolMatrix
+ * @matrix2: an #EekSymbolMatrix
+ *
+ * Check whether @matrix1 and @matrix2 have the same dimensions and
+ * hold the same symbol instances in every cell.
+ */
+gboolean
+eek_symbol_matrix_equal (const EekSymbolMatrix *matrix1,
+                         const EekSymbolMatrix *matrix2)
+{
+    gint num_symbols;
+
+    if (matrix1->num_groups != matrix2->num_groups ||
+        matrix1->num_levels != matrix2->num_levels)
+        return FALSE;
+
+    num_symbols = matrix1->num_groups * matrix1->num_levels;
+    return memcmp (matrix1->data,
+                   matrix2->data,
+                   sizeof (EekSymbol *) * num_symbols) == 0;
+}
+
+/**
+ * eek_symbol_matrix_hash:
+ * @matrix: an #EekSymbolMatrix
+ *
+ * Compute a hash value of @matrix consistent with
+ * eek_symbol_matrix_equal().
+ */
+guint
+eek_symbol_matrix_hash (const EekSymbolMatrix *matrix)
+{
+    gint i, num_symbols = matrix->num_groups * matrix->num_levels;
+    guint hash;
+
+    hash = matrix->num_groups * 31 + matrix->num_levels;
+    for (i = 0; i < num_symbols; i++)
+        hash = hash * 31 + GPOINTER_TO_UINT(matrix->data[i]);
+    return hash;
 }
 
 GType
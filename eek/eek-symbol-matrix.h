@@ -45,8 +45,13 @@ GType            eek_symbol_matrix_get_type (void) G_GNUC_CONST;
 EekSymbolMatrix *eek_symbol_matrix_new      (gint                   num_groups,
                                              gint                   num_levels);
 EekSymbolMatrix *eek_symbol_matrix_copy     (const EekSymbolMatrix *matrix);
+EekSymbolMatrix *eek_symbol_matrix_ref      (EekSymbolMatrix       *matrix);
 void             eek_symbol_matrix_free     (EekSymbolMatrix       *matrix);
 
+gboolean         eek_symbol_matrix_equal    (const EekSymbolMatrix *matrix1,
+                                             const EekSymbolMatrix *matrix2);
+guint            eek_symbol_matrix_hash     (const EekSymbolMatrix *matrix);
+
 void             eek_symbol_matrix_set_symbol
                                             (EekSymbolMatrix       *matrix,
                                              gint                   group,
@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* Process-wide pool of interned symbols.  Layouts assign the same
+   few hundred symbols ("a", "Shift_L", "BackSpace", ...) to keys over
+   and over; the pool lets every key of every keyboard share one
+   instance per distinct symbol.  Symbol matrices made of pooled
+   symbols are interned the same way, so keys with identical symbols
+   share a single matrix.  The pool holds a reference to everything
+   it returns; entries which nothing else refers to any more are
+   dropped whenever the pool has doubled in size since the last
+   sweep, so it stays within twice the number of symbols and matrices
+   in use. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <string.h>
+
+#include "eek-symbol-pool.h"
+#include "eek-symbol-matrix-private.h"
+#include "eek-keysym.h"
+#include "eek-keysym-private.h"
+#include "eek-text.h"
+
+G_LOCK_DEFINE_STATIC (pool);
+static GHashTable *pool = NULL;
+static GHashTable *pool_keys = NULL;
+static GHashTable *matrix_pool = NULL;
+
+#define MIN_SWEEP_SIZE 256
+static guint sweep_size = MIN_SWEEP_SIZE;
+
+static guint
+str_hash0 (const gchar *str)
+{
+    return str != NULL ? g_str_hash (str) : 0;
+}
+
+static guint
+symbol_key_hash (gconstpointer v)
+{
+    const EekSymbolPoolKey *key = v;
+    guint hash;
+
+    hash = key->kind;
+    hash = hash * 31 + key->xkeysym;
+    hash = hash * 31 + str_hash0 (key->text);
+    hash = hash * 31 + str_hash0 (key->label);
+    hash = hash * 31 + str_hash0 (key->icon_name);
+    hash = hash * 31 + str_hash0 (key->tooltip);
+    hash = hash * 31 + key->category;
+    hash = hash * 31 + key->modifier_mask;
+    return hash;
+}
+
+static gboolean
+symbol_key_equal (gconstpointer v1, gconstpointer v2)
+{
+    const EekSymbolPoolKey *key1 = v1, *key2 = v2;
+
+    return key1->kind == key2->kind &&
+        key1->xkeysym == key2->xkeysym &&
+        key1->category == key2->category &&
+        key1->modifier_mask == key2->modifier_mask &&
+        g_strcmp0 (key1->text, key2->text) == 0 &&
+        g_strcmp0 (key1->label, key2->label) == 0 &&
+        g_strcmp0 (key1->icon_name, key2->icon_name) == 0 &&
+        g_strcmp0 (key1->tooltip, key2->tooltip) == 0;
+}
+
+static EekSymbolPoolKey *
+symbol_key_copy (const EekSymbolPoolKey *key)
+{
+    EekSymbolPoolKey *copy = g_slice_dup (EekSymbolPoolKey, key);
+
+    copy->text = g_strdup (key->text);
+    copy->label = g_strdup (key->label);
+    copy->icon_name = g_strdup (key->icon_name);
+    copy->tooltip = g_strdup (key->tooltip);
+    return copy;
+}
+
+static void
+symbol_key_free (EekSymbolPoolKey *key)
+{
+    g_free (key->text);
+    g_free (key->label);
+    g_free (key->icon_name);
+    g_free (key->tooltip);
+    g_slice_free (EekSymbolPoolKey, key);
+}
+
+static EekSymbol *
+create_symbol (const EekSymbolPoolKey *key)
+{
+    EekSymbol *symbol;
+
+    switch (key->kind) {
+    case EEK_SYMBOL_POOL_KEYSYM:
+        symbol = EEK_SYMBOL(eek_keysym_new (key->xkeysym));
+        break;
+    case EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER:
+        symbol = EEK_SYMBOL(eek_keysym_new_with_modifier (key->xkeysym,
+                                                          key->modifier_mask));
+        break;
+    case EEK_SYMBOL_POOL_KEYSYM_FROM_NAME:
+        symbol = EEK_SYMBOL(eek_keysym_new_from_name (key->text));
+        break;
+    case EEK_SYMBOL_POOL_TEXT:
+        symbol = EEK_SYMBOL(eek_text_new (key->text));
+        break;
+    case EEK_SYMBOL_POOL_SYMBOL:
+        symbol = eek_symbol_new (key->text);
+        eek_symbol_set_category (symbol, key->category);
+        break;
+    default:
+        g_return_val_if_reached (NULL);
+    }
+
+    /* keysyms from eek_keysym_new() are shared, so customize a copy */
+    if ((key->label || key->icon_name || key->tooltip) &&
+        EEK_IS_KEYSYM(symbol) &&
+        _eek_keysym_is_interned (EEK_KEYSYM(symbol))) {
+        EekSymbol *copy = EEK_SYMBOL(_eek_keysym_copy (EEK_KEYSYM(symbol)));
+        g_object_unref (symbol);
+        symbol = copy;
+    }
+
+    if (key->label)
+        eek_symbol_set_label (symbol, key->label);
+    if (key->icon_name)
+        eek_symbol_set_icon_name (symbol, key->icon_name);
+    if (key->tooltip)
+        eek_symbol_set_tooltip (symbol, key->tooltip);
+
+    return symbol;
+}
+
+static guint
+pool_size (void)
+{
+    return (pool ? g_hash_table_size (pool) : 0) +
+        (matrix_pool ? g_hash_table_size (matrix_pool) : 0);
+}
+
+/* Only the pool hands out new references to matrices, so one whose
+   single reference is the pool's one can't be revived while the lock
+   is held. */
+static gboolean
+matrix_is_unused (gpointer key, gpointer value, gpointer user_data)
+{
+    return _eek_symbol_matrix_is_unique (key);
+}
+
+/* Shared keysyms are also handed out by eek_keysym_new() and friends,
+   which may take a reference to one right after it is found unused
+   here; that is harmless, since the keysym table keeps it alive and
+   the pool only forgets it. */
+static gboolean
+symbol_is_unused (gpointer key, gpointer value, gpointer user_data)
+{
+    guint ref_count = 1;
+
+    /* the keysym table holds another reference to shared keysyms */
+    if (EEK_IS_KEYSYM(value) && _eek_keysym_is_interned (value))
+        ref_count++;
+    if (g_atomic_int_get ((volatile gint *)&G_OBJECT(value)->ref_count) !=
+        ref_count)
+        return FALSE;
+    g_hash_table_remove (pool_keys, value);
+    return TRUE;
+}
+
+/* Called with the lock held. */
+static void
+maybe_sweep (void)
+{
+    if (pool_size () < sweep_size)
+        return;
+
+    /* matrices first, since they hold references to symbols */
+    if (matrix_pool)
+        g_hash_table_foreach_remove (matrix_pool, matrix_is_unused, NULL);
+    if (pool)
+        g_hash_table_foreach_remove (pool, symbol_is_unused, NULL);
+    sweep_size = MAX(2 * pool_size (), MIN_SWEEP_SIZE);
+}
+
+/* Describe every keysym by its X keysym value and modifier mask, and
+   clear the fields the kind of KEY doesn't use, so that the keys
+   which build the same symbol are equal.  Each pooled symbol then
+   has a single entry and a single key. */
+static void
+canonicalize_key (EekSymbolPoolKey *key)
+{
+    guint xkeysym;
+
+    switch (key->kind) {
+    case EEK_SYMBOL_POOL_KEYSYM:
+        key->kind = EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER;
+        key->modifier_mask =
+            _eek_keysym_get_default_modifier_mask (key->xkeysym);
+        break;
+    case EEK_SYMBOL_POOL_KEYSYM_FROM_NAME:
+        if (key->text && _eek_keysym_lookup_xkeysym (key->text, &xkeysym)) {
+            key->kind = EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER;
+            key->xkeysym = xkeysym;
+            key->modifier_mask =
+                _eek_keysym_get_default_modifier_mask (xkeysym);
+        } else {
+            key->xkeysym = 0;
+            key->modifier_mask = 0;
+        }
+        break;
+    case EEK_SYMBOL_POOL_TEXT:
+    case EEK_SYMBOL_POOL_SYMBOL:
+        key->xkeysym = 0;
+        key->modifier_mask = 0;
+        break;
+    default:
+        break;
+    }
+
+    if (key->kind == EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER)
+        key->text = NULL;
+    if (key->kind != EEK_SYMBOL_POOL_SYMBOL)
+        key->category = 0;
+}
+
+static EekSymbol *
+lookup_symbol (const EekSymbolPoolKey *key)
+{
+    EekSymbolPoolKey canonical = *key;
+    EekSymbol *symbol;
+
+    canonicalize_key (&canonical);
+    key = &canonical;
+
+    G_LOCK (pool);
+    if (pool == NULL) {
+        pool = g_hash_table_new_full (symbol_key_hash,
+                                      symbol_key_equal,
+                                      (GDestroyNotify)symbol_key_free,
+                                      (GDestroyNotify)g_object_unref);
+        pool_keys = g_hash_table_new (g_direct_hash, g_direct_equal);
+    }
+
+    symbol = g_hash_table_lookup (pool, key);
+    if (symbol == NULL) {
+        maybe_sweep ();
+        symbol = create_symbol (key);
+        if (symbol != NULL) {
+            EekSymbolPoolKey *copy = symbol_key_copy (key);
+
+            g_hash_table_insert (pool, copy, symbol);
+            g_hash_table_insert (pool_keys, symbol, copy);
+        }
+    }
+    if (symbol != NULL)
+        g_object_ref (symbol);
+    G_UNLOCK (pool);
+
+    return symbol;
+}
+
+/**
+ * eek_symbol_pool_lookup:
+ * @key: an #EekSymbolPoolKey
+ *
+ * Get a shared #EekSymbol built as described by @key.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_lookup (const EekSymbolPoolKey *key)
+{
+    g_return_val_if_fail (key != NULL, NULL);
+    return lookup_symbol (key);
+}
+
+/**
+ * eek_symbol_pool_get_key:
+ * @symbol: an #EekSymbol
+ *
+ * Get the description from which @symbol was built, if @symbol was
+ * obtained from the pool.  Keysyms are described by their X keysym
+ * value and modifier mask, whichever function returned them.  The
+ * returned key is owned by the pool and
+ * stays valid as long as the caller holds a reference to @symbol.
+ * Returns: an #EekSymbolPoolKey or %NULL
+ */
+const EekSymbolPoolKey *
+eek_symbol_pool_get_key (EekSymbol *symbol)
+{
+    const EekSymbolPoolKey *key = NULL;
+
+    g_return_val_if_fail (EEK_IS_SYMBOL(symbol), NULL);
+
+    G_LOCK (pool);
+    if (pool_keys != NULL)
+        key = g_hash_table_lookup (pool_keys, symbol);
+    G_UNLOCK (pool);
+
+    return key;
+}
+
+/**
+ * eek_symbol_pool_get_keysym:
+ * @xkeysym: an X keysym value
+ * @label: (allow-none): label overriding the default one
+ * @icon_name: (allow-none): icon name
+ * @tooltip: (allow-none): tooltip
+ *
+ * Get a shared #EekKeysym for @xkeysym, with the modifier mask
+ * derived from @xkeysym as eek_keysym_new() does.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_get_keysym (guint        xkeysym,
+                            const gchar *label,
+                            const gchar *icon_name,
+                            const gchar *tooltip)
+{
+    EekSymbolPoolKey key;
+
+    memset (&key, 0, sizeof key);
+    key.kind = EEK_SYMBOL_POOL_KEYSYM;
+    key.xkeysym = xkeysym;
+    key.label = (gchar *)label;
+    key.icon_name = (gchar *)icon_name;
+    key.tooltip = (gchar *)tooltip;
+    return lookup_symbol (&key);
+}
+
+/**
+ * eek_symbol_pool_get_keysym_with_modifier:
+ * @xkeysym: an X keysym value
+ * @modifier_mask: modifier assigned to @xkeysym
+ * @label: (allow-none): label overriding the default one
+ * @icon_name: (allow-none): icon name
+ * @tooltip: (allow-none): tooltip
+ *
+ * Get a shared #EekKeysym for @xkeysym and @modifier_mask.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_get_keysym_with_modifier (guint           xkeysym,
+                                          EekModifierType modifier_mask,
+                                          const gchar    *label,
+                                          const gchar    *icon_name,
+                                          const gchar    *tooltip)
+{
+    EekSymbolPoolKey key;
+
+    memset (&key, 0, sizeof key);
+    key.kind = EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER;
+    key.xkeysym = xkeysym;
+    key.modifier_mask = modifier_mask;
+    key.label = (gchar *)label;
+    key.icon_name = (gchar *)icon_name;
+    key.tooltip = (gchar *)tooltip;
+    return lookup_symbol (&key);
+}
+
+/**
+ * eek_symbol_pool_get_keysym_from_name:
+ * @name: an X keysym name
+ * @label: (allow-none): label overriding the default one
+ * @icon_name: (allow-none): icon name
+ * @tooltip: (allow-none): tooltip
+ *
+ * Get a shared #EekKeysym looked up by @name, as
+ * eek_keysym_new_from_name() does.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_get_keysym_from_name (const gchar *name,
+                                      const gchar *label,
+                                      const gchar *icon_name,
+                                      const gchar *tooltip)
+{
+    EekSymbolPoolKey key;
+
+    memset (&key, 0, sizeof key);
+    key.kind = EEK_SYMBOL_POOL_KEYSYM_FROM_NAME;
+    key.text = (gchar *)name;
+    key.label = (gchar *)label;
+    key.icon_name = (gchar *)icon_name;
+    key.tooltip = (gchar *)tooltip;
+    return lookup_symbol (&key);
+}
+
+/**
+ * eek_symbol_pool_get_text:
+ * @text: a text
+ * @label: (allow-none): label overriding the default one
+ * @icon_name: (allow-none): icon name
+ * @tooltip: (allow-none): tooltip
+ *
+ * Get a shared #EekText for @text.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_get_text (const gchar *text,
+                          const gchar *label,
+                          const gchar *icon_name,
+                          const gchar *tooltip)
+{
+    EekSymbolPoolKey key;
+
+    memset (&key, 0, sizeof key);
+    key.kind = EEK_SYMBOL_POOL_TEXT;
+    key.text = (gchar *)text;
+    key.label = (gchar *)label;
+    key.icon_name = (gchar *)icon_name;
+    key.tooltip = (gchar *)tooltip;
+    return lookup_symbol (&key);
+}
+
+/**
+ * eek_symbol_pool_get_symbol:
+ * @name: name of the symbol
+ * @category: an #EekSymbolCategory
+ * @label: (allow-none): label
+ * @icon_name: (allow-none): icon name
+ * @tooltip: (allow-none): tooltip
+ *
+ * Get a shared #EekSymbol named @name.
+ * Returns: (transfer full): an #EekSymbol
+ */
+EekSymbol *
+eek_symbol_pool_get_symbol (const gchar      *name,
+                            EekSymbolCategory category,
+                            const gchar      *label,
+                            const gchar      *icon_name,
+                            const gchar      *tooltip)
+{
+    EekSymbolPoolKey key;
+
+    memset (&key, 0, sizeof key);
+    key.kind = EEK_SYMBOL_POOL_SYMBOL;
+    key.text = (gchar *)name;
+    key.category = category;
+    key.label = (gchar *)label;
+    key.icon_name = (gchar *)icon_name;
+    key.tooltip = (gchar *)tooltip;
+    return lookup_symbol (&key);
+}
+
+/**
+ * eek_symbol_pool_get_matrix:
+ * @matrix: (transfer full): an #EekSymbolMatrix holding pooled symbols
+ *
+ * Get a shared #EekSymbolMatrix equal to @matrix.  This consumes the
+ * caller's reference to @matrix, which may be returned as is if no
+ * equal matrix is in the pool yet.
+ * Returns: (transfer full): an #EekSymbolMatrix
+ */
+EekSymbolMatrix *
+eek_symbol_pool_get_matrix (EekSymbolMatrix *matrix)
+{
+    EekSymbolMatrix *retval;
+
+    g_return_val_if_fail (matrix != NULL, NULL);
+
+    G_LOCK (pool);
+    if (matrix_pool == NULL)
+        matrix_pool =
+            g_hash_table_new_full ((GHashFunc)eek_symbol_matrix_hash,
+                                   (GEqualFunc)eek_symbol_matrix_equal,
+                                   (GDestroyNotify)eek_symbol_matrix_free,
+                                   NULL);
+
+    retval = g_hash_table_lookup (matrix_pool, matrix);
+    if (retval == NULL) {
+        maybe_sweep ();
+        retval = matrix;
+        g_hash_table_insert (matrix_pool, eek_symbol_matrix_ref (retval),
+                             retval);
+    } else {
+        eek_symbol_matrix_ref (retval);
+        eek_symbol_matrix_free (matrix);
+    }
+    G_UNLOCK (pool);
+
+    return retval;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef EEK_SYMBOL_POOL_H
+#define EEK_SYMBOL_POOL_H 1
+
+#include "eek-symbol.h"
+#include "eek-symbol-matrix.h"
+
+G_BEGIN_DECLS
+
+/* How the symbol is built; this stands for the symbol type plus the
+   way its modifier mask is obtained. */
+enum _EekSymbolPoolKind {
+    EEK_SYMBOL_POOL_KEYSYM,
+    EEK_SYMBOL_POOL_KEYSYM_WITH_MODIFIER,
+    EEK_SYMBOL_POOL_KEYSYM_FROM_NAME,
+    EEK_SYMBOL_POOL_TEXT,
+    EEK_SYMBOL_POOL_SYMBOL
+};
+typedef enum _EekSymbolPoolKind EekSymbolPoolKind;
+
+struct _EekSymbolPoolKey {
+    EekSymbolPoolKind kind;
+    guint xkeysym;
+    gchar *text;
+    gchar *label;
+    gchar *icon_name;
+    gchar *tooltip;
+    EekSymbolCategory category;
+    EekModifierType modifier_mask;
+};
+typedef struct _EekSymbolPoolKey EekSymbolPoolKey;
+
+/* Symbols returned from the pool are shared among keys and keyboards
+   and must be treated as immutable.  Each function returns a new
+   reference, which the caller must release with g_object_unref() or
+   eek_symbol_matrix_free(). */
+
+EekSymbol *eek_symbol_pool_lookup
+                                 (const EekSymbolPoolKey *key);
+const EekSymbolPoolKey *
+           eek_symbol_pool_get_key
+                                 (EekSymbol       *symbol);
+
+EekSymbol *eek_symbol_pool_get_keysym
+                                 (guint            xkeysym,
+                                  const gchar     *label,
+                                  const gchar     *icon_name,
+                                  const gchar     *tooltip);
+EekSymbol *eek_symbol_pool_get_keysym_with_modifier
+                                 (guint            xkeysym,
+                                  EekModifierType  modifier_mask,
+                                  const gchar     *label,
+                                  const gchar     *icon_name,
+                                  const gchar     *tooltip);
+EekSymbol *eek_symbol_pool_get_keysym_from_name
+                                 (const gchar     *name,
+                                  const gchar     *label,
+                                  const gchar     *icon_name,
+                                  const gchar     *tooltip);
+EekSymbol *eek_symbol_pool_get_text
+                                 (const gchar     *text,
+                                  const gchar     *label,
+                                  const gchar     *icon_name,
+                                  const gchar     *tooltip);
+EekSymbol *eek_symbol_pool_get_symbol
+                                 (const gchar     *name,
+                                  EekSymbolCategory category,
+                                  const gchar     *label,
+                                  const gchar     *icon_name,
+                                  const gchar     *tooltip);
+
+EekSymbolMatrix *eek_symbol_pool_get_matrix
+                                 (EekSymbolMatrix *matrix);
+
+G_END_DECLS
+
+#endif  /* EEK_SYMBOL_POOL_H */
@@ -43,6 +43,7 @@
 #include "eek-section.h"
 #include "eek-key.h"
 #include "eek-keysym.h"
+#include "eek-symbol-pool.h"
 
 #define XKB_COMPONENT_MASK (XkbGBN_GeometryMask |       \
                             XkbGBN_KeyNamesMask |       \
@@ -218,16 +219,18 @@ create_key (EekXkbLayout *layout,
                 keysym = XkbKeySymEntry (priv->xkb, keycode, j, i);
                 modifier = XkbKeysymToModifiers (priv->display, keysym);
                 matrix->data[i * num_levels + j] =
-                    EEK_SYMBOL(eek_keysym_new_with_modifier (keysym,
-                                                             modifier));
+                    eek_symbol_pool_get_keysym_with_modifier (keysym,
+                                                              modifier,
+                                                              NULL,
+                                                              NULL,
+                                                              NULL);
             }
     }
 
     key = eek_section_create_key (section, keycode, column, row);
     eek_element_set_name (EEK_ELEMENT(key), name);
     eek_element_set_bounds (EEK_ELEMENT(key), &bounds);
-    eek_key_set_symbol_matrix (key, matrix);
-    eek_symbol_matrix_free (matrix);
+    eek_key_take_symbol_matrix (key, eek_symbol_pool_get_matrix (matrix));
     eek_key_set_oref (key, oref);
 }
 
@@ -352,6 +355,39 @@ eek_xkb_layout_real_create_keyboard (EekLayout *self,
     return keyboard;
 }
 
+/* Xlib calls must stay in the main thread, so build the keyboard
+   right away and only defer the completion. */
+static void
+eek_xkb_layout_real_create_keyboard_async (EekLayout          *self,
+                                           gdouble             initial_width,
+                                           gdouble             initial_height,
+                                           GCancellable       *cancellable,
+                                           GAsyncReadyCallback callback,
+                                           gpointer            user_data)
+{
+    GSimpleAsyncResult *result;
+    EekKeyboard *keyboard;
+    GError *error = NULL;
+
+    result = g_simple_async_result_new (G_OBJECT(self),
+                                        callback,
+                                        user_data,
+                                        eek_layout_create_keyboard_async);
+    if (g_cancellable_set_error_if_cancelled (cancellable, &error)) {
+        g_simple_async_result_set_from_error (result, error);
+        g_error_free (error);
+    } else {
+        keyboard = eek_xkb_layout_real_create_keyboard (self,
+                                                        initial_width,
+                                                        initial_height);
+        g_simple_async_result_set_op_res_gpointer (result,
+                                                   keyboard,
+                                                   g_object_unref);
+    }
+    g_simple_async_result_complete_in_idle (result);
+    g_object_unref (result);
+}
+
 static void
 eek_xkb_layout_finalize (GObject *object)
 {
@@ -410,6 +446,8 @@ eek_xkb_layout_class_init (EekXkbLayoutClass *klass)
     g_type_class_add_private (gobject_class, sizeof (EekXkbLayoutPrivate));
 
     layout_class->create_keyboard = eek_xkb_layout_real_create_keyboard;
+    layout_class->create_keyboard_async =
+        eek_xkb_layout_real_create_keyboard_async;
 
     gobject_class->finalize = eek_xkb_layout_finalize;
     gobject_class->set_property = eek_xkb_layout_set_property;
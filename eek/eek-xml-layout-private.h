@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EEK_XML_LAYOUT_PRIVATE_H
+#define EEK_XML_LAYOUT_PRIVATE_H 1
+
+#include "eek-xml-layout.h"
+#include "eek-keyboard.h"
+
+G_BEGIN_DECLS
+
+/* Build an unscaled keyboard from the XML files, bypassing any
+   compiled layout.  If SOURCES is not NULL, the names of the files
+   read, relative to the keyboards directory, are appended to it as
+   newly allocated strings. */
+EekKeyboard *_eek_xml_layout_load_keyboard (EekXmlLayout *layout,
+                                            GPtrArray    *sources,
+                                            GError      **error);
+
+G_END_DECLS
+
+#endif  /* EEK_XML_LAYOUT_PRIVATE_H */
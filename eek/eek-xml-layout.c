@@ -25,15 +25,20 @@
 #include "config.h"
 #endif  /* HAVE_CONFIG_H */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <glib/gstdio.h>
 
 #include "eek-xml-layout.h"
+#include "eek-xml-layout-private.h"
+#include "eek-compiled-layout.h"
 #include "eek-keyboard.h"
 #include "eek-section.h"
 #include "eek-key.h"
 #include "eek-keysym.h"
 #include "eek-text.h"
+#include "eek-symbol-pool.h"
 
 enum {
     PROP_0,
@@ -61,36 +66,80 @@ G_DEFINE_BOXED_TYPE(EekXmlKeyboardDesc, eek_xml_keyboard_desc, eek_xml_keyboard_
 
 #define BUFSIZE	8192
 
+typedef struct _SymbolsEntry SymbolsEntry;
+
 static GList        *parse_keyboards (const gchar         *path,
                                       GError             **error);
-static GList        *parse_prerequisites
-                                     (const gchar         *path,
-                                      GError             **error);
 static gboolean      parse_geometry  (const gchar         *path,
                                       EekKeyboard         *keyboard,
                                       GError             **error);
-static gboolean      parse_symbols_with_prerequisites
-                                     (const gchar         *keyboards_dir,
+static gboolean      load_geometry   (const gchar         *path,
+                                      EekKeyboard         *keyboard,
+                                      GError             **error);
+static SymbolsEntry *get_symbols    (const gchar         *keyboards_dir,
                                       const gchar         *name,
+                                      GError             **error);
+static void          symbols_entry_unref
+                                     (SymbolsEntry        *entry);
+static gboolean      apply_symbols   (SymbolsEntry        *entry,
                                       EekKeyboard         *keyboard,
-                                      GList             **loaded,
                                       GError             **error);
 static gboolean      parse_symbols   (const gchar         *path,
-                                      EekKeyboard         *keyboard,
+                                      GHashTable          *matrices,
+                                      GList              **prerequisites,
                                       GError             **error);
 
 static void          scale_keyboard  (EekKeyboard         *keyboard,
                                       gdouble              width,
                                       gdouble              height);
 
-static gboolean      validate        (const gchar        **valid_path_list,
-                                      gsize                valid_path_list_len,
+/* Element ids, sorted by name so that element names can be looked
+   up with bsearch(). */
+typedef enum {
+    ELEMENT_BOUNDS,
+    ELEMENT_GEOMETRY,
+    ELEMENT_INCLUDE,
+    ELEMENT_INVALID,
+    ELEMENT_KEY,
+    ELEMENT_KEYBOARD,
+    ELEMENT_KEYBOARDS,
+    ELEMENT_KEYSYM,
+    ELEMENT_OUTLINE,
+    ELEMENT_POINT,
+    ELEMENT_ROW,
+    ELEMENT_SECTION,
+    ELEMENT_SYMBOL,
+    ELEMENT_SYMBOLS,
+    ELEMENT_TEXT,
+    N_ELEMENTS,
+    /* parent state of the document element */
+    ELEMENT_ROOT = N_ELEMENTS
+} ElementId;
+
+#define ELEMENT_BIT(id) (1 << (id))
+#define MAX_ELEMENT_DEPTH 8
+
+struct _ElementStack {
+    gint depth;
+    ElementId ids[MAX_ELEMENT_DEPTH];
+};
+typedef struct _ElementStack ElementStack;
+
+static gboolean      validate        (const guint32       *transitions,
                                       const gchar         *element_name,
-                                      GSList              *element_stack,
+                                      const ElementStack  *element_stack,
+                                      ElementId           *element_id,
                                       GError             **error);
+static void          element_stack_push
+                                     (ElementStack        *element_stack,
+                                      ElementId            element_id);
+static void          element_stack_pop
+                                     (ElementStack        *element_stack);
+static ElementId     element_stack_top
+                                     (const ElementStack  *element_stack);
 
 static gboolean      parse           (GMarkupParseContext *pcontext,
-                                      GInputStream        *input,
+                                      const gchar         *path,
                                       GError             **error);
 static const gchar * get_attribute   (const gchar        **names,
                                       const gchar        **values,
@@ -109,7 +158,7 @@ keyboard_desc_free (EekXmlKeyboardDesc *desc)
 }
 
 struct _KeyboardsParseData {
-    GSList *element_stack;
+    ElementStack element_stack;
 
     GList *keyboards;
 };
@@ -128,9 +177,9 @@ keyboards_parse_data_free (KeyboardsParseData *data)
     g_slice_free (KeyboardsParseData, data);
 }
 
-static const gchar *keyboards_valid_path_list[] = {
-    "keyboards",
-    "keyboard/keyboards",
+static const guint32 keyboards_transitions[N_ELEMENTS + 1] = {
+    [ELEMENT_ROOT] = ELEMENT_BIT(ELEMENT_KEYBOARDS),
+    [ELEMENT_KEYBOARDS] = ELEMENT_BIT(ELEMENT_KEYBOARD)
 };
 
 static void
@@ -142,15 +191,16 @@ keyboards_start_element_callback (GMarkupParseContext *pcontext,
                                   GError             **error)
 {
     KeyboardsParseData *data = user_data;
+    ElementId id;
 
-    if (!validate (keyboards_valid_path_list,
-                   G_N_ELEMENTS (keyboards_valid_path_list),
+    if (!validate (keyboards_transitions,
                    element_name,
-                   data->element_stack,
+                   &data->element_stack,
+                   &id,
                    error))
         return;
 
-    if (g_strcmp0 (element_name, "keyboard") == 0) {
+    if (id == ELEMENT_KEYBOARD) {
         EekXmlKeyboardDesc *desc = g_slice_new0 (EekXmlKeyboardDesc);
         const gchar *attribute;
 
@@ -206,8 +256,7 @@ keyboards_start_element_callback (GMarkupParseContext *pcontext,
     }
 
  out:
-    data->element_stack = g_slist_prepend (data->element_stack,
-                                           g_strdup (element_name));
+    element_stack_push (&data->element_stack, id);
 }
 
 static void
@@ -217,11 +266,8 @@ keyboards_end_element_callback (GMarkupParseContext *pcontext,
                                 GError             **error)
 {
     KeyboardsParseData *data = user_data;
-    GSList *head = data->element_stack;
 
-    g_free (head->data);
-    data->element_stack = g_slist_next (data->element_stack);
-    g_slist_free1 (head);
+    element_stack_pop (&data->element_stack);
 }
 
 static const GMarkupParser keyboards_parser = {
@@ -233,7 +279,7 @@ static const GMarkupParser keyboards_parser = {
 };
 
 struct _GeometryParseData {
-    GSList *element_stack;
+    ElementStack element_stack;
 
     EekBounds bounds;
     EekKeyboard *keyboard;
@@ -281,16 +327,16 @@ geometry_parse_data_free (GeometryParseData *data)
     g_slice_free (GeometryParseData, data);
 }
 
-static const gchar *geometry_valid_path_list[] = {
-    "geometry",
-    "bounds/geometry",
-    "section/geometry",
-    "outline/geometry",
-    "bounds/section/geometry",
-    "row/section/geometry",
-    "key/row/section/geometry",
-    "bounds/key/row/section/geometry",
-    "point/outline/geometry",
+static const guint32 geometry_transitions[N_ELEMENTS + 1] = {
+    [ELEMENT_ROOT] = ELEMENT_BIT(ELEMENT_GEOMETRY),
+    [ELEMENT_GEOMETRY] = ELEMENT_BIT(ELEMENT_BOUNDS) |
+                         ELEMENT_BIT(ELEMENT_SECTION) |
+                         ELEMENT_BIT(ELEMENT_OUTLINE),
+    [ELEMENT_SECTION] = ELEMENT_BIT(ELEMENT_BOUNDS) |
+                        ELEMENT_BIT(ELEMENT_ROW),
+    [ELEMENT_ROW] = ELEMENT_BIT(ELEMENT_KEY),
+    [ELEMENT_KEY] = ELEMENT_BIT(ELEMENT_BOUNDS),
+    [ELEMENT_OUTLINE] = ELEMENT_BIT(ELEMENT_POINT)
 };
 
 static void
@@ -303,16 +349,16 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
 {
     GeometryParseData *data = user_data;
     const gchar *attribute;
+    ElementId id;
 
-    if (!validate (geometry_valid_path_list,
-                   G_N_ELEMENTS (geometry_valid_path_list),
+    if (!validate (geometry_transitions,
                    element_name,
-                   data->element_stack,
-                   error)) {
+                   &data->element_stack,
+                   &id,
+                   error))
         return;
-    }
 
-    if (g_strcmp0 (element_name, "bounds") == 0) {
+    if (id == ELEMENT_BOUNDS) {
         EekBounds bounds;
 
         attribute = get_attribute (attribute_names, attribute_values, "x");
@@ -358,17 +404,24 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
         }
         bounds.height = g_strtod (attribute, NULL);
 
-        if (g_strcmp0 (data->element_stack->data, "geometry") == 0)
+        switch (element_stack_top (&data->element_stack)) {
+        case ELEMENT_GEOMETRY:
             eek_element_set_bounds (EEK_ELEMENT(data->keyboard), &bounds);
-        else if (g_strcmp0 (data->element_stack->data, "section") == 0)
+            break;
+        case ELEMENT_SECTION:
             eek_element_set_bounds (EEK_ELEMENT(data->section), &bounds);
-        else if (g_strcmp0 (data->element_stack->data, "key") == 0)
+            break;
+        case ELEMENT_KEY:
             eek_element_set_bounds (EEK_ELEMENT(data->key), &bounds);
+            break;
+        default:
+            g_assert_not_reached ();
+        }
 
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "section") == 0) {
+    if (id == ELEMENT_SECTION) {
         data->section = eek_keyboard_create_section (data->keyboard);
         attribute = get_attribute (attribute_names, attribute_values,
                                    "id");
@@ -384,7 +437,7 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "row") == 0) {
+    if (id == ELEMENT_ROW) {
         attribute = get_attribute (attribute_names, attribute_values,
                                    "orientation");
         if (attribute != NULL)
@@ -398,7 +451,7 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "key") == 0) {
+    if (id == ELEMENT_KEY) {
         guint keycode;
 
         attribute = get_attribute (attribute_names, attribute_values,
@@ -440,7 +493,7 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "outline") == 0) {
+    if (id == ELEMENT_OUTLINE) {
         attribute = get_attribute (attribute_names, attribute_values, "id");
         if (attribute == NULL) {
             g_set_error (error,
@@ -459,7 +512,7 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "point") == 0) {
+    if (id == ELEMENT_POINT) {
         EekPoint *point;
         gdouble x, y;
 
@@ -492,8 +545,7 @@ geometry_start_element_callback (GMarkupParseContext *pcontext,
     }
 
  out:
-    data->element_stack = g_slist_prepend (data->element_stack,
-                                           g_strdup (element_name));
+    element_stack_push (&data->element_stack, id);
 }
 
 static void
@@ -503,31 +555,30 @@ geometry_end_element_callback (GMarkupParseContext *pcontext,
                                GError             **error)
 {
     GeometryParseData *data = user_data;
-    GSList *head = data->element_stack;
+    ElementId id = element_stack_top (&data->element_stack);
+    GSList *head;
     gint i;
 
-    g_free (head->data);
-    data->element_stack = g_slist_next (data->element_stack);
-    g_slist_free1 (head);
+    element_stack_pop (&data->element_stack);
 
-    if (g_strcmp0 (element_name, "section") == 0) {
+    if (id == ELEMENT_SECTION) {
         data->section = NULL;
         data->num_rows = 0;
         return;
     }
 
-    if (g_strcmp0 (element_name, "key") == 0) {
+    if (id == ELEMENT_KEY) {
         data->key = NULL;
         return;
     }
 
-    if (g_strcmp0 (element_name, "row") == 0) {
+    if (id == ELEMENT_ROW) {
         data->num_columns = 0;
         data->orientation = EEK_ORIENTATION_HORIZONTAL;
         return;
     }
 
-    if (g_strcmp0 (element_name, "outline") == 0) {
+    if (id == ELEMENT_OUTLINE) {
         EekOutline *outline = g_slice_new (EekOutline);
 
         outline->corner_radius = data->corner_radius;
@@ -563,11 +614,12 @@ static const GMarkupParser geometry_parser = {
 };
 
 struct _SymbolsParseData {
-    GSList *element_stack;
+    ElementStack element_stack;
     GString *text;
 
-    EekKeyboard *keyboard;
-    EekKey *key;
+    GHashTable *matrices;
+    GList *prerequisites;
+    guint keycode;
     GSList *symbols;
     gchar *label;
     gchar *icon;
@@ -579,11 +631,11 @@ struct _SymbolsParseData {
 typedef struct _SymbolsParseData SymbolsParseData;
 
 static SymbolsParseData *
-symbols_parse_data_new (EekKeyboard *keyboard)
+symbols_parse_data_new (GHashTable *matrices)
 {
     SymbolsParseData *data = g_slice_new0 (SymbolsParseData);
 
-    data->keyboard = g_object_ref (keyboard);
+    data->matrices = g_hash_table_ref (matrices);
     data->text = g_string_sized_new (BUFSIZE);
     return data;
 }
@@ -591,19 +643,20 @@ symbols_parse_data_new (EekKeyboard *keyboard)
 static void
 symbols_parse_data_free (SymbolsParseData *data)
 {
-    g_object_unref (data->keyboard);
+    g_hash_table_unref (data->matrices);
+    g_list_free_full (data->prerequisites, g_free);
     g_string_free (data->text, TRUE);
     g_slice_free (SymbolsParseData, data);
 }
 
-static const gchar *symbols_valid_path_list[] = {
-    "symbols",
-    "include/symbols",
-    "key/symbols",
-    "text/key/symbols",
-    "keysym/key/symbols",
-    "symbol/key/symbols",
-    "invalid/key/symbols",
+static const guint32 symbols_transitions[N_ELEMENTS + 1] = {
+    [ELEMENT_ROOT] = ELEMENT_BIT(ELEMENT_SYMBOLS),
+    [ELEMENT_SYMBOLS] = ELEMENT_BIT(ELEMENT_INCLUDE) |
+                        ELEMENT_BIT(ELEMENT_KEY),
+    [ELEMENT_KEY] = ELEMENT_BIT(ELEMENT_TEXT) |
+                    ELEMENT_BIT(ELEMENT_KEYSYM) |
+                    ELEMENT_BIT(ELEMENT_SYMBOL) |
+                    ELEMENT_BIT(ELEMENT_INVALID)
 };
 
 static void
@@ -616,17 +669,16 @@ symbols_start_element_callback (GMarkupParseContext *pcontext,
 {
     SymbolsParseData *data = user_data;
     const gchar *attribute;
+    ElementId id;
 
-    if (!validate (symbols_valid_path_list,
-                   G_N_ELEMENTS (symbols_valid_path_list),
+    if (!validate (symbols_transitions,
                    element_name,
-                   data->element_stack,
+                   &data->element_stack,
+                   &id,
                    error))
         return;
 
-    if (g_strcmp0 (element_name, "key") == 0) {
-        guint keycode;
-
+    if (id == ELEMENT_KEY) {
         attribute = get_attribute (attribute_names, attribute_values,
                                    "keycode");
         if (attribute == NULL) {
@@ -636,17 +688,7 @@ symbols_start_element_callback (GMarkupParseContext *pcontext,
                          "no \"keycode\" attribute for \"key\"");
             return;
         }
-        keycode = strtoul (attribute, NULL, 10);
-
-        data->key = eek_keyboard_find_key_by_keycode (data->keyboard,
-                                                      keycode);
-        if (data->key == NULL) {
-            g_set_error (error,
-                         G_MARKUP_ERROR,
-                         G_MARKUP_ERROR_INVALID_CONTENT,
-                         "no such keycode %u", keycode);
-            return;
-        }
+        data->keycode = strtoul (attribute, NULL, 10);
 
         attribute = get_attribute (attribute_names, attribute_values,
                                    "groups");
@@ -658,7 +700,7 @@ symbols_start_element_callback (GMarkupParseContext *pcontext,
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "keysym") == 0) {
+    if (id == ELEMENT_KEYSYM) {
         attribute = get_attribute (attribute_names, attribute_values,
                                    "keyval");
         if (attribute == NULL) {
@@ -671,9 +713,9 @@ symbols_start_element_callback (GMarkupParseContext *pcontext,
         data->keyval = strtoul (attribute, NULL, 0);
     }
 
-    if (g_strcmp0 (element_name, "symbol") == 0 ||
-        g_strcmp0 (element_name, "keysym") == 0 ||
-        g_strcmp0 (element_name, "text") == 0) {
+    if (id == ELEMENT_SYMBOL ||
+        id == ELEMENT_KEYSYM ||
+        id == ELEMENT_TEXT) {
         attribute = get_attribute (attribute_names, attribute_values,
                                    "label");
         if (attribute != NULL)
@@ -698,8 +740,7 @@ symbols_start_element_callback (GMarkupParseContext *pcontext,
     }
 
  out:
-    data->element_stack = g_slist_prepend (data->element_stack,
-                                           g_strdup (element_name));
+    element_stack_push (&data->element_stack, id);
     data->text->len = 0;
 }
 
@@ -710,17 +751,16 @@ symbols_end_element_callback (GMarkupParseContext *pcontext,
                               GError             **error)
 {
     SymbolsParseData *data = user_data;
-    GSList *head = data->element_stack;
+    ElementId id = element_stack_top (&data->element_stack);
+    GSList *head;
     gchar *text;
     gint i;
 
-    g_free (head->data);
-    data->element_stack = g_slist_next (data->element_stack);
-    g_slist_free1 (head);
+    element_stack_pop (&data->element_stack);
 
     text = g_strndup (data->text->str, data->text->len);
 
-    if (g_strcmp0 (element_name, "key") == 0) {
+    if (id == ELEMENT_KEY) {
         gint num_symbols = g_slist_length (data->symbols);
         gint levels = num_symbols / data->groups;
         EekSymbolMatrix *matrix = eek_symbol_matrix_new (data->groups,
@@ -737,52 +777,61 @@ symbols_end_element_callback (GMarkupParseContext *pcontext,
         g_slist_free (data->symbols);
         data->symbols = NULL;
 
-        eek_key_set_symbol_matrix (data->key, matrix);
-        eek_symbol_matrix_free (matrix);
-        data->key = NULL;
+        /* Keys are looked up when the symbols are applied to a
+           keyboard, see apply_symbols(). */
+        g_hash_table_replace (data->matrices,
+                              GUINT_TO_POINTER(data->keycode),
+                              eek_symbol_pool_get_matrix (matrix));
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "symbol") == 0 ||
-        g_strcmp0 (element_name, "keysym") == 0 ||
-        g_strcmp0 (element_name, "text") == 0) {
+    if (id == ELEMENT_INCLUDE) {
+        data->prerequisites = g_list_append (data->prerequisites,
+                                             g_strdup (text));
+        goto out;
+    }
+
+    if (id == ELEMENT_SYMBOL ||
+        id == ELEMENT_KEYSYM ||
+        id == ELEMENT_TEXT) {
         EekSymbol *symbol;
 
-        if (g_strcmp0 (element_name, "keysym") == 0) {
-            EekKeysym *keysym;
+        if (id == ELEMENT_KEYSYM) {
             if (data->keyval != EEK_INVALID_KEYSYM)
-                keysym = eek_keysym_new (data->keyval);
+                symbol = eek_symbol_pool_get_keysym (data->keyval,
+                                                     data->label,
+                                                     data->icon,
+                                                     data->tooltip);
             else
-                keysym = eek_keysym_new_from_name (text);
-            symbol = EEK_SYMBOL(keysym);
-        } else if (g_strcmp0 (element_name, "text") == 0) {
-            symbol = EEK_SYMBOL(eek_text_new (text));
+                symbol = eek_symbol_pool_get_keysym_from_name (text,
+                                                               data->label,
+                                                               data->icon,
+                                                               data->tooltip);
+        } else if (id == ELEMENT_TEXT) {
+            symbol = eek_symbol_pool_get_text (text,
+                                               data->label,
+                                               data->icon,
+                                               data->tooltip);
         } else {
-            symbol = eek_symbol_new (text);
-            eek_symbol_set_category (symbol, EEK_SYMBOL_CATEGORY_KEYNAME);
+            symbol = eek_symbol_pool_get_symbol (text,
+                                                 EEK_SYMBOL_CATEGORY_KEYNAME,
+                                                 data->label,
+                                                 data->icon,
+                                                 data->tooltip);
         }
 
-        if (data->label) {
-            eek_symbol_set_label (symbol, data->label);
-            g_free (data->label);
-            data->label = NULL;
-        }
-        if (data->icon) {
-            eek_symbol_set_icon_name (symbol, data->icon);
-            g_free (data->icon);
-            data->icon = NULL;
-        }
-        if (data->tooltip) {
-            eek_symbol_set_tooltip (symbol, data->tooltip);
-            g_free (data->tooltip);
-            data->tooltip = NULL;
-        }
+        g_free (data->label);
+        data->label = NULL;
+        g_free (data->icon);
+        data->icon = NULL;
+        g_free (data->tooltip);
+        data->tooltip = NULL;
 
         data->symbols = g_slist_prepend (data->symbols, symbol);
         goto out;
     }
 
-    if (g_strcmp0 (element_name, "invalid") == 0) {
+    if (id == ELEMENT_INVALID) {
         data->symbols = g_slist_prepend (data->symbols, NULL);
         goto out;
     }
@@ -810,102 +859,16 @@ static const GMarkupParser symbols_parser = {
     0
 };
 
-struct _PrerequisitesParseData {
-    GSList *element_stack;
-    GString *text;
-
-    GList *prerequisites;
-};
-typedef struct _PrerequisitesParseData PrerequisitesParseData;
-
-static PrerequisitesParseData *
-prerequisites_parse_data_new (void)
-{
-    PrerequisitesParseData *data = g_slice_new0 (PrerequisitesParseData);
-    data->text = g_string_sized_new (BUFSIZE);
-    return data;
-}
-
-static void
-prerequisites_parse_data_free (PrerequisitesParseData *data)
-{
-    g_list_free_full (data->prerequisites, g_free);
-    g_string_free (data->text, TRUE);
-    g_slice_free (PrerequisitesParseData, data);
-}
-
-static void
-prerequisites_start_element_callback (GMarkupParseContext *pcontext,
-                                      const gchar         *element_name,
-                                      const gchar        **attribute_names,
-                                      const gchar        **attribute_values,
-                                      gpointer             user_data,
-                                      GError             **error)
-{
-    PrerequisitesParseData *data = user_data;
-
-    if (!validate (symbols_valid_path_list,
-                   G_N_ELEMENTS (symbols_valid_path_list),
-                   element_name,
-                   data->element_stack,
-                   error))
-        return;
-
-    data->element_stack = g_slist_prepend (data->element_stack,
-                                           g_strdup (element_name));
-    data->text->len = 0;
-}
-
-static void
-prerequisites_end_element_callback (GMarkupParseContext *pcontext,
-                                    const gchar         *element_name,
-                                    gpointer             user_data,
-                                    GError             **error)
-{
-    PrerequisitesParseData *data = user_data;
-    GSList *head = data->element_stack;
-
-    g_free (head->data);
-    data->element_stack = g_slist_next (data->element_stack);
-    g_slist_free1 (head);
-
-    if (g_strcmp0 (element_name, "include") == 0) {
-        data->prerequisites = g_list_append (data->prerequisites,
-                                              g_strndup (data->text->str,
-                                                         data->text->len));
-    }
-}
-
-static void
-prerequisites_text_callback (GMarkupParseContext *pcontext,
-                             const gchar         *text,
-                             gsize                text_len,
-                             gpointer             user_data,
-                             GError             **error)
-{
-    PrerequisitesParseData *data = user_data;
-    g_string_append_len (data->text, text, text_len);
-}
-
-static const GMarkupParser prerequisites_parser = {
-    prerequisites_start_element_callback,
-    prerequisites_end_element_callback,
-    prerequisites_text_callback,
-    0,
-    0
-};
-
-static EekKeyboard *
-eek_xml_layout_real_create_keyboard (EekLayout *self,
-                                     gdouble    initial_width,
-                                     gdouble    initial_height)
+EekKeyboard *
+_eek_xml_layout_load_keyboard (EekXmlLayout *layout,
+                               GPtrArray    *sources,
+                               GError      **error)
 {
-    EekXmlLayout *layout = EEK_XML_LAYOUT (self);
     EekKeyboard *keyboard;
+    SymbolsEntry *symbols;
     gchar *filename, *path;
-    GList *loaded;
-    GError *error;
     gboolean retval;
+    guint i;
 
     /* Create an empty keyboard to which geometry and symbols
        information are applied. */
@@ -914,37 +877,89 @@ eek_xml_layout_real_create_keyboard (EekLayout *self,
     /* Read geometry information. */
     filename = g_strdup_printf ("%s.xml", layout->priv->desc->geometry);
     path = g_build_filename (layout->priv->keyboards_dir, "geometry", filename, NULL);
+    if (sources) {
+        g_ptr_array_add (sources, g_strdup ("keyboards.xml"));
+        g_ptr_array_add (sources, g_build_filename ("geometry", filename, NULL));
+    }
     g_free (filename);
 
-    error = NULL;
-    retval = parse_geometry (path, keyboard, &error);
+    retval = load_geometry (path, keyboard, error);
     g_free (path);
     if (!retval) {
         g_object_unref (keyboard);
-        g_warning ("can't parse geometry file %s: %s",
-                   layout->priv->desc->geometry,
-                   error->message);
-        g_error_free (error);
+        g_prefix_error (error,
+                        "can't parse geometry file %s: ",
+                        layout->priv->desc->geometry);
         return NULL;
     }
 
     /* Read symbols information. */
-    loaded = NULL;
-    retval = parse_symbols_with_prerequisites (layout->priv->keyboards_dir,
-                                               layout->priv->desc->symbols,
-                                               keyboard,
-                                               &loaded,
-                                               &error);
-    g_list_free_full (loaded, g_free);
+    symbols = get_symbols (layout->priv->keyboards_dir,
+                           layout->priv->desc->symbols,
+                           error);
+    retval = symbols != NULL && apply_symbols (symbols, keyboard, error);
+    if (retval && sources) {
+        for (i = 0; i < symbols->files->len; i++) {
+            filename = g_strdup_printf ("%s.xml",
+                                        (const gchar *)
+                                        g_ptr_array_index (symbols->files, i));
+            g_ptr_array_add (sources,
+                             g_build_filename ("symbols", filename, NULL));
+            g_free (filename);
+        }
+    }
+    if (symbols)
+        symbols_entry_unref (symbols);
     if (!retval) {
         g_object_unref (keyboard);
-        g_warning ("can't parse symbols file %s: %s",
-                   layout->priv->desc->symbols,
-                   error->message);
-        g_error_free (error);
+        g_prefix_error (error,
+                        "can't parse symbols file %s: ",
+                        layout->priv->desc->symbols);
         return NULL;
     }
 
+    return keyboard;
+}
+
+static EekKeyboard *
+eek_xml_layout_real_create_keyboard (EekLayout *self,
+                                     gdouble    initial_width,
+                                     gdouble    initial_height)
+{
+    EekXmlLayout *layout = EEK_XML_LAYOUT (self);
+    EekKeyboard *keyboard = NULL;
+    gchar *path;
+    GError *error;
+
+    /* Prefer the compiled layout, which needs no parsing, unless it
+       is missing or older than the XML files. */
+    path = eek_compiled_layout_get_path (layout->priv->keyboards_dir,
+                                         layout->priv->desc->id);
+    if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+        error = NULL;
+        keyboard = eek_compiled_layout_load (path,
+                                             layout->priv->keyboards_dir,
+                                             self,
+                                             &error);
+        if (keyboard == NULL) {
+            g_debug ("can't load compiled layout %s: %s",
+                     path,
+                     error->message);
+            g_error_free (error);
+        }
+    }
+    g_free (path);
+
+    if (keyboard == NULL) {
+        error = NULL;
+        keyboard = _eek_xml_layout_load_keyboard (layout, NULL, &error);
+        if (keyboard == NULL) {
+            g_warning ("%s", error->message);
+            g_error_free (error);
+            return NULL;
+        }
+    }
+
     /* Fit keyboard in the given width and hight. */
     scale_keyboard (keyboard, initial_width, initial_height);
 
@@ -1045,47 +1060,157 @@ eek_xml_layout_new (const gchar *id, GError **error)
                                          NULL);
 }
 
-static gboolean
-initable_init (GInitable    *initable,
-               GCancellable *cancellable,
-               GError      **error)
+/* Process-wide index of the keyboards.xml files read so far, keyed
+   by directory.  An index is rebuilt only when the modification time
+   or size of its keyboards.xml changes. */
+struct _KeyboardsIndex {
+    time_t mtime;
+    goffset size;
+    GList *keyboards;
+    GHashTable *keyboard_hash;
+};
+typedef struct _KeyboardsIndex KeyboardsIndex;
+
+G_LOCK_DEFINE_STATIC (keyboards_indices);
+static GHashTable *keyboards_indices = NULL;
+
+static void
+keyboards_index_clear (KeyboardsIndex *index)
 {
-    EekXmlLayout *layout = EEK_XML_LAYOUT (initable);
+    if (index->keyboard_hash)
+        g_hash_table_destroy (index->keyboard_hash);
+    g_list_free_full (index->keyboards, (GDestroyNotify) keyboard_desc_free);
+    index->keyboards = NULL;
+    index->keyboard_hash = NULL;
+}
+
+static void
+keyboards_index_free (KeyboardsIndex *index)
+{
+    keyboards_index_clear (index);
+    g_slice_free (KeyboardsIndex, index);
+}
+
+static const gchar *
+get_keyboards_dir (void)
+{
+    const gchar *keyboards_dir;
+
+    keyboards_dir = g_getenv ("EEKBOARD_KEYBOARDSDIR");
+    if (keyboards_dir == NULL)
+        keyboards_dir = KEYBOARDSDIR;
+    return keyboards_dir;
+}
+
+/* Must be called with the keyboards_indices lock held. */
+static KeyboardsIndex *
+get_keyboards_index (const gchar *keyboards_dir, GError **error)
+{
+    KeyboardsIndex *index;
+    GStatBuf buf;
     GList *keyboards, *p;
+    GError *parse_error;
     gchar *path;
-    EekXmlKeyboardDesc *desc;
 
-    layout->priv->keyboards_dir = (gchar *) g_getenv ("EEKBOARD_KEYBOARDSDIR");
-    if (layout->priv->keyboards_dir == NULL)
-        layout->priv->keyboards_dir = KEYBOARDSDIR;
-    layout->priv->keyboards_dir = g_strdup (layout->priv->keyboards_dir);
+    if (keyboards_indices == NULL)
+        keyboards_indices =
+            g_hash_table_new_full (g_str_hash,
+                                   g_str_equal,
+                                   g_free,
+                                   (GDestroyNotify) keyboards_index_free);
 
-    path = g_build_filename (layout->priv->keyboards_dir, "keyboards.xml", NULL);
-    keyboards = parse_keyboards (path, error);
+    path = g_build_filename (keyboards_dir, "keyboards.xml", NULL);
+    if (g_stat (path, &buf) < 0) {
+        gint saved_errno = errno;
+
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (saved_errno),
+                     "can't stat %s: %s",
+                     path,
+                     g_strerror (saved_errno));
+        g_free (path);
+        g_hash_table_remove (keyboards_indices, keyboards_dir);
+        return NULL;
+    }
+
+    index = g_hash_table_lookup (keyboards_indices, keyboards_dir);
+    if (index != NULL &&
+        index->mtime == buf.st_mtime &&
+        index->size == buf.st_size) {
+        g_free (path);
+        return index;
+    }
+
+    parse_error = NULL;
+    keyboards = parse_keyboards (path, &parse_error);
     g_free (path);
-    if (error && *error)
-        return FALSE;
+    if (parse_error) {
+        g_propagate_error (error, parse_error);
+        g_hash_table_remove (keyboards_indices, keyboards_dir);
+        return NULL;
+    }
 
+    if (index == NULL) {
+        index = g_slice_new0 (KeyboardsIndex);
+        g_hash_table_insert (keyboards_indices,
+                             g_strdup (keyboards_dir),
+                             index);
+    } else
+        keyboards_index_clear (index);
+
+    index->mtime = buf.st_mtime;
+    index->size = buf.st_size;
+    index->keyboards = keyboards;
+    index->keyboard_hash = g_hash_table_new (g_str_hash, g_str_equal);
     for (p = keyboards; p; p = p->next) {
-        desc = p->data;
-        if (g_strcmp0 (desc->id, layout->priv->id) == 0)
-            break;
+        EekXmlKeyboardDesc *desc = p->data;
+        /* Keep the first entry of the list on duplicated IDs. */
+        if (!g_hash_table_lookup (index->keyboard_hash, desc->id))
+            g_hash_table_insert (index->keyboard_hash, desc->id, desc);
     }
-    if (p == NULL) {
-        g_set_error (error,
-                     EEK_ERROR,
-                     EEK_ERROR_LAYOUT_ERROR,
-                     "no such keyboard %s",
-                     layout->priv->id);
-        return FALSE;
+
+    return index;
+}
+
+static EekXmlKeyboardDesc *
+find_keyboard (const gchar *keyboards_dir,
+               const gchar *id,
+               GError     **error)
+{
+    KeyboardsIndex *index;
+    EekXmlKeyboardDesc *desc = NULL;
+
+    G_LOCK (keyboards_indices);
+    index = get_keyboards_index (keyboards_dir, error);
+    if (index) {
+        desc = g_hash_table_lookup (index->keyboard_hash, id);
+        if (desc)
+            desc = eek_xml_keyboard_desc_copy (desc);
+        else
+            g_set_error (error,
+                         EEK_ERROR,
+                         EEK_ERROR_LAYOUT_ERROR,
+                         "no such keyboard %s",
+                         id);
     }
+    G_UNLOCK (keyboards_indices);
 
-    keyboards = g_list_remove_link (keyboards, p);
-    layout->priv->desc = p->data;
-    g_list_free_1 (p);
-    g_list_free_full (keyboards, (GDestroyNotify) keyboard_desc_free);
+    return desc;
+}
 
-    return TRUE;
+static gboolean
+initable_init (GInitable    *initable,
+               GCancellable *cancellable,
+               GError      **error)
+{
+    EekXmlLayout *layout = EEK_XML_LAYOUT (initable);
+
+    layout->priv->keyboards_dir = g_strdup (get_keyboards_dir ());
+    layout->priv->desc = find_keyboard (layout->priv->keyboards_dir,
+                                        layout->priv->id,
+                                        error);
+    return layout->priv->desc != NULL;
 }
 
 static void
@@ -1097,29 +1222,57 @@ initable_iface_init (GInitableIface *initable_iface)
 /**
  * eek_xml_list_keyboards:
  *
- * List available keyboards.
- * Returns: (transfer container) (element-type utf8): the list of keyboards
+ * List available keyboards.  keyboards.xml is read once and parsed
+ * again only when it changes.
+ * Returns: (transfer full) (element-type EekXmlKeyboardDesc): the
+ * list of keyboards
  */
 GList *
 eek_xml_list_keyboards (void)
 {
-    const gchar *keyboards_dir;
-    gchar *path;
-    GList *keyboards;
+    KeyboardsIndex *index;
+    GList *keyboards = NULL, *p;
+
+    G_LOCK (keyboards_indices);
+    index = get_keyboards_index (get_keyboards_dir (), NULL);
+    if (index) {
+        for (p = index->keyboards; p; p = p->next)
+            keyboards = g_list_prepend (keyboards,
+                                        eek_xml_keyboard_desc_copy (p->data));
+    }
+    G_UNLOCK (keyboards_indices);
 
-    keyboards_dir = g_getenv ("EEKBOARD_KEYBOARDSDIR");
-    if (keyboards_dir == NULL)
-        keyboards_dir = KEYBOARDSDIR;
-    path = g_build_filename (keyboards_dir, "keyboards.xml", NULL);
-    keyboards = parse_keyboards (path, NULL);
-    g_free (path);
-    return keyboards;
+    return g_list_reverse (keyboards);
+}
+
+/**
+ * eek_xml_find_keyboard:
+ * @id: keyboard ID
+ *
+ * Look up the keyboard @id in keyboards.xml, without parsing it
+ * again unless it has changed.
+ * Returns: (transfer full): an #EekXmlKeyboardDesc or %NULL if there
+ * is no such keyboard
+ */
+EekXmlKeyboardDesc *
+eek_xml_find_keyboard (const gchar *id)
+{
+    g_return_val_if_fail (id != NULL, NULL);
+    return find_keyboard (get_keyboards_dir (), id, NULL);
 }
 
 EekXmlKeyboardDesc *
 eek_xml_keyboard_desc_copy (EekXmlKeyboardDesc *desc)
 {
-    return g_slice_dup (EekXmlKeyboardDesc, desc);
+    EekXmlKeyboardDesc *copy = g_slice_dup (EekXmlKeyboardDesc, desc);
+
+    copy->id = g_strdup (desc->id);
+    copy->name = g_strdup (desc->name);
+    copy->geometry = g_strdup (desc->geometry);
+    copy->symbols = g_strdup (desc->symbols);
+    copy->language = g_strdup (desc->language);
+    copy->longname = g_strdup (desc->longname);
+    return copy;
 }
 
 void
@@ -1142,26 +1295,16 @@ parse_geometry (const gchar *path, EekKeyboard *keyboard, GError **error)
     GHashTable *oref_hash;
     GHashTableIter iter;
     gpointer k, v;
-    GFile *file;
-    GFileInputStream *input;
     gboolean retval;
 
-    file = g_file_new_for_path (path);
-
-    input = g_file_read (file, NULL, error);
-    g_object_unref (file);
-    if (input == NULL)
-        return FALSE;
-
     data = geometry_parse_data_new (keyboard);
     pcontext = g_markup_parse_context_new (&geometry_parser,
                                            0,
                                            data,
                                            NULL);
 
-    retval = parse (pcontext, G_INPUT_STREAM (input), error);
+    retval = parse (pcontext, path, error);
     g_markup_parse_context_free (pcontext);
-    g_object_unref (input);
     if (!retval) {
         geometry_parse_data_free (data);
         return FALSE;
@@ -1190,123 +1333,483 @@ parse_geometry (const gchar *path, EekKeyboard *keyboard, GError **error)
     return TRUE;
 }
 
-static gboolean
-parse_symbols_with_prerequisites (const gchar *keyboards_dir,
-                                  const gchar *name,
-                                  EekKeyboard *keyboard,
-                                  GList     **loaded,
-                                  GError     **error)
+/* Parsed geometry files, shared by all keyboards using the same
+   geometry.  Each entry is an unscaled keyboard without symbols which
+   is never modified after parsing; keyboards are created by copying
+   it, see clone_geometry().  An entry is parsed again only when the
+   modification time or size of its file changes. */
+struct _GeometryTemplate {
+    time_t mtime;
+    goffset size;
+    EekKeyboard *keyboard;
+};
+typedef struct _GeometryTemplate GeometryTemplate;
+
+G_LOCK_DEFINE_STATIC (geometry_templates);
+static GHashTable *geometry_templates = NULL;
+
+static void
+geometry_template_free (GeometryTemplate *template)
 {
-    gchar *filename, *path;
-    GList *prerequisites, *p;
-    GError *prerequisites_error;
-    gboolean retval;
+    g_object_unref (template->keyboard);
+    g_slice_free (GeometryTemplate, template);
+}
 
-    for (p = *loaded; p; p = p->next) {
-        if (g_strcmp0 (p->data, name) == 0) {
-            g_set_error (error,
-                         EEK_ERROR,
-                         EEK_ERROR_LAYOUT_ERROR,
-                         "%s already loaded",
-                         name);
-            return FALSE;
+static EekKeyboard *
+get_geometry_template (const gchar *path, GError **error)
+{
+    GeometryTemplate *template;
+    EekKeyboard *keyboard = NULL;
+    GStatBuf buf;
+
+    if (g_stat (path, &buf) < 0) {
+        gint saved_errno = errno;
+
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (saved_errno),
+                     "can't stat %s: %s",
+                     path,
+                     g_strerror (saved_errno));
+        return NULL;
+    }
+
+    G_LOCK (geometry_templates);
+    if (geometry_templates == NULL)
+        geometry_templates =
+            g_hash_table_new_full (g_str_hash,
+                                   g_str_equal,
+                                   g_free,
+                                   (GDestroyNotify) geometry_template_free);
+
+    template = g_hash_table_lookup (geometry_templates, path);
+    if (template == NULL ||
+        template->mtime != buf.st_mtime ||
+        template->size != buf.st_size) {
+        keyboard = g_object_new (EEK_TYPE_KEYBOARD, NULL);
+        if (parse_geometry (path, keyboard, error)) {
+            template = g_slice_new (GeometryTemplate);
+            template->mtime = buf.st_mtime;
+            template->size = buf.st_size;
+            template->keyboard = keyboard;
+            g_hash_table_replace (geometry_templates,
+                                  g_strdup (path),
+                                  template);
+        } else {
+            g_object_unref (keyboard);
+            template = NULL;
         }
     }
-    *loaded = g_list_prepend (*loaded, g_strdup (name));
+    if (template)
+        keyboard = g_object_ref (template->keyboard);
+    G_UNLOCK (geometry_templates);
+
+    return keyboard;
+}
+
+static void
+clone_geometry (EekKeyboard *template, EekKeyboard *keyboard)
+{
+    EekBounds bounds;
+    gsize n_outlines;
+    guint i, j, n_sections, n_keys;
+    gint k, n_rows;
+
+    eek_element_get_bounds (EEK_ELEMENT(template), &bounds);
+    eek_element_set_bounds (EEK_ELEMENT(keyboard), &bounds);
+
+    /* Outline indices are preserved, so orefs stay valid. */
+    n_outlines = eek_keyboard_get_n_outlines (template);
+    for (i = 0; i < n_outlines; i++)
+        eek_keyboard_add_outline (keyboard,
+                                  eek_keyboard_get_outline (template, i));
+
+    n_sections = eek_container_get_n_children (EEK_CONTAINER(template));
+    for (i = 0; i < n_sections; i++) {
+        EekElement *tsection;
+        EekSection *section;
+
+        tsection = eek_container_get_child (EEK_CONTAINER(template), i);
+        section = eek_keyboard_create_section (keyboard);
+        eek_element_set_name (EEK_ELEMENT(section),
+                              eek_element_get_name (tsection));
+        eek_section_set_angle (section,
+                               eek_section_get_angle (EEK_SECTION(tsection)));
+        eek_element_get_bounds (tsection, &bounds);
+        eek_element_set_bounds (EEK_ELEMENT(section), &bounds);
+
+        n_rows = eek_section_get_n_rows (EEK_SECTION(tsection));
+        for (k = 0; k < n_rows; k++) {
+            gint num_columns;
+            EekOrientation orientation;
+
+            eek_section_get_row (EEK_SECTION(tsection),
+                                 k,
+                                 &num_columns,
+                                 &orientation);
+            eek_section_add_row (section, num_columns, orientation);
+        }
+
+        n_keys = eek_container_get_n_children (EEK_CONTAINER(tsection));
+        for (j = 0; j < n_keys; j++) {
+            EekElement *tkey;
+            EekKey *key;
+            gint column, row;
+
+            tkey = eek_container_get_child (EEK_CONTAINER(tsection), j);
+            eek_key_get_index (EEK_KEY(tkey), &column, &row);
+            key = eek_section_create_key (section,
+                                          eek_key_get_keycode (EEK_KEY(tkey)),
+                                          column,
+                                          row);
+            eek_element_set_name (EEK_ELEMENT(key),
+                                  eek_element_get_name (tkey));
+            eek_element_get_bounds (tkey, &bounds);
+            eek_element_set_bounds (EEK_ELEMENT(key), &bounds);
+            eek_key_set_oref (key, eek_key_get_oref (EEK_KEY(tkey)));
+        }
+    }
+}
+
+static gboolean
+load_geometry (const gchar *path, EekKeyboard *keyboard, GError **error)
+{
+    EekKeyboard *template;
+
+    template = get_geometry_template (path, error);
+    if (template == NULL)
+        return FALSE;
+
+    clone_geometry (template, keyboard);
+    g_object_unref (template);
+    return TRUE;
+}
+
+/* Symbols files, parsed once per process and shared by all
+   keyboards.  An entry holds the symbol matrices of a file merged
+   with those of the files it includes, so applying it to a keyboard
+   does not touch any other file.  Entries are immutable; they are
+   replaced when one of their files changes. */
+struct _SymbolsEntry {
+    volatile gint ref_count;
+    /* keycode -> EekSymbolMatrix */
+    GHashTable *matrices;
+    /* names of the symbols files read, prerequisites first */
+    GPtrArray *files;
+    /* modification time and size of each of the files */
+    GArray *stats;
+};
+
+struct _SymbolsFileStat {
+    time_t mtime;
+    goffset size;
+};
+typedef struct _SymbolsFileStat SymbolsFileStat;
+
+G_LOCK_DEFINE_STATIC (symbols_entries);
+static GHashTable *symbols_entries = NULL;
+
+static SymbolsEntry *
+symbols_entry_new (void)
+{
+    SymbolsEntry *entry = g_slice_new (SymbolsEntry);
+
+    entry->ref_count = 1;
+    entry->matrices =
+        g_hash_table_new_full (g_direct_hash,
+                               g_direct_equal,
+                               NULL,
+                               (GDestroyNotify) eek_symbol_matrix_free);
+    entry->files = g_ptr_array_new_with_free_func (g_free);
+    entry->stats = g_array_new (FALSE, FALSE, sizeof (SymbolsFileStat));
+    return entry;
+}
+
+static SymbolsEntry *
+symbols_entry_ref (SymbolsEntry *entry)
+{
+    g_atomic_int_inc (&entry->ref_count);
+    return entry;
+}
+
+static void
+symbols_entry_unref (SymbolsEntry *entry)
+{
+    if (g_atomic_int_dec_and_test (&entry->ref_count)) {
+        g_hash_table_destroy (entry->matrices);
+        g_ptr_array_free (entry->files, TRUE);
+        g_array_free (entry->stats, TRUE);
+        g_slice_free (SymbolsEntry, entry);
+    }
+}
+
+static gchar *
+get_symbols_path (const gchar *keyboards_dir, const gchar *name)
+{
+    gchar *filename, *path;
 
     filename = g_strdup_printf ("%s.xml", name);
     path = g_build_filename (keyboards_dir, "symbols", filename, NULL);
     g_free (filename);
+    return path;
+}
 
-    prerequisites_error = NULL;
-    prerequisites = parse_prerequisites (path, &prerequisites_error);
-    if (prerequisites_error != NULL) {
-        g_propagate_error (error, prerequisites_error);
+static gboolean
+stat_symbols_file (const gchar     *keyboards_dir,
+                   const gchar     *name,
+                   SymbolsFileStat *stat,
+                   GError         **error)
+{
+    GStatBuf buf;
+    gchar *path;
+
+    path = get_symbols_path (keyboards_dir, name);
+    if (g_stat (path, &buf) < 0) {
+        gint saved_errno = errno;
+
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (saved_errno),
+                     "can't stat %s: %s",
+                     path,
+                     g_strerror (saved_errno));
+        g_free (path);
         return FALSE;
     }
+    g_free (path);
 
-    for (p = prerequisites; p; p = p->next) {
-        retval = parse_symbols_with_prerequisites (keyboards_dir,
-                                                   p->data,
-                                                   keyboard,
-                                                   loaded,
-                                                   error);
-        if (!retval)
+    stat->mtime = buf.st_mtime;
+    stat->size = buf.st_size;
+    return TRUE;
+}
+
+static gboolean
+symbols_entry_is_valid (SymbolsEntry *entry, const gchar *keyboards_dir)
+{
+    guint i;
+
+    for (i = 0; i < entry->files->len; i++) {
+        SymbolsFileStat stat, *old_stat;
+
+        if (!stat_symbols_file (keyboards_dir,
+                                g_ptr_array_index (entry->files, i),
+                                &stat,
+                                NULL))
+            return FALSE;
+        old_stat = &g_array_index (entry->stats, SymbolsFileStat, i);
+        if (stat.mtime != old_stat->mtime || stat.size != old_stat->size)
             return FALSE;
     }
-    g_list_free_full (prerequisites, (GDestroyNotify)g_free);
+    return TRUE;
+}
 
-    retval = parse_symbols (path, keyboard, error);
-    g_free (path);
+static gboolean
+symbols_entry_has_file (SymbolsEntry *entry, const gchar *name)
+{
+    guint i;
 
-    return retval;
+    for (i = 0; i < entry->files->len; i++)
+        if (g_strcmp0 (g_ptr_array_index (entry->files, i), name) == 0)
+            return TRUE;
+    return FALSE;
 }
 
-static gboolean
-parse_symbols (const gchar *path, EekKeyboard *keyboard, GError **error)
+static void
+symbols_entry_add_file (SymbolsEntry          *entry,
+                        const gchar           *name,
+                        const SymbolsFileStat *stat)
 {
-    SymbolsParseData *data;
-    GMarkupParseContext *pcontext;
-    GFile *file;
-    GFileInputStream *input;
+    g_ptr_array_add (entry->files, g_strdup (name));
+    g_array_append_vals (entry->stats, stat, 1);
+}
+
+/* Must be called with the symbols_entries lock held.  LOADING is the
+   list of files being resolved, used to detect include loops. */
+static SymbolsEntry *
+resolve_symbols (const gchar *keyboards_dir,
+                 const gchar *name,
+                 GSList     **loading,
+                 GError     **error)
+{
+    SymbolsEntry *entry;
+    SymbolsFileStat stat;
+    GHashTable *matrices;
+    GHashTableIter iter;
+    gpointer k, v;
+    GList *prerequisites, *p;
+    gchar *key, *path;
     gboolean retval;
+    guint i;
 
-    file = g_file_new_for_path (path);
+    if (g_slist_find_custom (*loading, name, (GCompareFunc) g_strcmp0)) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "%s already loaded",
+                     name);
+        return NULL;
+    }
 
-    input = g_file_read (file, NULL, error);
-    g_object_unref (file);
-    if (input == NULL)
-        return FALSE;
+    key = g_build_filename (keyboards_dir, name, NULL);
+    entry = g_hash_table_lookup (symbols_entries, key);
+    if (entry && symbols_entry_is_valid (entry, keyboards_dir)) {
+        g_free (key);
+        return symbols_entry_ref (entry);
+    }
 
-    data = symbols_parse_data_new (keyboard);
-    pcontext = g_markup_parse_context_new (&symbols_parser,
-                                           0,
-                                           data,
-                                           NULL);
-    retval = parse (pcontext, G_INPUT_STREAM (input), error);
-    g_markup_parse_context_free (pcontext);
-    g_object_unref (input);
+    if (!stat_symbols_file (keyboards_dir, name, &stat, error)) {
+        g_free (key);
+        return NULL;
+    }
+
+    path = get_symbols_path (keyboards_dir, name);
+    matrices = g_hash_table_new_full (g_direct_hash,
+                                      g_direct_equal,
+                                      NULL,
+                                      (GDestroyNotify) eek_symbol_matrix_free);
+    prerequisites = NULL;
+    retval = parse_symbols (path, matrices, &prerequisites, error);
+    g_free (path);
     if (!retval) {
-        symbols_parse_data_free (data);
-        return FALSE;
+        g_hash_table_destroy (matrices);
+        g_free (key);
+        return NULL;
+    }
+
+    /* Merge the prerequisites in order, then the file itself, so that
+       later definitions of a keycode override earlier ones. */
+    entry = symbols_entry_new ();
+    *loading = g_slist_prepend (*loading, (gpointer) name);
+    for (p = prerequisites; p; p = p->next) {
+        SymbolsEntry *prerequisite;
+
+        prerequisite = resolve_symbols (keyboards_dir,
+                                        p->data,
+                                        loading,
+                                        error);
+        if (prerequisite == NULL)
+            break;
+
+        for (i = 0; i < prerequisite->files->len; i++) {
+            const gchar *file = g_ptr_array_index (prerequisite->files, i);
+
+            if (g_strcmp0 (file, name) == 0 ||
+                symbols_entry_has_file (entry, file)) {
+                g_set_error (error,
+                             EEK_ERROR,
+                             EEK_ERROR_LAYOUT_ERROR,
+                             "%s already loaded",
+                             file);
+                break;
+            }
+            symbols_entry_add_file (entry,
+                                    file,
+                                    &g_array_index (prerequisite->stats,
+                                                    SymbolsFileStat,
+                                                    i));
+        }
+        if (i < prerequisite->files->len) {
+            symbols_entry_unref (prerequisite);
+            break;
+        }
+
+        g_hash_table_iter_init (&iter, prerequisite->matrices);
+        while (g_hash_table_iter_next (&iter, &k, &v))
+            g_hash_table_replace (entry->matrices,
+                                  k,
+                                  eek_symbol_matrix_ref (v));
+        symbols_entry_unref (prerequisite);
+    }
+    *loading = g_slist_delete_link (*loading, *loading);
+    g_list_free_full (prerequisites, g_free);
+
+    if (p != NULL) {
+        symbols_entry_unref (entry);
+        g_hash_table_destroy (matrices);
+        g_free (key);
+        return NULL;
+    }
+
+    symbols_entry_add_file (entry, name, &stat);
+    g_hash_table_iter_init (&iter, matrices);
+    while (g_hash_table_iter_next (&iter, &k, &v))
+        g_hash_table_replace (entry->matrices, k, eek_symbol_matrix_ref (v));
+    g_hash_table_destroy (matrices);
+
+    g_hash_table_replace (symbols_entries, key, symbols_entry_ref (entry));
+    return entry;
+}
+
+static SymbolsEntry *
+get_symbols (const gchar *keyboards_dir,
+             const gchar *name,
+             GError     **error)
+{
+    SymbolsEntry *entry;
+    GSList *loading = NULL;
+
+    G_LOCK (symbols_entries);
+    if (symbols_entries == NULL)
+        symbols_entries =
+            g_hash_table_new_full (g_str_hash,
+                                   g_str_equal,
+                                   g_free,
+                                   (GDestroyNotify) symbols_entry_unref);
+    entry = resolve_symbols (keyboards_dir, name, &loading, error);
+    G_UNLOCK (symbols_entries);
+
+    return entry;
+}
+
+static gboolean
+apply_symbols (SymbolsEntry *entry,
+               EekKeyboard  *keyboard,
+               GError      **error)
+{
+    GHashTableIter iter;
+    gpointer k, v;
+
+    g_hash_table_iter_init (&iter, entry->matrices);
+    while (g_hash_table_iter_next (&iter, &k, &v)) {
+        EekKey *key;
+
+        key = eek_keyboard_find_key_by_keycode (keyboard,
+                                                GPOINTER_TO_UINT(k));
+        if (key == NULL) {
+            g_set_error (error,
+                         G_MARKUP_ERROR,
+                         G_MARKUP_ERROR_INVALID_CONTENT,
+                         "no such keycode %u", GPOINTER_TO_UINT(k));
+            return FALSE;
+        }
+        eek_key_take_symbol_matrix (key, eek_symbol_matrix_ref (v));
     }
-    symbols_parse_data_free (data);
     return TRUE;
 }
 
-static GList *
-parse_prerequisites (const gchar *path, GError **error)
+static gboolean
+parse_symbols (const gchar *path,
+               GHashTable  *matrices,
+               GList      **prerequisites,
+               GError     **error)
 {
-    PrerequisitesParseData *data;
+    SymbolsParseData *data;
     GMarkupParseContext *pcontext;
-    GFile *file;
-    GFileInputStream *input;
-    GList *prerequisites;
     gboolean retval;
 
-    file = g_file_new_for_path (path);
-
-    input = g_file_read (file, NULL, error);
-    g_object_unref (file);
-    if (input == NULL)
-        return FALSE;
-
-    data = prerequisites_parse_data_new ();
-    pcontext = g_markup_parse_context_new (&prerequisites_parser,
+    data = symbols_parse_data_new (matrices);
+    pcontext = g_markup_parse_context_new (&symbols_parser,
                                            0,
                                            data,
                                            NULL);
-    retval = parse (pcontext, G_INPUT_STREAM (input), error);
+    retval = parse (pcontext, path, error);
     g_markup_parse_context_free (pcontext);
-    g_object_unref (input);
-    if (!retval) {
-        prerequisites_parse_data_free (data);
-        return NULL;
+    if (retval) {
+        *prerequisites = data->prerequisites;
+        data->prerequisites = NULL;
     }
-    prerequisites = data->prerequisites;
-    data->prerequisites = NULL;
-    prerequisites_parse_data_free (data);
-    return prerequisites;
+    symbols_parse_data_free (data);
+    return retval;
 }
 
 static GList *
@@ -1314,25 +1817,15 @@ parse_keyboards (const gchar *path, GError **error)
 {
     KeyboardsParseData *data;
     GMarkupParseContext *pcontext;
-    GFile *file;
-    GFileInputStream *input;
     GList *keyboards;
     gboolean retval;
 
-    file = g_file_new_for_path (path);
-
-    input = g_file_read (file, NULL, error);
-    g_object_unref (file);
-    if (input == NULL)
-        return NULL;
-
     data = keyboards_parse_data_new ();
     pcontext = g_markup_parse_context_new (&keyboards_parser,
                                            0,
                                            data,
                                            NULL);
-    retval = parse (pcontext, G_INPUT_STREAM (input), error);
-    g_object_unref (input);
+    retval = parse (pcontext, path, error);
     g_markup_parse_context_free (pcontext);
     if (!retval) {
         keyboards_parse_data_free (data);
@@ -1345,9 +1838,6 @@ parse_keyboards (const gchar *path, GError **error)
     return keyboards;
 }
 
-static void scale_bounds_callback (EekElement *element,
-                                   gpointer    user_data);
-
 static void
 scale_bounds (EekElement *element,
               gdouble     scale)
@@ -1361,17 +1851,14 @@ scale_bounds (EekElement *element,
     bounds.height *= scale;
     eek_element_set_bounds (element, &bounds);
 
-    if (EEK_IS_CONTAINER(element))
-        eek_container_foreach_child (EEK_CONTAINER(element),
-                                     scale_bounds_callback,
-                                     &scale);
-}
+    if (EEK_IS_CONTAINER(element)) {
+        guint i, n_children;
 
-static void
-scale_bounds_callback (EekElement *element,
-                       gpointer    user_data)
-{
-    scale_bounds (element, *(gdouble *)user_data);
+        n_children = eek_container_get_n_children (EEK_CONTAINER(element));
+        for (i = 0; i < n_children; i++)
+            scale_bounds (eek_container_get_child (EEK_CONTAINER(element), i),
+                          scale);
+    }
 }
 
 static void scale_keyboard (EekKeyboard *keyboard,
@@ -1404,83 +1891,121 @@ static void scale_keyboard (EekKeyboard *keyboard,
     }
 }
 
-static gboolean
-validate (const gchar **valid_path_list,
-          gsize         valid_path_list_len,
-          const gchar  *element_name,
-          GSList       *element_stack,
-          GError      **error)
+static const gchar *element_names[] = {
+    "bounds",
+    "geometry",
+    "include",
+    "invalid",
+    "key",
+    "keyboard",
+    "keyboards",
+    "keysym",
+    "outline",
+    "point",
+    "row",
+    "section",
+    "symbol",
+    "symbols",
+    "text"
+};
+G_STATIC_ASSERT (G_N_ELEMENTS (element_names) == N_ELEMENTS);
+
+static int
+compare_element_name (const void *key, const void *elem)
 {
-    gint i;
-    gchar *element_path;
-    GSList *head, *p;
-    GString *string;
+    return strcmp (key, *(const gchar * const *)elem);
+}
 
-    head = g_slist_prepend (element_stack, (gchar *)element_name);
-    string = g_string_sized_new (64);
-    for (p = head; p; p = p->next) {
-        g_string_append (string, p->data);
-        if (g_slist_next (p))
-            g_string_append (string, "/");
-    }
-    element_path = g_string_free (string, FALSE);
-    g_slist_free1 (head);
+static void
+element_stack_push (ElementStack *element_stack, ElementId element_id)
+{
+    g_assert (element_stack->depth < MAX_ELEMENT_DEPTH);
+    element_stack->ids[element_stack->depth++] = element_id;
+}
 
-    for (i = 0; i < valid_path_list_len; i++)
-        if (g_strcmp0 (element_path, valid_path_list[i]) == 0)
-            break;
-    g_free (element_path);
+static void
+element_stack_pop (ElementStack *element_stack)
+{
+    g_assert (element_stack->depth > 0);
+    element_stack->depth--;
+}
 
-    if (i == valid_path_list_len) {
-        gchar *reverse_element_path;
+static ElementId
+element_stack_top (const ElementStack *element_stack)
+{
+    if (element_stack->depth == 0)
+        return ELEMENT_ROOT;
+    return element_stack->ids[element_stack->depth - 1];
+}
 
-        head = g_slist_reverse (g_slist_copy (element_stack));
-        string = g_string_sized_new (64);
-        for (p = head; p; p = p->next) {
-            g_string_append (string, p->data);
-            if (g_slist_next (p))
-                g_string_append (string, "/");
-        }
-        reverse_element_path = g_string_free (string, FALSE);
+/* Check ELEMENT_NAME against the table of elements allowed under
+   the current parent.  The element path is only built for the error
+   message. */
+static gboolean
+validate (const guint32      *transitions,
+          const gchar        *element_name,
+          const ElementStack *element_stack,
+          ElementId          *element_id,
+          GError            **error)
+{
+    const gchar **name;
+    GString *string;
+    gint i;
 
-        abort ();
-        g_set_error (error,
-                     G_MARKUP_ERROR,
-                     G_MARKUP_ERROR_UNKNOWN_ELEMENT,
-                     "%s cannot appear as %s",
-                     element_name,
-                     reverse_element_path);
-        g_free (reverse_element_path);
+    name = bsearch (element_name,
+                    element_names,
+                    N_ELEMENTS,
+                    sizeof (element_names[0]),
+                    compare_element_name);
+    if (name != NULL && element_stack->depth < MAX_ELEMENT_DEPTH) {
+        *element_id = name - element_names;
+        if (transitions[element_stack_top (element_stack)] &
+            ELEMENT_BIT(*element_id))
+            return TRUE;
+    }
 
-        return FALSE;
+    string = g_string_sized_new (64);
+    for (i = 0; i < element_stack->depth; i++) {
+        if (i > 0)
+            g_string_append_c (string, '/');
+        g_string_append (string, element_names[element_stack->ids[i]]);
     }
-    return TRUE;
+    g_set_error (error,
+                 G_MARKUP_ERROR,
+                 G_MARKUP_ERROR_UNKNOWN_ELEMENT,
+                 "%s cannot appear as %s",
+                 element_name,
+                 string->len > 0 ? string->str : "document element");
+    g_string_free (string, TRUE);
+    return FALSE;
 }
 
+/* Map the file at PATH and feed it to PCONTEXT in one call, so the
+   contents are neither copied into a buffer nor split into chunks. */
 static gboolean
 parse (GMarkupParseContext *pcontext,
-       GInputStream        *input,
+       const gchar         *path,
        GError             **error)
 {
-    gchar buffer[BUFSIZE];
-
-    while (1) {
-        gssize nread = g_input_stream_read (input,
-                                            buffer,
-                                            sizeof (buffer),
-                                            NULL,
-                                            error);
-        if (nread < 0)
-            return FALSE;
+    GMappedFile *mapped_file;
+    gsize length;
+    gboolean retval = TRUE;
 
-        if (nread == 0)
-            break;
+    mapped_file = g_mapped_file_new (path, FALSE, error);
+    if (mapped_file == NULL)
+        return FALSE;
 
-        if (!g_markup_parse_context_parse (pcontext, buffer, nread, error))
-            return FALSE;
-    }
+    length = g_mapped_file_get_length (mapped_file);
+    if (length > 0)
+        retval = g_markup_parse_context_parse (pcontext,
+                                               g_mapped_file_get_contents (mapped_file),
+                                               length,
+                                               error);
+    if (retval)
+        retval = g_markup_parse_context_end_parse (pcontext, error);
 
-    return g_markup_parse_context_end_parse (pcontext, error);
+    g_mapped_file_unref (mapped_file);
+    return retval;
 }
 
 static const gchar *
@@ -80,6 +80,7 @@ GType               eek_xml_layout_get_type    (void) G_GNUC_CONST;
 EekLayout          *eek_xml_layout_new         (const gchar        *id,
                                                 GError            **error);
 GList              *eek_xml_list_keyboards     (void);
+EekXmlKeyboardDesc *eek_xml_find_keyboard      (const gchar        *id);
 
 EekXmlKeyboardDesc *eek_xml_keyboard_desc_copy (EekXmlKeyboardDesc *desc);
 void                eek_xml_keyboard_desc_free (EekXmlKeyboardDesc *desc);
@@ -21,8 +21,14 @@
 import sys
 import re
 
+by_name = len(sys.argv) == 3 and sys.argv[1] == '--by-name'
+by_unichar = len(sys.argv) == 3 and sys.argv[1] == '--by-unichar'
+if by_name or by_unichar:
+    del sys.argv[1]
+
 if len(sys.argv) != 2:
-    print >> sys.stderr, "Usage: %s TABLE-NAME" % sys.argv[0]
+    print >> sys.stderr, \
+        "Usage: %s [--by-name|--by-unichar] TABLE-NAME" % sys.argv[0]
     sys.exit(-1)
 
 table = dict()
@@ -32,14 +38,54 @@ for line in sys.stdin:
     if match:
         table[int(match.group(1), 16)] = (match.group(2), match.group(3))
 
+entries = [(keysym, table[keysym]) for keysym in sorted(table.keys())]
+
 sys.stdout.write("static const EekKeysymEntry %s[] = {\n" %
                  sys.argv[1])
 
-for index, (keysym, (l, c)) in enumerate([(keysym, table[keysym])
-                                          for keysym in sorted(table.keys())]):
+for index, (keysym, (l, c)) in enumerate(entries):
     sys.stdout.write("    { 0x%X, %s, %s }" %
                      (keysym, l.encode('UTF-8'), c.encode('UTF-8')))
     if index < len(table) - 1:
         sys.stdout.write(",")
     sys.stdout.write("\n")
 sys.stdout.write("};\n")
+
+if by_name:
+    # Indices into the table above, sorted by the unquoted name in
+    # strcmp() order for bsearch().  When several keysyms share a
+    # name, only the smallest keysym is kept.
+    names = dict()
+    for index, (keysym, (l, c)) in enumerate(entries):
+        name = l.encode('UTF-8')[1:-1].decode('string_escape')
+        if name not in names:
+            names[name] = index
+
+    sys.stdout.write("\nstatic const guint16 %s_by_name[] = {\n" %
+                     sys.argv[1])
+    for index, name in enumerate(sorted(names.keys())):
+        sys.stdout.write("    %d" % names[name])
+        if index < len(names) - 1:
+            sys.stdout.write(",")
+        sys.stdout.write("\n")
+    sys.stdout.write("};\n")
+
+if by_unichar:
+    # Pairs of the character in each name and its keysym, sorted by
+    # character for bsearch().  When several keysyms produce the
+    # same character, only the smallest keysym is kept.
+    unichars = dict()
+    for keysym, (l, c) in entries:
+        name = l.encode('UTF-8')[1:-1].decode('string_escape')
+        name = name.decode('UTF-8')
+        if len(name) == 1 and ord(name) not in unichars:
+            unichars[ord(name)] = keysym
+
+    sys.stdout.write("\nstatic const EekUnicharEntry %s_by_unichar[] = {\n" %
+                     sys.argv[1])
+    for index, uc in enumerate(sorted(unichars.keys())):
+        sys.stdout.write("    { 0x%X, 0x%X }" % (uc, unichars[uc]))
+        if index < len(unichars) - 1:
+            sys.stdout.write(",")
+        sys.stdout.write("\n")
+    sys.stdout.write("};\n")
@@ -199,7 +199,9 @@ on_context_destroyed (EekboardContext *context,
  * @client_name: name of the client
  * @cancellable: a #GCancellable
  *
- * Create a new input context.
+ * Create a new input context.  If eekboard-server supports it, the
+ * context is connected directly to the server rather than through
+ * the bus.
  *
  * Return value: (transfer full): a newly created #EekboardContext.
  */
@@ -209,7 +211,7 @@ eekboard_client_create_context (EekboardClient *client,
                                 GCancellable   *cancellable)
 {
     GVariant *variant;
-    const gchar *object_path;
+    const gchar *object_path, *peer_address = "", *peer_token = "";
     EekboardContext *context;
     GError *error;
     GDBusConnection *connection;
@@ -219,19 +221,35 @@ eekboard_client_create_context (EekboardClient *client,
 
     error = NULL;
     variant = g_dbus_proxy_call_sync (G_DBUS_PROXY(client),
-                                      "CreateContext",
+                                      "CreatePeerContext",
                                       g_variant_new ("(s)", client_name),
                                       G_DBUS_CALL_FLAGS_NONE,
                                       -1,
                                       cancellable,
                                       &error);
+    if (variant)
+        g_variant_get (variant, "(&s&s&s)",
+                       &object_path, &peer_address, &peer_token);
+    else if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+        /* older server */
+        g_error_free (error);
+        error = NULL;
+        variant = g_dbus_proxy_call_sync (G_DBUS_PROXY(client),
+                                          "CreateContext",
+                                          g_variant_new ("(s)", client_name),
+                                          G_DBUS_CALL_FLAGS_NONE,
+                                          -1,
+                                          cancellable,
+                                          &error);
+        if (variant)
+            g_variant_get (variant, "(&s)", &object_path);
+    }
     if (!variant) {
         g_warning ("failed to call CreateContext: %s", error->message);
         g_error_free (error);
         return NULL;
     }
 
-    g_variant_get (variant, "(&s)", &object_path);
     connection = g_dbus_proxy_get_connection (G_DBUS_PROXY(client));
     context = eekboard_context_new (connection, object_path, cancellable);
     if (!context) {
@@ -239,11 +257,23 @@ eekboard_client_create_context (EekboardClient *client,
         return NULL;
     }
 
+    if (*peer_address != '\0' &&
+        !eekboard_context_connect_peer (context,
+                                        peer_address,
+                                        peer_token,
+                                        cancellable,
+                                        &error)) {
+        g_warning ("can't connect to %s, using the bus: %s",
+                   peer_address, error->message);
+        g_error_free (error);
+    }
+
     g_hash_table_insert (client->priv->context_hash,
                          g_strdup (object_path),
                          g_object_ref (context));
     g_signal_connect (context, "destroyed",
                       G_CALLBACK(on_context_destroyed), client);
+    g_variant_unref (variant);
     return context;
 }
 
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EEKBOARD_CONTEXT_SERVICE_PRIVATE_H
+#define EEKBOARD_CONTEXT_SERVICE_PRIVATE_H 1
+
+#include "eekboard/eekboard-context-service.h"
+#include "eekboard/eekboard-keyboard-cache.h"
+
+G_BEGIN_DECLS
+
+/* Let CONTEXT share the keyboards in CACHE, which EekboardService
+   does for every context it creates.  Must be called before any
+   keyboard is added. */
+void _eekboard_context_service_set_keyboard_cache
+                                   (EekboardContextService *context,
+                                    EekboardKeyboardCache  *cache);
+
+G_END_DECLS
+#endif  /* EEKBOARD_CONTEXT_SERVICE_PRIVATE_H */
@@ -29,18 +29,26 @@
 #include "config.h"
 #endif  /* HAVE_CONFIG_H */
 
-#include "eekboard/eekboard-context-service.h"
-#include "eekboard/eekboard-xklutil.h"
-#include "eek/eek-xkl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gio/gunixfdlist.h>
 
-#define CSW 640
-#define CSH 480
+#include "eekboard/eekboard-context-service.h"
+#include "eekboard/eekboard-context-service-private.h"
+#include "eekboard/eekboard-keyboard-cache.h"
+#include "eekboard/eekboard-key-ring.h"
+#include "eekboard/eekboard-key-repeat.h"
 
 enum {
     PROP_0,
     PROP_OBJECT_PATH,
     PROP_CONNECTION,
     PROP_CLIENT_NAME,
+    PROP_OWNER,
+    PROP_BROADCAST,
     PROP_KEYBOARD,
     PROP_VISIBLE,
     PROP_FULLSCREEN,
@@ -61,28 +69,80 @@ static guint signals[LAST_SIGNAL] = { 0, };
 
 struct _EekboardContextServicePrivate {
     GDBusConnection *connection;
-    GDBusNodeInfo *introspection_data;
     guint registration_id;
     char *object_path;
     char *client_name;
+    char *owner;
 
+    gboolean broadcast;
     gboolean enabled;
     gboolean visible;
     gboolean fullscreen;
 
     EekKeyboard *keyboard;
+    guint keyboard_id;
+    /* keyboard ID -> KeyboardEntry */
     GHashTable *keyboard_hash;
+    /* shared with the other contexts of the service, may be NULL */
+    EekboardKeyboardCache *keyboard_cache;
 
     gulong key_pressed_handler;
     gulong key_released_handler;
 
     EekKey *repeat_key;
-    guint repeat_timeout_id;
+    EekboardKeyRepeat *repeat;
     gboolean repeat_triggered;
 
+    /* cancelled when the context is destroyed */
+    GCancellable *cancellable;
+
+    /* direct connection from the owner, which bypasses the bus */
+    GDBusServer *peer_server;
+    gchar *peer_socket_path;
+    /* handed to the owner with the address, and presented with
+       BindPeer to bind a connection to the context */
+    gchar *peer_token;
+    /* PendingPeer, connections which have not presented the token */
+    GSList *pending_peers;
+    GDBusConnection *peer_connection;
+    guint peer_registration_id;
+
+    /* shared memory KeyActivated transport, see OpenKeyRing */
+    EekboardKeyRing *key_ring;
+};
+
+/* A keyboard added to the context.  Keyboards from the cache are
+   shared with other contexts; the context which holds a keyboard has
+   its state applied to it and gets its key signals, and the others
+   keep their state in STATE until they take the keyboard back.  Keys
+   pressed over D-Bus in the meantime only change STATE. */
+typedef struct _KeyboardEntry KeyboardEntry;
+struct _KeyboardEntry {
+    EekKeyboard *keyboard;
+    /* the cache key, or NULL if the keyboard is not shared */
+    gchar *keyboard_type;
+    EekboardKeyboardCache *cache;
+    EekKeyboardState *state;
+};
+
+/* the context holding a keyboard, stored on the keyboard */
+static GQuark holder_quark = 0;
+
+/* parsed once for all the contexts */
+static GDBusNodeInfo *introspection_data = NULL;
+
+/* Settings read by the contexts.  All of them share one snapshot,
+   made on first use and kept up to date by change notification. */
+typedef struct _SettingsSnapshot SettingsSnapshot;
+struct _SettingsSnapshot {
     GSettings *settings;
+    gboolean repeat;
+    guint repeat_delay;
+    guint repeat_interval;
 };
 
+static SettingsSnapshot *settings_snapshot = NULL;
+
 G_DEFINE_TYPE (EekboardContextService, eekboard_context_service, G_TYPE_OBJECT);
 
 static const gchar introspection_xml[] =
@@ -95,12 +155,19 @@ static const gchar introspection_xml[] =
     "    <method name='RemoveKeyboard'>"
     "      <arg direction='in' type='u' name='keyboard_id'/>"
     "    </method>"
+    "    <method name='GetSymbolTable'>"
+    "      <arg direction='in' type='u' name='keyboard_id'/>"
+    "      <arg direction='out' type='av' name='symbols'/>"
+    "    </method>"
     "    <method name='SetKeyboard'>"
     "      <arg type='u' name='keyboard_id'/>"
     "    </method>"
     "    <method name='SetFullscreen'>"
     "      <arg type='b' name='fullscreen'/>"
     "    </method>"
+    "    <method name='SetBroadcast'>"
+    "      <arg type='b' name='broadcast'/>"
+    "    </method>"
     "    <method name='ShowKeyboard'/>"
     "    <method name='HideKeyboard'/>"
     "    <method name='SetGroup'>"
@@ -112,13 +179,25 @@ static const gchar introspection_xml[] =
     "    <method name='ReleaseKeycode'>"
     "      <arg type='u' name='keycode'/>"
     "    </method>"
+    "    <method name='ProcessKeyEvents'>"
+    "      <arg type='a(ub)' name='events'/>"
+    "    </method>"
+    "    <method name='OpenKeyRing'>"
+    "      <arg direction='out' type='h' name='ring'/>"
+    "      <arg direction='out' type='h' name='notify'/>"
+    "    </method>"
+    "    <method name='BindPeer'>"
+    "      <arg type='s' name='token'/>"
+    "    </method>"
+    "    <method name='UnbindPeer'/>"
     /* signals */
     "    <signal name='Enabled'/>"
     "    <signal name='Disabled'/>"
     "    <signal name='Destroyed'/>"
     "    <signal name='KeyActivated'>"
     "      <arg type='u' name='keycode'/>"
-    "      <arg type='v' name='symbol'/>"
+    "      <arg type='u' name='keyboard_id'/>"
+    "      <arg type='u' name='symbol_id'/>"
     "      <arg type='u' name='modifiers'/>"
     "    </signal>"
     "    <signal name='VisibilityChanged'>"
@@ -130,6 +209,8 @@ static const gchar introspection_xml[] =
     "    <signal name='GroupChanged'>"
     "      <arg type='i' name='group'/>"
     "    </signal>"
+    "    <signal name='PeerBound'/>"
+    "    <signal name='PeerUnbound'/>"
     "  </interface>"
     "</node>";
 
@@ -147,6 +228,11 @@ static void handle_method_call       (GDBusConnection        *connection,
 static void emit_visibility_changed_signal
                                      (EekboardContextService *context,
                                       gboolean                visible);
+static void detach_peer              (EekboardContextService *context);
+static void emit_peer_marker_signal  (EekboardContextService *context,
+                                      const gchar            *signal_name);
+static void stop_peer_server         (EekboardContextService *context);
+static void unhold_keyboard          (EekboardContextService *context);
 
 static const GDBusInterfaceVTable interface_vtable =
 {
@@ -155,7 +241,19 @@ static const GDBusInterfaceVTable interface_vtable =
   NULL
 };
 
-static Display *display = NULL;
+static void
+keyboard_entry_free (KeyboardEntry *entry)
+{
+    g_object_unref (entry->keyboard);
+    if (entry->keyboard_type) {
+        _eekboard_keyboard_cache_release (entry->cache, entry->keyboard_type);
+        _eekboard_keyboard_cache_unref (entry->cache);
+        g_free (entry->keyboard_type);
+    }
+    if (entry->state)
+        eek_keyboard_state_free (entry->state);
+    g_slice_free (KeyboardEntry, entry);
+}
 
 static EekKeyboard *
 eekboard_context_service_real_create_keyboard (EekboardContextService *self,
@@ -165,40 +263,346 @@ eekboard_context_service_real_create_keyboard (EekboardContextService *self,
     EekLayout *layout;
     GError *error;
 
-    if (g_str_has_prefix (keyboard_type, "xkb:")) {
-        XklConfigRec *rec =
-            eekboard_xkl_config_rec_from_string (&keyboard_type[4]);
+    error = NULL;
+    layout = _eekboard_create_layout (keyboard_type, &error);
+    if (layout == NULL) {
+        g_warning ("can't create keyboard %s: %s",
+                   keyboard_type, error->message);
+        g_error_free (error);
+        return NULL;
+    }
+    keyboard = eek_keyboard_new (layout,
+                                 EEKBOARD_KEYBOARD_WIDTH,
+                                 EEKBOARD_KEYBOARD_HEIGHT);
+    g_object_unref (layout);
 
-        if (display == NULL)
-            display = XOpenDisplay (NULL);
+    return keyboard;
+}
 
-        error = NULL;
-        layout = eek_xkl_layout_new (display, &error);
-        if (layout == NULL) {
-            g_warning ("can't create keyboard %s: %s",
-                       keyboard_type, error->message);
-            g_error_free (error);
-            return NULL;
-        }
+static void
+on_layout_keyboard_created (GObject      *source_object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+    GSimpleAsyncResult *result = user_data;
+    EekKeyboard *keyboard;
+    GError *error;
 
-        if (!eek_xkl_layout_set_config (EEK_XKL_LAYOUT(layout), rec)) {
-            g_object_unref (layout);
-            return NULL;
-        }
-    } else {
-        error = NULL;
-        layout = eek_xml_layout_new (keyboard_type, &error);
-        if (layout == NULL) {
-            g_warning ("can't create keyboard %s: %s",
-                       keyboard_type, error->message);
-            g_error_free (error);
-            return NULL;
-        }
+    error = NULL;
+    keyboard = eek_layout_create_keyboard_finish (EEK_LAYOUT(source_object),
+                                                  res,
+                                                  &error);
+    if (keyboard == NULL) {
+        g_simple_async_result_set_from_error (result, error);
+        g_error_free (error);
+    } else
+        g_simple_async_result_set_op_res_gpointer (result,
+                                                   keyboard,
+                                                   g_object_unref);
+    g_simple_async_result_complete (result);
+    g_object_unref (result);
+}
+
+static void
+eekboard_context_service_real_create_keyboard_async
+                                   (EekboardContextService *self,
+                                    const gchar            *keyboard_type,
+                                    GCancellable           *cancellable,
+                                    GAsyncReadyCallback     callback,
+                                    gpointer                user_data)
+{
+    GSimpleAsyncResult *result;
+    EekLayout *layout;
+    GError *error;
+
+    result = g_simple_async_result_new
+        (G_OBJECT(self),
+         callback,
+         user_data,
+         eekboard_context_service_real_create_keyboard_async);
+
+    error = NULL;
+    layout = _eekboard_create_layout (keyboard_type, &error);
+    if (layout == NULL) {
+        g_simple_async_result_set_from_error (result, error);
+        g_error_free (error);
+        g_simple_async_result_complete_in_idle (result);
+        g_object_unref (result);
+        return;
     }
-    keyboard = eek_keyboard_new (layout, CSW, CSH);
+
+    eek_layout_create_keyboard_async (layout,
+                                      EEKBOARD_KEYBOARD_WIDTH,
+                                      EEKBOARD_KEYBOARD_HEIGHT,
+                                      cancellable,
+                                      on_layout_keyboard_created,
+                                      result);
     g_object_unref (layout);
+}
 
-    return keyboard;
+static EekKeyboard *
+eekboard_context_service_real_create_keyboard_finish
+                                   (EekboardContextService *self,
+                                    GAsyncResult           *result,
+                                    GError                **error)
+{
+    GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT(result);
+
+    g_return_val_if_fail (g_simple_async_result_is_valid
+                          (result,
+                           G_OBJECT(self),
+                           eekboard_context_service_real_create_keyboard_async),
+                          NULL);
+
+    if (g_simple_async_result_propagate_error (simple, error))
+        return NULL;
+
+    return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+static void
+on_peer_closed (GDBusConnection *connection,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data)
+{
+    EekboardContextService *context = user_data;
+
+    detach_peer (context);
+}
+
+static void
+detach_peer (EekboardContextService *context)
+{
+    GDBusConnection *connection = context->priv->peer_connection;
+
+    if (connection == NULL)
+        return;
+
+    g_signal_handlers_disconnect_by_func (connection,
+                                          G_CALLBACK(on_peer_closed),
+                                          context);
+    if (context->priv->peer_registration_id > 0) {
+        g_dbus_connection_unregister_object
+            (connection,
+             context->priv->peer_registration_id);
+        context->priv->peer_registration_id = 0;
+    }
+    if (!g_dbus_connection_is_closed (connection))
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+    context->priv->peer_connection = NULL;
+
+    /* signals go through the bus from now on */
+    emit_peer_marker_signal (context, "PeerUnbound");
+}
+
+/* A connection to the peer server, on which the context object is
+   registered only to receive BindPeer. */
+typedef struct _PendingPeer PendingPeer;
+struct _PendingPeer {
+    GDBusConnection *connection;
+    guint registration_id;
+};
+
+static void on_pending_peer_closed (GDBusConnection *connection,
+                                    gboolean         remote_peer_vanished,
+                                    GError          *error,
+                                    gpointer         user_data);
+
+static PendingPeer *
+find_pending_peer (EekboardContextService *context,
+                   GDBusConnection        *connection)
+{
+    GSList *head;
+
+    for (head = context->priv->pending_peers; head; head = head->next) {
+        PendingPeer *peer = head->data;
+        if (peer->connection == connection)
+            return peer;
+    }
+    return NULL;
+}
+
+/* Forget PEER and return its connection, which the caller owns. */
+static GDBusConnection *
+steal_pending_peer (EekboardContextService *context,
+                    PendingPeer            *peer)
+{
+    GDBusConnection *connection = peer->connection;
+
+    context->priv->pending_peers =
+        g_slist_remove (context->priv->pending_peers, peer);
+    g_signal_handlers_disconnect_by_func (connection,
+                                          G_CALLBACK(on_pending_peer_closed),
+                                          context);
+    g_slice_free (PendingPeer, peer);
+    return connection;
+}
+
+static void
+drop_pending_peer (EekboardContextService *context,
+                   PendingPeer            *peer)
+{
+    guint registration_id = peer->registration_id;
+    GDBusConnection *connection = steal_pending_peer (context, peer);
+
+    g_dbus_connection_unregister_object (connection, registration_id);
+    if (!g_dbus_connection_is_closed (connection))
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+}
+
+static void
+on_pending_peer_closed (GDBusConnection *connection,
+                        gboolean         remote_peer_vanished,
+                        GError          *error,
+                        gpointer         user_data)
+{
+    EekboardContextService *context = user_data;
+    PendingPeer *peer = find_pending_peer (context, connection);
+
+    if (peer)
+        drop_pending_peer (context, peer);
+}
+
+static gboolean
+token_equal (const gchar *token1, const gchar *token2)
+{
+    gsize i, length = strlen (token2);
+    guchar diff = 0;
+
+    if (strlen (token1) != length)
+        return FALSE;
+
+    /* don't tell how much of the token was right */
+    for (i = 0; i < length; i++)
+        diff |= token1[i] ^ token2[i];
+    return diff == 0;
+}
+
+/* Handle a call on a connection which is not bound to the context
+   yet.  Only BindPeer with the right token is accepted; anything
+   else closes the connection, so a token can't be guessed. */
+static void
+handle_pending_peer_call (EekboardContextService *context,
+                          GDBusConnection        *connection,
+                          const gchar            *method_name,
+                          GVariant               *parameters,
+                          GDBusMethodInvocation  *invocation)
+{
+    PendingPeer *peer = find_pending_peer (context, connection);
+    const gchar *token;
+    guint registration_id;
+
+    if (peer != NULL &&
+        context->priv->peer_token != NULL &&
+        g_strcmp0 (method_name, "BindPeer") == 0) {
+        g_variant_get (parameters, "(&s)", &token);
+        if (token_equal (token, context->priv->peer_token)) {
+            registration_id = peer->registration_id;
+            context->priv->peer_connection =
+                steal_pending_peer (context, peer);
+            context->priv->peer_registration_id = registration_id;
+            g_signal_connect (connection, "closed",
+                              G_CALLBACK(on_peer_closed), context);
+
+            /* the token and the address are good for one connection */
+            stop_peer_server (context);
+
+            g_dbus_method_invocation_return_value (invocation, NULL);
+
+            /* signals go through the peer from now on */
+            emit_peer_marker_signal (context, "PeerBound");
+            return;
+        }
+    }
+
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_IO_ERROR,
+                                           G_IO_ERROR_PERMISSION_DENIED,
+                                           "connection not bound to %s",
+                                           context->priv->object_path);
+    if (peer)
+        drop_pending_peer (context, peer);
+}
+
+static gboolean
+on_peer_new_connection (GDBusServer     *server,
+                        GDBusConnection *connection,
+                        gpointer         user_data)
+{
+    EekboardContextService *context = user_data;
+    PendingPeer *peer;
+    GError *error;
+    guint registration_id;
+
+    if (context->priv->peer_connection)
+        return FALSE;
+
+    error = NULL;
+    registration_id = g_dbus_connection_register_object
+        (connection,
+         context->priv->object_path,
+         introspection_data->interfaces[0],
+         &interface_vtable,
+         context,
+         NULL,
+         &error);
+    if (registration_id == 0) {
+        g_warning ("failed to register context object on peer: %s",
+                   error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    peer = g_slice_new (PendingPeer);
+    peer->connection = g_object_ref (connection);
+    peer->registration_id = registration_id;
+    context->priv->pending_peers =
+        g_slist_prepend (context->priv->pending_peers, peer);
+    g_signal_connect (connection, "closed",
+                      G_CALLBACK(on_pending_peer_closed), context);
+    return TRUE;
+}
+
+/* Only processes of the user running the service may connect. */
+static gboolean
+on_authorize_authenticated_peer (GDBusAuthObserver *observer,
+                                 GIOStream         *stream,
+                                 GCredentials      *credentials,
+                                 gpointer           user_data)
+{
+    return credentials != NULL &&
+        g_credentials_get_unix_user (credentials, NULL) == getuid ();
+}
+
+static void
+stop_peer_server (EekboardContextService *context)
+{
+    GSList *head;
+
+    if (context->priv->peer_server) {
+        g_dbus_server_stop (context->priv->peer_server);
+        g_object_unref (context->priv->peer_server);
+        context->priv->peer_server = NULL;
+    }
+
+    if (context->priv->peer_socket_path) {
+        g_unlink (context->priv->peer_socket_path);
+        g_free (context->priv->peer_socket_path);
+        context->priv->peer_socket_path = NULL;
+    }
+
+    g_free (context->priv->peer_token);
+    context->priv->peer_token = NULL;
+
+    head = context->priv->pending_peers;
+    while (head) {
+        PendingPeer *peer = head->data;
+        head = head->next;
+        drop_pending_peer (context, peer);
+    }
 }
 
 static void
@@ -247,6 +651,14 @@ eekboard_context_service_set_property (GObject      *object,
             g_free (context->priv->client_name);
         context->priv->client_name = g_value_dup_string (value);
         break;
+    case PROP_OWNER:
+        if (context->priv->owner)
+            g_free (context->priv->owner);
+        context->priv->owner = g_value_dup_string (value);
+        break;
+    case PROP_BROADCAST:
+        context->priv->broadcast = g_value_get_boolean (value);
+        break;
     case PROP_KEYBOARD:
         if (context->priv->keyboard)
             g_object_unref (context->priv->keyboard);
@@ -287,6 +699,12 @@ eekboard_context_service_get_property (GObject    *object,
     case PROP_CLIENT_NAME:
         g_value_set_string (value, context->priv->client_name);
         break;
+    case PROP_OWNER:
+        g_value_set_string (value, context->priv->owner);
+        break;
+    case PROP_BROADCAST:
+        g_value_set_boolean (value, context->priv->broadcast);
+        break;
     case PROP_KEYBOARD:
         g_value_set_object (value, context->priv->keyboard);
         break;
@@ -307,11 +725,38 @@ eekboard_context_service_dispose (GObject *object)
 {
     EekboardContextService *context = EEKBOARD_CONTEXT_SERVICE(object);
 
+    if (context->priv->cancellable) {
+        g_cancellable_cancel (context->priv->cancellable);
+        g_object_unref (context->priv->cancellable);
+        context->priv->cancellable = NULL;
+    }
+
     if (context->priv->keyboard_hash) {
+        unhold_keyboard (context);
+        context->priv->keyboard = NULL;
         g_hash_table_destroy (context->priv->keyboard_hash);
         context->priv->keyboard_hash = NULL;
     }
 
+    if (context->priv->keyboard_cache) {
+        _eekboard_keyboard_cache_unref (context->priv->keyboard_cache);
+        context->priv->keyboard_cache = NULL;
+    }
+
+    /* after the keyboard is let go, which stops the repeat */
+    if (context->priv->repeat) {
+        _eekboard_key_repeat_free (context->priv->repeat);
+        context->priv->repeat = NULL;
+    }
+
+    if (context->priv->key_ring) {
+        eekboard_key_ring_free (context->priv->key_ring);
+        context->priv->key_ring = NULL;
+    }
+
+    detach_peer (context);
+    stop_peer_server (context);
+
     if (context->priv->connection) {
         if (context->priv->registration_id > 0) {
             g_dbus_connection_unregister_object (context->priv->connection,
@@ -323,11 +768,6 @@ eekboard_context_service_dispose (GObject *object)
         context->priv->connection = NULL;
     }
 
-    if (context->priv->introspection_data) {
-        g_dbus_node_info_unref (context->priv->introspection_data);
-        context->priv->introspection_data = NULL;
-    }
-
     G_OBJECT_CLASS (eekboard_context_service_parent_class)->
         dispose (object);
 }
@@ -339,6 +779,7 @@ eekboard_context_service_finalize (GObject *object)
 
     g_free (context->priv->object_path);
     g_free (context->priv->client_name);
+    g_free (context->priv->owner);
 
     G_OBJECT_CLASS (eekboard_context_service_parent_class)->
         finalize (object);
@@ -354,7 +795,7 @@ eekboard_context_service_constructed (GObject *object)
         context->priv->registration_id = g_dbus_connection_register_object
             (context->priv->connection,
              context->priv->object_path,
-             context->priv->introspection_data->interfaces[0],
+             introspection_data->interfaces[0],
              &interface_vtable,
              context,
              NULL,
@@ -373,11 +814,28 @@ eekboard_context_service_class_init (EekboardContextServiceClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
     GParamSpec *pspec;
+    GError *error;
 
     g_type_class_add_private (gobject_class,
                               sizeof (EekboardContextServicePrivate));
 
+    holder_quark =
+        g_quark_from_static_string ("eekboard-context-service-holder");
+
+    error = NULL;
+    introspection_data = g_dbus_node_info_new_for_xml (introspection_xml,
+                                                       &error);
+    if (introspection_data == NULL) {
+        g_warning ("failed to parse D-Bus XML: %s", error->message);
+        g_error_free (error);
+        g_assert_not_reached ();
+    }
+
     klass->create_keyboard = eekboard_context_service_real_create_keyboard;
+    klass->create_keyboard_async =
+        eekboard_context_service_real_create_keyboard_async;
+    klass->create_keyboard_finish =
+        eekboard_context_service_real_create_keyboard_finish;
     klass->show_keyboard = eekboard_context_service_real_show_keyboard;
     klass->hide_keyboard = eekboard_context_service_real_hide_keyboard;
 
@@ -480,6 +938,37 @@ eekboard_context_service_class_init (EekboardContextServiceClass *klass)
                                      PROP_CLIENT_NAME,
                                      pspec);
 
+    /**
+     * EekboardContextService:owner:
+     *
+     * Unique bus name of the client who created this context service.
+     * Signals are addressed to it unless
+     * #EekboardContextService:broadcast is set.
+     */
+    pspec = g_param_spec_string ("owner",
+                                 "Owner",
+                                 "Owner",
+                                 NULL,
+                                 G_PARAM_READWRITE);
+    g_object_class_install_property (gobject_class,
+                                     PROP_OWNER,
+                                     pspec);
+
+    /**
+     * EekboardContextService:broadcast:
+     *
+     * Flag to indicate if signals are broadcast to every client on
+     * the bus instead of being sent only to the owner.
+     */
+    pspec = g_param_spec_boolean ("broadcast",
+                                  "Broadcast",
+                                  "Broadcast",
+                                  FALSE,
+                                  G_PARAM_READWRITE);
+    g_object_class_install_property (gobject_class,
+                                     PROP_BROADCAST,
+                                     pspec);
+
     /**
      * EekboardContextService:keyboard:
      *
@@ -524,27 +1013,50 @@ eekboard_context_service_class_init (EekboardContextServiceClass *klass)
 }
 
 static void
-eekboard_context_service_init (EekboardContextService *self)
+read_settings (SettingsSnapshot *snapshot)
 {
-    GError *error;
+    snapshot->repeat = g_settings_get_boolean (snapshot->settings, "repeat");
+    g_settings_get (snapshot->settings,
+                    "repeat-delay", "u", &snapshot->repeat_delay);
+    g_settings_get (snapshot->settings,
+                    "repeat-interval", "u", &snapshot->repeat_interval);
+}
 
-    self->priv = EEKBOARD_CONTEXT_SERVICE_GET_PRIVATE(self);
-    error = NULL;
-    self->priv->introspection_data =
-        g_dbus_node_info_new_for_xml (introspection_xml, &error);
-    if (self->priv->introspection_data == NULL) {
-        g_warning ("failed to parse D-Bus XML: %s", error->message);
-        g_error_free (error);
-        g_assert_not_reached ();
+static void
+on_settings_changed (GSettings   *settings,
+                     const gchar *key,
+                     gpointer     user_data)
+{
+    read_settings (user_data);
+}
+
+static const SettingsSnapshot *
+get_settings (void)
+{
+    if (settings_snapshot == NULL) {
+        settings_snapshot = g_slice_new0 (SettingsSnapshot);
+        settings_snapshot->settings =
+            g_settings_new ("org.fedorahosted.eekboard");
+        g_signal_connect (settings_snapshot->settings, "changed",
+                          G_CALLBACK(on_settings_changed), settings_snapshot);
+        read_settings (settings_snapshot);
     }
+    return settings_snapshot;
+}
+
+/* Only the state of this context is made here; what can be shared
+   between contexts is made once, in class_init() or on first use. */
+static void
+eekboard_context_service_init (EekboardContextService *self)
+{
+    self->priv = EEKBOARD_CONTEXT_SERVICE_GET_PRIVATE(self);
 
     self->priv->keyboard_hash =
         g_hash_table_new_full (g_direct_hash,
                                g_direct_equal,
                                NULL,
-                               (GDestroyNotify)g_object_unref);
-
-    self->priv->settings = g_settings_new ("org.fedorahosted.eekboard");
+                               (GDestroyNotify)keyboard_entry_free);
+    self->priv->cancellable = g_cancellable_new ();
 }
 
 static void
@@ -560,129 +1072,256 @@ disconnect_keyboard_signals (EekboardContextService *context)
                                      context->priv->key_released_handler);
 }
 
-static void
-emit_visibility_changed_signal (EekboardContextService *context,
-                                gboolean                visible)
+/* Signals go only to the owner, so that other clients on the bus
+   are not woken up by every key press.  Observers which want them
+   can opt in with SetBroadcast. */
+static const gchar *
+get_signal_destination (EekboardContextService *context)
 {
-    if (context->priv->connection && context->priv->enabled) {
-        GError *error = NULL;
-        gboolean retval;
-
-        retval = g_dbus_connection_emit_signal (context->priv->connection,
-                                                NULL,
-                                                context->priv->object_path,
-                                                EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                                "VisibilityChanged",
-                                                g_variant_new ("(b)", visible),
-                                                &error);
-        if (!retval) {
-            g_warning ("failed to emit VisibilityChanged signal: %s",
-                       error->message);
-            g_error_free (error);
-            g_assert_not_reached ();
-        }
-    }
+    if (context->priv->broadcast)
+        return NULL;
+    return context->priv->owner;
 }
 
+/* If the owner is connected directly, send signals only through that
+   connection, and additionally on the bus when broadcast is
+   enabled. */
 static void
-emit_group_changed_signal (EekboardContextService *context,
-                           gint                    group)
+emit_signal (EekboardContextService *context,
+             const gchar            *signal_name,
+             GVariant               *parameters)
 {
-    if (context->priv->connection && context->priv->enabled) {
-        GError *error = NULL;
-        gboolean retval;
+    GError *error;
+    gboolean retval;
 
-        retval = g_dbus_connection_emit_signal (context->priv->connection,
+    if (parameters)
+        g_variant_ref_sink (parameters);
+
+    if (context->priv->peer_connection) {
+        error = NULL;
+        retval = g_dbus_connection_emit_signal (context->priv->peer_connection,
                                                 NULL,
                                                 context->priv->object_path,
                                                 EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                                "GroupChanged",
-                                                g_variant_new ("(i)", group),
+                                                signal_name,
+                                                parameters,
                                                 &error);
+        /* the peer may have just gone away; fall back to the bus
+           without waiting for the closed signal.  detach_peer()
+           sends PeerUnbound first, so the client takes this signal
+           from the bus. */
         if (!retval) {
-            g_warning ("failed to emit GroupChanged signal: %s",
-                       error->message);
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
+                g_warning ("failed to emit %s signal to peer: %s",
+                           signal_name, error->message);
             g_error_free (error);
-            g_assert_not_reached ();
+            detach_peer (context);
         }
     }
-}
-
-static void
-emit_key_activated_dbus_signal (EekboardContextService *context,
-                                EekKey                 *key)
-{
-    if (context->priv->connection && context->priv->enabled) {
-        guint keycode = eek_key_get_keycode (key);
-        EekSymbol *symbol = eek_key_get_symbol_with_fallback (key, 0, 0);
-        guint modifiers = eek_keyboard_get_modifiers (context->priv->keyboard);
-        GVariant *variant;
-        GError *error;
-        gboolean retval;
-
-        variant = eek_serializable_serialize (EEK_SERIALIZABLE(symbol));
 
+    if (context->priv->peer_connection == NULL || context->priv->broadcast) {
         error = NULL;
         retval = g_dbus_connection_emit_signal (context->priv->connection,
-                                                NULL,
+                                                get_signal_destination (context),
                                                 context->priv->object_path,
                                                 EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                                "KeyActivated",
-                                                g_variant_new ("(uvu)",
-                                                               keycode,
-                                                               variant,
-                                                               modifiers),
+                                                signal_name,
+                                                parameters,
                                                 &error);
         if (!retval) {
-            g_warning ("failed to emit KeyActivated signal: %s",
-                       error->message);
+            g_warning ("failed to emit %s signal: %s",
+                       signal_name, error->message);
             g_error_free (error);
             g_assert_not_reached ();
         }
     }
-}
 
-static gboolean on_repeat_timeout (EekboardContextService *context);
+    if (parameters)
+        g_variant_unref (parameters);
+}
 
-static gboolean
-on_repeat_timeout (EekboardContextService *context)
+/* PeerBound and PeerUnbound tell the owner where on the bus the
+   signals start and stop coming through the peer connection: signals
+   on the bus between the two are copies sent for broadcast. */
+static void
+emit_peer_marker_signal (EekboardContextService *context,
+                         const gchar            *signal_name)
 {
-    guint delay;
+    GError *error;
 
-    g_settings_get (context->priv->settings, "repeat-interval", "u", &delay);
+    if (context->priv->connection == NULL)
+        return;
 
-    emit_key_activated_dbus_signal (context, context->priv->repeat_key);
+    error = NULL;
+    if (!g_dbus_connection_emit_signal (context->priv->connection,
+                                        context->priv->owner,
+                                        context->priv->object_path,
+                                        EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+                                        signal_name,
+                                        NULL,
+                                        &error)) {
+        g_warning ("failed to emit %s signal: %s",
+                   signal_name, error->message);
+        g_error_free (error);
+    }
+}
+
+static void
+emit_visibility_changed_signal (EekboardContextService *context,
+                                gboolean                visible)
+{
+    if (context->priv->connection && context->priv->enabled)
+        emit_signal (context,
+                     "VisibilityChanged",
+                     g_variant_new ("(b)", visible));
+}
+
+static void
+emit_group_changed_signal (EekboardContextService *context,
+                           gint                    group)
+{
+    if (context->priv->connection && context->priv->enabled)
+        emit_signal (context,
+                     "GroupChanged",
+                     g_variant_new ("(i)", group));
+}
+
+/* Symbols of a keyboard, numbered in the order they are found.
+   KeyActivated refers to a symbol by its number, and clients fetch
+   the whole table once per keyboard with GetSymbolTable. */
+struct _SymbolTable {
+    GPtrArray *symbols;
+    /* EekSymbol * -> symbol id + 1 */
+    GHashTable *ids;
+};
+typedef struct _SymbolTable SymbolTable;
+
+static void
+symbol_table_free (SymbolTable *table)
+{
+    g_ptr_array_free (table->symbols, TRUE);
+    g_hash_table_destroy (table->ids);
+    g_slice_free (SymbolTable, table);
+}
+
+static guint
+symbol_table_add (SymbolTable *table, EekSymbol *symbol)
+{
+    gpointer id = g_hash_table_lookup (table->ids, symbol);
+
+    if (id == NULL) {
+        g_ptr_array_add (table->symbols, g_object_ref (symbol));
+        id = GUINT_TO_POINTER(table->symbols->len);
+        g_hash_table_insert (table->ids, symbol, id);
+    }
+    return GPOINTER_TO_UINT(id) - 1;
+}
+
+static void
+add_key_symbols (EekElement *element, gpointer user_data)
+{
+    SymbolTable *table = user_data;
+    EekSymbolMatrix *matrix;
+    gint i;
+
+    matrix = eek_key_get_symbol_matrix (EEK_KEY(element));
+    if (matrix == NULL)
+        return;
+
+    for (i = 0; i < matrix->num_groups * matrix->num_levels; i++)
+        if (matrix->data[i])
+            symbol_table_add (table, matrix->data[i]);
+}
+
+static void
+add_section_symbols (EekElement *element, gpointer user_data)
+{
+    eek_container_foreach_child (EEK_CONTAINER(element),
+                                 add_key_symbols,
+                                 user_data);
+}
 
-    context->priv->repeat_timeout_id =
-        g_timeout_add (delay,
-                       (GSourceFunc)on_repeat_timeout,
-                       context);
+static SymbolTable *
+get_symbol_table (EekKeyboard *keyboard)
+{
+    SymbolTable *table;
+
+    table = g_object_get_data (G_OBJECT(keyboard), "symbol-table");
+    if (table == NULL) {
+        table = g_slice_new (SymbolTable);
+        table->symbols = g_ptr_array_new_with_free_func (g_object_unref);
+        table->ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+        eek_container_foreach_child (EEK_CONTAINER(keyboard),
+                                     add_section_symbols,
+                                     table);
+        g_object_set_data_full (G_OBJECT(keyboard),
+                                "symbol-table",
+                                table,
+                                (GDestroyNotify)symbol_table_free);
+    }
+    return table;
+}
 
-    return FALSE;
+static void
+emit_key_activated_dbus_signal (EekboardContextService *context,
+                                EekKey                 *key)
+{
+    if (context->priv->connection && context->priv->enabled) {
+        guint keycode = eek_key_get_keycode (key);
+        EekSymbol *symbol = eek_key_get_symbol_with_fallback (key, 0, 0);
+        guint modifiers = eek_keyboard_get_modifiers (context->priv->keyboard);
+        guint keyboard_id, symbol_id;
+
+        keyboard_id = context->priv->keyboard_id;
+        /* A symbol which is not on any key is appended to the table;
+           clients refetch the table when they see an unknown id. */
+        symbol_id = symbol_table_add (get_symbol_table (context->priv->keyboard),
+                                      symbol);
+
+        /* Once the ring is open, keys only go through it and are not
+           seen by broadcast observers.  A key which doesn't fit is
+           dropped and counted in the ring rather than sent by
+           signal, which would overtake the keys still queued. */
+        if (context->priv->key_ring) {
+            EekboardKeyRecord record;
+
+            record.keycode = keycode;
+            record.keyboard_id = keyboard_id;
+            record.symbol_id = symbol_id;
+            record.modifiers = modifiers;
+            eekboard_key_ring_push (context->priv->key_ring, &record);
+            return;
+        }
+
+        emit_signal (context,
+                     "KeyActivated",
+                     g_variant_new ("(uuuu)",
+                                    keycode,
+                                    keyboard_id,
+                                    symbol_id,
+                                    modifiers));
+    }
 }
 
+/* Returns TRUE if the repeat timer was running. */
 static gboolean
-on_repeat_timeout_init (EekboardContextService *context)
+stop_repeat (EekboardContextService *context)
+{
+    return context->priv->repeat &&
+        _eekboard_key_repeat_stop (context->priv->repeat);
+}
+
+static void
+on_repeat_tick (guint count, gpointer user_data)
 {
+    EekboardContextService *context = user_data;
+
     emit_key_activated_dbus_signal (context, context->priv->repeat_key);
 
     /* FIXME: clear modifiers for further key repeat; better not
        depend on modifier behavior is LATCH */
-    eek_keyboard_set_modifiers (context->priv->keyboard, 0);
-    
-    /* reschedule repeat timeout only when "repeat" option is set */
-    if (g_settings_get_boolean (context->priv->settings, "repeat")) {
-        guint delay;
-
-        g_settings_get (context->priv->settings, "repeat-interval", "u", &delay);
-        context->priv->repeat_timeout_id =
-            g_timeout_add (delay,
-                           (GSourceFunc)on_repeat_timeout,
-                           context);
-    } else
-        context->priv->repeat_timeout_id = 0;
-
-    return FALSE;
+    if (count == 1)
+        eek_keyboard_set_modifiers (context->priv->keyboard, 0);
 }
 
 static void
@@ -691,20 +1330,19 @@ on_key_pressed (EekKeyboard *keyboard,
                 gpointer     user_data)
 {
     EekboardContextService *context = user_data;
-    guint delay;
+    const SettingsSnapshot *settings = get_settings ();
 
-    g_settings_get (context->priv->settings, "repeat-delay", "u", &delay);
-
-    if (context->priv->repeat_timeout_id) {
-        g_source_remove (context->priv->repeat_timeout_id);
-        context->priv->repeat_timeout_id = 0;
-    }
+    /* the repeat timer is made when a key is first pressed */
+    if (context->priv->repeat == NULL)
+        context->priv->repeat = _eekboard_key_repeat_new (on_repeat_tick,
+                                                          context);
+    _eekboard_key_repeat_set_timing (context->priv->repeat,
+                                     settings->repeat,
+                                     settings->repeat_delay,
+                                     settings->repeat_interval);
 
     context->priv->repeat_key = key;
-    context->priv->repeat_timeout_id =
-        g_timeout_add (delay,
-                       (GSourceFunc)on_repeat_timeout_init,
-                       context);
+    _eekboard_key_repeat_start (context->priv->repeat);
 }
 
 static void
@@ -714,14 +1352,10 @@ on_key_released (EekKeyboard *keyboard,
 {
     EekboardContextService *context = user_data;
 
-    if (context->priv->repeat_timeout_id > 0) {
-        g_source_remove (context->priv->repeat_timeout_id);
-        context->priv->repeat_timeout_id = 0;
-
+    if (stop_repeat (context))
         /* KeyActivated signal has not been emitted in repeat handler */
         emit_key_activated_dbus_signal (context,
                                         context->priv->repeat_key);
-    }
 }
 
 static void
@@ -737,6 +1371,270 @@ connect_keyboard_signals (EekboardContextService *context)
                           context);
 }
 
+/* Save the state of the keyboard held by CONTEXT and let it go. */
+static void
+release_keyboard (EekboardContextService *context)
+{
+    KeyboardEntry *entry;
+
+    entry = g_hash_table_lookup (context->priv->keyboard_hash,
+                                 GUINT_TO_POINTER(context->priv->keyboard_id));
+    g_assert (entry && entry->keyboard == context->priv->keyboard);
+
+    stop_repeat (context);
+    disconnect_keyboard_signals (context);
+
+    if (entry->keyboard_type) {
+        if (entry->state)
+            eek_keyboard_state_free (entry->state);
+        entry->state = eek_keyboard_get_state (entry->keyboard);
+    }
+    g_object_set_qdata (G_OBJECT(entry->keyboard), holder_quark, NULL);
+}
+
+/* Make CONTEXT hold its current keyboard, taking it from the context
+   which had it. */
+static void
+hold_keyboard (EekboardContextService *context)
+{
+    EekboardContextService *holder;
+    KeyboardEntry *entry;
+
+    if (context->priv->keyboard == NULL)
+        return;
+
+    holder = g_object_get_qdata (G_OBJECT(context->priv->keyboard),
+                                 holder_quark);
+    if (holder == context)
+        return;
+    if (holder)
+        release_keyboard (holder);
+
+    entry = g_hash_table_lookup (context->priv->keyboard_hash,
+                                 GUINT_TO_POINTER(context->priv->keyboard_id));
+    if (entry->state)
+        eek_keyboard_set_state (entry->keyboard, entry->state);
+    connect_keyboard_signals (context);
+    g_object_set_qdata (G_OBJECT(entry->keyboard), holder_quark, context);
+}
+
+static void
+unhold_keyboard (EekboardContextService *context)
+{
+    if (context->priv->keyboard &&
+        g_object_get_qdata (G_OBJECT(context->priv->keyboard),
+                            holder_quark) == context)
+        release_keyboard (context);
+}
+
+/* A client may drive a context in the background, while another
+   context holds the keyboard they share.  Return the saved state of
+   the keyboard of CONTEXT to apply changes to in that case, so that
+   the keys pressed and locked in the other context are left alone.
+   Otherwise, CONTEXT holds the keyboard, taking it if nobody does,
+   and NULL is returned. */
+static EekKeyboardState *
+get_background_state (EekboardContextService *context)
+{
+    EekboardContextService *holder;
+    KeyboardEntry *entry;
+
+    holder = g_object_get_qdata (G_OBJECT(context->priv->keyboard),
+                                 holder_quark);
+    if (holder == NULL)
+        hold_keyboard (context);
+    if (holder == NULL || holder == context)
+        return NULL;
+
+    entry = g_hash_table_lookup (context->priv->keyboard_hash,
+                                 GUINT_TO_POINTER(context->priv->keyboard_id));
+    g_assert (entry && entry->state);
+    return entry->state;
+}
+
+typedef struct _AddKeyboardData AddKeyboardData;
+struct _AddKeyboardData {
+    EekboardContextService *context;
+    GDBusMethodInvocation *invocation;
+    /* set if the keyboard comes from the cache */
+    gchar *keyboard_type;
+    EekboardKeyboardCache *cache;
+};
+
+static void
+on_keyboard_created (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+    AddKeyboardData *data = user_data;
+    EekboardContextService *context = data->context;
+    EekboardContextServiceClass *klass = EEKBOARD_CONTEXT_SERVICE_GET_CLASS(context);
+    GDBusMethodInvocation *invocation = data->invocation;
+    static guint keyboard_id = 0;
+    KeyboardEntry *entry;
+    EekKeyboard *keyboard;
+    GError *error;
+
+    error = NULL;
+    if (data->keyboard_type)
+        keyboard = _eekboard_keyboard_cache_get_finish (data->cache,
+                                                        res,
+                                                        &error);
+    else
+        keyboard = klass->create_keyboard_finish (context, res, &error);
+    if (keyboard == NULL) {
+        g_warning ("can't create keyboard: %s", error->message);
+        g_error_free (error);
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_IO_ERROR,
+                                               G_IO_ERROR_FAILED_HANDLED,
+                                               "can't create a keyboard");
+        goto out;
+    }
+
+    entry = g_slice_new0 (KeyboardEntry);
+    entry->keyboard = keyboard;
+    if (data->keyboard_type) {
+        entry->keyboard_type = data->keyboard_type;
+        data->keyboard_type = NULL;
+        entry->cache = data->cache;
+        data->cache = NULL;
+        entry->state = eek_keyboard_state_copy
+            (_eekboard_keyboard_cache_get_initial_state (entry->cache,
+                                                         entry->keyboard_type));
+    }
+
+    /* The context may have been destroyed while loading. */
+    if (context->priv->keyboard_hash == NULL) {
+        keyboard_entry_free (entry);
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_IO_ERROR,
+                                               G_IO_ERROR_CANCELLED,
+                                               "context is destroyed");
+        goto out;
+    }
+
+    /* a shared keyboard gets the behavior of the context holding it */
+    if (entry->state)
+        eek_keyboard_state_set_modifier_behavior (entry->state,
+                                                  EEK_MODIFIER_BEHAVIOR_LATCH);
+    else
+        eek_keyboard_set_modifier_behavior (keyboard,
+                                            EEK_MODIFIER_BEHAVIOR_LATCH);
+
+    keyboard_id++;
+    g_hash_table_insert (context->priv->keyboard_hash,
+                         GUINT_TO_POINTER(keyboard_id),
+                         entry);
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(u)",
+                                                          keyboard_id));
+
+ out:
+    g_object_unref (data->context);
+    g_free (data->keyboard_type);
+    if (data->cache)
+        _eekboard_keyboard_cache_unref (data->cache);
+    g_slice_free (AddKeyboardData, data);
+}
+
+/* Press or release a key in STATE, as returned by
+   get_background_state(), or on the keyboard if it is NULL. */
+static gboolean
+process_key_event (EekboardContextService *context,
+                   EekKeyboardState       *state,
+                   guint                   keycode,
+                   gboolean                pressed)
+{
+    EekKey *key;
+
+    key = eek_keyboard_find_key_by_keycode (context->priv->keyboard, keycode);
+    if (!key)
+        return FALSE;
+
+    if (state) {
+        if (pressed)
+            eek_keyboard_state_press_key (state, context->priv->keyboard, key);
+        else
+            eek_keyboard_state_release_key (state,
+                                            context->priv->keyboard,
+                                            key);
+    } else if (pressed) {
+        g_signal_handler_block (context->priv->keyboard,
+                                context->priv->key_pressed_handler);
+        g_signal_emit_by_name (key, "pressed");
+        g_signal_handler_unblock (context->priv->keyboard,
+                                  context->priv->key_pressed_handler);
+    } else {
+        g_signal_handler_block (context->priv->keyboard,
+                                context->priv->key_released_handler);
+        g_signal_emit_by_name (key, "released");
+        g_signal_handler_unblock (context->priv->keyboard,
+                                  context->priv->key_released_handler);
+    }
+    return TRUE;
+}
+
+/* The peer connection is the owner's own. */
+static gboolean
+is_owner (EekboardContextService *context,
+          GDBusConnection        *connection,
+          const gchar            *sender)
+{
+    return connection == context->priv->peer_connection ||
+        context->priv->owner == NULL ||
+        g_strcmp0 (context->priv->owner, sender) == 0;
+}
+
+/* g_dbus_method_invocation_return_value() cannot pass file
+   descriptors, so build the reply by hand. */
+static void
+return_key_ring (GDBusConnection       *connection,
+                 GDBusMethodInvocation *invocation,
+                 EekboardKeyRing       *ring)
+{
+    GDBusMessage *reply;
+    GUnixFDList *fd_list;
+    gint fd_index, notify_fd_index = -1;
+    GError *error;
+
+    fd_list = g_unix_fd_list_new ();
+    error = NULL;
+    fd_index = g_unix_fd_list_append (fd_list,
+                                      eekboard_key_ring_get_fd (ring),
+                                      &error);
+    if (fd_index >= 0)
+        notify_fd_index =
+            g_unix_fd_list_append (fd_list,
+                                   eekboard_key_ring_get_notify_fd (ring),
+                                   &error);
+    if (notify_fd_index < 0) {
+        g_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+        g_object_unref (fd_list);
+        return;
+    }
+
+    reply = g_dbus_message_new_method_reply
+        (g_dbus_method_invocation_get_message (invocation));
+    g_dbus_message_set_body (reply,
+                             g_variant_new ("(hh)", fd_index, notify_fd_index));
+    g_dbus_message_set_unix_fd_list (reply, fd_list);
+    if (!g_dbus_connection_send_message (connection,
+                                         reply,
+                                         G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                         NULL,
+                                         &error)) {
+        g_warning ("failed to send key ring: %s", error->message);
+        g_error_free (error);
+    }
+    g_object_unref (reply);
+    g_object_unref (fd_list);
+
+    /* the invocation is ours to release since it was not returned */
+    g_object_unref (invocation);
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const gchar           *sender,
@@ -749,41 +1647,49 @@ handle_method_call (GDBusConnection       *connection,
 {
     EekboardContextService *context = user_data;
     EekboardContextServiceClass *klass = EEKBOARD_CONTEXT_SERVICE_GET_CLASS(context);
-    
-    if (context->priv->repeat_timeout_id) {
-        g_source_remove (context->priv->repeat_timeout_id);
-        context->priv->repeat_timeout_id = 0;
+
+    if (connection != context->priv->connection &&
+        connection != context->priv->peer_connection) {
+        handle_pending_peer_call (context,
+                                  connection,
+                                  method_name,
+                                  parameters,
+                                  invocation);
+        return;
     }
 
+    stop_repeat (context);
+
     if (g_strcmp0 (method_name, "AddKeyboard") == 0) {
         const gchar *keyboard_type;
-        static guint keyboard_id = 0;
-        EekKeyboard *keyboard;
+        AddKeyboardData *data;
 
+        /* The reply is sent from on_keyboard_created(), so loading
+           the keyboard does not block the main loop. */
         g_variant_get (parameters, "(&s)", &keyboard_type);
-        keyboard = klass->create_keyboard (context, keyboard_type);
-
-        if (keyboard == NULL) {
-            g_dbus_method_invocation_return_error (invocation,
-                                                   G_IO_ERROR,
-                                                   G_IO_ERROR_FAILED_HANDLED,
-                                                   "can't create a keyboard");
-            return;
-        }
-
-        eek_keyboard_set_modifier_behavior (keyboard,
-                                            EEK_MODIFIER_BEHAVIOR_LATCH);
-
-        keyboard_id++;
-        g_hash_table_insert (context->priv->keyboard_hash,
-                             GUINT_TO_POINTER(keyboard_id),
-                             keyboard);
-        g_object_set_data (G_OBJECT(keyboard),
-                           "keyboard-id",
-                           GUINT_TO_POINTER(keyboard_id));
-        g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(u)",
-                                                              keyboard_id));
+        data = g_slice_new0 (AddKeyboardData);
+        data->context = g_object_ref (context);
+        data->invocation = invocation;
+
+        /* Keyboards are shared only when they are created in the
+           default way; a subclass may make them differently. */
+        if (context->priv->keyboard_cache &&
+            klass->create_keyboard_async ==
+            eekboard_context_service_real_create_keyboard_async) {
+            data->keyboard_type = g_strdup (keyboard_type);
+            data->cache =
+                _eekboard_keyboard_cache_ref (context->priv->keyboard_cache);
+            _eekboard_keyboard_cache_get_async (context->priv->keyboard_cache,
+                                                keyboard_type,
+                                                context->priv->cancellable,
+                                                on_keyboard_created,
+                                                data);
+        } else
+            klass->create_keyboard_async (context,
+                                          keyboard_type,
+                                          context->priv->cancellable,
+                                          on_keyboard_created,
+                                          data);
         return;
     }
 
@@ -793,12 +1699,11 @@ handle_method_call (GDBusConnection       *connection,
         g_variant_get (parameters, "(u)", &keyboard_id);
 
         if (context->priv->keyboard != NULL) {
-            current_keyboard_id =
-                GPOINTER_TO_UINT (g_object_get_data (G_OBJECT(context->priv->keyboard),
-                                                     "keyboard-id"));
+            current_keyboard_id = context->priv->keyboard_id;
             if (keyboard_id == current_keyboard_id) {
-                disconnect_keyboard_signals (context);
+                unhold_keyboard (context);
                 context->priv->keyboard = NULL;
+                context->priv->keyboard_id = 0;
                 g_object_notify (G_OBJECT(context), "keyboard");
             }
         }
@@ -809,16 +1714,51 @@ handle_method_call (GDBusConnection       *connection,
         return;
     }
 
+    if (g_strcmp0 (method_name, "GetSymbolTable") == 0) {
+        KeyboardEntry *entry;
+        SymbolTable *table;
+        GVariantBuilder builder;
+        guint keyboard_id, i;
+
+        g_variant_get (parameters, "(u)", &keyboard_id);
+
+        entry = g_hash_table_lookup (context->priv->keyboard_hash,
+                                     GUINT_TO_POINTER(keyboard_id));
+        if (!entry) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED_HANDLED,
+                                                   "no such keyboard");
+            return;
+        }
+
+        table = get_symbol_table (entry->keyboard);
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+        for (i = 0; i < table->symbols->len; i++) {
+            EekSerializable *serializable =
+                g_ptr_array_index (table->symbols, i);
+            g_variant_builder_add (&builder,
+                                   "v",
+                                   eek_serializable_serialize (serializable));
+        }
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(av)",
+                                                              &builder));
+        return;
+    }
+
     if (g_strcmp0 (method_name, "SetKeyboard") == 0) {
+        KeyboardEntry *entry;
         EekKeyboard *keyboard;
+        EekboardContextService *holder;
         guint keyboard_id;
         gint group;
 
         g_variant_get (parameters, "(u)", &keyboard_id);
 
-        keyboard = g_hash_table_lookup (context->priv->keyboard_hash,
-                                        GUINT_TO_POINTER(keyboard_id));
-        if (!keyboard) {
+        entry = g_hash_table_lookup (context->priv->keyboard_hash,
+                                     GUINT_TO_POINTER(keyboard_id));
+        if (!entry) {
             g_dbus_method_invocation_return_error (invocation,
                                                    G_IO_ERROR,
                                                    G_IO_ERROR_FAILED_HANDLED,
@@ -826,20 +1766,27 @@ handle_method_call (GDBusConnection       *connection,
             return;
         }
 
-        if (keyboard == context->priv->keyboard) {
+        keyboard = entry->keyboard;
+        if (keyboard_id == context->priv->keyboard_id) {
             g_dbus_method_invocation_return_value (invocation, NULL);
             return;
         }
 
-        if (context->priv->keyboard)
-            disconnect_keyboard_signals (context);
+        unhold_keyboard (context);
 
         context->priv->keyboard = keyboard;
-        connect_keyboard_signals (context);
+        context->priv->keyboard_id = keyboard_id;
+
+        /* Leave a keyboard shared with the context on screen alone
+           until this context is enabled or used. */
+        holder = g_object_get_qdata (G_OBJECT(keyboard), holder_quark);
+        if (holder == NULL || context->priv->enabled)
+            hold_keyboard (context);
 
         g_dbus_method_invocation_return_value (invocation, NULL);
 
-        group = eek_element_get_group (EEK_ELEMENT(context->priv->keyboard));
+        /* only sent when enabled, and then the keyboard is held */
+        group = eek_element_get_group (EEK_ELEMENT(keyboard));
         emit_group_changed_signal (context, group);
 
         g_object_notify (G_OBJECT(context), "keyboard");
@@ -862,7 +1809,98 @@ handle_method_call (GDBusConnection       *connection,
         return;
     }
 
+    if (g_strcmp0 (method_name, "SetBroadcast") == 0) {
+        gboolean broadcast;
+
+        /* only the owner may expose its signals to other clients */
+        if (!is_owner (context, connection, sender)) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_PERMISSION_DENIED,
+                                                   "context at %s not owned by %s",
+                                                   context->priv->object_path,
+                                                   sender);
+            return;
+        }
+
+        g_variant_get (parameters, "(b)", &broadcast);
+
+        if (context->priv->broadcast == broadcast) {
+            g_dbus_method_invocation_return_value (invocation, NULL);
+            return;
+        }
+        context->priv->broadcast = broadcast;
+        g_dbus_method_invocation_return_value (invocation, NULL);
+
+        g_object_notify (G_OBJECT(context), "broadcast");
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "BindPeer") == 0) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_IO_ERROR,
+                                               G_IO_ERROR_FAILED,
+                                               "not a pending peer connection");
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "UnbindPeer") == 0) {
+        if (connection != context->priv->peer_connection) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED,
+                                                   "not a peer connection");
+            return;
+        }
+
+        /* Everything sent through the peer so far, this reply
+           included, reaches the client before the connection is
+           closed; later signals go through the bus after
+           PeerUnbound. */
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        g_dbus_connection_flush_sync (connection, NULL, NULL);
+        detach_peer (context);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "OpenKeyRing") == 0) {
+        GError *error;
+
+        if (!is_owner (context, connection, sender)) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_PERMISSION_DENIED,
+                                                   "context at %s not owned by %s",
+                                                   context->priv->object_path,
+                                                   sender);
+            return;
+        }
+
+        if (!(g_dbus_connection_get_capabilities (connection) &
+              G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING)) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_NOT_SUPPORTED,
+                                                   "connection can't pass file descriptors");
+            return;
+        }
+
+        if (context->priv->key_ring == NULL) {
+            error = NULL;
+            context->priv->key_ring = eekboard_key_ring_new (&error);
+            if (context->priv->key_ring == NULL) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+                return;
+            }
+        }
+
+        return_key_ring (connection, invocation, context->priv->key_ring);
+        return;
+    }
+
     if (g_strcmp0 (method_name, "SetGroup") == 0) {
+        EekKeyboardState *state;
         gint group;
 
         if (!context->priv->keyboard) {
@@ -874,7 +1912,12 @@ handle_method_call (GDBusConnection       *connection,
         }
 
         g_variant_get (parameters, "(i)", &group);
-        eek_element_set_group (EEK_ELEMENT(context->priv->keyboard), group);
+        state = get_background_state (context);
+        if (state)
+            eek_keyboard_state_set_group (state, group);
+        else
+            eek_element_set_group (EEK_ELEMENT(context->priv->keyboard),
+                                   group);
         g_dbus_method_invocation_return_value (invocation, NULL);
         emit_group_changed_signal (context, group);
         return;
@@ -902,8 +1945,8 @@ handle_method_call (GDBusConnection       *connection,
 
     if (g_strcmp0 (method_name, "PressKeycode") == 0 ||
         g_strcmp0 (method_name, "ReleaseKeycode") == 0) {
-        EekKey *key;
         guint keycode;
+        gboolean found;
 
         if (!context->priv->keyboard) {
             g_dbus_method_invocation_return_error (invocation,
@@ -914,9 +1957,11 @@ handle_method_call (GDBusConnection       *connection,
         }
 
         g_variant_get (parameters, "(u)", &keycode);
-        key = eek_keyboard_find_key_by_keycode (context->priv->keyboard, keycode);
-
-        if (!key) {
+        found = process_key_event (context,
+                                   get_background_state (context),
+                                   keycode,
+                                   g_strcmp0 (method_name, "PressKeycode") == 0);
+        if (!found) {
             g_dbus_method_invocation_return_error (invocation,
                                                    G_IO_ERROR,
                                                    G_IO_ERROR_FAILED_HANDLED,
@@ -925,18 +1970,43 @@ handle_method_call (GDBusConnection       *connection,
             return;
         }
 
-        if (g_strcmp0 (method_name, "PressKeycode") == 0) {
-            g_signal_handler_block (context->priv->keyboard,
-                                    context->priv->key_pressed_handler);
-            g_signal_emit_by_name (key, "pressed");
-            g_signal_handler_unblock (context->priv->keyboard,
-                                      context->priv->key_pressed_handler);
-        } else {
-            g_signal_handler_block (context->priv->keyboard,
-                                    context->priv->key_released_handler);
-            g_signal_emit_by_name (key, "released");
-            g_signal_handler_unblock (context->priv->keyboard,
-                                      context->priv->key_released_handler);
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "ProcessKeyEvents") == 0) {
+        EekKeyboardState *state;
+        GVariantIter *iter;
+        guint keycode, missing_keycode = 0;
+        gboolean pressed, found = TRUE;
+
+        if (!context->priv->keyboard) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED_HANDLED,
+                                                   "keyboard is not set");
+            return;
+        }
+
+        /* Apply every event in order, even after an unknown keycode,
+           so that one bad event does not leave keys pressed. */
+        g_variant_get (parameters, "(a(ub))", &iter);
+        state = get_background_state (context);
+        while (g_variant_iter_next (iter, "(ub)", &keycode, &pressed))
+            if (!process_key_event (context, state, keycode, pressed) &&
+                found) {
+                missing_keycode = keycode;
+                found = FALSE;
+            }
+        g_variant_iter_free (iter);
+
+        if (!found) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED_HANDLED,
+                                                   "key for %u is not found",
+                                                   missing_keycode);
+            return;
         }
 
         g_dbus_method_invocation_return_value (invocation, NULL);
@@ -946,6 +2016,19 @@ handle_method_call (GDBusConnection       *connection,
     g_return_if_reached ();
 }
 
+void
+_eekboard_context_service_set_keyboard_cache (EekboardContextService *context,
+                                              EekboardKeyboardCache  *cache)
+{
+    g_return_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context));
+    g_return_if_fail (g_hash_table_size (context->priv->keyboard_hash) == 0);
+
+    if (context->priv->keyboard_cache)
+        _eekboard_keyboard_cache_unref (context->priv->keyboard_cache);
+    context->priv->keyboard_cache = cache ?
+        _eekboard_keyboard_cache_ref (cache) : NULL;
+}
+
 /**
  * eekboard_context_service_enable:
  * @context: an #EekboardContextService
@@ -956,30 +2039,13 @@ handle_method_call (GDBusConnection       *connection,
 void
 eekboard_context_service_enable (EekboardContextService *context)
 {
-    GError *error;
-
     g_return_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context));
     g_return_if_fail (context->priv->connection);
 
     if (!context->priv->enabled) {
-        gboolean retval;
-
         context->priv->enabled = TRUE;
-
-        error = NULL;
-        retval = g_dbus_connection_emit_signal (context->priv->connection,
-                                                NULL,
-                                                context->priv->object_path,
-                                                EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                                "Enabled",
-                                                NULL,
-                                                &error);
-        if (!retval) {
-            g_warning ("failed to emit Enabled signal: %s",
-                       error->message);
-            g_error_free (error);
-            g_assert_not_reached ();
-        }
+        hold_keyboard (context);
+        emit_signal (context, "Enabled", NULL);
         g_signal_emit (context, signals[ENABLED], 0);
     }
 }
@@ -994,30 +2060,12 @@ eekboard_context_service_enable (EekboardContextService *context)
 void
 eekboard_context_service_disable (EekboardContextService *context)
 {
-    GError *error;
-
     g_return_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context));
     g_return_if_fail (context->priv->connection);
 
     if (context->priv->enabled) {
-        gboolean retval;
-
         context->priv->enabled = FALSE;
-
-        error = NULL;
-        retval = g_dbus_connection_emit_signal (context->priv->connection,
-                                                NULL,
-                                                context->priv->object_path,
-                                                EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                                "Disabled",
-                                                NULL,
-                                                &error);
-        if (!retval) {
-            g_warning ("failed to emit Disabled signal: %s",
-                       error->message);
-            g_error_free (error);
-            g_assert_not_reached ();
-        }
+        emit_signal (context, "Disabled", NULL);
         g_signal_emit (context, signals[DISABLED], 0);
     }
 }
@@ -1028,6 +2076,7 @@ eekboard_context_service_show_keyboard (EekboardContextService *context)
     g_return_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context));
     g_return_if_fail (context->priv->connection);
 
+    hold_keyboard (context);
     EEKBOARD_CONTEXT_SERVICE_GET_CLASS(context)->show_keyboard (context);
 }
 
@@ -1049,9 +2098,6 @@ eekboard_context_service_hide_keyboard (EekboardContextService *context)
 void
 eekboard_context_service_destroy (EekboardContextService *context)
 {
-    gboolean retval;
-    GError *error;
-
     g_return_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context));
     g_return_if_fail (context->priv->connection);
 
@@ -1059,20 +2105,11 @@ eekboard_context_service_destroy (EekboardContextService *context)
         eekboard_context_service_disable (context);
     }
 
-    error = NULL;
-    retval = g_dbus_connection_emit_signal (context->priv->connection,
-                                            NULL,
-                                            context->priv->object_path,
-                                            EEKBOARD_CONTEXT_SERVICE_INTERFACE,
-                                            "Destroyed",
-                                            NULL,
-                                            &error);
-    if (!retval) {
-        g_warning ("failed to emit Destroyed signal: %s",
-                   error->message);
-        g_error_free (error);
-        g_assert_not_reached ();
-    }
+    /* Pending AddKeyboard calls hold a reference to the context, so
+       cancel them here rather than waiting for dispose. */
+    g_cancellable_cancel (context->priv->cancellable);
+
+    emit_signal (context, "Destroyed", NULL);
     g_signal_emit (context, signals[DESTROYED], 0);
 }
 
@@ -1114,3 +2151,160 @@ eekboard_context_service_get_client_name (EekboardContextService *context)
 {
     return context->priv->client_name;
 }
+
+/**
+ * eekboard_context_service_get_owner:
+ * @context: an #EekboardContextService
+ *
+ * Get the unique bus name of the client which created @context.
+ * Returns: (transfer none): a string
+ */
+const gchar *
+eekboard_context_service_get_owner (EekboardContextService *context)
+{
+    return context->priv->owner;
+}
+
+/* Escape VALUE for use in a D-Bus address. */
+static gchar *
+escape_address_value (const gchar *value)
+{
+    GString *string = g_string_new (NULL);
+
+    for (; *value != '\0'; value++) {
+        if (g_ascii_isalnum (*value) || strchr ("-_/.\\", *value))
+            g_string_append_c (string, *value);
+        else
+            g_string_append_printf (string, "%%%02x", (guchar) *value);
+    }
+    return g_string_free (string, FALSE);
+}
+
+static gchar *
+generate_peer_token (GError **error)
+{
+    guchar buf[16];
+    GString *string;
+    gssize nread = 0;
+    gint fd;
+    guint i;
+
+    fd = g_open ("/dev/urandom", O_RDONLY, 0);
+    if (fd >= 0) {
+        do
+            nread = read (fd, buf, sizeof buf);
+        while (nread < 0 && errno == EINTR);
+        close (fd);
+    }
+    if (nread != (gssize) sizeof buf) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_FAILED,
+                     "can't read random bytes for peer token");
+        return NULL;
+    }
+
+    string = g_string_sized_new (2 * sizeof buf);
+    for (i = 0; i < sizeof buf; i++)
+        g_string_append_printf (string, "%02x", buf[i]);
+    return g_string_free (string, FALSE);
+}
+
+/**
+ * eekboard_context_service_listen_peer:
+ * @context: an #EekboardContextService
+ * @token: (out) (transfer none): location to store the token
+ * @error: a #GError
+ *
+ * Start listening for a direct D-Bus connection from the owner of
+ * @context.  The socket is created in $XDG_RUNTIME_DIR and only
+ * processes of the same user may connect.  A connection is bound to
+ * @context once it calls BindPeer with @token; then method calls are
+ * also accepted on that connection and signals are sent through it
+ * instead of the bus, until it calls UnbindPeer or is closed.  The
+ * PeerBound and PeerUnbound signals on the bus mark the switch.
+ *
+ * Returns: (transfer none): the address to connect to, or %NULL on
+ * error
+ */
+const gchar *
+eekboard_context_service_listen_peer (EekboardContextService *context,
+                                      const gchar           **token,
+                                      GError                **error)
+{
+    g_return_val_if_fail (EEKBOARD_IS_CONTEXT_SERVICE(context), NULL);
+    g_return_val_if_fail (token != NULL, NULL);
+
+    if (context->priv->peer_server == NULL) {
+        GDBusServer *server;
+        GDBusAuthObserver *observer;
+        const gchar *runtime_dir;
+        gchar *dir, *path, *escaped, *address, *guid, *peer_token;
+
+        /* GDBusServer of glib 2.26 doesn't support unix:dir, so
+           pick the socket path ourselves */
+        runtime_dir = g_getenv ("XDG_RUNTIME_DIR");
+        if (runtime_dir == NULL || *runtime_dir == '\0') {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_NOT_SUPPORTED,
+                         "XDG_RUNTIME_DIR is not set");
+            return NULL;
+        }
+
+        dir = g_build_filename (runtime_dir, "eekboard", NULL);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+            int saved_errno = errno;
+            g_set_error (error,
+                         G_IO_ERROR,
+                         g_io_error_from_errno (saved_errno),
+                         "can't create %s: %s",
+                         dir,
+                         g_strerror (saved_errno));
+            g_free (dir);
+            return NULL;
+        }
+
+        peer_token = generate_peer_token (error);
+        if (peer_token == NULL) {
+            g_free (dir);
+            return NULL;
+        }
+
+        guid = g_dbus_generate_guid ();
+        path = g_strdup_printf ("%s/peer-%s", dir, guid);
+        g_free (dir);
+        escaped = escape_address_value (path);
+        address = g_strdup_printf ("unix:path=%s", escaped);
+        g_free (escaped);
+
+        observer = g_dbus_auth_observer_new ();
+        g_signal_connect (observer, "authorize-authenticated-peer",
+                          G_CALLBACK(on_authorize_authenticated_peer),
+                          context);
+        server = g_dbus_server_new_sync (address,
+                                         G_DBUS_SERVER_FLAGS_NONE,
+                                         guid,
+                                         observer,
+                                         NULL,
+                                         error);
+        g_object_unref (observer);
+        g_free (guid);
+        g_free (address);
+        if (server == NULL) {
+            g_free (path);
+            g_free (peer_token);
+            return NULL;
+        }
+
+        g_signal_connect (server, "new-connection",
+                          G_CALLBACK(on_peer_new_connection), context);
+        g_dbus_server_start (server);
+        context->priv->peer_server = server;
+        context->priv->peer_socket_path = path;
+        context->priv->peer_token = peer_token;
+    }
+
+    *token = context->priv->peer_token;
+    return g_dbus_server_get_client_address (context->priv->peer_server);
+}
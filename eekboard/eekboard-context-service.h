@@ -55,6 +55,10 @@ struct _EekboardContextService {
 /**
  * EekboardContextServiceClass:
  * @create_keyboard: virtual function for create a keyboard from string
+ * @create_keyboard_async: virtual function for create a keyboard from
+ * string asynchronously
+ * @create_keyboard_finish: virtual function for finishing
+ * @create_keyboard_async
  * @show_keyboard: virtual function for show a keyboard
  * @hide_keyboard: virtual function for hide a keyboard
  * @enabled: class handler for #EekboardContextService::enabled signal
@@ -75,9 +79,20 @@ struct _EekboardContextServiceClass {
     void         (*disabled)           (EekboardContextService *self);
     void         (*destroyed)          (EekboardContextService *self);
 
+    void         (*create_keyboard_async)
+                                       (EekboardContextService *self,
+                                        const gchar            *keyboard_type,
+                                        GCancellable           *cancellable,
+                                        GAsyncReadyCallback     callback,
+                                        gpointer                user_data);
+    EekKeyboard *(*create_keyboard_finish)
+                                       (EekboardContextService *self,
+                                        GAsyncResult           *result,
+                                        GError                **error);
+
     /*< private >*/
     /* padding */
-    gpointer pdummy[24];
+    gpointer pdummy[22];
 };
 
 GType         eekboard_context_service_get_type
@@ -95,6 +110,12 @@ gboolean      eekboard_context_service_get_fullscreen
                                               (EekboardContextService *context);
 const gchar * eekboard_context_service_get_client_name
                                               (EekboardContextService *context);
+const gchar * eekboard_context_service_get_owner
+                                              (EekboardContextService *context);
+const gchar * eekboard_context_service_listen_peer
+                                              (EekboardContextService *context,
+                                               const gchar           **token,
+                                               GError                **error);
 
 G_END_DECLS
 #endif  /* EEKBOARD_CONTEXT_SERVICE_H */
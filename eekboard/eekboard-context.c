@@ -28,6 +28,9 @@
 #include "config.h"
 #endif  /* HAVE_CONFIG_H */
 
+#include <unistd.h>
+#include <gio/gunixfdlist.h>
+
 #include "eekboard/eekboard-context.h"
 #include "eekboard/eekboard-marshalers.h"
 
@@ -54,22 +57,96 @@ G_DEFINE_TYPE (EekboardContext, eekboard_context, G_TYPE_DBUS_PROXY);
 #define EEKBOARD_CONTEXT_GET_PRIVATE(obj)                               \
     (G_TYPE_INSTANCE_GET_PRIVATE ((obj), EEKBOARD_TYPE_CONTEXT, EekboardContextPrivate))
 
+/* Where signals come from.  eekboard-server sends PeerBound and
+   PeerUnbound on the bus to mark where signals start and stop coming
+   through the peer connection. */
+typedef enum {
+    /* signals come through the bus */
+    PEER_STATE_NONE,
+    /* bound, but signals sent on the bus before PeerBound may still
+       come; those from the peer are held until PeerBound */
+    PEER_STATE_BINDING,
+    /* signals come through the peer; those on the bus are copies
+       sent for broadcast */
+    PEER_STATE_BOUND,
+    /* PeerUnbound came, but signals sent through the peer before it
+       may still come; those from the bus are held until the peer
+       connection is closed */
+    PEER_STATE_UNBINDING
+} PeerState;
+
 struct _EekboardContextPrivate
 {
     gboolean visible;
     gboolean enabled;
     gboolean fullscreen;
     gint group;
+
+    /* key events queued by eekboard_context_queue_key_event() */
+    GArray *key_events;
+    guint flush_key_events_id;
+
+    /* keyboard ID -> SymbolTable */
+    GHashTable *symbol_tables;
+    guint symbol_table_serial;
+
+    /* direct connection to eekboard-server, see
+       eekboard_context_connect_peer() */
+    GDBusConnection *peer_connection;
+    guint peer_signal_id;
+    /* set once UnbindPeer returned; method calls go through the bus
+       again while the connection delivers the remaining signals */
+    gboolean peer_unbound;
+    PeerState peer_state;
+    /* HeldSignal, see PeerState */
+    GQueue *held_signals;
 };
 
+typedef struct _HeldSignal HeldSignal;
+struct _HeldSignal {
+    gchar *signal_name;
+    GVariant *parameters;
+};
+
+/* Symbols of a keyboard, which KeyActivated refers to by index.
+   The table is fetched asynchronously; key activations which arrive
+   before it, or which refer to symbols added to the server's table
+   since, are queued until it is fetched again. */
+typedef struct _SymbolTable SymbolTable;
+struct _SymbolTable {
+    GPtrArray *symbols;
+    /* identifies the GetSymbolTable call in flight, 0 if none */
+    guint serial;
+    GArray *pending;
+};
+
+typedef struct _PendingKey PendingKey;
+struct _PendingKey {
+    guint keycode;
+    guint symbol_id;
+    guint modifiers;
+};
+
+static void key_activated (EekboardContext *context,
+                           guint            keycode,
+                           guint            keyboard_id,
+                           guint            symbol_id,
+                           guint            modifiers);
+
 static void
-eekboard_context_real_g_signal (GDBusProxy  *self,
-                                const gchar *sender_name,
-                                const gchar *signal_name,
-                                GVariant    *parameters)
+symbol_table_free (SymbolTable *table)
 {
-    EekboardContext *context = EEKBOARD_CONTEXT (self);
+    if (table->symbols)
+        g_ptr_array_unref (table->symbols);
+    g_array_free (table->pending, TRUE);
+    g_slice_free (SymbolTable, table);
+}
 
+static void
+handle_signal (EekboardContext *context,
+               const gchar     *signal_name,
+               GVariant        *parameters)
+{
     if (g_strcmp0 (signal_name, "Enabled") == 0) {
         g_signal_emit (context, signals[ENABLED], 0);
         return;
@@ -86,24 +163,12 @@ eekboard_context_real_g_signal (GDBusProxy  *self,
     }
 
     if (g_strcmp0 (signal_name, "KeyActivated") == 0) {
-        guint keycode;
-        GVariant *variant = NULL;
+        guint keycode, keyboard_id, symbol_id;
         guint modifiers = 0;
-        EekSerializable *serializable;
-
-        g_variant_get (parameters, "(uvu)",
-                       &keycode, &variant, &modifiers);
-        g_return_if_fail (variant != NULL);
-
-        serializable = eek_serializable_deserialize (variant);
-        g_variant_unref (variant);
-
-        g_return_if_fail (EEK_IS_SYMBOL(serializable));
-        
-        g_signal_emit (context, signals[KEY_ACTIVATED], 0,
-                       keycode, EEK_SYMBOL(serializable), modifiers);
-        g_object_unref (serializable);
 
+        g_variant_get (parameters, "(uuuu)",
+                       &keycode, &keyboard_id, &symbol_id, &modifiers);
+        key_activated (context, keycode, keyboard_id, symbol_id, modifiers);
         return;
     }
 
@@ -132,6 +197,142 @@ eekboard_context_real_g_signal (GDBusProxy  *self,
     g_return_if_reached ();
 }
 
+static void
+hold_signal (EekboardContext *context,
+             const gchar     *signal_name,
+             GVariant        *parameters)
+{
+    HeldSignal *held = g_slice_new (HeldSignal);
+
+    held->signal_name = g_strdup (signal_name);
+    held->parameters = parameters ? g_variant_ref (parameters) : NULL;
+    g_queue_push_tail (context->priv->held_signals, held);
+}
+
+static void
+held_signal_free (HeldSignal *held)
+{
+    g_free (held->signal_name);
+    if (held->parameters)
+        g_variant_unref (held->parameters);
+    g_slice_free (HeldSignal, held);
+}
+
+static void
+flush_held_signals (EekboardContext *context)
+{
+    HeldSignal *held;
+
+    while ((held = g_queue_pop_head (context->priv->held_signals)) != NULL) {
+        handle_signal (context, held->signal_name, held->parameters);
+        held_signal_free (held);
+    }
+}
+
+static void
+eekboard_context_real_g_signal (GDBusProxy  *self,
+                                const gchar *sender_name,
+                                const gchar *signal_name,
+                                GVariant    *parameters)
+{
+    EekboardContext *context = EEKBOARD_CONTEXT (self);
+
+    if (g_strcmp0 (signal_name, "PeerBound") == 0) {
+        if (context->priv->peer_state == PEER_STATE_BINDING) {
+            context->priv->peer_state = PEER_STATE_BOUND;
+            flush_held_signals (context);
+        }
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "PeerUnbound") == 0) {
+        if (context->priv->peer_state == PEER_STATE_BOUND)
+            context->priv->peer_state = context->priv->peer_connection ?
+                PEER_STATE_UNBINDING :
+                PEER_STATE_NONE;
+        return;
+    }
+
+    switch (context->priv->peer_state) {
+    case PEER_STATE_BOUND:
+        break;
+    case PEER_STATE_UNBINDING:
+        hold_signal (context, signal_name, parameters);
+        break;
+    default:
+        handle_signal (context, signal_name, parameters);
+        break;
+    }
+}
+
+static void
+on_peer_signal (GDBusConnection *connection,
+                const gchar     *sender_name,
+                const gchar     *object_path,
+                const gchar     *interface_name,
+                const gchar     *signal_name,
+                GVariant        *parameters,
+                gpointer         user_data)
+{
+    EekboardContext *context = user_data;
+
+    if (context->priv->peer_state == PEER_STATE_BINDING)
+        hold_signal (context, signal_name, parameters);
+    else
+        handle_signal (context, signal_name, parameters);
+}
+
+static void
+on_peer_closed (GDBusConnection *connection,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data);
+
+static void
+disconnect_peer (EekboardContext *context)
+{
+    GDBusConnection *connection = context->priv->peer_connection;
+
+    if (connection == NULL)
+        return;
+
+    g_signal_handlers_disconnect_by_func (connection,
+                                          G_CALLBACK(on_peer_closed),
+                                          context);
+    g_dbus_connection_signal_unsubscribe (connection,
+                                          context->priv->peer_signal_id);
+    context->priv->peer_signal_id = 0;
+    if (!g_dbus_connection_is_closed (connection))
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+    context->priv->peer_connection = NULL;
+    context->priv->peer_unbound = FALSE;
+}
+
+/* Go back to the bus once the peer connection delivered everything. */
+static void
+close_peer (EekboardContext *context)
+{
+    disconnect_peer (context);
+    if (context->priv->peer_state == PEER_STATE_UNBINDING) {
+        context->priv->peer_state = PEER_STATE_NONE;
+        flush_held_signals (context);
+    }
+}
+
+static void
+on_peer_closed (GDBusConnection *connection,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data)
+{
+    EekboardContext *context = user_data;
+
+    /* after UnbindPeer, the connection is closed by on_unbind_peer() */
+    if (!context->priv->peer_unbound)
+        close_peer (context);
+}
+
 static void
 eekboard_context_real_enabled (EekboardContext *self)
 {
@@ -174,6 +375,36 @@ eekboard_context_get_property (GObject    *object,
     }
 }
 
+static void
+eekboard_context_dispose (GObject *object)
+{
+    EekboardContext *context = EEKBOARD_CONTEXT(object);
+
+    if (context->priv->flush_key_events_id > 0) {
+        g_source_remove (context->priv->flush_key_events_id);
+        context->priv->flush_key_events_id = 0;
+    }
+
+    disconnect_peer (context);
+
+    G_OBJECT_CLASS (eekboard_context_parent_class)->dispose (object);
+}
+
+static void
+eekboard_context_finalize (GObject *object)
+{
+    EekboardContext *context = EEKBOARD_CONTEXT(object);
+
+    g_array_free (context->priv->key_events, TRUE);
+    g_hash_table_destroy (context->priv->symbol_tables);
+    g_queue_foreach (context->priv->held_signals,
+                     (GFunc)held_signal_free,
+                     NULL);
+    g_queue_free (context->priv->held_signals);
+
+    G_OBJECT_CLASS (eekboard_context_parent_class)->finalize (object);
+}
+
 static void
 eekboard_context_class_init (EekboardContextClass *klass)
 {
@@ -192,6 +423,8 @@ eekboard_context_class_init (EekboardContextClass *klass)
     proxy_class->g_signal = eekboard_context_real_g_signal;
 
     gobject_class->get_property = eekboard_context_get_property;
+    gobject_class->dispose = eekboard_context_dispose;
+    gobject_class->finalize = eekboard_context_finalize;
 
     /**
      * EekboardContext:visible:
@@ -288,6 +521,15 @@ static void
 eekboard_context_init (EekboardContext *self)
 {
     self->priv = EEKBOARD_CONTEXT_GET_PRIVATE(self);
+    self->priv->key_events = g_array_new (FALSE,
+                                          FALSE,
+                                          sizeof (EekboardKeyEvent));
+    self->priv->symbol_tables =
+        g_hash_table_new_full (g_direct_hash,
+                               g_direct_equal,
+                               NULL,
+                               (GDestroyNotify)symbol_table_free);
+    self->priv->held_signals = g_queue_new ();
 }
 
 static void
@@ -358,6 +600,98 @@ eekboard_context_new (GDBusConnection *connection,
     return NULL;
 }
 
+/* While connected directly, every method call goes through the peer
+   connection, so that the server processes the calls in the order
+   they were made. */
+static GDBusConnection *
+get_peer_connection (EekboardContext *context)
+{
+    if (context->priv->peer_unbound)
+        return NULL;
+    return context->priv->peer_connection;
+}
+
+static void
+call_method (EekboardContext    *context,
+             const gchar        *method_name,
+             GVariant           *parameters,
+             GCancellable       *cancellable,
+             GAsyncReadyCallback callback,
+             gpointer            user_data)
+{
+    GDBusConnection *connection = get_peer_connection (context);
+
+    if (connection)
+        g_dbus_connection_call (connection,
+                                NULL,
+                                g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+                                g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+                                method_name,
+                                parameters,
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                cancellable,
+                                callback,
+                                user_data);
+    else
+        g_dbus_proxy_call (G_DBUS_PROXY(context),
+                           method_name,
+                           parameters,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           cancellable,
+                           callback,
+                           user_data);
+}
+
+/* SOURCE_OBJECT is the peer connection or the proxy, whichever
+   call_method() used. */
+static GVariant *
+call_method_finish (GObject      *source_object,
+                    GAsyncResult *res,
+                    GError      **error)
+{
+    if (G_IS_DBUS_PROXY(source_object))
+        return g_dbus_proxy_call_finish (G_DBUS_PROXY(source_object),
+                                         res,
+                                         error);
+    return g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                          res,
+                                          error);
+}
+
+static GVariant *
+call_method_sync (EekboardContext *context,
+                  const gchar     *method_name,
+                  GVariant        *parameters,
+                  GCancellable    *cancellable,
+                  GError         **error)
+{
+    GDBusConnection *connection = get_peer_connection (context);
+
+    if (connection)
+        return g_dbus_connection_call_sync
+            (connection,
+             NULL,
+             g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+             g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+             method_name,
+             parameters,
+             NULL,
+             G_DBUS_CALL_FLAGS_NONE,
+             -1,
+             cancellable,
+             error);
+    return g_dbus_proxy_call_sync (G_DBUS_PROXY(context),
+                                   method_name,
+                                   parameters,
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   cancellable,
+                                   error);
+}
+
 static void
 context_async_ready_callback (GObject      *source_object,
                               GAsyncResult *res,
@@ -366,9 +700,7 @@ context_async_ready_callback (GObject      *source_object,
     GError *error = NULL;
     GVariant *result;
 
-    result = g_dbus_proxy_call_finish (G_DBUS_PROXY(source_object),
-                                       res,
-                                       &error);
+    result = call_method_finish (source_object, res, &error);
     if (result)
         g_variant_unref (result);
     else {
@@ -377,6 +709,193 @@ context_async_ready_callback (GObject      *source_object,
     }
 }
 
+static SymbolTable *
+get_symbol_table (EekboardContext *context, guint keyboard_id)
+{
+    SymbolTable *table;
+
+    table = g_hash_table_lookup (context->priv->symbol_tables,
+                                 GUINT_TO_POINTER(keyboard_id));
+    if (table == NULL) {
+        table = g_slice_new0 (SymbolTable);
+        table->pending = g_array_new (FALSE, FALSE, sizeof (PendingKey));
+        g_hash_table_insert (context->priv->symbol_tables,
+                             GUINT_TO_POINTER(keyboard_id),
+                             table);
+    }
+    return table;
+}
+
+static GPtrArray *
+deserialize_symbol_table (GVariant *result)
+{
+    GVariant *variant;
+    GVariantIter *iter;
+    GPtrArray *symbols;
+
+    symbols = g_ptr_array_new_with_free_func (g_object_unref);
+    g_variant_get (result, "(av)", &iter);
+    while (g_variant_iter_next (iter, "v", &variant)) {
+        EekSerializable *serializable = eek_serializable_deserialize (variant);
+
+        g_variant_unref (variant);
+        if (!EEK_IS_SYMBOL(serializable)) {
+            g_warning ("invalid symbol in GetSymbolTable reply");
+            if (serializable)
+                g_object_unref (serializable);
+            g_ptr_array_unref (symbols);
+            symbols = NULL;
+            break;
+        }
+        g_ptr_array_add (symbols, serializable);
+    }
+    g_variant_iter_free (iter);
+
+    return symbols;
+}
+
+typedef struct _KeyboardCallData KeyboardCallData;
+struct _KeyboardCallData {
+    EekboardContext *context;
+    guint keyboard_id;
+    guint serial;
+};
+
+static KeyboardCallData *
+keyboard_call_data_new (EekboardContext *context,
+                        guint            keyboard_id,
+                        guint            serial)
+{
+    KeyboardCallData *data = g_slice_new (KeyboardCallData);
+
+    data->context = g_object_ref (context);
+    data->keyboard_id = keyboard_id;
+    data->serial = serial;
+    return data;
+}
+
+static void
+keyboard_call_data_free (KeyboardCallData *data)
+{
+    g_object_unref (data->context);
+    g_slice_free (KeyboardCallData, data);
+}
+
+static void
+fetch_symbol_table_ready_callback (GObject      *source_object,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+    KeyboardCallData *data = user_data;
+    EekboardContext *context = data->context;
+    SymbolTable *table;
+    GPtrArray *symbols = NULL;
+    GArray *pending;
+    GVariant *result;
+    GError *error;
+    guint i;
+
+    error = NULL;
+    result = call_method_finish (source_object, res, &error);
+    if (result) {
+        symbols = deserialize_symbol_table (result);
+        g_variant_unref (result);
+    } else {
+        g_warning ("error in GetSymbolTable call: %s", error->message);
+        g_error_free (error);
+    }
+
+    /* the keyboard may have been removed, or fetched again, since */
+    table = g_hash_table_lookup (context->priv->symbol_tables,
+                                 GUINT_TO_POINTER(data->keyboard_id));
+    if (table == NULL || table->serial != data->serial) {
+        if (symbols)
+            g_ptr_array_unref (symbols);
+        keyboard_call_data_free (data);
+        return;
+    }
+
+    table->serial = 0;
+    if (symbols) {
+        if (table->symbols)
+            g_ptr_array_unref (table->symbols);
+        table->symbols = symbols;
+    }
+
+    /* Deliver the queued keys in order.  Handlers may change the
+       table, so work on the queue and symbols taken out of it. */
+    pending = table->pending;
+    table->pending = g_array_new (FALSE, FALSE, sizeof (PendingKey));
+    symbols = table->symbols ? g_ptr_array_ref (table->symbols) : NULL;
+    for (i = 0; i < pending->len; i++) {
+        PendingKey *key = &g_array_index (pending, PendingKey, i);
+
+        if (symbols == NULL || key->symbol_id >= symbols->len) {
+            g_warning ("unknown symbol %u in keyboard %u",
+                       key->symbol_id, data->keyboard_id);
+            continue;
+        }
+        g_signal_emit (context, signals[KEY_ACTIVATED], 0,
+                       key->keycode,
+                       g_ptr_array_index (symbols, key->symbol_id),
+                       key->modifiers);
+    }
+    if (symbols)
+        g_ptr_array_unref (symbols);
+    g_array_free (pending, TRUE);
+    keyboard_call_data_free (data);
+}
+
+/* Fetch the symbol table of a keyboard, unless it is already being
+   fetched. */
+static void
+fetch_symbol_table (EekboardContext *context, guint keyboard_id)
+{
+    SymbolTable *table = get_symbol_table (context, keyboard_id);
+
+    if (table->serial != 0)
+        return;
+
+    table->serial = ++context->priv->symbol_table_serial;
+    if (table->serial == 0)
+        table->serial = ++context->priv->symbol_table_serial;
+
+    call_method (context,
+                 "GetSymbolTable",
+                 g_variant_new ("(u)", keyboard_id),
+                 NULL,
+                 fetch_symbol_table_ready_callback,
+                 keyboard_call_data_new (context, keyboard_id, table->serial));
+}
+
+static void
+key_activated (EekboardContext *context,
+               guint            keycode,
+               guint            keyboard_id,
+               guint            symbol_id,
+               guint            modifiers)
+{
+    SymbolTable *table = get_symbol_table (context, keyboard_id);
+    PendingKey key;
+
+    /* keys queued before this one go first */
+    if (table->pending->len == 0 &&
+        table->symbols != NULL &&
+        symbol_id < table->symbols->len) {
+        g_signal_emit (context, signals[KEY_ACTIVATED], 0,
+                       keycode,
+                       g_ptr_array_index (table->symbols, symbol_id),
+                       modifiers);
+        return;
+    }
+
+    key.keycode = keycode;
+    key.symbol_id = symbol_id;
+    key.modifiers = modifiers;
+    g_array_append_val (table->pending, key);
+    fetch_symbol_table (context, keyboard_id);
+}
+
 /**
  * eekboard_context_add_keyboard:
  * @context: an #EekboardContext
@@ -396,13 +915,11 @@ eekboard_context_add_keyboard (EekboardContext *context,
     g_return_val_if_fail (EEKBOARD_IS_CONTEXT(context), 0);
 
     error = NULL;
-    result = g_dbus_proxy_call_sync (G_DBUS_PROXY(context),
-                                     "AddKeyboard",
-                                     g_variant_new ("(s)", keyboard),
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     cancellable,
-                                     &error);
+    result = call_method_sync (context,
+                               "AddKeyboard",
+                               g_variant_new ("(s)", keyboard),
+                               cancellable,
+                               &error);
 
     if (result) {
         guint keyboard_id;
@@ -410,6 +927,7 @@ eekboard_context_add_keyboard (EekboardContext *context,
         g_variant_get (result, "(u)", &keyboard_id);
         g_variant_unref (result);
 
+        fetch_symbol_table (context, keyboard_id);
         return keyboard_id;
     }
 
@@ -434,14 +952,41 @@ eekboard_context_remove_keyboard (EekboardContext *context,
 {
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
-    g_dbus_proxy_call (G_DBUS_PROXY(context),
-                       "RemoveKeyboard",
-                       g_variant_new ("(u)", keyboard_id),
-                       G_DBUS_CALL_FLAGS_NONE,
-                       -1,
-                       cancellable,
-                       context_async_ready_callback,
-                       NULL);
+    g_hash_table_remove (context->priv->symbol_tables,
+                         GUINT_TO_POINTER(keyboard_id));
+
+    call_method (context,
+                 "RemoveKeyboard",
+                 g_variant_new ("(u)", keyboard_id),
+                 cancellable,
+                 context_async_ready_callback,
+                 NULL);
+}
+
+static void
+set_keyboard_async_ready_callback (GObject      *source_object,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+    KeyboardCallData *data = user_data;
+    SymbolTable *table;
+    GError *error = NULL;
+    GVariant *result;
+
+    result = call_method_finish (source_object, res, &error);
+    if (result == NULL) {
+        g_warning ("error in D-Bus proxy call: %s", error->message);
+        g_error_free (error);
+        keyboard_call_data_free (data);
+        return;
+    }
+    g_variant_unref (result);
+
+    /* the keyboard may have been added by another client */
+    table = get_symbol_table (data->context, data->keyboard_id);
+    if (table->symbols == NULL)
+        fetch_symbol_table (data->context, data->keyboard_id);
+    keyboard_call_data_free (data);
 }
 
 /**
@@ -459,14 +1004,12 @@ eekboard_context_set_keyboard (EekboardContext *context,
 {
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
-    g_dbus_proxy_call (G_DBUS_PROXY(context),
-                       "SetKeyboard",
-                       g_variant_new ("(u)", keyboard_id),
-                       G_DBUS_CALL_FLAGS_NONE,
-                       -1,
-                       cancellable,
-                       context_async_ready_callback,
-                       NULL);
+    call_method (context,
+                 "SetKeyboard",
+                 g_variant_new ("(u)", keyboard_id),
+                 cancellable,
+                 set_keyboard_async_ready_callback,
+                 keyboard_call_data_new (context, keyboard_id, 0));
 }
 
 /**
@@ -485,14 +1028,12 @@ eekboard_context_set_group (EekboardContext *context,
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
     if (context->priv->group != group) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "SetGroup",
-                           g_variant_new ("(i)", group),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
+        call_method (context,
+                     "SetGroup",
+                     g_variant_new ("(i)", group),
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
     }
 }
 
@@ -526,14 +1067,12 @@ eekboard_context_show_keyboard (EekboardContext *context,
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
     if (context->priv->enabled) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "ShowKeyboard",
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
+        call_method (context,
+                     "ShowKeyboard",
+                     NULL,
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
     }
 }
 
@@ -551,14 +1090,12 @@ eekboard_context_hide_keyboard (EekboardContext *context,
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
     if (context->priv->enabled) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "HideKeyboard",
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
+        call_method (context,
+                     "HideKeyboard",
+                     NULL,
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
     }
 }
 
@@ -577,16 +1114,13 @@ eekboard_context_press_keycode (EekboardContext *context,
 {
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
-    if (context->priv->enabled) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "PressKeycode",
-                           g_variant_new ("(u)", keycode),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
-    }
+    if (context->priv->enabled)
+        call_method (context,
+                     "PressKeycode",
+                     g_variant_new ("(u)", keycode),
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
 }
 
 /**
@@ -604,16 +1138,100 @@ eekboard_context_release_keycode (EekboardContext *context,
 {
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
 
-    if (context->priv->enabled) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "ReleaseKeycode",
-                           g_variant_new ("(u)", keycode),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
-    }
+    if (context->priv->enabled)
+        call_method (context,
+                     "ReleaseKeycode",
+                     g_variant_new ("(u)", keycode),
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
+}
+
+/**
+ * eekboard_context_process_key_events:
+ * @context: an #EekboardContext
+ * @events: (array length=n_events): key events
+ * @n_events: length of @events
+ * @cancellable: a #GCancellable
+ *
+ * Tell eekboard-server that keys are pressed or released, in the
+ * order of @events.  Unlike eekboard_context_press_keycode() and
+ * eekboard_context_release_keycode(), all the events are sent in a
+ * single D-Bus message.
+ */
+void
+eekboard_context_process_key_events (EekboardContext        *context,
+                                     const EekboardKeyEvent *events,
+                                     guint                   n_events,
+                                     GCancellable           *cancellable)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
+    g_return_if_fail (events != NULL || n_events == 0);
+
+    if (!context->priv->enabled || n_events == 0)
+        return;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ub)"));
+    for (i = 0; i < n_events; i++)
+        g_variant_builder_add (&builder,
+                               "(ub)",
+                               events[i].keycode,
+                               events[i].pressed);
+    call_method (context,
+                 "ProcessKeyEvents",
+                 g_variant_new ("(a(ub))", &builder),
+                 cancellable,
+                 context_async_ready_callback,
+                 NULL);
+}
+
+static gboolean
+on_flush_key_events (gpointer user_data)
+{
+    EekboardContext *context = user_data;
+
+    eekboard_context_process_key_events
+        (context,
+         (const EekboardKeyEvent *)context->priv->key_events->data,
+         context->priv->key_events->len,
+         NULL);
+    g_array_set_size (context->priv->key_events, 0);
+    context->priv->flush_key_events_id = 0;
+    return FALSE;
+}
+
+/**
+ * eekboard_context_queue_key_event:
+ * @context: an #EekboardContext
+ * @keycode: keycode number
+ * @pressed: %TRUE if the key is pressed, %FALSE if released
+ *
+ * Queue a key event for eekboard-server.  Events queued before
+ * @context gets back to the main loop are sent together, as with
+ * eekboard_context_process_key_events().
+ */
+void
+eekboard_context_queue_key_event (EekboardContext *context,
+                                  guint            keycode,
+                                  gboolean         pressed)
+{
+    EekboardKeyEvent event;
+
+    g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
+
+    if (!context->priv->enabled)
+        return;
+
+    event.keycode = keycode;
+    event.pressed = pressed;
+    g_array_append_val (context->priv->key_events, event);
+
+    if (context->priv->flush_key_events_id == 0)
+        context->priv->flush_key_events_id =
+            g_idle_add (on_flush_key_events, context);
 }
 
 /**
@@ -674,13 +1292,361 @@ eekboard_context_set_fullscreen (EekboardContext *context,
 {
     g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
     if (context->priv->fullscreen != fullscreen) {
-        g_dbus_proxy_call (G_DBUS_PROXY(context),
-                           "SetFullscreen",
-                           g_variant_new ("(b)", fullscreen),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           cancellable,
-                           context_async_ready_callback,
-                           NULL);
+        call_method (context,
+                     "SetFullscreen",
+                     g_variant_new ("(b)", fullscreen),
+                     cancellable,
+                     context_async_ready_callback,
+                     NULL);
+    }
+}
+
+/**
+ * eekboard_context_set_broadcast:
+ * @context: an #EekboardContext
+ * @broadcast: a flag to indicate broadcast mode
+ * @cancellable: a #GCancellable
+ *
+ * Set whether signals of @context are broadcast to every client on
+ * the bus.  By default they are only sent to the client which
+ * created @context; set @broadcast to let other clients observe it.
+ */
+void
+eekboard_context_set_broadcast (EekboardContext *context,
+                                gboolean         broadcast,
+                                GCancellable    *cancellable)
+{
+    g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
+    call_method (context,
+                 "SetBroadcast",
+                 g_variant_new ("(b)", broadcast),
+                 cancellable,
+                 context_async_ready_callback,
+                 NULL);
+}
+
+/**
+ * eekboard_context_connect_peer:
+ * @context: an #EekboardContext
+ * @address: D-Bus address returned by eekboard-server
+ * @token: token returned by eekboard-server along with @address
+ * @cancellable: a #GCancellable
+ * @error: a #GError
+ *
+ * Connect directly to the input context maintained by eekboard-server
+ * at @address, bypassing the bus daemon, and bind the connection to
+ * the context with @token.  Method calls are then sent and signals
+ * received through that connection; if it is closed,
+ * @context goes back to the bus.  This function is seldom called from
+ * applications since eekboard_client_create_context() calls it
+ * implicitly.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+eekboard_context_connect_peer (EekboardContext *context,
+                               const gchar     *address,
+                               const gchar     *token,
+                               GCancellable    *cancellable,
+                               GError         **error)
+{
+    GDBusConnection *connection;
+    GVariant *result;
+
+    g_return_val_if_fail (EEKBOARD_IS_CONTEXT(context), FALSE);
+    g_return_val_if_fail (address != NULL, FALSE);
+    g_return_val_if_fail (token != NULL, FALSE);
+
+    connection = g_dbus_connection_new_for_address_sync
+        (address,
+         G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+         NULL,
+         cancellable,
+         error);
+    if (connection == NULL)
+        return FALSE;
+
+    result = g_dbus_connection_call_sync
+        (connection,
+         NULL,
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+         "BindPeer",
+         g_variant_new ("(s)", token),
+         NULL,
+         G_DBUS_CALL_FLAGS_NONE,
+         -1,
+         cancellable,
+         error);
+    if (result == NULL) {
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+        g_object_unref (connection);
+        return FALSE;
+    }
+    g_variant_unref (result);
+
+    close_peer (context);
+    context->priv->peer_connection = connection;
+    context->priv->peer_state = PEER_STATE_BINDING;
+    context->priv->peer_signal_id =
+        g_dbus_connection_signal_subscribe
+        (connection,
+         NULL,
+         g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+         NULL,
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         NULL,
+         G_DBUS_SIGNAL_FLAGS_NONE,
+         on_peer_signal,
+         context,
+         NULL);
+    g_signal_connect (connection, "closed",
+                      G_CALLBACK(on_peer_closed), context);
+    return TRUE;
+}
+
+typedef struct _UnbindPeerData UnbindPeerData;
+struct _UnbindPeerData {
+    EekboardContext *context;
+    GDBusConnection *connection;
+};
+
+static void
+unbind_peer_data_free (gpointer user_data)
+{
+    UnbindPeerData *data = user_data;
+
+    g_object_unref (data->context);
+    g_object_unref (data->connection);
+    g_slice_free (UnbindPeerData, data);
+}
+
+static gboolean
+on_unbind_peer (gpointer user_data)
+{
+    UnbindPeerData *data = user_data;
+
+    /* unless connected again meanwhile */
+    if (data->context->priv->peer_connection == data->connection)
+        close_peer (data->context);
+    return FALSE;
+}
+
+/**
+ * eekboard_context_disconnect_peer:
+ * @context: an #EekboardContext
+ *
+ * Unbind the connection made by eekboard_context_connect_peer(), if
+ * any, and go back to the bus.  Method calls made before are
+ * processed by eekboard-server first, and signals are still delivered
+ * once each and in order.
+ */
+void
+eekboard_context_disconnect_peer (EekboardContext *context)
+{
+    UnbindPeerData *data;
+    GSource *source;
+    GVariant *result;
+    GError *error;
+
+    g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
+
+    if (get_peer_connection (context) == NULL)
+        return;
+
+    error = NULL;
+    result = g_dbus_connection_call_sync
+        (context->priv->peer_connection,
+         NULL,
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+         "UnbindPeer",
+         NULL,
+         NULL,
+         G_DBUS_CALL_FLAGS_NONE,
+         -1,
+         NULL,
+         &error);
+    if (result == NULL) {
+        g_warning ("error in UnbindPeer call: %s", error->message);
+        g_error_free (error);
+        close_peer (context);
+        return;
+    }
+    g_variant_unref (result);
+    context->priv->peer_unbound = TRUE;
+
+    /* Signals which came through the peer before the reply are still
+       to be dispatched; close the connection after them. */
+    data = g_slice_new (UnbindPeerData);
+    data->context = g_object_ref (context);
+    data->connection = g_object_ref (context->priv->peer_connection);
+    source = g_idle_source_new ();
+    g_source_set_priority (source, G_PRIORITY_DEFAULT);
+    g_source_set_callback (source,
+                           on_unbind_peer,
+                           data,
+                           unbind_peer_data_free);
+    g_source_attach (source, g_main_context_get_thread_default ());
+    g_source_unref (source);
+}
+
+/**
+ * eekboard_context_lookup_symbol:
+ * @context: an #EekboardContext
+ * @keyboard_id: keyboard ID
+ * @symbol_id: symbol ID
+ *
+ * Look up a symbol by the IDs found in an #EekboardKeyRecord.  The
+ * symbol table of a keyboard is fetched asynchronously once the
+ * keyboard is added or selected; if @symbol_id is not in the table
+ * fetched so far, the table is fetched again and %NULL is returned.
+ *
+ * Returns: (transfer none): an #EekSymbol, or %NULL if not found
+ */
+EekSymbol *
+eekboard_context_lookup_symbol (EekboardContext *context,
+                                guint            keyboard_id,
+                                guint            symbol_id)
+{
+    SymbolTable *table;
+
+    g_return_val_if_fail (EEKBOARD_IS_CONTEXT(context), NULL);
+
+    table = get_symbol_table (context, keyboard_id);
+    if (table->symbols == NULL || symbol_id >= table->symbols->len) {
+        fetch_symbol_table (context, keyboard_id);
+        return NULL;
+    }
+    return g_ptr_array_index (table->symbols, symbol_id);
+}
+
+/**
+ * eekboard_context_activate_key_record:
+ * @context: an #EekboardContext
+ * @record: an #EekboardKeyRecord popped from the ring returned by
+ * eekboard_context_open_key_ring()
+ *
+ * Emit #EekboardContext::key-activated for @record, as for a
+ * KeyActivated signal.  If the symbol is not in the table fetched so
+ * far, the key is queued and delivered, after the keys queued before
+ * it, once the table is fetched again.
+ */
+void
+eekboard_context_activate_key_record (EekboardContext         *context,
+                                      const EekboardKeyRecord *record)
+{
+    g_return_if_fail (EEKBOARD_IS_CONTEXT(context));
+    g_return_if_fail (record != NULL);
+
+    key_activated (context,
+                   record->keycode,
+                   record->keyboard_id,
+                   record->symbol_id,
+                   record->modifiers);
+}
+
+/**
+ * eekboard_context_open_key_ring:
+ * @context: an #EekboardContext
+ * @cancellable: a #GCancellable
+ * @error: a #GError
+ *
+ * Ask eekboard-server to pass key activations of @context through
+ * shared memory rather than the #EekboardContext::key-activated
+ * signal.  The caller should watch the notify file descriptor of the
+ * returned ring, pop records from it and pass them to
+ * eekboard_context_activate_key_record().  Keys are no longer
+ * delivered by signal; if the ring is full, they are dropped and
+ * counted by eekboard_key_ring_get_dropped().  This needs a
+ * connection which can pass file descriptors, such as a local bus or
+ * the direct connection made by eekboard_context_connect_peer().
+ *
+ * Returns: an #EekboardKeyRing to be freed with
+ * eekboard_key_ring_free(), or %NULL on error
+ */
+EekboardKeyRing *
+eekboard_context_open_key_ring (EekboardContext *context,
+                                GCancellable    *cancellable,
+                                GError         **error)
+{
+    GDBusConnection *connection, *peer_connection;
+    GDBusMessage *message, *reply;
+    GUnixFDList *fd_list;
+    GVariant *body;
+    gint fd_index, notify_fd_index, fd, notify_fd;
+    EekboardKeyRing *ring;
+
+    g_return_val_if_fail (EEKBOARD_IS_CONTEXT(context), NULL);
+
+    peer_connection = get_peer_connection (context);
+    connection = peer_connection;
+    if (connection == NULL)
+        connection = g_dbus_proxy_get_connection (G_DBUS_PROXY(context));
+    if (!(g_dbus_connection_get_capabilities (connection) &
+          G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING)) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_NOT_SUPPORTED,
+                     "connection can't pass file descriptors");
+        return NULL;
+    }
+
+    /* g_dbus_proxy_call() cannot receive file descriptors, so send
+       the message by hand */
+    message = g_dbus_message_new_method_call
+        (peer_connection ?
+         NULL :
+         g_dbus_proxy_get_name (G_DBUS_PROXY(context)),
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         g_dbus_proxy_get_interface_name (G_DBUS_PROXY(context)),
+         "OpenKeyRing");
+    reply = g_dbus_connection_send_message_with_reply_sync
+        (connection,
+         message,
+         G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+         -1,
+         NULL,
+         cancellable,
+         error);
+    g_object_unref (message);
+    if (reply == NULL)
+        return NULL;
+    if (g_dbus_message_to_gerror (reply, error)) {
+        g_object_unref (reply);
+        return NULL;
+    }
+
+    body = g_dbus_message_get_body (reply);
+    fd_list = g_dbus_message_get_unix_fd_list (reply);
+    if (body == NULL ||
+        !g_variant_is_of_type (body, G_VARIANT_TYPE ("(hh)")) ||
+        fd_list == NULL) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVALID_DATA,
+                     "invalid reply to OpenKeyRing");
+        g_object_unref (reply);
+        return NULL;
+    }
+
+    g_variant_get (body, "(hh)", &fd_index, &notify_fd_index);
+    fd = g_unix_fd_list_get (fd_list, fd_index, error);
+    if (fd < 0) {
+        g_object_unref (reply);
+        return NULL;
+    }
+    notify_fd = g_unix_fd_list_get (fd_list, notify_fd_index, error);
+    g_object_unref (reply);
+    if (notify_fd < 0) {
+        close (fd);
+        return NULL;
+    }
+
+    ring = eekboard_key_ring_new_from_fds (fd, notify_fd, error);
+    if (ring == NULL) {
+        close (notify_fd);
+        close (fd);
     }
+    return ring;
 }
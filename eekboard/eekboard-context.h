@@ -24,6 +24,7 @@
 
 #include <gio/gio.h>
 #include "eek/eek.h"
+#include "eekboard/eekboard-key-ring.h"
 
 G_BEGIN_DECLS
 
@@ -37,6 +38,7 @@ G_BEGIN_DECLS
 typedef struct _EekboardContext EekboardContext;
 typedef struct _EekboardContextClass EekboardContextClass;
 typedef struct _EekboardContextPrivate EekboardContextPrivate;
+typedef struct _EekboardKeyEvent EekboardKeyEvent;
 
 /**
  * EekboardContext:
@@ -78,6 +80,18 @@ struct _EekboardContextClass {
     gpointer pdummy[24];
 };
 
+/**
+ * EekboardKeyEvent:
+ * @keycode: keycode number
+ * @pressed: %TRUE if the key is pressed, %FALSE if released
+ *
+ * A key event sent with eekboard_context_process_key_events().
+ */
+struct _EekboardKeyEvent {
+    guint keycode;
+    gboolean pressed;
+};
+
 GType            eekboard_context_get_type       (void) G_GNUC_CONST;
 
 EekboardContext *eekboard_context_new            (GDBusConnection *connection,
@@ -107,6 +121,16 @@ void             eekboard_context_press_keycode  (EekboardContext *context,
 void             eekboard_context_release_keycode (EekboardContext *context,
                                                    guint            keycode,
                                                    GCancellable    *cancellable);
+void             eekboard_context_process_key_events
+                                                 (EekboardContext *context,
+                                                  const EekboardKeyEvent
+                                                                  *events,
+                                                  guint            n_events,
+                                                  GCancellable    *cancellable);
+void             eekboard_context_queue_key_event
+                                                 (EekboardContext *context,
+                                                  guint            keycode,
+                                                  gboolean         pressed);
 gboolean         eekboard_context_is_visible
                                                  (EekboardContext *context);
 void             eekboard_context_set_enabled    (EekboardContext *context,
@@ -115,6 +139,26 @@ gboolean         eekboard_context_is_enabled     (EekboardContext *context);
 void             eekboard_context_set_fullscreen (EekboardContext *context,
                                                   gboolean         fullscreen,
                                                   GCancellable    *cancellable);
+void             eekboard_context_set_broadcast  (EekboardContext *context,
+                                                  gboolean         broadcast,
+                                                  GCancellable    *cancellable);
+gboolean         eekboard_context_connect_peer   (EekboardContext *context,
+                                                  const gchar     *address,
+                                                  const gchar     *token,
+                                                  GCancellable    *cancellable,
+                                                  GError         **error);
+void             eekboard_context_disconnect_peer
+                                                 (EekboardContext *context);
+EekboardKeyRing *eekboard_context_open_key_ring  (EekboardContext *context,
+                                                  GCancellable    *cancellable,
+                                                  GError         **error);
+EekSymbol       *eekboard_context_lookup_symbol  (EekboardContext *context,
+                                                  guint            keyboard_id,
+                                                  guint            symbol_id);
+void             eekboard_context_activate_key_record
+                                                 (EekboardContext *context,
+                                                  const EekboardKeyRecord
+                                                                  *record);
 
 G_END_DECLS
 #endif  /* EEKBOARD_CONTEXT_H */
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif  /* HAVE_SYS_TIMERFD_H */
+
+#include "eekboard/eekboard-key-repeat.h"
+
+/* ticks delivered at once, beyond the one which is due */
+#define MAX_CATCH_UP_TICKS 2
+
+typedef struct _RepeatSource RepeatSource;
+
+/* One source per EekboardKeyRepeat, attached for its whole life and
+   idle while the repeat is stopped.  With a timerfd, the kernel
+   wakes up the main loop at the deadlines; otherwise the poll
+   timeout is computed from them. */
+struct _RepeatSource {
+    GSource source;
+    EekboardKeyRepeat *repeat;
+    GPollFD pollfd;
+};
+
+struct _EekboardKeyRepeat {
+    EekboardKeyRepeatFunc func;
+    gpointer user_data;
+
+    gboolean enabled;
+    gint64 delay;
+    gint64 interval;
+
+    RepeatSource *source;
+    gboolean running;
+    /* monotonic time of the next tick, in microseconds */
+    gint64 deadline;
+    guint count;
+
+    guint n_samples;
+    gint64 total_lateness;
+    gint64 max_lateness;
+};
+
+static gint64
+get_monotonic_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+static void
+usec_to_timespec (gint64 usec, struct timespec *ts)
+{
+    ts->tv_sec = usec / G_USEC_PER_SEC;
+    ts->tv_nsec = (usec % G_USEC_PER_SEC) * 1000;
+}
+
+/* Arm the timerfd at the deadlines of REPEAT, or disarm it. */
+static void
+arm_timerfd (EekboardKeyRepeat *repeat)
+{
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+    if (repeat->running) {
+        usec_to_timespec (repeat->deadline, &spec.it_value);
+        if (repeat->enabled)
+            usec_to_timespec (repeat->interval, &spec.it_interval);
+    }
+    if (timerfd_settime (repeat->source->pollfd.fd,
+                         TFD_TIMER_ABSTIME,
+                         &spec,
+                         NULL) < 0)
+        g_warning ("can't set key repeat timer: %s", g_strerror (errno));
+}
+#endif  /* HAVE_SYS_TIMERFD_H */
+
+static gboolean
+repeat_source_prepare (GSource *source, gint *timeout)
+{
+    EekboardKeyRepeat *repeat = ((RepeatSource *)source)->repeat;
+    gint64 now;
+
+    *timeout = -1;
+    if (!repeat->running || ((RepeatSource *)source)->pollfd.fd >= 0)
+        return FALSE;
+
+    now = get_monotonic_time ();
+    if (now >= repeat->deadline) {
+        *timeout = 0;
+        return TRUE;
+    }
+    /* round up, so as not to wake up just before the deadline */
+    *timeout = (repeat->deadline - now + 999) / 1000;
+    return FALSE;
+}
+
+static gboolean
+repeat_source_check (GSource *source)
+{
+    RepeatSource *repeat_source = (RepeatSource *)source;
+    EekboardKeyRepeat *repeat = repeat_source->repeat;
+
+    if (repeat_source->pollfd.fd >= 0) {
+        if (repeat_source->pollfd.revents & G_IO_IN) {
+            guint64 expirations;
+
+            /* The ticks are counted from the clock below, so the
+               number of expirations is not needed. */
+            if (read (repeat_source->pollfd.fd,
+                      &expirations,
+                      sizeof expirations) < 0 && errno != EAGAIN)
+                g_warning ("can't read key repeat timer: %s",
+                           g_strerror (errno));
+        }
+    }
+
+    return repeat->running && get_monotonic_time () >= repeat->deadline;
+}
+
+static gboolean
+repeat_source_dispatch (GSource     *source,
+                        GSourceFunc  callback,
+                        gpointer     user_data)
+{
+    EekboardKeyRepeat *repeat = ((RepeatSource *)source)->repeat;
+    gint64 now, lateness;
+    guint n_ticks;
+
+    now = get_monotonic_time ();
+    lateness = now - repeat->deadline;
+    repeat->n_samples++;
+    repeat->total_lateness += lateness;
+    if (lateness > repeat->max_lateness)
+        repeat->max_lateness = lateness;
+
+    /* Stay on the grid of deadlines, dropping the ticks which are too
+       late to be worth delivering. */
+    n_ticks = 1;
+    if (repeat->enabled && repeat->count > 0) {
+        gint64 missed = lateness / repeat->interval;
+
+        n_ticks += MIN(missed, MAX_CATCH_UP_TICKS);
+        repeat->deadline += (missed + 1) * repeat->interval;
+    } else if (repeat->enabled)
+        repeat->deadline += repeat->interval;
+    else
+        repeat->running = FALSE;
+
+    while (n_ticks-- > 0) {
+        repeat->func (++repeat->count, repeat->user_data);
+        /* the tick function may have stopped or restarted REPEAT */
+        if (!repeat->running || repeat->count == 0)
+            break;
+    }
+
+#ifdef HAVE_SYS_TIMERFD_H
+    if (!repeat->running && ((RepeatSource *)source)->pollfd.fd >= 0)
+        arm_timerfd (repeat);
+#endif  /* HAVE_SYS_TIMERFD_H */
+    return TRUE;
+}
+
+static void
+repeat_source_finalize (GSource *source)
+{
+    RepeatSource *repeat_source = (RepeatSource *)source;
+
+    if (repeat_source->pollfd.fd >= 0)
+        close (repeat_source->pollfd.fd);
+}
+
+static GSourceFuncs repeat_source_funcs = {
+    repeat_source_prepare,
+    repeat_source_check,
+    repeat_source_dispatch,
+    repeat_source_finalize
+};
+
+EekboardKeyRepeat *
+_eekboard_key_repeat_new (EekboardKeyRepeatFunc func,
+                          gpointer              user_data)
+{
+    EekboardKeyRepeat *repeat;
+    RepeatSource *source;
+
+    g_return_val_if_fail (func != NULL, NULL);
+
+    repeat = g_slice_new0 (EekboardKeyRepeat);
+    repeat->func = func;
+    repeat->user_data = user_data;
+    repeat->enabled = TRUE;
+    repeat->delay = 1000 * 1000;
+    repeat->interval = 100 * 1000;
+
+    source = (RepeatSource *)g_source_new (&repeat_source_funcs,
+                                           sizeof (RepeatSource));
+    source->repeat = repeat;
+    source->pollfd.fd = -1;
+#ifdef HAVE_SYS_TIMERFD_H
+    source->pollfd.fd = timerfd_create (CLOCK_MONOTONIC,
+                                        TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source->pollfd.fd >= 0) {
+        source->pollfd.events = G_IO_IN;
+        g_source_add_poll ((GSource *)source, &source->pollfd);
+    }
+#endif  /* HAVE_SYS_TIMERFD_H */
+    g_source_set_priority ((GSource *)source, G_PRIORITY_HIGH);
+    g_source_attach ((GSource *)source, NULL);
+    repeat->source = source;
+
+    return repeat;
+}
+
+void
+_eekboard_key_repeat_free (EekboardKeyRepeat *repeat)
+{
+    g_return_if_fail (repeat != NULL);
+
+    g_source_destroy ((GSource *)repeat->source);
+    g_source_unref ((GSource *)repeat->source);
+    g_slice_free (EekboardKeyRepeat, repeat);
+}
+
+void
+_eekboard_key_repeat_set_timing (EekboardKeyRepeat *repeat,
+                                 gboolean           enabled,
+                                 guint              delay,
+                                 guint              interval)
+{
+    g_return_if_fail (repeat != NULL);
+
+    repeat->enabled = enabled;
+    repeat->delay = (gint64)delay * 1000;
+    /* a zero interval would never let the deadline pass */
+    repeat->interval = (gint64)MAX(interval, 1) * 1000;
+}
+
+void
+_eekboard_key_repeat_start (EekboardKeyRepeat *repeat)
+{
+    g_return_if_fail (repeat != NULL);
+
+    repeat->running = TRUE;
+    repeat->count = 0;
+    repeat->deadline = get_monotonic_time () + repeat->delay;
+#ifdef HAVE_SYS_TIMERFD_H
+    if (repeat->source->pollfd.fd >= 0)
+        arm_timerfd (repeat);
+#endif  /* HAVE_SYS_TIMERFD_H */
+}
+
+gboolean
+_eekboard_key_repeat_stop (EekboardKeyRepeat *repeat)
+{
+    g_return_val_if_fail (repeat != NULL, FALSE);
+
+    if (!repeat->running)
+        return FALSE;
+
+    repeat->running = FALSE;
+#ifdef HAVE_SYS_TIMERFD_H
+    if (repeat->source->pollfd.fd >= 0)
+        arm_timerfd (repeat);
+#endif  /* HAVE_SYS_TIMERFD_H */
+    return TRUE;
+}
+
+gboolean
+_eekboard_key_repeat_is_running (EekboardKeyRepeat *repeat)
+{
+    g_return_val_if_fail (repeat != NULL, FALSE);
+    return repeat->running;
+}
+
+void
+_eekboard_key_repeat_get_jitter (EekboardKeyRepeat *repeat,
+                                 gint64            *mean,
+                                 gint64            *max)
+{
+    g_return_if_fail (repeat != NULL);
+
+    if (mean)
+        *mean = repeat->n_samples > 0 ?
+            repeat->total_lateness / repeat->n_samples : 0;
+    if (max)
+        *max = repeat->max_lateness;
+}
+
+void
+_eekboard_key_repeat_reset_jitter (EekboardKeyRepeat *repeat)
+{
+    g_return_if_fail (repeat != NULL);
+
+    repeat->n_samples = 0;
+    repeat->total_lateness = 0;
+    repeat->max_lateness = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+#ifndef EEKBOARD_KEY_REPEAT_H
+#define EEKBOARD_KEY_REPEAT_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Key repeat timer of a context.  Once started, it calls the tick
+   function after the repeat delay and then every repeat interval,
+   until stopped.  Ticks are scheduled on fixed deadlines of the
+   monotonic clock, so that a late tick does not delay the next
+   ones; ticks missed while the main loop was busy are delivered at
+   once, up to a few. */
+typedef struct _EekboardKeyRepeat EekboardKeyRepeat;
+
+/* COUNT is 1 for the first tick after the delay. */
+typedef void (*EekboardKeyRepeatFunc) (guint    count,
+                                       gpointer user_data);
+
+EekboardKeyRepeat *_eekboard_key_repeat_new
+                                   (EekboardKeyRepeatFunc  func,
+                                    gpointer               user_data);
+void               _eekboard_key_repeat_free
+                                   (EekboardKeyRepeat     *repeat);
+
+/* DELAY and INTERVAL are in milliseconds.  If ENABLED is FALSE, only
+   the first tick is delivered.  Takes effect at the next start. */
+void               _eekboard_key_repeat_set_timing
+                                   (EekboardKeyRepeat     *repeat,
+                                    gboolean               enabled,
+                                    guint                  delay,
+                                    guint                  interval);
+
+void               _eekboard_key_repeat_start
+                                   (EekboardKeyRepeat     *repeat);
+/* Returns TRUE if REPEAT was running. */
+gboolean           _eekboard_key_repeat_stop
+                                   (EekboardKeyRepeat     *repeat);
+gboolean           _eekboard_key_repeat_is_running
+                                   (EekboardKeyRepeat     *repeat);
+
+/* How late the ticks were delivered since the last reset, in
+   microseconds.  Both are 0 if there was no tick. */
+void               _eekboard_key_repeat_get_jitter
+                                   (EekboardKeyRepeat     *repeat,
+                                    gint64                *mean,
+                                    gint64                *max);
+void               _eekboard_key_repeat_reset_jitter
+                                   (EekboardKeyRepeat     *repeat);
+
+G_END_DECLS
+#endif  /* EEKBOARD_KEY_REPEAT_H */
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * SECTION:eekboard-key-ring
+ * @short_description: shared memory transport of key activations
+ *
+ * An #EekboardKeyRing is a single-producer, single-consumer ring of
+ * #EekboardKeyRecord in memory shared between eekboard-server and
+ * a client, with an eventfd to wake up the client.  The server
+ * creates it with eekboard_key_ring_new() and passes both file
+ * descriptors over D-Bus; the client maps them with
+ * eekboard_key_ring_new_from_fds().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* for memfd_create() */
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif  /* HAVE_SYS_EVENTFD_H */
+
+#include <gio/gio.h>
+
+#include "eekboard/eekboard-key-ring.h"
+
+#define KEY_RING_MAGIC 0x454b5232  /* "EKR2" */
+#define N_RECORDS 256
+#define CACHE_LINE_SIZE 64
+
+/* The producer only writes head and n_dropped, and the consumer only
+   writes tail.  All count up forever, and head and tail wrap around
+   N_RECORDS when indexing; the two sides' counters live on separate
+   cache lines so that they do not keep invalidating each other's. */
+typedef struct _KeyRingData KeyRingData;
+struct _KeyRingData {
+    guint32 magic;
+    guint32 n_records;
+    gchar pad0[CACHE_LINE_SIZE - 2 * sizeof (guint32)];
+    volatile gint head;
+    /* records which were not pushed because the ring was full */
+    volatile gint n_dropped;
+    gchar pad1[CACHE_LINE_SIZE - 2 * sizeof (gint)];
+    volatile gint tail;
+    gchar pad2[CACHE_LINE_SIZE - sizeof (gint)];
+    EekboardKeyRecord records[N_RECORDS];
+};
+
+struct _EekboardKeyRing {
+    gint fd;
+    gint notify_fd;
+    KeyRingData *data;
+    /* n_dropped when the consumer last looked */
+    guint n_dropped_seen;
+};
+
+static gint64
+get_monotonic_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static EekboardKeyRing *
+key_ring_map (gint fd, gint notify_fd, GError **error)
+{
+    EekboardKeyRing *ring;
+    gpointer data;
+
+    data = mmap (NULL,
+                 sizeof (KeyRingData),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED,
+                 fd,
+                 0);
+    if (data == MAP_FAILED) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "can't map key ring: %s",
+                     g_strerror (errno));
+        return NULL;
+    }
+
+    ring = g_slice_new (EekboardKeyRing);
+    ring->fd = fd;
+    ring->notify_fd = notify_fd;
+    ring->data = data;
+    ring->n_dropped_seen = 0;
+    return ring;
+}
+
+/**
+ * eekboard_key_ring_new:
+ * @error: a #GError
+ *
+ * Create an empty key ring for the producer side.
+ *
+ * Returns: a new #EekboardKeyRing, or %NULL if shared memory key
+ * rings are not supported on this system
+ */
+EekboardKeyRing *
+eekboard_key_ring_new (GError **error)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_EVENTFD_H)
+    EekboardKeyRing *ring;
+    gint fd, notify_fd;
+
+    fd = memfd_create ("eekboard-key-ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "can't create key ring: %s",
+                     g_strerror (errno));
+        return NULL;
+    }
+    if (ftruncate (fd, sizeof (KeyRingData)) < 0) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "can't create key ring: %s",
+                     g_strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    notify_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (notify_fd < 0) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "can't create key ring notifier: %s",
+                     g_strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    ring = key_ring_map (fd, notify_fd, error);
+    if (ring == NULL) {
+        close (notify_fd);
+        close (fd);
+        return NULL;
+    }
+
+    /* the file is zero-filled, so head and tail start at 0 */
+    ring->data->magic = KEY_RING_MAGIC;
+    ring->data->n_records = N_RECORDS;
+    return ring;
+#else
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_NOT_SUPPORTED,
+                 "shared memory key rings are not supported");
+    return NULL;
+#endif
+}
+
+/**
+ * eekboard_key_ring_new_from_fds:
+ * @fd: file descriptor of the shared memory
+ * @notify_fd: eventfd written by the producer
+ * @error: a #GError
+ *
+ * Map a key ring created by eekboard_key_ring_new() in another
+ * process, for the consumer side.  On success, the ring takes
+ * ownership of @fd and @notify_fd.
+ *
+ * Returns: a new #EekboardKeyRing, or %NULL on error
+ */
+EekboardKeyRing *
+eekboard_key_ring_new_from_fds (gint     fd,
+                                gint     notify_fd,
+                                GError **error)
+{
+    EekboardKeyRing *ring;
+    struct stat st;
+
+    g_return_val_if_fail (fd >= 0, NULL);
+    g_return_val_if_fail (notify_fd >= 0, NULL);
+
+    if (fstat (fd, &st) < 0 || st.st_size < (off_t)sizeof (KeyRingData)) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVALID_DATA,
+                     "key ring is too small");
+        return NULL;
+    }
+
+    ring = key_ring_map (fd, notify_fd, error);
+    if (ring == NULL)
+        return NULL;
+
+    if (ring->data->magic != KEY_RING_MAGIC ||
+        ring->data->n_records != N_RECORDS) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVALID_DATA,
+                     "unknown key ring format");
+        munmap (ring->data, sizeof (KeyRingData));
+        g_slice_free (EekboardKeyRing, ring);
+        return NULL;
+    }
+
+    /* only count the records dropped from now on */
+    ring->n_dropped_seen = g_atomic_int_get (&ring->data->n_dropped);
+    return ring;
+}
+
+/**
+ * eekboard_key_ring_free:
+ * @ring: an #EekboardKeyRing
+ *
+ * Unmap @ring and close its file descriptors.
+ */
+void
+eekboard_key_ring_free (EekboardKeyRing *ring)
+{
+    g_return_if_fail (ring != NULL);
+
+    munmap (ring->data, sizeof (KeyRingData));
+    close (ring->notify_fd);
+    close (ring->fd);
+    g_slice_free (EekboardKeyRing, ring);
+}
+
+/**
+ * eekboard_key_ring_get_fd:
+ * @ring: an #EekboardKeyRing
+ *
+ * Get the file descriptor of the shared memory of @ring.
+ */
+gint
+eekboard_key_ring_get_fd (EekboardKeyRing *ring)
+{
+    g_return_val_if_fail (ring != NULL, -1);
+    return ring->fd;
+}
+
+/**
+ * eekboard_key_ring_get_notify_fd:
+ * @ring: an #EekboardKeyRing
+ *
+ * Get the eventfd of @ring, which becomes readable when records are
+ * pushed.
+ */
+gint
+eekboard_key_ring_get_notify_fd (EekboardKeyRing *ring)
+{
+    g_return_val_if_fail (ring != NULL, -1);
+    return ring->notify_fd;
+}
+
+/**
+ * eekboard_key_ring_push:
+ * @ring: an #EekboardKeyRing
+ * @record: an #EekboardKeyRecord
+ *
+ * Append @record to @ring, stamped with the current time, and wake
+ * up the consumer.  If @ring is full, @record is dropped and counted,
+ * so that the consumer learns about it from
+ * eekboard_key_ring_get_dropped().  Only the producer may call this.
+ *
+ * Returns: %TRUE on success, %FALSE if @ring is full
+ */
+gboolean
+eekboard_key_ring_push (EekboardKeyRing         *ring,
+                        const EekboardKeyRecord *record)
+{
+    KeyRingData *data;
+    guint head, tail;
+    guint64 one = 1;
+
+    g_return_val_if_fail (ring != NULL, FALSE);
+    g_return_val_if_fail (record != NULL, FALSE);
+
+    data = ring->data;
+    head = data->head;
+    tail = g_atomic_int_get (&data->tail);
+    /* also catches a tail the consumer has corrupted */
+    if (head - tail >= N_RECORDS)
+        g_atomic_int_set (&data->n_dropped, data->n_dropped + 1);
+    else {
+        data->records[head % N_RECORDS] = *record;
+        data->records[head % N_RECORDS].timestamp = get_monotonic_time ();
+        g_atomic_int_set (&data->head, head + 1);
+    }
+
+    /* Always write, even if the ring was not empty: the consumer may
+       have read head just before the store above.  A dropped record
+       wakes it up too, so that it notices. */
+    if (write (ring->notify_fd, &one, sizeof one) < 0 && errno != EAGAIN)
+        g_warning ("can't notify key ring: %s", g_strerror (errno));
+    return head - tail < N_RECORDS;
+}
+
+/**
+ * eekboard_key_ring_pop:
+ * @ring: an #EekboardKeyRing
+ * @record: (out): location to store the record
+ *
+ * Remove the oldest record from @ring.  Only the consumer may call
+ * this.
+ *
+ * Returns: %TRUE if a record was stored in @record, %FALSE if @ring
+ * is empty
+ */
+gboolean
+eekboard_key_ring_pop (EekboardKeyRing   *ring,
+                       EekboardKeyRecord *record)
+{
+    KeyRingData *data;
+    guint head, tail;
+
+    g_return_val_if_fail (ring != NULL, FALSE);
+    g_return_val_if_fail (record != NULL, FALSE);
+
+    data = ring->data;
+    tail = data->tail;
+    head = g_atomic_int_get (&data->head);
+    if (head == tail)
+        return FALSE;
+    if (head - tail > N_RECORDS) {
+        g_warning ("key ring is corrupted");
+        return FALSE;
+    }
+
+    *record = data->records[tail % N_RECORDS];
+    g_atomic_int_set (&data->tail, tail + 1);
+    return TRUE;
+}
+
+/**
+ * eekboard_key_ring_get_dropped:
+ * @ring: an #EekboardKeyRing
+ *
+ * Get the number of records the producer dropped because @ring was
+ * full, since the last call.  Only the consumer may call this.
+ *
+ * Returns: the number of dropped records
+ */
+guint
+eekboard_key_ring_get_dropped (EekboardKeyRing *ring)
+{
+    guint n_dropped, count;
+
+    g_return_val_if_fail (ring != NULL, 0);
+
+    n_dropped = g_atomic_int_get (&ring->data->n_dropped);
+    count = n_dropped - ring->n_dropped_seen;
+    ring->n_dropped_seen = n_dropped;
+    return count;
+}
+
+/**
+ * eekboard_key_ring_clear_notify:
+ * @ring: an #EekboardKeyRing
+ *
+ * Reset the eventfd of @ring.  The consumer should call this before
+ * popping all the records, so that records pushed in the meantime
+ * wake it up again.
+ */
+void
+eekboard_key_ring_clear_notify (EekboardKeyRing *ring)
+{
+    guint64 count;
+
+    g_return_if_fail (ring != NULL);
+
+    if (read (ring->notify_fd, &count, sizeof count) < 0 && errno != EAGAIN)
+        g_warning ("can't read key ring notifier: %s", g_strerror (errno));
+}
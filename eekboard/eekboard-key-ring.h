@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+#ifndef EEKBOARD_KEY_RING_H
+#define EEKBOARD_KEY_RING_H 1
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EekboardKeyRing EekboardKeyRing;
+typedef struct _EekboardKeyRecord EekboardKeyRecord;
+
+/**
+ * EekboardKeyRecord:
+ * @keycode: keycode number
+ * @keyboard_id: keyboard ID, as returned by eekboard_context_add_keyboard()
+ * @symbol_id: symbol ID within the keyboard's symbol table
+ * @modifiers: modifiers
+ * @timestamp: monotonic time in microseconds when the record was pushed
+ *
+ * A key activation passed through an #EekboardKeyRing.  It carries
+ * the same information as the KeyActivated D-Bus signal.
+ */
+struct _EekboardKeyRecord {
+    guint32 keycode;
+    guint32 keyboard_id;
+    guint32 symbol_id;
+    guint32 modifiers;
+    gint64 timestamp;
+};
+
+EekboardKeyRing *eekboard_key_ring_new            (GError                 **error);
+EekboardKeyRing *eekboard_key_ring_new_from_fds   (gint                     fd,
+                                                   gint                     notify_fd,
+                                                   GError                 **error);
+void             eekboard_key_ring_free           (EekboardKeyRing         *ring);
+
+gint             eekboard_key_ring_get_fd         (EekboardKeyRing         *ring);
+gint             eekboard_key_ring_get_notify_fd  (EekboardKeyRing         *ring);
+
+gboolean         eekboard_key_ring_push           (EekboardKeyRing         *ring,
+                                                   const EekboardKeyRecord *record);
+gboolean         eekboard_key_ring_pop            (EekboardKeyRing         *ring,
+                                                   EekboardKeyRecord       *record);
+guint            eekboard_key_ring_get_dropped    (EekboardKeyRing         *ring);
+void             eekboard_key_ring_clear_notify   (EekboardKeyRing         *ring);
+
+G_END_DECLS
+#endif  /* EEKBOARD_KEY_RING_H */
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include "eekboard/eekboard-keyboard-cache.h"
+#include "eekboard/eekboard-xklutil.h"
+#include "eek/eek-xkl.h"
+
+typedef struct _CacheEntry CacheEntry;
+typedef struct _Waiter Waiter;
+
+struct _EekboardKeyboardCache {
+    volatile gint ref_count;
+    /* keyboard type -> CacheEntry */
+    GHashTable *entries;
+};
+
+struct _CacheEntry {
+    EekboardKeyboardCache *cache;
+    gchar *keyboard_type;
+    /* NULL while loading */
+    EekKeyboard *keyboard;
+    EekKeyboardState *initial_state;
+    /* number of keyboards returned and not released yet */
+    guint use_count;
+    /* kept even when unused, see _eekboard_keyboard_cache_preload() */
+    gboolean preloaded;
+    /* Waiter, in the order of the requests */
+    GSList *waiters;
+};
+
+struct _Waiter {
+    GSimpleAsyncResult *result;
+    GCancellable *cancellable;
+};
+
+static Display *display = NULL;
+
+/* Creating the layout only looks up the keyboard description; the
+   layout files are loaded along with the keyboard. */
+EekLayout *
+_eekboard_create_layout (const gchar *keyboard_type, GError **error)
+{
+    EekLayout *layout;
+
+    if (g_str_has_prefix (keyboard_type, "xkb:")) {
+        XklConfigRec *rec =
+            eekboard_xkl_config_rec_from_string (&keyboard_type[4]);
+
+        if (display == NULL)
+            display = XOpenDisplay (NULL);
+
+        layout = eek_xkl_layout_new (display, error);
+        if (layout == NULL)
+            return NULL;
+
+        if (!eek_xkl_layout_set_config (EEK_XKL_LAYOUT(layout), rec)) {
+            g_object_unref (layout);
+            g_set_error (error,
+                         EEK_ERROR,
+                         EEK_ERROR_LAYOUT_ERROR,
+                         "can't set XKB config %s",
+                         &keyboard_type[4]);
+            return NULL;
+        }
+    } else
+        layout = eek_xml_layout_new (keyboard_type, error);
+
+    return layout;
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+    g_assert (entry->waiters == NULL);
+
+    if (entry->keyboard)
+        g_object_unref (entry->keyboard);
+    if (entry->initial_state)
+        eek_keyboard_state_free (entry->initial_state);
+    g_free (entry->keyboard_type);
+    g_slice_free (CacheEntry, entry);
+}
+
+EekboardKeyboardCache *
+_eekboard_keyboard_cache_new (void)
+{
+    EekboardKeyboardCache *cache;
+
+    cache = g_slice_new (EekboardKeyboardCache);
+    cache->ref_count = 1;
+    cache->entries = g_hash_table_new_full (g_str_hash,
+                                            g_str_equal,
+                                            NULL,
+                                            (GDestroyNotify)cache_entry_free);
+    return cache;
+}
+
+EekboardKeyboardCache *
+_eekboard_keyboard_cache_ref (EekboardKeyboardCache *cache)
+{
+    g_return_val_if_fail (cache != NULL, NULL);
+    g_atomic_int_inc (&cache->ref_count);
+    return cache;
+}
+
+void
+_eekboard_keyboard_cache_unref (EekboardKeyboardCache *cache)
+{
+    g_return_if_fail (cache != NULL);
+
+    if (g_atomic_int_dec_and_test (&cache->ref_count)) {
+        g_hash_table_destroy (cache->entries);
+        g_slice_free (EekboardKeyboardCache, cache);
+    }
+}
+
+/* Called once loading ENTRY is done, successfully or not. */
+static void
+finish_load (CacheEntry *entry, EekKeyboard *keyboard, const GError *error)
+{
+    EekboardKeyboardCache *cache = entry->cache;
+    GSList *head;
+
+    if (keyboard) {
+        entry->keyboard = keyboard;
+        entry->initial_state = eek_keyboard_get_state (keyboard);
+    }
+
+    for (head = entry->waiters; head; head = g_slist_next (head)) {
+        Waiter *waiter = head->data;
+        GError *cancelled_error = NULL;
+
+        if (error)
+            g_simple_async_result_set_from_error (waiter->result, error);
+        else if (g_cancellable_set_error_if_cancelled (waiter->cancellable,
+                                                       &cancelled_error)) {
+            g_simple_async_result_set_from_error (waiter->result,
+                                                  cancelled_error);
+            g_error_free (cancelled_error);
+        } else {
+            entry->use_count++;
+            g_simple_async_result_set_op_res_gpointer
+                (waiter->result,
+                 g_object_ref (keyboard),
+                 g_object_unref);
+        }
+        g_simple_async_result_complete_in_idle (waiter->result);
+        g_object_unref (waiter->result);
+        if (waiter->cancellable)
+            g_object_unref (waiter->cancellable);
+        g_slice_free (Waiter, waiter);
+    }
+    g_slist_free (entry->waiters);
+    entry->waiters = NULL;
+
+    if (error && entry->preloaded)
+        g_warning ("can't preload keyboard %s: %s",
+                   entry->keyboard_type, error->message);
+
+    if (keyboard == NULL || (entry->use_count == 0 && !entry->preloaded))
+        g_hash_table_remove (cache->entries, entry->keyboard_type);
+
+    /* taken in load_keyboard() */
+    _eekboard_keyboard_cache_unref (cache);
+}
+
+static void
+on_keyboard_loaded (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+    CacheEntry *entry = user_data;
+    EekKeyboard *keyboard;
+    GError *error;
+
+    error = NULL;
+    keyboard = eek_layout_create_keyboard_finish (EEK_LAYOUT(source_object),
+                                                  res,
+                                                  &error);
+    finish_load (entry, keyboard, error);
+    if (error)
+        g_error_free (error);
+}
+
+static void
+load_keyboard (CacheEntry *entry)
+{
+    EekLayout *layout;
+    GError *error;
+
+    /* the cache must outlive the load, which no one can cancel */
+    _eekboard_keyboard_cache_ref (entry->cache);
+
+    error = NULL;
+    layout = _eekboard_create_layout (entry->keyboard_type, &error);
+    if (layout == NULL) {
+        finish_load (entry, NULL, error);
+        g_error_free (error);
+        return;
+    }
+
+    eek_layout_create_keyboard_async (layout,
+                                      EEKBOARD_KEYBOARD_WIDTH,
+                                      EEKBOARD_KEYBOARD_HEIGHT,
+                                      NULL,
+                                      on_keyboard_loaded,
+                                      entry);
+    g_object_unref (layout);
+}
+
+static CacheEntry *
+cache_entry_new (EekboardKeyboardCache *cache, const gchar *keyboard_type)
+{
+    CacheEntry *entry;
+
+    entry = g_slice_new0 (CacheEntry);
+    entry->cache = cache;
+    entry->keyboard_type = g_strdup (keyboard_type);
+    g_hash_table_insert (cache->entries, entry->keyboard_type, entry);
+    return entry;
+}
+
+void
+_eekboard_keyboard_cache_get_async (EekboardKeyboardCache *cache,
+                                    const gchar           *keyboard_type,
+                                    GCancellable          *cancellable,
+                                    GAsyncReadyCallback    callback,
+                                    gpointer               user_data)
+{
+    GSimpleAsyncResult *result;
+    CacheEntry *entry;
+    Waiter *waiter;
+
+    g_return_if_fail (cache != NULL);
+    g_return_if_fail (keyboard_type != NULL);
+
+    result = g_simple_async_result_new (NULL,
+                                        callback,
+                                        user_data,
+                                        _eekboard_keyboard_cache_get_async);
+
+    entry = g_hash_table_lookup (cache->entries, keyboard_type);
+    if (entry && entry->keyboard) {
+        entry->use_count++;
+        g_simple_async_result_set_op_res_gpointer
+            (result,
+             g_object_ref (entry->keyboard),
+             g_object_unref);
+        g_simple_async_result_complete_in_idle (result);
+        g_object_unref (result);
+        return;
+    }
+
+    waiter = g_slice_new (Waiter);
+    waiter->result = result;
+    waiter->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+    if (entry) {
+        entry->waiters = g_slist_append (entry->waiters, waiter);
+        return;
+    }
+
+    entry = cache_entry_new (cache, keyboard_type);
+    entry->waiters = g_slist_append (NULL, waiter);
+    load_keyboard (entry);
+}
+
+EekKeyboard *
+_eekboard_keyboard_cache_get_finish (EekboardKeyboardCache *cache,
+                                     GAsyncResult          *result,
+                                     GError               **error)
+{
+    GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT(result);
+
+    g_return_val_if_fail (g_simple_async_result_is_valid
+                          (result,
+                           NULL,
+                           _eekboard_keyboard_cache_get_async),
+                          NULL);
+
+    if (g_simple_async_result_propagate_error (simple, error))
+        return NULL;
+
+    return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+void
+_eekboard_keyboard_cache_release (EekboardKeyboardCache *cache,
+                                  const gchar           *keyboard_type)
+{
+    CacheEntry *entry;
+
+    g_return_if_fail (cache != NULL);
+
+    entry = g_hash_table_lookup (cache->entries, keyboard_type);
+    g_return_if_fail (entry != NULL && entry->use_count > 0);
+
+    if (--entry->use_count == 0 && !entry->preloaded)
+        g_hash_table_remove (cache->entries, keyboard_type);
+}
+
+void
+_eekboard_keyboard_cache_preload (EekboardKeyboardCache *cache,
+                                  const gchar * const   *keyboard_types)
+{
+    GHashTableIter iter;
+    CacheEntry *entry;
+    gint i;
+
+    g_return_if_fail (cache != NULL);
+
+    g_hash_table_iter_init (&iter, cache->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+        entry->preloaded = FALSE;
+
+    for (i = 0; keyboard_types && keyboard_types[i]; i++) {
+        entry = g_hash_table_lookup (cache->entries, keyboard_types[i]);
+        if (entry == NULL) {
+            entry = cache_entry_new (cache, keyboard_types[i]);
+            entry->preloaded = TRUE;
+            load_keyboard (entry);
+        } else
+            entry->preloaded = TRUE;
+    }
+
+    /* Entries being loaded are removed by finish_load(), if need
+       be. */
+    g_hash_table_iter_init (&iter, cache->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+        if (entry->keyboard && entry->use_count == 0 && !entry->preloaded)
+            g_hash_table_iter_remove (&iter);
+}
+
+const EekKeyboardState *
+_eekboard_keyboard_cache_get_initial_state (EekboardKeyboardCache *cache,
+                                            const gchar           *keyboard_type)
+{
+    CacheEntry *entry;
+
+    g_return_val_if_fail (cache != NULL, NULL);
+
+    entry = g_hash_table_lookup (cache->entries, keyboard_type);
+    g_return_val_if_fail (entry != NULL && entry->keyboard != NULL, NULL);
+    return entry->initial_state;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EEKBOARD_KEYBOARD_CACHE_H
+#define EEKBOARD_KEYBOARD_CACHE_H 1
+
+#include <gio/gio.h>
+#include "eek/eek.h"
+
+G_BEGIN_DECLS
+
+/* Size of keyboards before they are first shown. */
+#define EEKBOARD_KEYBOARD_WIDTH 640
+#define EEKBOARD_KEYBOARD_HEIGHT 480
+
+/* Keyboards shared by the contexts of an EekboardService, keyed by
+   the keyboard type string given to AddKeyboard.  Each keyboard is
+   loaded once and kept as long as a context uses it, or for good if
+   it is preloaded.  Keyboards are
+   never modified by the cache; the contexts take turns applying
+   their own state to them, see eek_keyboard_set_state(). */
+typedef struct _EekboardKeyboardCache EekboardKeyboardCache;
+
+EekLayout             *_eekboard_create_layout
+                                   (const gchar            *keyboard_type,
+                                    GError                **error);
+
+EekboardKeyboardCache *_eekboard_keyboard_cache_new
+                                   (void);
+EekboardKeyboardCache *_eekboard_keyboard_cache_ref
+                                   (EekboardKeyboardCache  *cache);
+void                   _eekboard_keyboard_cache_unref
+                                   (EekboardKeyboardCache  *cache);
+
+/* Get the keyboard of KEYBOARD_TYPE, loading it if it is not in the
+   cache yet.  Concurrent requests for the same type share one load.
+   Every keyboard returned by _finish() must be given back with
+   _eekboard_keyboard_cache_release(). */
+void                   _eekboard_keyboard_cache_get_async
+                                   (EekboardKeyboardCache  *cache,
+                                    const gchar            *keyboard_type,
+                                    GCancellable           *cancellable,
+                                    GAsyncReadyCallback     callback,
+                                    gpointer                user_data);
+EekKeyboard           *_eekboard_keyboard_cache_get_finish
+                                   (EekboardKeyboardCache  *cache,
+                                    GAsyncResult           *result,
+                                    GError                **error);
+void                   _eekboard_keyboard_cache_release
+                                   (EekboardKeyboardCache  *cache,
+                                    const gchar            *keyboard_type);
+
+/* Keep the keyboards of KEYBOARD_TYPES, a NULL-terminated array, in
+   the cache even when no context uses them, and start loading those
+   which are not there yet.  Keyboards preloaded by a previous call
+   and not in KEYBOARD_TYPES are dropped once unused. */
+void                   _eekboard_keyboard_cache_preload
+                                   (EekboardKeyboardCache  *cache,
+                                    const gchar * const    *keyboard_types);
+
+/* The state of the keyboard of KEYBOARD_TYPE as it was loaded, which
+   is where a context starts from.  Only valid while the keyboard is
+   in use. */
+const EekKeyboardState *_eekboard_keyboard_cache_get_initial_state
+                                   (EekboardKeyboardCache  *cache,
+                                    const gchar            *keyboard_type);
+
+G_END_DECLS
+#endif  /* EEKBOARD_KEYBOARD_CACHE_H */
@@ -29,6 +29,7 @@
 #endif  /* HAVE_CONFIG_H */
 
 #include "eekboard/eekboard-service.h"
+#include "eekboard/eekboard-context-service-private.h"
 
 enum {
     PROP_0,
@@ -53,9 +54,41 @@ struct _EekboardServicePrivate {
     guint registration_id;
     char *object_path;
 
+    /* object path -> ContextEntry */
     GHashTable *context_hash;
-    GSList *context_stack;
+    /* unique name -> SenderEntry */
+    GHashTable *sender_hash;
+    /* ContextEntry, the head is the active context */
+    GQueue context_stack;
     gboolean visible;
+
+    /* keyboards shared by the contexts */
+    EekboardKeyboardCache *keyboard_cache;
+    GSettings *settings;
+    guint preload_id;
+};
+
+typedef struct _SenderEntry SenderEntry;
+typedef struct _ContextEntry ContextEntry;
+
+#define ENTRY_CONTEXT(link) (((ContextEntry *)(link)->data)->context)
+
+/* A client with one name watcher for all the contexts it owns. */
+struct _SenderEntry {
+    gchar *name;
+    guint watch_id;
+    GQueue contexts;
+};
+
+/* The links let a context be removed from the stack and from its
+   owner's list without searching them. */
+struct _ContextEntry {
+    EekboardService *service;
+    EekboardContextService *context;
+    gchar *object_path;
+    SenderEntry *sender;
+    GList *sender_link;
+    GList *stack_link;
 };
 
 G_DEFINE_TYPE (EekboardService, eekboard_service, G_TYPE_OBJECT);
@@ -67,10 +100,19 @@ static const gchar introspection_xml[] =
     "      <arg direction='in' type='s' name='client_name'/>"
     "      <arg direction='out' type='s' name='object_path'/>"
     "    </method>"
+    "    <method name='CreatePeerContext'>"
+    "      <arg direction='in' type='s' name='client_name'/>"
+    "      <arg direction='out' type='s' name='object_path'/>"
+    "      <arg direction='out' type='s' name='peer_address'/>"
+    "      <arg direction='out' type='s' name='peer_token'/>"
+    "    </method>"
     "    <method name='PushContext'>"
     "      <arg direction='in' type='s' name='object_path'/>"
     "    </method>"
     "    <method name='PopContext'/>"
+    "    <method name='DestroyContext'>"
+    "      <arg direction='in' type='s' name='object_path'/>"
+    "    </method>"
     "    <method name='ShowKeyboard'/>"
     "    <method name='HideKeyboard'/>"
     "    <method name='Destroy'/>"
@@ -142,21 +184,43 @@ eekboard_service_get_property (GObject    *object,
     }
 }
 
+static void on_keyboards_changed (GSettings   *settings,
+                                  const gchar *key,
+                                  gpointer     user_data);
+
 static void
 eekboard_service_dispose (GObject *object)
 {
     EekboardService *service = EEKBOARD_SERVICE(object);
-    GSList *head;
+
+    g_queue_clear (&service->priv->context_stack);
+
+    if (service->priv->sender_hash) {
+        g_hash_table_destroy (service->priv->sender_hash);
+        service->priv->sender_hash = NULL;
+    }
 
     if (service->priv->context_hash) {
         g_hash_table_destroy (service->priv->context_hash);
         service->priv->context_hash = NULL;
     }
 
-    for (head = service->priv->context_stack; head; head = service->priv->context_stack) {
-        g_object_unref (head->data);
-        service->priv->context_stack = g_slist_next (head);
-        g_slist_free1 (head);
+    if (service->priv->preload_id) {
+        g_source_remove (service->priv->preload_id);
+        service->priv->preload_id = 0;
+    }
+
+    if (service->priv->settings) {
+        g_signal_handlers_disconnect_by_func (service->priv->settings,
+                                              G_CALLBACK(on_keyboards_changed),
+                                              service);
+        g_object_unref (service->priv->settings);
+        service->priv->settings = NULL;
+    }
+
+    if (service->priv->keyboard_cache) {
+        _eekboard_keyboard_cache_unref (service->priv->keyboard_cache);
+        service->priv->keyboard_cache = NULL;
     }
 
     if (service->priv->connection) {
@@ -188,10 +252,54 @@ eekboard_service_finalize (GObject *object)
     G_OBJECT_CLASS (eekboard_service_parent_class)->finalize (object);
 }
 
+/* Load the keyboards the user has configured, so that AddKeyboard
+   calls for them are answered from the cache. */
+static void
+preload_keyboards (EekboardService *service)
+{
+    gchar **keyboards;
+
+    if (service->priv->preload_id) {
+        g_source_remove (service->priv->preload_id);
+        service->priv->preload_id = 0;
+    }
+
+    keyboards = g_settings_get_strv (service->priv->settings, "keyboards");
+    _eekboard_keyboard_cache_preload (service->priv->keyboard_cache,
+                                      (const gchar * const *)keyboards);
+    g_strfreev (keyboards);
+}
+
+static gboolean
+on_preload_idle (gpointer user_data)
+{
+    EekboardService *service = user_data;
+
+    service->priv->preload_id = 0;
+    preload_keyboards (service);
+    return FALSE;
+}
+
+static void
+on_keyboards_changed (GSettings   *settings,
+                      const gchar *key,
+                      gpointer     user_data)
+{
+    preload_keyboards (EEKBOARD_SERVICE(user_data));
+}
+
 static void
 eekboard_service_constructed (GObject *object)
 {
     EekboardService *service = EEKBOARD_SERVICE(object);
+
+    /* Start loading after the service is up, unless a context is
+       created earlier, see create_context(). */
+    service->priv->preload_id =
+        g_idle_add_full (G_PRIORITY_LOW, on_preload_idle, service, NULL);
+    g_signal_connect (service->priv->settings, "changed::keyboards",
+                      G_CALLBACK(on_keyboards_changed), service);
+
     if (service->priv->connection && service->priv->object_path) {
         GError *error = NULL;
 
@@ -275,6 +383,30 @@ eekboard_service_class_init (EekboardServiceClass *klass)
                                      pspec);
 }
 
+static void on_notify_visible (GObject    *object,
+                               GParamSpec *spec,
+                               gpointer    user_data);
+
+static void
+sender_entry_free (SenderEntry *sender)
+{
+    g_bus_unwatch_name (sender->watch_id);
+    g_queue_clear (&sender->contexts);
+    g_free (sender->name);
+    g_slice_free (SenderEntry, sender);
+}
+
+static void
+context_entry_free (ContextEntry *entry)
+{
+    g_signal_handlers_disconnect_by_func (entry->context,
+                                          G_CALLBACK(on_notify_visible),
+                                          entry->service);
+    g_object_unref (entry->context);
+    g_free (entry->object_path);
+    g_slice_free (ContextEntry, entry);
+}
+
 static void
 eekboard_service_init (EekboardService *self)
 {
@@ -294,24 +426,38 @@ eekboard_service_init (EekboardService *self)
     self->priv->context_hash =
         g_hash_table_new_full (g_str_hash,
                                g_str_equal,
-                               (GDestroyNotify)g_free,
-                               (GDestroyNotify)g_object_unref);
+                               NULL,
+                               (GDestroyNotify)context_entry_free);
+    self->priv->sender_hash =
+        g_hash_table_new_full (g_str_hash,
+                               g_str_equal,
+                               NULL,
+                               (GDestroyNotify)sender_entry_free);
+    g_queue_init (&self->priv->context_stack);
+    self->priv->keyboard_cache = _eekboard_keyboard_cache_new ();
+    self->priv->settings = g_settings_new ("org.fedorahosted.eekboard");
 }
 
+/* Forget ENTRY and drop the service's reference to its context.
+   The next context on the stack, if any, becomes active. */
 static void
-remove_context_from_stack (EekboardService        *service,
-                           EekboardContextService *context)
+remove_context (EekboardService *service, ContextEntry *entry)
 {
-    GSList *head;
-
-    head = g_slist_find (service->priv->context_stack, context);
-    if (head) {
-        service->priv->context_stack = g_slist_remove_link (service->priv->context_stack, head);
-        g_object_unref (head->data);
-        g_slist_free1 (head);
+    if (entry->stack_link) {
+        GQueue *stack = &service->priv->context_stack;
+        gboolean was_active = entry->stack_link == stack->head;
+
+        g_queue_delete_link (stack, entry->stack_link);
+        entry->stack_link = NULL;
+        if (was_active && stack->head)
+            eekboard_context_service_enable (ENTRY_CONTEXT(stack->head));
     }
-    if (service->priv->context_stack)
-        eekboard_context_service_enable (service->priv->context_stack->data);
+
+    g_queue_delete_link (&entry->sender->contexts, entry->sender_link);
+    if (g_queue_is_empty (&entry->sender->contexts))
+        g_hash_table_remove (service->priv->sender_hash, entry->sender->name);
+
+    g_hash_table_remove (service->priv->context_hash, entry->object_path);
 }
 
 static void
@@ -320,44 +466,28 @@ service_name_vanished_callback (GDBusConnection *connection,
                                 gpointer         user_data)
 {
     EekboardService *service = user_data;
-    GSList *head;
-    GHashTableIter iter;
-    gpointer k, v;
-
-    g_hash_table_iter_init (&iter, service->priv->context_hash);
-    while (g_hash_table_iter_next (&iter, &k, &v)) {
-        const gchar *owner = g_object_get_data (G_OBJECT(v), "owner");
-        if (g_strcmp0 (owner, name) == 0)
-            g_hash_table_iter_remove (&iter);
-    }
-
-    for (head = service->priv->context_stack; head; ) {
-        const gchar *owner = g_object_get_data (G_OBJECT(head->data), "owner");
-        GSList *next = g_slist_next (head);
-
-        if (g_strcmp0 (owner, name) == 0) {
-            service->priv->context_stack =
-                g_slist_remove_link (service->priv->context_stack, head);
-            g_object_unref (head->data);
-            g_slist_free1 (head);
-        }
+    SenderEntry *sender;
+    guint n_contexts;
 
-        head = next;
-    }
+    sender = g_hash_table_lookup (service->priv->sender_hash, name);
+    if (sender == NULL)
+        return;
 
-    if (service->priv->context_stack)
-        eekboard_context_service_enable (service->priv->context_stack->data);
+    /* removing the last context frees sender */
+    for (n_contexts = sender->contexts.length; n_contexts > 0; n_contexts--)
+        remove_context (service, g_queue_peek_head (&sender->contexts));
 }
 
 static void
 context_destroyed_cb (EekboardContextService *context, EekboardService *service)
 {
     gchar *object_path = NULL;
-
-    remove_context_from_stack (service, context);
+    ContextEntry *entry;
 
     g_object_get (G_OBJECT(context), "object-path", &object_path, NULL);
-    g_hash_table_remove (service->priv->context_hash, object_path);
+    entry = g_hash_table_lookup (service->priv->context_hash, object_path);
+    if (entry)
+        remove_context (service, entry);
     g_free (object_path);
 }
 
@@ -369,6 +499,65 @@ on_notify_visible (GObject *object, GParamSpec *spec, gpointer user_data)
     g_object_get (object, "visible", &service->priv->visible, NULL);
 }
 
+/* Returns the object path of the new context, owned by the context
+   hash. */
+static const gchar *
+create_context (EekboardService *service,
+                const gchar     *client_name,
+                const gchar     *sender)
+{
+    EekboardServiceClass *klass = EEKBOARD_SERVICE_GET_CLASS(service);
+    static gint context_id = 0;
+    SenderEntry *sender_entry;
+    ContextEntry *entry;
+
+    /* The client is about to add keyboards; let it wait on loads
+       which are already running. */
+    if (service->priv->preload_id)
+        preload_keyboards (service);
+
+    sender_entry = g_hash_table_lookup (service->priv->sender_hash, sender);
+    if (sender_entry == NULL) {
+        sender_entry = g_slice_new0 (SenderEntry);
+        sender_entry->name = g_strdup (sender);
+        g_queue_init (&sender_entry->contexts);
+        /* the vanished callback is called when clients are disconnected */
+        sender_entry->watch_id =
+            g_bus_watch_name_on_connection (service->priv->connection,
+                                            sender,
+                                            G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                            NULL,
+                                            service_name_vanished_callback,
+                                            service,
+                                            NULL);
+        g_hash_table_insert (service->priv->sender_hash,
+                             sender_entry->name,
+                             sender_entry);
+    }
+
+    entry = g_slice_new0 (ContextEntry);
+    entry->service = service;
+    entry->object_path = g_strdup_printf (EEKBOARD_CONTEXT_SERVICE_PATH,
+                                          context_id++);
+    g_assert (klass->create_context);
+    entry->context = klass->create_context (service,
+                                            client_name,
+                                            entry->object_path);
+    g_object_set (G_OBJECT(entry->context), "owner", sender, NULL);
+    _eekboard_context_service_set_keyboard_cache
+        (entry->context, service->priv->keyboard_cache);
+    entry->sender = sender_entry;
+    g_queue_push_tail (&sender_entry->contexts, entry);
+    entry->sender_link = sender_entry->contexts.tail;
+    g_hash_table_insert (service->priv->context_hash,
+                         entry->object_path,
+                         entry);
+
+    g_signal_connect (G_OBJECT(entry->context), "destroyed",
+                      G_CALLBACK(context_destroyed_cb), service);
+    return entry->object_path;
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const gchar           *sender,
@@ -380,105 +569,149 @@ handle_method_call (GDBusConnection       *connection,
                     gpointer               user_data)
 {
     EekboardService *service = user_data;
-    EekboardServiceClass *klass = EEKBOARD_SERVICE_GET_CLASS(service);
 
     if (g_strcmp0 (method_name, "CreateContext") == 0) {
-        const gchar *client_name;
-        gchar *object_path;
-        static gint context_id = 0;
-        EekboardContextService *context;
+        const gchar *client_name, *object_path;
 
         g_variant_get (parameters, "(&s)", &client_name);
-        object_path = g_strdup_printf (EEKBOARD_CONTEXT_SERVICE_PATH, context_id++);
-        g_assert (klass->create_context);
-        context = klass->create_context (service, client_name, object_path);
-        g_object_set_data_full (G_OBJECT(context),
-                                "owner", g_strdup (sender),
-                                (GDestroyNotify)g_free);
-        g_hash_table_insert (service->priv->context_hash,
-                             object_path,
-                             context);
+        object_path = create_context (service, client_name, sender);
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(s)",
+                                                              object_path));
+        return;
+    }
 
-        /* the vanished callback is called when clients are disconnected */
-        g_bus_watch_name_on_connection (service->priv->connection,
-                                        sender,
-                                        G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                        NULL,
-                                        service_name_vanished_callback,
-                                        service,
-                                        NULL);
+    /* Same as CreateContext, but also let the client connect to the
+       context directly.  The client binds the connection with
+       BindPeer and the token.  An empty address means the client
+       has to stay on the bus. */
+    if (g_strcmp0 (method_name, "CreatePeerContext") == 0) {
+        const gchar *client_name, *object_path, *peer_address, *peer_token;
+        ContextEntry *entry;
+        GError *error;
 
-        g_signal_connect (G_OBJECT(context), "destroyed",
-                          G_CALLBACK(context_destroyed_cb), service);
+        g_variant_get (parameters, "(&s)", &client_name);
+        object_path = create_context (service, client_name, sender);
+        entry = g_hash_table_lookup (service->priv->context_hash, object_path);
+
+        error = NULL;
+        peer_address = eekboard_context_service_listen_peer (entry->context,
+                                                             &peer_token,
+                                                             &error);
+        if (peer_address == NULL) {
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+                g_warning ("can't listen for peer connection: %s",
+                           error->message);
+            g_error_free (error);
+            peer_address = "";
+            peer_token = "";
+        }
 
         g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(s)",
-                                                              object_path));
+                                               g_variant_new ("(sss)",
+                                                              object_path,
+                                                              peer_address,
+                                                              peer_token));
         return;
     }
 
     if (g_strcmp0 (method_name, "PushContext") == 0) {
         const gchar *object_path;
-        EekboardContextService *context;
+        ContextEntry *entry;
+        GQueue *stack = &service->priv->context_stack;
 
         g_variant_get (parameters, "(&s)", &object_path);
-        context = g_hash_table_lookup (service->priv->context_hash, object_path);
-        if (!context) {
+        entry = g_hash_table_lookup (service->priv->context_hash, object_path);
+        if (!entry) {
             g_dbus_method_invocation_return_error (invocation,
                                                    G_IO_ERROR,
                                                    G_IO_ERROR_FAILED_HANDLED,
                                                    "context not found");
             return;
         }
-        if (service->priv->context_stack)
-            eekboard_context_service_disable (service->priv->context_stack->data);
-        service->priv->context_stack = g_slist_prepend (service->priv->context_stack,
-                                               g_object_ref (context));
-        eekboard_context_service_enable (context);
-        g_signal_connect (context, "notify::visible",
-                          G_CALLBACK(on_notify_visible), service);
+        if (stack->head)
+            eekboard_context_service_disable (ENTRY_CONTEXT(stack->head));
+        /* a context pushed again moves to the top */
+        if (entry->stack_link)
+            g_queue_unlink (stack, entry->stack_link);
+        else {
+            entry->stack_link = g_list_alloc ();
+            entry->stack_link->data = entry;
+            g_signal_connect (entry->context, "notify::visible",
+                              G_CALLBACK(on_notify_visible), service);
+        }
+        g_queue_push_head_link (stack, entry->stack_link);
+        eekboard_context_service_enable (entry->context);
         if (service->priv->visible)
-            eekboard_context_service_show_keyboard (context);
+            eekboard_context_service_show_keyboard (entry->context);
 
         g_dbus_method_invocation_return_value (invocation, NULL);
         return;
     }
 
     if (g_strcmp0 (method_name, "PopContext") == 0) {
-        if (service->priv->context_stack) {
-            EekboardContextService *context = service->priv->context_stack->data;
-            gchar *object_path;
-            const gchar *owner;
-
-            g_object_get (G_OBJECT(context), "object-path", &object_path, NULL);
-            owner = g_object_get_data (G_OBJECT(context), "owner");
-            if (g_strcmp0 (owner, sender) != 0) {
+        GQueue *stack = &service->priv->context_stack;
+
+        if (stack->head) {
+            ContextEntry *entry = stack->head->data;
+
+            if (g_strcmp0 (entry->sender->name, sender) != 0) {
                 g_dbus_method_invocation_return_error
                     (invocation,
                      G_IO_ERROR,
                      G_IO_ERROR_FAILED_HANDLED,
                      "context at %s not owned by %s",
-                     object_path, sender);
+                     entry->object_path, sender);
                 return;
             }
-            g_free (object_path);
-                
-            g_signal_handlers_disconnect_by_func (context,
+
+            g_signal_handlers_disconnect_by_func (entry->context,
                                                   G_CALLBACK(on_notify_visible),
                                                   service);
-            eekboard_context_service_disable (context);
-            service->priv->context_stack = g_slist_next (service->priv->context_stack);
-            if (service->priv->context_stack)
-                eekboard_context_service_enable (service->priv->context_stack->data);
+            eekboard_context_service_disable (entry->context);
+            g_queue_delete_link (stack, entry->stack_link);
+            entry->stack_link = NULL;
+            if (stack->head)
+                eekboard_context_service_enable (ENTRY_CONTEXT(stack->head));
+        }
+
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "DestroyContext") == 0) {
+        const gchar *object_path;
+        ContextEntry *entry;
+
+        g_variant_get (parameters, "(&s)", &object_path);
+        entry = g_hash_table_lookup (service->priv->context_hash, object_path);
+        if (!entry) {
+            g_dbus_method_invocation_return_error (invocation,
+                                                   G_IO_ERROR,
+                                                   G_IO_ERROR_FAILED_HANDLED,
+                                                   "context not found");
+            return;
+        }
+        if (g_strcmp0 (entry->sender->name, sender) != 0) {
+            g_dbus_method_invocation_return_error
+                (invocation,
+                 G_IO_ERROR,
+                 G_IO_ERROR_FAILED_HANDLED,
+                 "context at %s not owned by %s",
+                 object_path, sender);
+            return;
         }
 
+        /* context_destroyed_cb() removes the entry */
+        eekboard_context_service_destroy (entry->context);
         g_dbus_method_invocation_return_value (invocation, NULL);
         return;
     }
 
     if (g_strcmp0 (method_name, "ShowKeyboard") == 0) {
-        if (service->priv->context_stack) {
-            eekboard_context_service_show_keyboard (service->priv->context_stack->data);
+        if (service->priv->context_stack.head) {
+            eekboard_context_service_show_keyboard
+                (ENTRY_CONTEXT(service->priv->context_stack.head));
         } else {
             service->priv->visible = TRUE;
         }
@@ -486,8 +719,9 @@ handle_method_call (GDBusConnection       *connection,
     }
 
     if (g_strcmp0 (method_name, "HideKeyboard") == 0) {
-        if (service->priv->context_stack) {
-            eekboard_context_service_hide_keyboard (service->priv->context_stack->data);
+        if (service->priv->context_stack.head) {
+            eekboard_context_service_hide_keyboard
+                (ENTRY_CONTEXT(service->priv->context_stack.head));
         } else {
             service->priv->visible = FALSE;
         }
@@ -45,6 +45,10 @@ static gchar *opt_keyboards = NULL;
 
 static gboolean opt_fullscreen = FALSE;
 
+#ifdef HAVE_XTEST
+static gboolean opt_shared_memory = FALSE;
+#endif  /* HAVE_XTEST */
+
 static const GOptionEntry options[] = {
     {"system", 'y', 0, G_OPTION_ARG_NONE, &opt_system,
      N_("Connect to the system bus")},
@@ -64,6 +68,10 @@ static const GOptionEntry options[] = {
      N_("Specify keyboards (comma separated)")},
     {"fullscreen", 'F', 0, G_OPTION_ARG_NONE, &opt_fullscreen,
      N_("Create window in fullscreen mode")},
+#ifdef HAVE_XTEST
+    {"shared-memory", 'm', 0, G_OPTION_ARG_NONE, &opt_shared_memory,
+     N_("Receive key events through shared memory")},
+#endif  /* HAVE_XTEST */
     {NULL}
 };
 
@@ -276,6 +284,10 @@ main (int argc, char **argv)
         g_object_unref (client);
         exit (1);
     }
+
+    /* not fatal: key events keep coming through D-Bus */
+    if (opt_shared_memory && !client_enable_key_ring (client))
+        g_printerr ("Can't receive key events through shared memory\n");
 #endif  /* HAVE_XTEST */
 
     if (!opt_focus) {
@@ -94,6 +94,9 @@ struct _Client {
 #ifdef HAVE_XTEST
     guint modifier_keycodes[8]; 
     XkbDescRec *xkb;
+
+    EekboardKeyRing *key_ring;
+    guint key_ring_watch_id;
 #endif  /* HAVE_XTEST */
 
     GSettings *settings;
@@ -224,6 +227,7 @@ client_dispose (GObject *object)
     }
 
 #ifdef HAVE_XTEST
+    client_disable_key_ring (client);
     client_disable_xtest (client);
 #endif  /* HAVE_XTEST */
 
@@ -580,12 +584,18 @@ keystroke_listener_cb (const AtspiDeviceEvent *stroke,
 {
     Client *client = user_data;
 
+    /* Queue the event so that a burst of key events is sent to the
+       server in one message. */
     switch (stroke->type) {
     case ATSPI_KEY_PRESSED:
-        eekboard_context_press_keycode (client->context, stroke->hw_code, NULL);
+        eekboard_context_queue_key_event (client->context,
+                                          stroke->hw_code,
+                                          TRUE);
         break;
     case ATSPI_KEY_RELEASED:
-        eekboard_context_release_keycode (client->context, stroke->hw_code, NULL);
+        eekboard_context_queue_key_event (client->context,
+                                          stroke->hw_code,
+                                          FALSE);
         break;
     default:
         g_return_val_if_reached (FALSE);
@@ -1017,28 +1027,18 @@ send_fake_key_events (Client    *client,
     if (eek_symbol_is_modifier (symbol))
         return;
 
-    /* If symbol is a text, convert chars in it to keysym */
+    /* If symbol is a text, send the keysym of each char in it */
     if (EEK_IS_TEXT(symbol)) {
-        const gchar *utf8 = eek_text_get_text (EEK_TEXT(symbol));
-        glong items_written;
-        gunichar *ucs4 = g_utf8_to_ucs4_fast (utf8, -1, &items_written);
-        gint i;
+        const gchar *p;
 
-        for (i = 0; i < items_written; i++) {
+        for (p = eek_text_get_text (EEK_TEXT(symbol));
+             p != NULL && *p != '\0';
+             p = g_utf8_next_char (p)) {
             guint xkeysym;
-            EekKeysym *keysym;
-            gchar *name;
-
-            name = g_strdup_printf ("U%04X", ucs4[i]);
-            xkeysym = XStringToKeysym (name);
-            g_free (name);
 
-            keysym = eek_keysym_new (xkeysym);
-            send_fake_key_events (client,
-                                  EEK_SYMBOL(keysym),
-                                  keyboard_modifiers);
+            xkeysym = eek_keysym_unichar_to_xkeysym (g_utf8_get_char (p));
+            send_fake_key_event (client, xkeysym, keyboard_modifiers);
         }
-        g_free (ucs4);
         return;
     }
 
@@ -1049,14 +1049,10 @@ send_fake_key_events (Client    *client,
 }
 
 static void
-on_key_activated (EekboardContext *context,
-                  guint            keycode,
-                  EekSymbol       *symbol,
-                  guint            modifiers,
-                  gpointer         user_data)
+activate_symbol (Client    *client,
+                 EekSymbol *symbol,
+                 guint      modifiers)
 {
-    Client *client = user_data;
-
     if (g_strcmp0 (eek_symbol_get_name (symbol), "cycle-keyboard") == 0) {
         client->keyboards_head = g_slist_next (client->keyboards_head);
         if (client->keyboards_head == NULL)
@@ -1086,6 +1082,41 @@ on_key_activated (EekboardContext *context,
     send_fake_key_events (client, symbol, modifiers);
 }
 
+static void
+on_key_activated (EekboardContext *context,
+                  guint            keycode,
+                  EekSymbol       *symbol,
+                  guint            modifiers,
+                  gpointer         user_data)
+{
+    Client *client = user_data;
+
+    activate_symbol (client, symbol, modifiers);
+}
+
+static gboolean
+on_key_ring_ready (GIOChannel   *source,
+                   GIOCondition  condition,
+                   gpointer      user_data)
+{
+    Client *client = user_data;
+    EekboardKeyRecord record;
+    guint n_dropped;
+
+    /* clear first, so that records pushed while draining wake us up
+       again */
+    eekboard_key_ring_clear_notify (client->key_ring);
+    /* delivered through on_key_activated(), which the context defers
+       until the symbol table is fetched */
+    while (eekboard_key_ring_pop (client->key_ring, &record))
+        eekboard_context_activate_key_record (client->context, &record);
+
+    n_dropped = eekboard_key_ring_get_dropped (client->key_ring);
+    if (n_dropped > 0)
+        g_warning ("%u keys dropped, key ring is full", n_dropped);
+    return TRUE;
+}
+
 static void
 update_modifier_keycodes (Client *client)
 {
@@ -1152,4 +1183,46 @@ client_disable_xtest (Client *client)
         client->xkb = NULL;
     }
 }
+
+/* Receive key activations through shared memory.  The server stops
+   sending KeyActivated to this client; keys which did not fit in the
+   ring are only counted there. */
+gboolean
+client_enable_key_ring (Client *client)
+{
+    GIOChannel *channel;
+    GError *error;
+
+    error = NULL;
+    client->key_ring = eekboard_context_open_key_ring (client->context,
+                                                       NULL,
+                                                       &error);
+    if (client->key_ring == NULL) {
+        g_warning ("can't open key ring: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    channel =
+        g_io_channel_unix_new (eekboard_key_ring_get_notify_fd (client->key_ring));
+    client->key_ring_watch_id = g_io_add_watch (channel,
+                                                G_IO_IN,
+                                                on_key_ring_ready,
+                                                client);
+    g_io_channel_unref (channel);
+    return TRUE;
+}
+
+void
+client_disable_key_ring (Client *client)
+{
+    if (client->key_ring_watch_id > 0) {
+        g_source_remove (client->key_ring_watch_id);
+        client->key_ring_watch_id = 0;
+    }
+    if (client->key_ring) {
+        eekboard_key_ring_free (client->key_ring);
+        client->key_ring = NULL;
+    }
+}
 #endif  /* HAVE_XTEST */
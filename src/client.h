@@ -48,6 +48,9 @@ void     client_disable_atspi_keystroke (Client              *client);
 gboolean client_enable_xtest            (Client              *client);
 void     client_disable_xtest           (Client              *client);
 
+gboolean client_enable_key_ring         (Client              *client);
+void     client_disable_key_ring        (Client              *client);
+
 gboolean client_enable_ibus_focus       (Client              *client);
 void     client_disable_ibus_focus      (Client              *client);
 
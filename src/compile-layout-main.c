@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compile XML keyboard layouts into the binary layout format.  Each
+   compiled layout is loaded back and compared with the keyboard
+   built from the XML files, so a layout which does not round-trip
+   is never installed. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include "eek/eek.h"
+#include "eek/eek-compiled-layout.h"
+#include "eek/eek-xml-layout-private.h"
+
+static gchar *opt_keyboards_dir = NULL;
+static gchar *opt_output_dir = NULL;
+static gboolean opt_all = FALSE;
+
+static const GOptionEntry options[] = {
+    {"keyboards-dir", 'd', 0, G_OPTION_ARG_FILENAME, &opt_keyboards_dir,
+     N_("Read keyboards from the given directory")},
+    {"output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_dir,
+     N_("Write compiled layouts to the given directory")},
+    {"all", 'a', 0, G_OPTION_ARG_NONE, &opt_all,
+     N_("Compile all keyboards listed in keyboards.xml")},
+    {NULL}
+};
+
+static gboolean
+bounds_equal (const EekBounds *bounds1, const EekBounds *bounds2)
+{
+    return bounds1->x == bounds2->x &&
+        bounds1->y == bounds2->y &&
+        bounds1->width == bounds2->width &&
+        bounds1->height == bounds2->height;
+}
+
+static gboolean
+elements_equal (EekElement *element1, EekElement *element2)
+{
+    EekBounds bounds1, bounds2;
+
+    eek_element_get_bounds (element1, &bounds1);
+    eek_element_get_bounds (element2, &bounds2);
+    return bounds_equal (&bounds1, &bounds2) &&
+        g_strcmp0 (eek_element_get_name (element1),
+                   eek_element_get_name (element2)) == 0;
+}
+
+static gboolean
+matrices_equal (EekSymbolMatrix *matrix1, EekSymbolMatrix *matrix2)
+{
+    gint num_symbols1 = 0, num_symbols2 = 0;
+
+    if (matrix1)
+        num_symbols1 = matrix1->num_groups * matrix1->num_levels;
+    if (matrix2)
+        num_symbols2 = matrix2->num_groups * matrix2->num_levels;
+    if (num_symbols1 == 0 || num_symbols2 == 0)
+        return num_symbols1 == num_symbols2;
+
+    /* Both keyboards get their symbols from the pool, so equal
+       symbols are identical. */
+    return eek_symbol_matrix_equal (matrix1, matrix2);
+}
+
+static gboolean
+keys_equal (EekKey *key1, EekKey *key2)
+{
+    gint column1, row1, column2, row2;
+
+    eek_key_get_index (key1, &column1, &row1);
+    eek_key_get_index (key2, &column2, &row2);
+    return elements_equal (EEK_ELEMENT(key1), EEK_ELEMENT(key2)) &&
+        eek_key_get_keycode (key1) == eek_key_get_keycode (key2) &&
+        eek_key_get_oref (key1) == eek_key_get_oref (key2) &&
+        column1 == column2 && row1 == row2 &&
+        matrices_equal (eek_key_get_symbol_matrix (key1),
+                        eek_key_get_symbol_matrix (key2));
+}
+
+static gboolean
+sections_equal (EekSection *section1, EekSection *section2)
+{
+    gint i, n_rows;
+    guint j, n_keys;
+
+    if (!elements_equal (EEK_ELEMENT(section1), EEK_ELEMENT(section2)) ||
+        eek_section_get_angle (section1) != eek_section_get_angle (section2))
+        return FALSE;
+
+    n_rows = eek_section_get_n_rows (section1);
+    if (n_rows != eek_section_get_n_rows (section2))
+        return FALSE;
+    for (i = 0; i < n_rows; i++) {
+        gint num_columns1, num_columns2;
+        EekOrientation orientation1, orientation2;
+
+        eek_section_get_row (section1, i, &num_columns1, &orientation1);
+        eek_section_get_row (section2, i, &num_columns2, &orientation2);
+        if (num_columns1 != num_columns2 || orientation1 != orientation2)
+            return FALSE;
+    }
+
+    n_keys = eek_container_get_n_children (EEK_CONTAINER(section1));
+    if (n_keys != eek_container_get_n_children (EEK_CONTAINER(section2)))
+        return FALSE;
+    for (j = 0; j < n_keys; j++) {
+        EekElement *key1, *key2;
+
+        key1 = eek_container_get_child (EEK_CONTAINER(section1), j);
+        key2 = eek_container_get_child (EEK_CONTAINER(section2), j);
+        if (!keys_equal (EEK_KEY(key1), EEK_KEY(key2)))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+keyboards_equal (EekKeyboard *keyboard1, EekKeyboard *keyboard2)
+{
+    EekBounds bounds1, bounds2;
+    gsize i, n_outlines;
+    guint j, n_sections;
+
+    eek_element_get_bounds (EEK_ELEMENT(keyboard1), &bounds1);
+    eek_element_get_bounds (EEK_ELEMENT(keyboard2), &bounds2);
+    if (!bounds_equal (&bounds1, &bounds2))
+        return FALSE;
+
+    n_outlines = eek_keyboard_get_n_outlines (keyboard1);
+    if (n_outlines != eek_keyboard_get_n_outlines (keyboard2))
+        return FALSE;
+    for (i = 0; i < n_outlines; i++) {
+        EekOutline *outline1 = eek_keyboard_get_outline (keyboard1, i);
+        EekOutline *outline2 = eek_keyboard_get_outline (keyboard2, i);
+        gint k;
+
+        if (outline1->corner_radius != outline2->corner_radius ||
+            outline1->num_points != outline2->num_points)
+            return FALSE;
+        for (k = 0; k < outline1->num_points; k++)
+            if (outline1->points[k].x != outline2->points[k].x ||
+                outline1->points[k].y != outline2->points[k].y)
+                return FALSE;
+    }
+
+    n_sections = eek_container_get_n_children (EEK_CONTAINER(keyboard1));
+    if (n_sections != eek_container_get_n_children (EEK_CONTAINER(keyboard2)))
+        return FALSE;
+    for (j = 0; j < n_sections; j++) {
+        EekElement *section1, *section2;
+
+        section1 = eek_container_get_child (EEK_CONTAINER(keyboard1), j);
+        section2 = eek_container_get_child (EEK_CONTAINER(keyboard2), j);
+        if (!sections_equal (EEK_SECTION(section1), EEK_SECTION(section2)))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+compile_keyboard (const gchar *id,
+                  const gchar *keyboards_dir,
+                  const gchar *output_dir,
+                  GError     **error)
+{
+    EekLayout *layout;
+    EekKeyboard *keyboard = NULL, *compiled = NULL;
+    GPtrArray *sources;
+    gchar *filename, *path = NULL;
+    gboolean retval = FALSE;
+
+    layout = eek_xml_layout_new (id, error);
+    if (layout == NULL)
+        return FALSE;
+
+    sources = g_ptr_array_new_with_free_func (g_free);
+    keyboard = _eek_xml_layout_load_keyboard (EEK_XML_LAYOUT(layout),
+                                              sources,
+                                              error);
+    if (keyboard == NULL)
+        goto out;
+    g_ptr_array_add (sources, NULL);
+
+    filename = g_strdup_printf ("%s%s", id, EEK_COMPILED_LAYOUT_SUFFIX);
+    path = g_build_filename (output_dir, filename, NULL);
+    g_free (filename);
+
+    if (!eek_compiled_layout_write (keyboard,
+                                    (const gchar * const *)sources->pdata,
+                                    path,
+                                    error))
+        goto out;
+
+    compiled = eek_compiled_layout_load (path, keyboards_dir, layout, error);
+    if (compiled == NULL)
+        goto out;
+
+    if (!keyboards_equal (keyboard, compiled)) {
+        g_set_error (error,
+                     EEK_ERROR,
+                     EEK_ERROR_LAYOUT_ERROR,
+                     "%s does not match the XML layout",
+                     path);
+        g_unlink (path);
+        goto out;
+    }
+    retval = TRUE;
+
+ out:
+    if (compiled)
+        g_object_unref (compiled);
+    if (keyboard)
+        g_object_unref (keyboard);
+    g_ptr_array_free (sources, TRUE);
+    g_free (path);
+    g_object_unref (layout);
+    return retval;
+}
+
+int
+main (int argc, char **argv)
+{
+    GOptionContext *option_context;
+    const gchar *keyboards_dir;
+    gchar *output_dir;
+    GPtrArray *ids;
+    GError *error;
+    guint i;
+    gint status = EXIT_SUCCESS;
+
+    g_type_init ();
+    eek_init ();
+
+    option_context = g_option_context_new ("[ID...]");
+    g_option_context_set_summary (option_context,
+                                  "Compile keyboard layouts into the binary layout format.");
+    g_option_context_add_main_entries (option_context, options, NULL);
+    error = NULL;
+    if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+        g_printerr ("Can't parse options: %s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (option_context);
+        exit (EXIT_FAILURE);
+    }
+    g_option_context_free (option_context);
+
+    /* The XML layout reads keyboards from EEKBOARD_KEYBOARDSDIR. */
+    if (opt_keyboards_dir)
+        g_setenv ("EEKBOARD_KEYBOARDSDIR", opt_keyboards_dir, TRUE);
+    keyboards_dir = g_getenv ("EEKBOARD_KEYBOARDSDIR");
+    if (keyboards_dir == NULL)
+        keyboards_dir = KEYBOARDSDIR;
+
+    if (opt_output_dir)
+        output_dir = g_strdup (opt_output_dir);
+    else
+        output_dir = g_build_filename (keyboards_dir,
+                                       EEK_COMPILED_LAYOUT_DIR,
+                                       NULL);
+    if (g_mkdir_with_parents (output_dir, 0755) < 0) {
+        g_printerr ("Can't create %s\n", output_dir);
+        g_free (output_dir);
+        exit (EXIT_FAILURE);
+    }
+
+    ids = g_ptr_array_new_with_free_func (g_free);
+    if (opt_all) {
+        GList *keyboards, *p;
+
+        keyboards = eek_xml_list_keyboards ();
+        for (p = keyboards; p; p = p->next) {
+            EekXmlKeyboardDesc *desc = p->data;
+            g_ptr_array_add (ids, g_strdup (desc->id));
+        }
+        g_list_free_full (keyboards,
+                          (GDestroyNotify)eek_xml_keyboard_desc_free);
+    }
+    for (i = 1; i < (guint)argc; i++)
+        g_ptr_array_add (ids, g_strdup (argv[i]));
+
+    if (ids->len == 0) {
+        g_printerr ("No keyboard given\n");
+        status = EXIT_FAILURE;
+    }
+
+    for (i = 0; i < ids->len; i++) {
+        const gchar *id = g_ptr_array_index (ids, i);
+
+        error = NULL;
+        if (!compile_keyboard (id, keyboards_dir, output_dir, &error)) {
+            g_printerr ("Can't compile %s: %s\n", id, error->message);
+            g_error_free (error);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    g_ptr_array_free (ids, TRUE);
+    g_free (output_dir);
+
+    return status;
+}
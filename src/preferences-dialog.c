@@ -187,12 +187,6 @@ selection_changed_cb (GtkTreeSelection *selection, PreferencesDialog *dialog)
     }
 }
 
-static gint
-compare_keyboard_id (const EekXmlKeyboardDesc *desc, const char *id)
-{
-    return g_strcmp0 (desc->id, id);
-}
-
 static void
 populate_selected_keyboards (PreferencesDialog *dialog)
 {
@@ -200,16 +194,14 @@ populate_selected_keyboards (PreferencesDialog *dialog)
 
     strv = g_settings_get_strv (dialog->settings, "keyboards");
     for (p = strv; *p != NULL; p++) {
-        GList *head = g_list_find_custom (dialog->available_keyboards,
-                                            *p,
-                                            (GCompareFunc) compare_keyboard_id);
-        if (head == NULL) {
+        EekXmlKeyboardDesc *desc = eek_xml_find_keyboard (*p);
+        if (desc == NULL) {
             g_warning ("unknown keyboard %s", *p);
         } else {
-            EekXmlKeyboardDesc *desc = head->data;
             add_keyboard_to_treeview (GTK_TREE_VIEW(dialog->selected_keyboards_treeview),
                                       desc->id,
                                       desc->longname);
+            eek_xml_keyboard_desc_free (desc);
         }
     }
     g_strfreev (strv);
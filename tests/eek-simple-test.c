@@ -18,6 +18,7 @@
  * 02110-1301 USA
  */
 #include "eek/eek.h"
+#include "eek/eek-symbol-pool.h"
 
 static void
 test_create (void)
@@ -36,11 +37,67 @@ test_create (void)
     g_assert (EEK_IS_KEY(key1));
 }
 
+static void
+test_keysym (void)
+{
+    EekKeysym *keysym0, *keysym1;
+    EekSymbol *symbol;
+
+    /* keysyms are shared */
+    keysym0 = eek_keysym_new (0x61);
+    keysym1 = eek_keysym_new (0x61);
+    g_assert (keysym0 == keysym1);
+    g_object_unref (keysym1);
+
+    keysym1 = eek_keysym_new_with_modifier (0x61, EEK_SHIFT_MASK);
+    g_assert (keysym0 != keysym1);
+    g_object_unref (keysym1);
+
+    /* a pooled keysym with its own label doesn't change the shared one */
+    symbol = eek_symbol_pool_get_keysym (0x61, "A!", NULL, NULL);
+    g_assert (symbol != EEK_SYMBOL(keysym0));
+    g_assert_cmpstr (eek_symbol_get_label (symbol), ==, "A!");
+    g_assert_cmpstr (eek_symbol_get_label (EEK_SYMBOL(keysym0)), ==, "a");
+    g_object_unref (symbol);
+
+    g_object_unref (keysym0);
+}
+
+static void
+test_symbol_pool (void)
+{
+    EekSymbol *symbol0, *symbol1, *symbol2;
+    const EekSymbolPoolKey *key;
+
+    /* keys describing the same keysym share one entry */
+    symbol0 = eek_symbol_pool_get_keysym (0x61, NULL, NULL, NULL);
+    symbol1 = eek_symbol_pool_get_keysym_from_name ("a", NULL, NULL, NULL);
+    symbol2 = eek_symbol_pool_get_keysym_with_modifier
+        (0x61,
+         eek_symbol_get_modifier_mask (symbol0),
+         NULL, NULL, NULL);
+    g_assert (symbol0 == symbol1);
+    g_assert (symbol0 == symbol2);
+
+    key = eek_symbol_pool_get_key (symbol0);
+    g_assert (key != NULL);
+    g_assert_cmpuint (key->xkeysym, ==, 0x61);
+    g_object_unref (symbol2);
+    g_object_unref (symbol1);
+
+    /* only the pool and the keysym table are left holding it, so the
+       pool can drop it */
+    g_assert_cmpuint (G_OBJECT(symbol0)->ref_count, ==, 3);
+    g_object_unref (symbol0);
+}
+
 int
 main (int argc, char **argv)
 {
     g_type_init ();
     g_test_init (&argc, &argv, NULL);
     g_test_add_func ("/eek-simple-test/create", test_create);
+    g_test_add_func ("/eek-simple-test/keysym", test_keysym);
+    g_test_add_func ("/eek-simple-test/symbol-pool", test_symbol_pool);
     return g_test_run ();
 }
@@ -43,6 +43,229 @@ test_output_parse (void)
     g_object_unref (keyboard);
 }
 
+/* Keys pressed in a saved state leave the keyboard alone, and take
+   effect when the state is put back. */
+static void
+test_keyboard_state (void)
+{
+    EekLayout *layout;
+    EekKeyboard *keyboard;
+    EekKeyboardState *state;
+    EekKey *key, *shift;
+    GList *keys;
+    GError *error;
+
+    error = NULL;
+    layout = eek_xml_layout_new ("us", &error);
+    g_assert_no_error (error);
+    keyboard = eek_keyboard_new (layout, 640, 480);
+    g_object_unref (layout);
+
+    key = eek_keyboard_find_key_by_keycode (keyboard, 38);
+    shift = eek_keyboard_find_key_by_keycode (keyboard, 50);
+    g_assert (key != NULL && shift != NULL);
+
+    state = eek_keyboard_get_state (keyboard);
+    eek_keyboard_state_set_modifier_behavior (state,
+                                              EEK_MODIFIER_BEHAVIOR_LATCH);
+    eek_keyboard_state_set_group (state, 1);
+
+    g_signal_emit_by_name (key, "pressed");
+    eek_keyboard_state_press_key (state, keyboard, shift);
+    eek_keyboard_state_release_key (state, keyboard, shift);
+
+    keys = eek_keyboard_get_pressed_keys (keyboard);
+    g_assert (keys != NULL && keys->data == key && keys->next == NULL);
+    g_list_free (keys);
+    g_assert_cmpint (eek_keyboard_get_modifiers (keyboard), ==, 0);
+    g_assert (eek_keyboard_get_locked_keys (keyboard) == NULL);
+    g_assert_cmpint (eek_keyboard_get_modifier_behavior (keyboard),
+                     ==,
+                     EEK_MODIFIER_BEHAVIOR_NONE);
+
+    /* shift is latched, and the key pressed before is cancelled */
+    eek_keyboard_set_state (keyboard, state);
+    g_assert (eek_keyboard_get_pressed_keys (keyboard) == NULL);
+    g_assert_cmpint (eek_keyboard_get_modifiers (keyboard),
+                     ==,
+                     EEK_SHIFT_MASK);
+    keys = eek_keyboard_get_locked_keys (keyboard);
+    g_assert (keys != NULL && keys->next == NULL);
+    g_assert (((EekModifierKey *)keys->data)->key == shift);
+    g_list_free (keys);
+    g_assert_cmpint (eek_keyboard_get_modifier_behavior (keyboard),
+                     ==,
+                     EEK_MODIFIER_BEHAVIOR_LATCH);
+    g_assert_cmpint (eek_element_get_group (EEK_ELEMENT(keyboard)), ==, 1);
+
+    eek_keyboard_state_free (state);
+    g_object_unref (keyboard);
+}
+
+static void
+test_find_keyboard (void)
+{
+    EekXmlKeyboardDesc *desc, *copy;
+
+    desc = eek_xml_find_keyboard ("us");
+    g_assert (desc != NULL);
+    g_assert_cmpstr (desc->id, ==, "us");
+
+    copy = eek_xml_keyboard_desc_copy (desc);
+    g_assert (copy->id != desc->id);
+    g_assert_cmpstr (copy->geometry, ==, desc->geometry);
+    eek_xml_keyboard_desc_free (desc);
+    g_assert_cmpstr (copy->id, ==, "us");
+    eek_xml_keyboard_desc_free (copy);
+
+    g_assert (eek_xml_find_keyboard ("no-such-keyboard") == NULL);
+}
+
+/* Create and destroy every shipped keyboard.  With -m perf, repeat
+   it and report the average time per keyboard. */
+static void
+test_create_destroy (void)
+{
+    GList *keyboards, *head;
+    gint i, iterations = g_test_perf () ? 20 : 1;
+
+    keyboards = eek_xml_list_keyboards ();
+    g_assert (keyboards != NULL);
+
+    for (head = keyboards; head; head = g_list_next (head)) {
+        EekXmlKeyboardDesc *desc = head->data;
+        gdouble create_time = 0.0, destroy_time = 0.0;
+
+        for (i = 0; i < iterations; i++) {
+            EekLayout *layout;
+            EekKeyboard *keyboard;
+            GError *error;
+
+            g_test_timer_start ();
+            error = NULL;
+            layout = eek_xml_layout_new (desc->id, &error);
+            g_assert_no_error (error);
+            keyboard = eek_keyboard_new (layout, 640, 480);
+            g_assert (keyboard != NULL);
+            create_time += g_test_timer_elapsed ();
+
+            g_test_timer_start ();
+            g_object_unref (keyboard);
+            g_object_unref (layout);
+            destroy_time += g_test_timer_elapsed ();
+        }
+
+        if (g_test_perf ()) {
+            g_test_minimized_result (create_time / iterations,
+                                     "create %s: %.3f msec",
+                                     desc->id,
+                                     create_time * 1000 / iterations);
+            g_test_minimized_result (destroy_time / iterations,
+                                     "destroy %s: %.3f msec",
+                                     desc->id,
+                                     destroy_time * 1000 / iterations);
+        }
+    }
+
+    g_list_free_full (keyboards, (GDestroyNotify) eek_xml_keyboard_desc_free);
+}
+
+static const GMarkupParser null_parser = { 0, };
+
+/* Parse FILENAME either in 8k chunks read from a stream, as the XML
+   layout used to, or in one call from a mapped file. */
+static gdouble
+time_parse (const gchar *filename, gboolean mapped)
+{
+    GMarkupParseContext *pcontext;
+    GError *error = NULL;
+    gboolean retval;
+
+    g_test_timer_start ();
+    pcontext = g_markup_parse_context_new (&null_parser, 0, NULL, NULL);
+    if (mapped) {
+        GMappedFile *mapped_file = g_mapped_file_new (filename, FALSE, &error);
+
+        g_assert_no_error (error);
+        retval = g_markup_parse_context_parse
+            (pcontext,
+             g_mapped_file_get_contents (mapped_file),
+             g_mapped_file_get_length (mapped_file),
+             &error) &&
+            g_markup_parse_context_end_parse (pcontext, &error);
+        g_mapped_file_unref (mapped_file);
+    } else {
+        GFile *file = g_file_new_for_path (filename);
+        GFileInputStream *input = g_file_read (file, NULL, &error);
+        gchar buffer[8192];
+        gssize nread;
+
+        g_assert_no_error (error);
+        retval = TRUE;
+        while (retval &&
+               (nread = g_input_stream_read (G_INPUT_STREAM(input),
+                                             buffer,
+                                             sizeof (buffer),
+                                             NULL,
+                                             &error)) > 0)
+            retval = g_markup_parse_context_parse (pcontext,
+                                                   buffer,
+                                                   nread,
+                                                   &error);
+        if (retval)
+            retval = g_markup_parse_context_end_parse (pcontext, &error);
+        g_object_unref (input);
+        g_object_unref (file);
+    }
+    g_markup_parse_context_free (pcontext);
+    g_assert_no_error (error);
+    g_assert (retval);
+    return g_test_timer_elapsed ();
+}
+
+/* Check that every shipped symbols file is well-formed.  With -m
+   perf, compare reading it through a stream with mapping it. */
+static void
+test_parse_symbols (void)
+{
+    const gchar *keyboards_dir, *name;
+    gchar *symbols_dir;
+    GDir *dir;
+    GError *error = NULL;
+    gint i, iterations = g_test_perf () ? 100 : 1;
+    gdouble stream_time = 0.0, mapped_time = 0.0;
+
+    keyboards_dir = g_getenv ("EEKBOARD_KEYBOARDSDIR");
+    g_assert (keyboards_dir != NULL);
+    symbols_dir = g_build_filename (keyboards_dir, "symbols", NULL);
+    dir = g_dir_open (symbols_dir, 0, &error);
+    g_assert_no_error (error);
+
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        gchar *filename;
+
+        if (!g_str_has_suffix (name, ".xml"))
+            continue;
+        filename = g_build_filename (symbols_dir, name, NULL);
+        for (i = 0; i < iterations; i++) {
+            stream_time += time_parse (filename, FALSE);
+            mapped_time += time_parse (filename, TRUE);
+        }
+        g_free (filename);
+    }
+    g_dir_close (dir);
+    g_free (symbols_dir);
+
+    if (g_test_perf ()) {
+        g_test_minimized_result (stream_time / iterations,
+                                 "parse symbols (stream): %.3f msec",
+                                 stream_time * 1000 / iterations);
+        g_test_minimized_result (mapped_time / iterations,
+                                 "parse symbols (mapped): %.3f msec",
+                                 mapped_time * 1000 / iterations);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
@@ -51,6 +274,10 @@ main (int argc, char **argv)
     gtk_init (&argc, &argv);  /* for gdk_x11_display_get_xdisplay() */
 
     g_test_add_func ("/eek-xml-test/output-parse", test_output_parse);
+    g_test_add_func ("/eek-xml-test/keyboard-state", test_keyboard_state);
+    g_test_add_func ("/eek-xml-test/find-keyboard", test_find_keyboard);
+    g_test_add_func ("/eek-xml-test/create-destroy", test_create_destroy);
+    g_test_add_func ("/eek-xml-test/parse-symbols", test_parse_symbols);
 
     return g_test_run ();
 }
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* Scheduling of the key repeat timer used by EekboardContextService. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <string.h>
+
+#include "eekboard/eekboard-key-repeat.h"
+
+typedef struct _RepeatData RepeatData;
+struct _RepeatData {
+    EekboardKeyRepeat *repeat;
+    GMainLoop *loop;
+    GTimer *timer;
+    guint n_ticks;
+    guint last_count;
+    gdouble tick_times[8];
+    /* sleep in the first tick, in milliseconds */
+    guint stall;
+};
+
+static void
+on_tick (guint count, gpointer user_data)
+{
+    RepeatData *data = user_data;
+
+    g_assert_cmpuint (count, ==, data->last_count + 1);
+    data->last_count = count;
+    if (count <= G_N_ELEMENTS(data->tick_times))
+        data->tick_times[count - 1] = g_timer_elapsed (data->timer, NULL);
+
+    if (count == 1 && data->stall > 0)
+        g_usleep (data->stall * 1000);
+
+    if (count == data->n_ticks) {
+        _eekboard_key_repeat_stop (data->repeat);
+        g_main_loop_quit (data->loop);
+    }
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+    RepeatData *data = user_data;
+
+    g_main_loop_quit (data->loop);
+    return FALSE;
+}
+
+static void
+repeat_data_init (RepeatData *data, guint n_ticks)
+{
+    memset (data, 0, sizeof *data);
+    data->repeat = _eekboard_key_repeat_new (on_tick, data);
+    data->loop = g_main_loop_new (NULL, FALSE);
+    data->timer = g_timer_new ();
+    data->n_ticks = n_ticks;
+}
+
+static void
+repeat_data_clear (RepeatData *data)
+{
+    _eekboard_key_repeat_free (data->repeat);
+    g_main_loop_unref (data->loop);
+    g_timer_destroy (data->timer);
+}
+
+/* Ticks come after the delay and then on every interval, not
+   earlier.  With -m perf, report how late they were. */
+static void
+test_ticks (void)
+{
+    RepeatData data;
+    guint n_ticks = g_test_perf () ? 500 : 10;
+    gint64 mean, max;
+
+    repeat_data_init (&data, n_ticks);
+    _eekboard_key_repeat_set_timing (data.repeat, TRUE, 20, 5);
+    g_timer_start (data.timer);
+    _eekboard_key_repeat_start (data.repeat);
+    g_main_loop_run (data.loop);
+
+    g_assert_cmpuint (data.last_count, ==, n_ticks);
+    g_assert (!_eekboard_key_repeat_is_running (data.repeat));
+    g_assert_cmpfloat (data.tick_times[0], >=, 0.020);
+    g_assert_cmpfloat (g_timer_elapsed (data.timer, NULL),
+                       >=,
+                       0.020 + 0.005 * (n_ticks - 1));
+
+    _eekboard_key_repeat_get_jitter (data.repeat, &mean, &max);
+    g_assert_cmpint (mean, >=, 0);
+    g_assert_cmpint (max, >=, mean);
+    if (g_test_perf ()) {
+        g_test_minimized_result (mean / 1000.0,
+                                 "mean repeat jitter: %.3f ms",
+                                 mean / 1000.0);
+        g_test_minimized_result (max / 1000.0,
+                                 "max repeat jitter: %.3f ms",
+                                 max / 1000.0);
+    }
+
+    repeat_data_clear (&data);
+}
+
+/* Without repeat, only the first tick is delivered. */
+static void
+test_no_repeat (void)
+{
+    RepeatData data;
+
+    repeat_data_init (&data, 0);
+    _eekboard_key_repeat_set_timing (data.repeat, FALSE, 10, 5);
+    _eekboard_key_repeat_start (data.repeat);
+    g_timeout_add (100, on_timeout, &data);
+    g_main_loop_run (data.loop);
+
+    g_assert_cmpuint (data.last_count, ==, 1);
+    g_assert (!_eekboard_key_repeat_is_running (data.repeat));
+    g_assert (!_eekboard_key_repeat_stop (data.repeat));
+
+    repeat_data_clear (&data);
+}
+
+/* Ticks missed while the main loop is stalled are delivered together,
+   but not all of them. */
+static void
+test_catch_up (void)
+{
+    RepeatData data;
+
+    repeat_data_init (&data, 4);
+    data.stall = 60;
+    _eekboard_key_repeat_set_timing (data.repeat, TRUE, 0, 10);
+    g_timer_start (data.timer);
+    _eekboard_key_repeat_start (data.repeat);
+    g_main_loop_run (data.loop);
+
+    g_assert_cmpuint (data.last_count, ==, 4);
+    /* ticks 2 to 4 are dispatched at once after the stall */
+    g_assert_cmpfloat (data.tick_times[1], >=, 0.060);
+    g_assert_cmpfloat (data.tick_times[3] - data.tick_times[1], <, 0.005);
+
+    repeat_data_clear (&data);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/eekboard-key-repeat-test/ticks", test_ticks);
+    g_test_add_func ("/eekboard-key-repeat-test/no-repeat", test_no_repeat);
+    g_test_add_func ("/eekboard-key-repeat-test/catch-up", test_catch_up);
+
+    return g_test_run ();
+}
@@ -0,0 +1,866 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* Direct peer connections to contexts, as eekboard-server offers
+   with CreatePeerContext: binding with the token, KeyActivated over
+   the peer and the fallback to the bus, the key ring, and round trip
+   latency compared with the bus.  The session bus is required and
+   the test is skipped without one. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "eekboard/eekboard-service.h"
+#include "eekboard/eekboard-client.h"
+
+#define TEST_OBJECT_PATH "/org/fedorahosted/Eekboard/Test"
+#define TEST_INTERFACE "org.fedorahosted.Eekboard.Test"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" TEST_INTERFACE "'>"
+    "    <method name='PressKeycode'>"
+    "      <arg type='u' name='keycode'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+  handle_method_call,
+  NULL,
+  NULL
+};
+
+typedef struct _RoundTripData RoundTripData;
+struct _RoundTripData {
+    GMainLoop *loop;
+    GDBusConnection *server_connection;
+    GDBusConnection *client_connection;
+    const gchar *bus_name;
+    gint remaining;
+};
+
+static void call_press_keycode (RoundTripData *data);
+
+static void
+on_press_keycode_reply (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+    RoundTripData *data = user_data;
+    GVariant *result;
+    GError *error = NULL;
+
+    result = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                            res,
+                                            &error);
+    g_assert_no_error (error);
+    g_variant_unref (result);
+
+    if (--data->remaining > 0)
+        call_press_keycode (data);
+    else
+        g_main_loop_quit (data->loop);
+}
+
+static void
+call_press_keycode (RoundTripData *data)
+{
+    g_dbus_connection_call (data->client_connection,
+                            data->bus_name,
+                            TEST_OBJECT_PATH,
+                            TEST_INTERFACE,
+                            "PressKeycode",
+                            g_variant_new ("(u)", 38),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            on_press_keycode_reply,
+                            data);
+}
+
+/* Make ITERATIONS calls one after another and return the average
+   round trip time. */
+static gdouble
+time_round_trip (RoundTripData *data, gint iterations)
+{
+    GDBusNodeInfo *introspection_data;
+    GError *error = NULL;
+    guint registration_id;
+    gdouble elapsed;
+
+    introspection_data = g_dbus_node_info_new_for_xml (introspection_xml,
+                                                       &error);
+    g_assert_no_error (error);
+    registration_id =
+        g_dbus_connection_register_object (data->server_connection,
+                                           TEST_OBJECT_PATH,
+                                           introspection_data->interfaces[0],
+                                           &interface_vtable,
+                                           NULL,
+                                           NULL,
+                                           &error);
+    g_assert_no_error (error);
+
+    data->remaining = iterations;
+    g_test_timer_start ();
+    call_press_keycode (data);
+    g_main_loop_run (data->loop);
+    elapsed = g_test_timer_elapsed ();
+
+    g_dbus_connection_unregister_object (data->server_connection,
+                                         registration_id);
+    g_dbus_node_info_unref (introspection_data);
+    return elapsed / iterations;
+}
+
+static gboolean
+on_new_connection (GDBusServer     *server,
+                   GDBusConnection *connection,
+                   gpointer         user_data)
+{
+    RoundTripData *data = user_data;
+
+    data->server_connection = g_object_ref (connection);
+    if (data->client_connection)
+        g_main_loop_quit (data->loop);
+    return TRUE;
+}
+
+static void
+on_client_connected (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+    RoundTripData *data = user_data;
+    GError *error = NULL;
+
+    data->client_connection = g_dbus_connection_new_for_address_finish (res,
+                                                                        &error);
+    g_assert_no_error (error);
+    if (data->server_connection)
+        g_main_loop_quit (data->loop);
+}
+
+static void
+test_round_trip (void)
+{
+    RoundTripData data = { 0, };
+    GDBusServer *server;
+    GDBusConnection *bus;
+    gchar *address, *guid;
+    GError *error = NULL;
+    gint iterations = g_test_perf () ? 1000 : 10;
+    gdouble peer_time, bus_time;
+
+    data.loop = g_main_loop_new (NULL, FALSE);
+
+    address = g_strdup_printf ("unix:tmpdir=%s", g_get_tmp_dir ());
+    guid = g_dbus_generate_guid ();
+    server = g_dbus_server_new_sync (address,
+                                     G_DBUS_SERVER_FLAGS_NONE,
+                                     guid,
+                                     NULL,
+                                     NULL,
+                                     &error);
+    g_assert_no_error (error);
+    g_free (guid);
+    g_free (address);
+    g_signal_connect (server, "new-connection",
+                      G_CALLBACK(on_new_connection), &data);
+    g_dbus_server_start (server);
+
+    g_dbus_connection_new_for_address
+        (g_dbus_server_get_client_address (server),
+         G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+         NULL,
+         NULL,
+         on_client_connected,
+         &data);
+    g_main_loop_run (data.loop);
+
+    peer_time = time_round_trip (&data, iterations);
+    if (g_test_perf ())
+        g_test_minimized_result (peer_time,
+                                 "round trip (peer): %.3f msec",
+                                 peer_time * 1000);
+
+    g_dbus_connection_close_sync (data.client_connection, NULL, NULL);
+    g_object_unref (data.client_connection);
+    g_object_unref (data.server_connection);
+    g_dbus_server_stop (server);
+    g_object_unref (server);
+
+    /* The bus is optional; compare with it when there is one. */
+    bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    if (bus != NULL) {
+        data.server_connection = bus;
+        data.client_connection = bus;
+        data.bus_name = g_dbus_connection_get_unique_name (bus);
+        bus_time = time_round_trip (&data, iterations);
+        if (g_test_perf ())
+            g_test_minimized_result (bus_time,
+                                     "round trip (bus): %.3f msec",
+                                     bus_time * 1000);
+        g_object_unref (bus);
+    }
+
+    g_main_loop_unref (data.loop);
+}
+
+typedef struct _TestService TestService;
+typedef struct _TestServiceClass TestServiceClass;
+
+struct _TestService {
+    EekboardService parent;
+};
+
+struct _TestServiceClass {
+    EekboardServiceClass parent_class;
+};
+
+static GType test_service_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (TestService, test_service, EEKBOARD_TYPE_SERVICE);
+
+/* the context created last, only used in the main thread */
+static EekboardContextService *test_context = NULL;
+
+static EekboardContextService *
+test_service_real_create_context (EekboardService *self,
+                                  const gchar     *client_name,
+                                  const gchar     *object_path)
+{
+    GDBusConnection *connection;
+    EekboardContextService *context;
+
+    g_object_get (G_OBJECT(self), "connection", &connection, NULL);
+    context = g_object_new (EEKBOARD_TYPE_CONTEXT_SERVICE,
+                            "client-name", client_name,
+                            "object-path", object_path,
+                            "connection", connection,
+                            NULL);
+    g_object_unref (connection);
+    test_context = context;
+    return context;
+}
+
+static void
+test_service_class_init (TestServiceClass *klass)
+{
+    EekboardServiceClass *service_class = EEKBOARD_SERVICE_CLASS(klass);
+    service_class->create_context = test_service_real_create_context;
+}
+
+static void
+test_service_init (TestService *self)
+{
+}
+
+/* The service runs in the main loop of the main thread, and the
+   client in another thread, since the client library makes
+   synchronous calls. */
+typedef struct _ClientData ClientData;
+struct _ClientData {
+    GMainContext *main_context;
+    GDBusConnection *bus;
+    void (*func) (ClientData *data);
+    GMainLoop *service_loop;
+    guint n_enabled;
+    guint n_activated;
+    guint n_bus_activated;
+};
+
+static gboolean
+on_wait_timeout (gpointer user_data)
+{
+    gboolean *timed_out = user_data;
+
+    *timed_out = TRUE;
+    return FALSE;
+}
+
+/* Run the main context of the client until *COUNTER reaches VALUE,
+   for up to TIMEOUT milliseconds. */
+static gboolean
+wait_for_count (ClientData  *data,
+                const guint *counter,
+                guint        value,
+                guint        timeout)
+{
+    GSource *source;
+    gboolean timed_out = FALSE;
+
+    source = g_timeout_source_new (timeout);
+    g_source_set_callback (source, on_wait_timeout, &timed_out, NULL);
+    g_source_attach (source, data->main_context);
+    while (*counter < value && !timed_out)
+        g_main_context_iteration (data->main_context, TRUE);
+    g_source_destroy (source);
+    g_source_unref (source);
+    return *counter >= value;
+}
+
+static gpointer
+client_thread (gpointer user_data)
+{
+    ClientData *data = user_data;
+    gchar *address;
+    GError *error = NULL;
+
+    data->main_context = g_main_context_new ();
+    g_main_context_push_thread_default (data->main_context);
+
+    /* a connection of its own, as a client in another process has */
+    address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION,
+                                               NULL,
+                                               &error);
+    g_assert_no_error (error);
+    data->bus = g_dbus_connection_new_for_address_sync
+        (address,
+         G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+         G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+         NULL,
+         NULL,
+         &error);
+    g_assert_no_error (error);
+    g_free (address);
+
+    data->func (data);
+
+    g_dbus_connection_close_sync (data->bus, NULL, NULL);
+    g_object_unref (data->bus);
+    g_main_context_pop_thread_default (data->main_context);
+    g_main_context_unref (data->main_context);
+
+    g_main_loop_quit (data->service_loop);
+    return NULL;
+}
+
+/* Run FUNC in a client thread while serving it. */
+static void
+run_client (void (*func) (ClientData *data))
+{
+    GDBusConnection *connection;
+    EekboardService *service;
+    ClientData data = { 0, };
+    GThread *thread;
+    GError *error = NULL;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert (connection != NULL);
+    service = g_object_new (test_service_get_type (),
+                            "object-path", EEKBOARD_SERVICE_PATH,
+                            "connection", connection,
+                            NULL);
+
+    data.func = func;
+    data.service_loop = g_main_loop_new (NULL, FALSE);
+    thread = g_thread_create (client_thread, &data, TRUE, &error);
+    g_assert_no_error (error);
+    g_main_loop_run (data.service_loop);
+    g_thread_join (thread);
+
+    g_main_loop_unref (data.service_loop);
+    g_object_unref (service);
+    g_object_unref (connection);
+}
+
+static void
+on_enabled (EekboardContext *context,
+            gpointer         user_data)
+{
+    ClientData *data = user_data;
+
+    data->n_enabled++;
+}
+
+static void
+on_key_activated (EekboardContext *context,
+                  guint            keycode,
+                  EekSymbol       *symbol,
+                  guint            modifiers,
+                  gpointer         user_data)
+{
+    ClientData *data = user_data;
+
+    g_assert_cmpuint (keycode, ==, 38);
+    g_assert (EEK_IS_SYMBOL(symbol));
+    data->n_activated++;
+}
+
+/* KeyActivated signals which reached the client over the bus. */
+static void
+on_bus_key_activated (GDBusConnection *connection,
+                      const gchar     *sender_name,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+    ClientData *data = user_data;
+
+    data->n_bus_activated++;
+}
+
+/* Click a key on the keyboard shown by the service, which is what
+   makes it send KeyActivated; keys pressed by clients with
+   PressKeycode are not sent back to them. */
+static gboolean
+on_click_key (gpointer user_data)
+{
+    EekKeyboard *keyboard;
+    EekKey *key;
+
+    keyboard = eekboard_context_service_get_keyboard (test_context);
+    g_assert (keyboard != NULL);
+    key = eek_keyboard_find_key_by_keycode (keyboard, 38);
+    g_assert (key != NULL);
+    g_signal_emit_by_name (key, "pressed");
+    g_signal_emit_by_name (key, "released");
+    return FALSE;
+}
+
+static void
+click_key (void)
+{
+    g_idle_add (on_click_key, NULL);
+}
+
+static void
+peer_key_activated (ClientData *data)
+{
+    EekboardClient *client;
+    EekboardContext *context;
+    guint keyboard_id, signal_id;
+    gint i;
+
+    client = eekboard_client_new (data->bus, NULL);
+    g_assert (client != NULL);
+    context = eekboard_client_create_context (client, "test", NULL);
+    g_assert (context != NULL);
+    g_signal_connect (context, "enabled",
+                      G_CALLBACK(on_enabled), data);
+    g_signal_connect (context, "key-activated",
+                      G_CALLBACK(on_key_activated), data);
+    signal_id = g_dbus_connection_signal_subscribe
+        (data->bus,
+         NULL,
+         EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+         "KeyActivated",
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         NULL,
+         G_DBUS_SIGNAL_FLAGS_NONE,
+         on_bus_key_activated,
+         data,
+         NULL);
+
+    /* copies of the signals on the bus, which the context must not
+       deliver again; AddKeyboard comes through the peer after it */
+    eekboard_context_set_broadcast (context, TRUE, NULL);
+    keyboard_id = eekboard_context_add_keyboard (context, "us", NULL);
+    g_assert_cmpuint (keyboard_id, >, 0);
+    eekboard_context_set_keyboard (context, keyboard_id, NULL);
+    eekboard_client_push_context (client, context, NULL);
+    /* Enabled comes once the service handled the calls above */
+    g_assert (wait_for_count (data, &data->n_enabled, 1, 5000));
+
+    click_key ();
+    g_assert (wait_for_count (data, &data->n_activated, 1, 5000));
+
+    /* Keys clicked while the client goes back to the bus come
+       through either connection, and each of them once. */
+    for (i = 0; i < 10; i++)
+        click_key ();
+    eekboard_context_disconnect_peer (context);
+    for (i = 0; i < 10; i++)
+        click_key ();
+    g_assert (wait_for_count (data, &data->n_activated, 21, 5000));
+    g_assert (wait_for_count (data, &data->n_bus_activated, 21, 5000));
+    g_assert (!wait_for_count (data, &data->n_activated, 22, 500));
+    g_assert_cmpuint (data->n_bus_activated, ==, 21);
+
+    g_dbus_connection_signal_unsubscribe (data->bus, signal_id);
+    eekboard_client_destroy_context (client, context, NULL);
+    g_object_unref (context);
+    g_object_unref (client);
+}
+
+/* Signals come over the peer connection, and over the bus again once
+   the client disconnects from the peer, without any of them lost or
+   delivered twice. */
+static void
+test_key_activated (void)
+{
+    run_client (peer_key_activated);
+}
+
+static gboolean
+on_key_ring_ready (GIOChannel   *source,
+                   GIOCondition  condition,
+                   gpointer      user_data)
+{
+    EekboardContext *context = user_data;
+    EekboardKeyRing *ring = g_object_get_data (G_OBJECT(context),
+                                               "test-key-ring");
+    EekboardKeyRecord record;
+
+    eekboard_key_ring_clear_notify (ring);
+    while (eekboard_key_ring_pop (ring, &record))
+        eekboard_context_activate_key_record (context, &record);
+    return TRUE;
+}
+
+static void
+peer_key_ring (ClientData *data)
+{
+    EekboardClient *client;
+    EekboardContext *context;
+    EekboardKeyRing *ring;
+    GIOChannel *channel;
+    GSource *source;
+    guint keyboard_id, signal_id;
+    GError *error = NULL;
+
+    client = eekboard_client_new (data->bus, NULL);
+    g_assert (client != NULL);
+    context = eekboard_client_create_context (client, "test", NULL);
+    g_assert (context != NULL);
+    g_signal_connect (context, "enabled",
+                      G_CALLBACK(on_enabled), data);
+    g_signal_connect (context, "key-activated",
+                      G_CALLBACK(on_key_activated), data);
+    signal_id = g_dbus_connection_signal_subscribe
+        (data->bus,
+         NULL,
+         EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+         "KeyActivated",
+         g_dbus_proxy_get_object_path (G_DBUS_PROXY(context)),
+         NULL,
+         G_DBUS_SIGNAL_FLAGS_NONE,
+         on_bus_key_activated,
+         data,
+         NULL);
+
+    ring = eekboard_context_open_key_ring (context, NULL, &error);
+    g_assert_no_error (error);
+    g_object_set_data (G_OBJECT(context), "test-key-ring", ring);
+    channel = g_io_channel_unix_new (eekboard_key_ring_get_notify_fd (ring));
+    source = g_io_create_watch (channel, G_IO_IN);
+    g_source_set_callback (source,
+                           (GSourceFunc)on_key_ring_ready,
+                           context,
+                           NULL);
+    g_source_attach (source, data->main_context);
+    g_io_channel_unref (channel);
+
+    keyboard_id = eekboard_context_add_keyboard (context, "us", NULL);
+    g_assert_cmpuint (keyboard_id, >, 0);
+    eekboard_context_set_keyboard (context, keyboard_id, NULL);
+    eekboard_client_push_context (client, context, NULL);
+    g_assert (wait_for_count (data, &data->n_enabled, 1, 5000));
+
+    /* delivered even if the symbol table is still being fetched */
+    click_key ();
+    click_key ();
+    g_assert (wait_for_count (data, &data->n_activated, 2, 5000));
+    g_assert_cmpuint (data->n_bus_activated, ==, 0);
+    g_assert_cmpuint (eekboard_key_ring_get_dropped (ring), ==, 0);
+
+    g_source_destroy (source);
+    g_source_unref (source);
+    g_dbus_connection_signal_unsubscribe (data->bus, signal_id);
+    eekboard_client_destroy_context (client, context, NULL);
+    g_object_set_data (G_OBJECT(context), "test-key-ring", NULL);
+    eekboard_key_ring_free (ring);
+    g_object_unref (context);
+    g_object_unref (client);
+}
+
+/* Keys passed through the key ring are delivered as key-activated,
+   and not by signal. */
+static void
+test_key_ring (void)
+{
+    run_client (peer_key_ring);
+}
+
+static GVariant *
+call_peer (GDBusConnection *connection,
+           const gchar     *object_path,
+           const gchar     *method_name,
+           GVariant        *parameters,
+           GError         **error)
+{
+    return g_dbus_connection_call_sync (connection,
+                                        NULL,
+                                        object_path,
+                                        EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+                                        method_name,
+                                        parameters,
+                                        NULL,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        NULL,
+                                        error);
+}
+
+static GDBusConnection *
+connect_peer (const gchar *address)
+{
+    GDBusConnection *connection;
+    GError *error = NULL;
+
+    connection = g_dbus_connection_new_for_address_sync
+        (address,
+         G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+         NULL,
+         NULL,
+         &error);
+    g_assert_no_error (error);
+    return connection;
+}
+
+static void
+close_peer (GDBusConnection *connection)
+{
+    g_dbus_connection_close_sync (connection, NULL, NULL);
+    g_object_unref (connection);
+}
+
+static void
+peer_bind (ClientData *data)
+{
+    GDBusConnection *connection;
+    GVariant *result;
+    gchar *object_path, *address, *token;
+    GError *error = NULL;
+
+    result = g_dbus_connection_call_sync (data->bus,
+                                          EEKBOARD_SERVICE_INTERFACE,
+                                          EEKBOARD_SERVICE_PATH,
+                                          EEKBOARD_SERVICE_INTERFACE,
+                                          "CreatePeerContext",
+                                          g_variant_new ("(s)", "test"),
+                                          G_VARIANT_TYPE("(sss)"),
+                                          G_DBUS_CALL_FLAGS_NONE,
+                                          -1,
+                                          NULL,
+                                          &error);
+    g_assert_no_error (error);
+    g_variant_get (result, "(sss)", &object_path, &address, &token);
+    g_variant_unref (result);
+    g_assert_cmpstr (address, !=, "");
+    g_assert_cmpstr (token, !=, "");
+
+    /* no other call is accepted before BindPeer */
+    connection = connect_peer (address);
+    result = call_peer (connection,
+                        object_path,
+                        "PressKeycode",
+                        g_variant_new ("(u)", 38),
+                        &error);
+    g_assert (result == NULL);
+    g_assert (error != NULL);
+    g_clear_error (&error);
+    close_peer (connection);
+
+    connection = connect_peer (address);
+    result = call_peer (connection,
+                        object_path,
+                        "BindPeer",
+                        g_variant_new ("(s)", "0123456789abcdef"),
+                        &error);
+    g_assert (result == NULL);
+    g_assert (error != NULL);
+    g_clear_error (&error);
+    close_peer (connection);
+
+    connection = connect_peer (address);
+    result = call_peer (connection,
+                        object_path,
+                        "BindPeer",
+                        g_variant_new ("(s)", token),
+                        &error);
+    g_assert_no_error (error);
+    g_variant_unref (result);
+
+    /* bound only once */
+    result = call_peer (connection,
+                        object_path,
+                        "BindPeer",
+                        g_variant_new ("(s)", token),
+                        &error);
+    g_assert (result == NULL);
+    g_assert (error != NULL);
+    g_clear_error (&error);
+
+    /* unbound only through the peer */
+    result = g_dbus_connection_call_sync (data->bus,
+                                          EEKBOARD_SERVICE_INTERFACE,
+                                          object_path,
+                                          EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+                                          "UnbindPeer",
+                                          NULL,
+                                          NULL,
+                                          G_DBUS_CALL_FLAGS_NONE,
+                                          -1,
+                                          NULL,
+                                          &error);
+    g_assert (result == NULL);
+    g_assert (error != NULL);
+    g_clear_error (&error);
+    result = call_peer (connection,
+                        object_path,
+                        "UnbindPeer",
+                        NULL,
+                        &error);
+    g_assert_no_error (error);
+    g_variant_unref (result);
+    close_peer (connection);
+
+    result = g_dbus_connection_call_sync (data->bus,
+                                          EEKBOARD_SERVICE_INTERFACE,
+                                          EEKBOARD_SERVICE_PATH,
+                                          EEKBOARD_SERVICE_INTERFACE,
+                                          "DestroyContext",
+                                          g_variant_new ("(s)", object_path),
+                                          NULL,
+                                          G_DBUS_CALL_FLAGS_NONE,
+                                          -1,
+                                          NULL,
+                                          &error);
+    g_assert_no_error (error);
+    g_variant_unref (result);
+
+    g_free (object_path);
+    g_free (address);
+    g_free (token);
+}
+
+/* A connection to the peer address is bound to the context only with
+   the token returned by CreatePeerContext, and unbound only by
+   itself. */
+static void
+test_bind (void)
+{
+    run_client (peer_bind);
+}
+
+/* Own the service name, as eekboard-server does, so that the client
+   library finds the test service. */
+static gboolean
+own_service_name (GDBusConnection *connection)
+{
+    GVariant *result;
+    guint32 reply;
+
+    result = g_dbus_connection_call_sync (connection,
+                                          "org.freedesktop.DBus",
+                                          "/org/freedesktop/DBus",
+                                          "org.freedesktop.DBus",
+                                          "RequestName",
+                                          g_variant_new
+                                          ("(su)",
+                                           EEKBOARD_SERVICE_INTERFACE,
+                                           0x4 /* DO_NOT_QUEUE */),
+                                          G_VARIANT_TYPE("(u)"),
+                                          G_DBUS_CALL_FLAGS_NONE,
+                                          -1,
+                                          NULL,
+                                          NULL);
+    if (result == NULL)
+        return FALSE;
+    g_variant_get (result, "(u)", &reply);
+    g_variant_unref (result);
+    return reply == 1 /* PRIMARY_OWNER */;
+}
+
+int
+main (int argc, char **argv)
+{
+    GDBusConnection *connection;
+    gchar *runtime_dir = NULL, *peer_dir;
+    gint retval;
+
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+    g_type_init ();
+    g_test_init (&argc, &argv, NULL);
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    if (connection == NULL) {
+        printf ("no session bus, skipping\n");
+        return 77;
+    }
+    if (!own_service_name (connection)) {
+        printf ("can't own %s, skipping\n", EEKBOARD_SERVICE_INTERFACE);
+        g_object_unref (connection);
+        return 77;
+    }
+
+    /* peer sockets are made in $XDG_RUNTIME_DIR */
+    if (g_getenv ("XDG_RUNTIME_DIR") == NULL) {
+        runtime_dir = g_build_filename (g_get_tmp_dir (),
+                                        "eekboard-peer-test-XXXXXX",
+                                        NULL);
+        g_assert (mkdtemp (runtime_dir) != NULL);
+        g_setenv ("XDG_RUNTIME_DIR", runtime_dir, TRUE);
+    }
+
+    g_test_add_func ("/eekboard-peer-test/round-trip", test_round_trip);
+    g_test_add_func ("/eekboard-peer-test/bind", test_bind);
+    g_test_add_func ("/eekboard-peer-test/key-activated",
+                     test_key_activated);
+    g_test_add_func ("/eekboard-peer-test/key-ring", test_key_ring);
+
+    retval = g_test_run ();
+
+    if (runtime_dir) {
+        peer_dir = g_build_filename (runtime_dir, "eekboard", NULL);
+        g_rmdir (peer_dir);
+        g_free (peer_dir);
+        g_rmdir (runtime_dir);
+        g_free (runtime_dir);
+    }
+    g_object_unref (connection);
+    return retval;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2011 Daiki Ueno <ueno@unixuser.org>
+ * Copyright (C) 2011 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* Context bookkeeping and keyboard sharing of EekboardService,
+   driven through D-Bus as clients do.  The session bus is required
+   and the test is skipped without one. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif  /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#include "eekboard/eekboard-service.h"
+
+typedef struct _TestService TestService;
+typedef struct _TestServiceClass TestServiceClass;
+
+struct _TestService {
+    EekboardService parent;
+};
+
+struct _TestServiceClass {
+    EekboardServiceClass parent_class;
+};
+
+static GType test_service_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (TestService, test_service, EEKBOARD_TYPE_SERVICE);
+
+/* the context created last */
+static EekboardContextService *test_context = NULL;
+
+static EekboardContextService *
+test_service_real_create_context (EekboardService *self,
+                                  const gchar     *client_name,
+                                  const gchar     *object_path)
+{
+    GDBusConnection *connection;
+    EekboardContextService *context;
+
+    g_object_get (G_OBJECT(self), "connection", &connection, NULL);
+    context = g_object_new (EEKBOARD_TYPE_CONTEXT_SERVICE,
+                            "client-name", client_name,
+                            "object-path", object_path,
+                            "connection", connection,
+                            NULL);
+    g_object_unref (connection);
+    test_context = context;
+    return context;
+}
+
+static void
+test_service_class_init (TestServiceClass *klass)
+{
+    EekboardServiceClass *service_class = EEKBOARD_SERVICE_CLASS(klass);
+    service_class->create_context = test_service_real_create_context;
+}
+
+static void
+test_service_init (TestService *self)
+{
+}
+
+typedef struct _CallData CallData;
+struct _CallData {
+    GMainLoop *loop;
+    GVariant *result;
+    GError *error;
+};
+
+static void
+on_call_reply (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    CallData *data = user_data;
+
+    data->result = g_dbus_connection_call_finish
+        (G_DBUS_CONNECTION(source_object), res, &data->error);
+    g_main_loop_quit (data->loop);
+}
+
+/* The service is exported on the same connection, so the call must
+   not block the main loop that dispatches it. */
+static GVariant *
+call_object (GDBusConnection *connection,
+             const gchar     *object_path,
+             const gchar     *interface_name,
+             const gchar     *method_name,
+             GVariant        *parameters,
+             GError         **error)
+{
+    CallData data = { 0, };
+
+    data.loop = g_main_loop_new (NULL, FALSE);
+    g_dbus_connection_call (connection,
+                            g_dbus_connection_get_unique_name (connection),
+                            object_path,
+                            interface_name,
+                            method_name,
+                            parameters,
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            on_call_reply,
+                            &data);
+    g_main_loop_run (data.loop);
+    g_main_loop_unref (data.loop);
+
+    if (data.error)
+        g_propagate_error (error, data.error);
+    return data.result;
+}
+
+static GVariant *
+call_service (GDBusConnection *connection,
+              const gchar     *method_name,
+              GVariant        *parameters,
+              GError         **error)
+{
+    return call_object (connection,
+                        EEKBOARD_SERVICE_PATH,
+                        EEKBOARD_SERVICE_INTERFACE,
+                        method_name,
+                        parameters,
+                        error);
+}
+
+/* Create many short-lived contexts, pushing and destroying each.
+   With -m perf, report how many CreateContext calls the service
+   handles per second. */
+static void
+test_create_destroy (void)
+{
+    GDBusConnection *connection;
+    EekboardService *service;
+    gint i, iterations = g_test_perf () ? 5000 : 50;
+    gdouble create_time = 0.0, destroy_time = 0.0;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert (connection != NULL);
+
+    service = g_object_new (test_service_get_type (),
+                            "object-path", EEKBOARD_SERVICE_PATH,
+                            "connection", connection,
+                            NULL);
+
+    for (i = 0; i < iterations; i++) {
+        GVariant *result;
+        gchar *object_path;
+        GError *error = NULL;
+
+        g_test_timer_start ();
+        result = call_service (connection,
+                               "CreateContext",
+                               g_variant_new ("(s)", "test"),
+                               &error);
+        g_assert_no_error (error);
+        create_time += g_test_timer_elapsed ();
+        g_variant_get (result, "(s)", &object_path);
+        g_variant_unref (result);
+
+        result = call_service (connection,
+                               "PushContext",
+                               g_variant_new ("(s)", object_path),
+                               &error);
+        g_assert_no_error (error);
+        g_variant_unref (result);
+
+        g_test_timer_start ();
+        result = call_service (connection,
+                               "DestroyContext",
+                               g_variant_new ("(s)", object_path),
+                               &error);
+        g_assert_no_error (error);
+        destroy_time += g_test_timer_elapsed ();
+        g_variant_unref (result);
+
+        /* the context is gone, and so is the stack entry */
+        result = call_service (connection,
+                               "PushContext",
+                               g_variant_new ("(s)", object_path),
+                               &error);
+        g_assert (result == NULL);
+        g_assert (error != NULL);
+        g_error_free (error);
+        g_free (object_path);
+    }
+
+    if (g_test_perf ()) {
+        g_test_maximized_result (iterations / create_time,
+                                 "CreateContext: %.0f contexts/sec",
+                                 iterations / create_time);
+        g_test_maximized_result (iterations / destroy_time,
+                                 "DestroyContext: %.0f contexts/sec",
+                                 iterations / destroy_time);
+    }
+
+    g_object_unref (service);
+    g_object_unref (connection);
+}
+
+/* Create and destroy contexts directly, without D-Bus calls, to
+   measure what a context costs by itself.  With -m perf, report how
+   many contexts are created per second. */
+static void
+test_context_new (void)
+{
+    GDBusConnection *connection;
+    gint i, iterations = g_test_perf () ? 20000 : 100;
+    gdouble elapsed;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert (connection != NULL);
+
+    g_test_timer_start ();
+    for (i = 0; i < iterations; i++) {
+        EekboardContextService *context;
+        gchar *object_path;
+
+        object_path = g_strdup_printf (EEKBOARD_CONTEXT_SERVICE_PATH, i);
+        context = g_object_new (EEKBOARD_TYPE_CONTEXT_SERVICE,
+                                "client-name", "test",
+                                "object-path", object_path,
+                                "connection", connection,
+                                NULL);
+        g_object_unref (context);
+        g_free (object_path);
+    }
+    elapsed = g_test_timer_elapsed ();
+
+    if (g_test_perf ())
+        g_test_maximized_result (iterations / elapsed,
+                                 "context creation: %.0f contexts/sec",
+                                 iterations / elapsed);
+
+    g_object_unref (connection);
+}
+
+/* Add the preloaded "us" keyboard to many contexts.  The keyboard is
+   loaded once and every context gets the same one, so with -m perf,
+   report how long AddKeyboard takes for the first context and for
+   the others. */
+static void
+test_add_keyboard (void)
+{
+    GDBusConnection *connection;
+    EekboardService *service;
+    EekKeyboard *first_keyboard = NULL;
+    GSettings *settings;
+    const gchar *keyboards[] = { "us", NULL };
+    gint i, iterations = g_test_perf () ? 500 : 10;
+    gdouble first_time = 0.0, add_time = 0.0;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    g_assert (connection != NULL);
+
+    settings = g_settings_new ("org.fedorahosted.eekboard");
+    g_settings_set_strv (settings, "keyboards", keyboards);
+
+    service = g_object_new (test_service_get_type (),
+                            "object-path", EEKBOARD_SERVICE_PATH,
+                            "connection", connection,
+                            NULL);
+
+    for (i = 0; i < iterations; i++) {
+        GVariant *result;
+        gchar *object_path;
+        guint keyboard_id;
+        GError *error = NULL;
+
+        result = call_service (connection,
+                               "CreateContext",
+                               g_variant_new ("(s)", "test"),
+                               &error);
+        g_assert_no_error (error);
+        g_variant_get (result, "(s)", &object_path);
+        g_variant_unref (result);
+
+        g_test_timer_start ();
+        result = call_object (connection,
+                              object_path,
+                              EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+                              "AddKeyboard",
+                              g_variant_new ("(s)", "us"),
+                              &error);
+        g_assert_no_error (error);
+        if (i == 0)
+            first_time = g_test_timer_elapsed ();
+        else
+            add_time += g_test_timer_elapsed ();
+        g_variant_get (result, "(u)", &keyboard_id);
+        g_assert_cmpuint (keyboard_id, >, 0);
+        g_variant_unref (result);
+
+        result = call_object (connection,
+                              object_path,
+                              EEKBOARD_CONTEXT_SERVICE_INTERFACE,
+                              "SetKeyboard",
+                              g_variant_new ("(u)", keyboard_id),
+                              &error);
+        g_assert_no_error (error);
+        g_variant_unref (result);
+
+        /* the keyboard comes from the cache, not from another load */
+        if (i == 0)
+            first_keyboard =
+                eekboard_context_service_get_keyboard (test_context);
+        g_assert (first_keyboard != NULL);
+        g_assert (eekboard_context_service_get_keyboard (test_context) ==
+                  first_keyboard);
+
+        g_free (object_path);
+    }
+
+    if (g_test_perf ()) {
+        g_test_minimized_result (first_time,
+                                 "AddKeyboard, first context: %.3f ms",
+                                 first_time * 1000);
+        g_test_minimized_result (add_time / (iterations - 1),
+                                 "AddKeyboard, other contexts: %.3f ms",
+                                 add_time * 1000 / (iterations - 1));
+    }
+
+    g_object_unref (service);
+    g_object_unref (settings);
+    g_object_unref (connection);
+}
+
+int
+main (int argc, char **argv)
+{
+    GDBusConnection *connection;
+
+    g_type_init ();
+    g_test_init (&argc, &argv, NULL);
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    if (connection == NULL) {
+        printf ("no session bus, skipping\n");
+        return 77;
+    }
+    g_object_unref (connection);
+
+    g_test_add_func ("/eekboard-service-test/create-destroy",
+                     test_create_destroy);
+    g_test_add_func ("/eekboard-service-test/context-new",
+                     test_context_new);
+    g_test_add_func ("/eekboard-service-test/add-keyboard",
+                     test_add_keyboard);
+
+    return g_test_run ();
+}